@@ -55,9 +55,51 @@ typedef struct {
   double *buffer; /* memory dataset buffer */
   rectObj extent; /* original dataset extent */
   OGRDataSourceH hOGRDS;
+  char *cachekey; /* key of the current window in the contour cache */
 
 } contourLayerInfo;
 
+/*
+** Generated contours are kept in a process wide cache so that repeated
+** and neighbouring requests don't run GDALContourGenerate() again.  The
+** key is made of the dataset (path and modification time), the band and
+** contour options, and the raster window read.  That window is already
+** aligned on the sampling grid of the request resolution.  With
+** PROCESSING CONTOUR_CACHE_BLOCK=n it is also snapped outwards to blocks
+** of n samples so that nearby requests end up on the same window.
+**
+** Entries keep the contours as WKB, read-only once stored, so requests
+** build their own OGR Memory datasource from an entry without holding
+** TLOCK_CONTOUR; the lock only protects the list and the reference counts.
+** The cache is only used when the MS_CONTOUR_CACHE_SIZE config option
+** gives its size in megabytes (it is off by default).  The least recently
+** used entries are dropped once the total goes over that size, and freed
+** when no request uses them anymore.
+*/
+
+typedef struct {
+  int id;
+  double elev;
+  unsigned char *wkb;
+  int wkbsize;
+} contourCacheFeatureObj;
+
+typedef struct contourCacheObj {
+  char *key;
+  contourCacheFeatureObj *features;
+  int numfeatures;
+  size_t size;
+
+  int refcount;
+  int stale; /* no longer in the list, free once refcount drops to 0 */
+
+  struct contourCacheObj *prev, *next;
+} contourCacheObj;
+
+static contourCacheObj *contourCacheHead = NULL;
+static contourCacheObj *contourCacheTail = NULL;
+static size_t contourCacheSize = 0;
+
 
 static int msContourLayerInitItemInfo(layerObj *layer)
 {
@@ -120,11 +162,287 @@ static void msContourLayerInfoFree(layerObj *layer)
     return;
 
   freeLayer(&clinfo->ogrLayer);
+  msFree(clinfo->cachekey);
   free(clinfo);
 
   layer->layerinfo = NULL;
 }
 
+static char* msContourGetOption(layerObj *layer, const char *name);
+
+/*
+** Create the OGR Memory datasource the contours of a layer go into: one
+** line layer with an ID field and, if set, the CONTOUR_ITEM field.
+*/
+static OGRDataSourceH msContourCreateDataSource(layerObj *layer)
+{
+  contourLayerInfo *clinfo = (contourLayerInfo *) layer->layerinfo;
+  OGRSFDriverH hDriver;
+  OGRDataSourceH hDS;
+  OGRFieldDefnH hFld;
+  OGRLayerH hLayer;
+  const char *elevItem;
+
+  hDriver = OGRGetDriverByName("Memory");
+  if (hDriver == NULL) {
+    msSetError(MS_OGRERR,
+               "Unable to get OGR driver 'Memory'.",
+               "msContourLayerCreateOGRDataSource()");
+    return NULL;
+  }
+
+  hDS = OGR_Dr_CreateDataSource(hDriver, NULL, NULL);
+  if (hDS == NULL) {
+    msSetError(MS_OGRERR,
+               "Unable to create OGR DataSource.",
+               "msContourLayerCreateOGRDataSource()");
+    return NULL;
+  }
+
+  hLayer = OGR_DS_CreateLayer(hDS, clinfo->ogrLayer.name, NULL,
+                              wkbLineString, NULL );
+
+  hFld = OGR_Fld_Create("ID", OFTInteger);
+  OGR_Fld_SetWidth(hFld, 8);
+  OGR_L_CreateField(hLayer, hFld, FALSE);
+  OGR_Fld_Destroy(hFld);
+
+  /* Check if we have a coutour item specified */
+  elevItem = CSLFetchNameValue(layer->processing,"CONTOUR_ITEM");
+  if (elevItem && strlen(elevItem) > 0) {
+    hFld = OGR_Fld_Create(elevItem, OFTReal);
+    OGR_Fld_SetWidth(hFld, 12);
+    OGR_Fld_SetPrecision(hFld, 3);
+    OGR_L_CreateField(hLayer, hFld, FALSE);
+    OGR_Fld_Destroy(hFld);
+  }
+
+  return hDS;
+}
+
+static size_t msContourCacheMaxSize(mapObj *map)
+{
+  const char *value = msGetConfigOption(map, "MS_CONTOUR_CACHE_SIZE");
+
+  if (value == NULL)
+    return 0;
+
+  return (size_t) (MAX(0.0, atof(value)) * 1024 * 1024);
+}
+
+static void msContourCacheFree(contourCacheObj *entry)
+{
+  int i;
+
+  for (i = 0; i < entry->numfeatures; i++)
+    msFree(entry->features[i].wkb);
+  msFree(entry->features);
+  msFree(entry->key);
+  free(entry);
+}
+
+/* Make a cache entry of the contours in hSrcDS, NULL if over maxsize */
+static contourCacheObj *msContourCacheCreate(const char *key, OGRDataSourceH hSrcDS,
+    size_t maxsize)
+{
+  OGRLayerH hLayer = OGR_DS_GetLayer(hSrcDS, 0);
+  int nElevField = OGR_FD_GetFieldCount(OGR_L_GetLayerDefn(hLayer)) > 1 ? 1 : -1;
+  contourCacheObj *entry;
+  OGRFeatureH hFeature;
+  int maxfeatures = 0;
+
+  entry = (contourCacheObj *) msSmallCalloc(1, sizeof(contourCacheObj));
+  entry->key = msStrdup(key);
+  entry->size = sizeof(contourCacheObj) + strlen(key);
+
+  OGR_L_ResetReading(hLayer);
+  while ((hFeature = OGR_L_GetNextFeature(hLayer)) != NULL) {
+    OGRGeometryH hGeom = OGR_F_GetGeometryRef(hFeature);
+    contourCacheFeatureObj *feature;
+
+    if (entry->numfeatures == maxfeatures) {
+      maxfeatures = maxfeatures ? maxfeatures * 2 : 64;
+      entry->features = (contourCacheFeatureObj *)
+                        msSmallRealloc(entry->features, sizeof(contourCacheFeatureObj) * maxfeatures);
+    }
+
+    feature = entry->features + entry->numfeatures++;
+    feature->id = OGR_F_GetFieldAsInteger(hFeature, 0);
+    feature->elev = nElevField < 0 ? 0.0 : OGR_F_GetFieldAsDouble(hFeature, nElevField);
+    feature->wkb = NULL;
+    feature->wkbsize = 0;
+    if (hGeom != NULL) {
+      feature->wkbsize = OGR_G_WkbSize(hGeom);
+      feature->wkb = (unsigned char *) msSmallMalloc(feature->wkbsize);
+      OGR_G_ExportToWkb(hGeom, wkbNDR, feature->wkb);
+    }
+    entry->size += sizeof(contourCacheFeatureObj) + feature->wkbsize;
+    OGR_F_Destroy(hFeature);
+
+    if (entry->size > maxsize)
+      break;
+  }
+  OGR_L_ResetReading(hLayer);
+
+  if (entry->size > maxsize) {
+    msContourCacheFree(entry);
+    return NULL;
+  }
+
+  return entry;
+}
+
+/* Build the contours of a cache entry into a new datasource for layer */
+static OGRDataSourceH msContourCacheCopy(layerObj *layer, contourCacheObj *entry)
+{
+  OGRDataSourceH hDS = msContourCreateDataSource(layer);
+  OGRLayerH hLayer;
+  OGRFeatureDefnH hDefn;
+  int i, nElevField;
+
+  if (hDS == NULL)
+    return NULL;
+
+  hLayer = OGR_DS_GetLayer(hDS, 0);
+  hDefn = OGR_L_GetLayerDefn(hLayer);
+  nElevField = OGR_FD_GetFieldCount(hDefn) > 1 ? 1 : -1;
+
+  for (i = 0; i < entry->numfeatures; i++) {
+    contourCacheFeatureObj *feature = entry->features + i;
+    OGRFeatureH hFeature = OGR_F_Create(hDefn);
+
+    OGR_F_SetFieldInteger(hFeature, 0, feature->id);
+    if (nElevField >= 0)
+      OGR_F_SetFieldDouble(hFeature, nElevField, feature->elev);
+    if (feature->wkb != NULL) {
+      OGRGeometryH hGeom = NULL;
+      if (OGR_G_CreateFromWkb(feature->wkb, NULL, &hGeom, feature->wkbsize) == OGRERR_NONE)
+        OGR_F_SetGeometryDirectly(hFeature, hGeom);
+    }
+    OGR_L_CreateFeature(hLayer, hFeature);
+    OGR_F_Destroy(hFeature);
+  }
+
+  return hDS;
+}
+
+static void msContourCacheUnlink(contourCacheObj *entry)
+{
+  if (entry->prev)
+    entry->prev->next = entry->next;
+  else
+    contourCacheHead = entry->next;
+  if (entry->next)
+    entry->next->prev = entry->prev;
+  else
+    contourCacheTail = entry->prev;
+  entry->prev = entry->next = NULL;
+}
+
+static void msContourCachePushFront(contourCacheObj *entry)
+{
+  entry->prev = NULL;
+  entry->next = contourCacheHead;
+  if (contourCacheHead)
+    contourCacheHead->prev = entry;
+  else
+    contourCacheTail = entry;
+  contourCacheHead = entry;
+}
+
+/* Drop entries until the total is at most maxsize, TLOCK_CONTOUR held */
+static void msContourCacheTrim(size_t maxsize)
+{
+  while (contourCacheTail != NULL && contourCacheSize > maxsize) {
+    contourCacheObj *entry = contourCacheTail;
+    msContourCacheUnlink(entry);
+    contourCacheSize -= entry->size;
+    if (entry->refcount > 0)
+      entry->stale = MS_TRUE;
+    else
+      msContourCacheFree(entry);
+  }
+}
+
+/* Return the cached contours for key, to give back with msContourCacheRelease() */
+static contourCacheObj *msContourCacheAcquire(const char *key)
+{
+  contourCacheObj *entry;
+
+  msAcquireLock(TLOCK_CONTOUR);
+  for (entry = contourCacheHead; entry != NULL; entry = entry->next) {
+    if (strcmp(entry->key, key) == 0) {
+      msContourCacheUnlink(entry);
+      msContourCachePushFront(entry);
+      entry->refcount++;
+      break;
+    }
+  }
+  msReleaseLock(TLOCK_CONTOUR);
+
+  return entry;
+}
+
+static void msContourCacheRelease(contourCacheObj *entry)
+{
+  msAcquireLock(TLOCK_CONTOUR);
+  entry->refcount--;
+  if (entry->stale && entry->refcount == 0)
+    msContourCacheFree(entry);
+  msReleaseLock(TLOCK_CONTOUR);
+}
+
+/* Return a copy of the cached contours for key, or NULL */
+static OGRDataSourceH msContourCacheGet(layerObj *layer, const char *key)
+{
+  contourCacheObj *entry = msContourCacheAcquire(key);
+  OGRDataSourceH hDS;
+
+  if (entry == NULL)
+    return NULL;
+
+  hDS = msContourCacheCopy(layer, entry);
+  msContourCacheRelease(entry);
+
+  return hDS;
+}
+
+/* Keep a copy of freshly generated contours */
+static void msContourCacheAdd(const char *key, OGRDataSourceH hSrcDS, size_t maxsize)
+{
+  contourCacheObj *entry, *newentry;
+
+  newentry = msContourCacheCreate(key, hSrcDS, maxsize);
+  if (newentry == NULL)
+    return;
+
+  msAcquireLock(TLOCK_CONTOUR);
+  for (entry = contourCacheHead; entry != NULL; entry = entry->next) {
+    if (strcmp(entry->key, key) == 0)
+      break;
+  }
+  if (entry == NULL) { /* unless another thread beat us to it */
+    msContourCachePushFront(newentry);
+    contourCacheSize += newentry->size;
+    msContourCacheTrim(maxsize);
+    newentry = NULL;
+  }
+  msReleaseLock(TLOCK_CONTOUR);
+
+  if (newentry != NULL)
+    msContourCacheFree(newentry);
+}
+
+/*
+** Free all cached contours, called from msCleanup().
+*/
+void msContourCacheCleanup()
+{
+  msAcquireLock(TLOCK_CONTOUR);
+  msContourCacheTrim(0);
+  msReleaseLock(TLOCK_CONTOUR);
+}
+
 static int msContourLayerReadRaster(layerObj *layer, rectObj rect)
 {
   mapObj *map = layer->map;  
@@ -140,6 +458,7 @@ static int msContourLayerReadRaster(layerObj *layer, rectObj rect)
   double map_cellsize_x, map_cellsize_y, dst_cellsize_x, dst_cellsize_y;
   GDALRasterBandH hBand = NULL;
   CPLErr eErr;
+  size_t cachemaxsize = msContourCacheMaxSize(map);
   
   contourLayerInfo *clinfo = (contourLayerInfo *) layer->layerinfo;
 
@@ -153,6 +472,9 @@ static int msContourLayerReadRaster(layerObj *layer, rectObj rect)
     
   }
 
+  clinfo->hOGRDS = NULL;
+  clinfo->buffer = NULL;
+
   bands = CSLTokenizeStringComplex(
                CSLFetchNameValue(layer->processing,"BANDS"), " ,", FALSE, FALSE );
   if (CSLCount(bands) > 0) {
@@ -345,6 +667,21 @@ static int msContourLayerReadRaster(layerObj *layer, rectObj rect)
     urx = ceil(urx / virtual_grid_step_x) * virtual_grid_step_x + (virtual_grid_step_x*5);
     ury = floor(ury / virtual_grid_step_y) * virtual_grid_step_y - (virtual_grid_step_x*5);
     lly = ceil(lly / virtual_grid_step_y) * virtual_grid_step_y + (virtual_grid_step_x*5);
+
+    /* Snap the window to cache blocks, if asked to, so that nearby requests share it */
+    if (cachemaxsize > 0) {
+      const char *value = CSLFetchNameValue(layer->processing, "CONTOUR_CACHE_BLOCK");
+      int block = value ? atoi(value) : 0;
+
+      if (block > 1) {
+        double block_x = (double) block * virtual_grid_step_x;
+        double block_y = (double) block * virtual_grid_step_y;
+        llx = floor(llx / block_x) * block_x;
+        urx = ceil(urx / block_x) * block_x;
+        ury = floor(ury / block_y) * block_y;
+        lly = ceil(lly / block_y) * block_y;
+      }
+    }
     
     src_xoff = MAX(0,(int) floor(llx+0.5));
     src_yoff = MAX(0,(int) floor(ury+0.5));
@@ -391,6 +728,40 @@ static int msContourLayerReadRaster(layerObj *layer, rectObj rect)
     dst_ysize = src_ysize = MIN(map->height,src_ysize);
   }
 
+  /* -------------------------------------------------------------------- */
+  /*      Reuse the contours of this window if we still have them.        */
+  /* -------------------------------------------------------------------- */
+  msFree(clinfo->cachekey);
+  clinfo->cachekey = NULL;
+
+  if (cachemaxsize > 0) {
+    VSIStatBufL sStat;
+    long mtime = 0;
+    char *interval = msContourGetOption(layer, "CONTOUR_INTERVAL");
+    char *levels = msContourGetOption(layer, "CONTOUR_LEVELS");
+    const char *elevItem = CSLFetchNameValue(layer->processing, "CONTOUR_ITEM");
+
+    if (VSIStatL(GDALGetDescription(clinfo->hOrigDS), &sStat) == 0)
+      mtime = (long) sStat.st_mtime;
+
+    clinfo->cachekey =
+      msStrdup(CPLSPrintf("%s|%ld|%d|%s|%s|%s|%d,%d,%d,%d|%d,%d",
+                          GDALGetDescription(clinfo->hOrigDS), mtime, band,
+                          interval ? interval : "", levels ? levels : "",
+                          elevItem ? elevItem : "",
+                          src_xoff, src_yoff, src_xsize, src_ysize,
+                          dst_xsize, dst_ysize));
+    msFree(interval);
+    msFree(levels);
+
+    clinfo->hOGRDS = msContourCacheGet(layer, clinfo->cachekey);
+    if (clinfo->hOGRDS != NULL) {
+      if (layer->debug)
+        msDebug("msContourLayerReadRaster(): reusing cached contours.\n");
+      return MS_SUCCESS;
+    }
+  }
+
   /* -------------------------------------------------------------------- */
   /*      Allocate buffer, and read data into it.                         */
   /* -------------------------------------------------------------------- */
@@ -483,8 +854,6 @@ static char* msContourGetOption(layerObj *layer, const char *name)
 
 static int msContourLayerGenerateContour(layerObj *layer)
 {
-  OGRSFDriverH hDriver;
-  OGRFieldDefnH hFld;
   OGRLayerH hLayer;
   const char *elevItem;
   char *option;
@@ -503,6 +872,12 @@ static int msContourLayerGenerateContour(layerObj *layer)
     return MS_FAILURE;
   }
 
+  /* found in the cache by msContourLayerReadRaster() */
+  if (clinfo->hOGRDS != NULL) {
+    msConnPoolRegister(&clinfo->ogrLayer, clinfo->hOGRDS, msContourOGRCloseConnection);
+    return MS_SUCCESS;
+  }
+
   hBand = GDALGetRasterBand(clinfo->hDS, 1);
   if (hBand == NULL)
   {
@@ -513,42 +888,15 @@ static int msContourLayerGenerateContour(layerObj *layer)
   }
 
   /* Create the OGR DataSource */
-  hDriver = OGRGetDriverByName("Memory");
-  if (hDriver == NULL) {
-    msSetError(MS_OGRERR,
-               "Unable to get OGR driver 'Memory'.",
-               "msContourLayerCreateOGRDataSource()");
-    return MS_FAILURE;
-  }
-
-  clinfo->hOGRDS = OGR_Dr_CreateDataSource(hDriver, NULL, NULL);
-  if (clinfo->hOGRDS == NULL) {
-    msSetError(MS_OGRERR,
-               "Unable to create OGR DataSource.",
-               "msContourLayerCreateOGRDataSource()");
+  clinfo->hOGRDS = msContourCreateDataSource(layer);
+  if (clinfo->hOGRDS == NULL)
     return MS_FAILURE;
-  }
 
-  hLayer = OGR_DS_CreateLayer(clinfo->hOGRDS, clinfo->ogrLayer.name, NULL,
-                              wkbLineString, NULL );
+  hLayer = OGR_DS_GetLayer(clinfo->hOGRDS, 0);
 
-  hFld = OGR_Fld_Create("ID", OFTInteger);
-  OGR_Fld_SetWidth(hFld, 8);
-  OGR_L_CreateField(hLayer, hFld, FALSE);
-  OGR_Fld_Destroy(hFld);
-
-  /* Check if we have a coutour item specified */
   elevItem = CSLFetchNameValue(layer->processing,"CONTOUR_ITEM");
-  if (elevItem && strlen(elevItem) > 0) {
-    hFld = OGR_Fld_Create(elevItem, OFTReal);
-    OGR_Fld_SetWidth(hFld, 12);
-    OGR_Fld_SetPrecision(hFld, 3);
-    OGR_L_CreateField(hLayer, hFld, FALSE);
-    OGR_Fld_Destroy(hFld);
-  }
-  else {
+  if (elevItem == NULL || strlen(elevItem) == 0)
     elevItem = NULL;
-  }
 
   option = msContourGetOption(layer, "CONTOUR_INTERVAL");
   if (option) {
@@ -579,6 +927,10 @@ static int msContourLayerGenerateContour(layerObj *layer)
                                                     elevItem ),
                               NULL, NULL );
 
+  if (eErr == CE_None && clinfo->cachekey != NULL)
+    msContourCacheAdd(clinfo->cachekey, clinfo->hOGRDS,
+                      msContourCacheMaxSize(layer->map));
+
   msConnPoolRegister(&clinfo->ogrLayer, clinfo->hOGRDS, msContourOGRCloseConnection);
 
   return MS_SUCCESS;
@@ -630,9 +982,12 @@ int msContourLayerOpen(layerObj *layer)
   if (msContourLayerGenerateContour(layer) != MS_SUCCESS)
     return MS_FAILURE;
 
-  GDALClose(clinfo->hDS);
-  clinfo->hDS = NULL;  
+  if (clinfo->hDS) {
+    GDALClose(clinfo->hDS);
+    clinfo->hDS = NULL;
+  }
   free(clinfo->buffer);
+  clinfo->buffer = NULL;
 
   /* Open our virtual ogr layer */
   if (msLayerOpen(&clinfo->ogrLayer) != MS_SUCCESS)
@@ -729,9 +1084,12 @@ int msContourLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
   if (msContourLayerGenerateContour(layer) != MS_SUCCESS)
     return MS_FAILURE;
 
-  GDALClose(clinfo->hDS);
-  clinfo->hDS = NULL;
-  free(clinfo->buffer);  
+  if (clinfo->hDS) {
+    GDALClose(clinfo->hDS);
+    clinfo->hDS = NULL;
+  }
+  free(clinfo->buffer);
+  clinfo->buffer = NULL;
   
   /* Open our virtual ogr layer */
   if (msLayerOpen(&clinfo->ogrLayer) != MS_SUCCESS)
@@ -852,5 +1210,9 @@ int msContourLayerInitializeVirtualTable(layerObj *layer)
   msSetError(MS_MISCERR, "Contour Layer needs GDAL support, but it it not compiled in", "msContourLayerInitializeVirtualTable()");
   return MS_FAILURE;
 }
+
+void msContourCacheCleanup()
+{
+}
 #endif
 
@@ -193,6 +193,7 @@ int msCopyExpression(expressionObj *dst, expressionObj *src)
 {
   MS_COPYSTRING(dst->string, src->string);
   MS_COPYSTELEM(type);
+  MS_COPYSTELEM(flags);
   dst->compiled = MS_FALSE;
 
   return MS_SUCCESS;
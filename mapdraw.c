@@ -968,6 +968,23 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
     return MS_FAILURE;
   }
 
+#ifdef USE_PROJ
+  /*
+  ** Optionally interpolate reprojected vertices from a grid of exactly
+  ** projected points over the request extent, within a maximum error
+  ** given in pixels (PROCESSING "APPROXIMATE_TRANSFORM=ON", with
+  ** "APPROXIMATE_TRANSFORM_MAX_ERROR=<pixels>", 0.25 by default).
+  */
+  if(layer->project && layer->transform == MS_TRUE
+      && msLayerGetProcessingKey(layer, "APPROXIMATE_TRANSFORM")
+      && strcasecmp(msLayerGetProcessingKey(layer, "APPROXIMATE_TRANSFORM"), "OFF") != 0
+      && msProjectionsDiffer(&(layer->projection), &(map->projection))) {
+    const char *max_error = msLayerGetProcessingKey(layer, "APPROXIMATE_TRANSFORM_MAX_ERROR");
+    msProjectionInitApprox(&(layer->projection), &(map->projection), &searchrect,
+                           (max_error ? atof(max_error) : 0.25) * map->cellsize, layer->debug);
+  }
+#endif
+
   /* step through the target shapes */
   msInitShape(&shape);
 
@@ -1114,6 +1131,10 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
     msFreeShape(&shape);
   }
 
+#ifdef USE_PROJ
+  msProjectionFreeApprox(&(layer->projection));
+#endif
+
   if (classgroup)
     msFree(classgroup);
 
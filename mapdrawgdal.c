@@ -48,6 +48,13 @@ extern int InvGeoTransform( double *gt_in, double *gt_out );
 
 #include "gdal_alg.h"
 
+/* reading an overview window given in fractional pixels, see ReadGDALBand() */
+#if defined(GDAL_COMPUTE_VERSION)
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(2,0,0)
+#define MS_GDAL_OVERVIEW_IO
+#endif
+#endif
+
 static int
 LoadGDALImages( GDALDatasetH hDS, int band_numbers[4], int band_count,
                 layerObj *layer,
@@ -56,6 +63,18 @@ LoadGDALImages( GDALDatasetH hDS, int band_numbers[4], int band_count,
                 int dst_xsize, int dst_ysize,
                 int *pbHaveRGBNoData,
                 int *pnNoData1, int *pnNoData2, int *pnNoData3 );
+static CPLErr
+ReadGDALBand( layerObj *layer, GDALRasterBandH hBand, int bMask,
+              int src_xoff, int src_yoff, int src_xsize, int src_ysize,
+              void *pBuffer, int dst_xsize, int dst_ysize,
+              GDALDataType eType );
+static CPLErr
+ReadGDALBands( layerObj *layer, GDALDatasetH hDS,
+               int band_count, int *band_numbers,
+               int src_xoff, int src_yoff, int src_xsize, int src_ysize,
+               void *pBuffer, int dst_xsize, int dst_ysize,
+               GDALDataType eType );
+static int CheckGDALOverviewLevel( layerObj *layer );
 static int
 msDrawRasterLayerGDAL_RawMode(
   mapObj *map, layerObj *layer, imageObj *image, GDALDatasetH hDS,
@@ -137,6 +156,9 @@ int msDrawRasterLayerGDAL(mapObj *map, layerObj *layer, imageObj *image,
   /*make sure we don't have a truecolor gd image*/
   assert(!rb || rb->type != MS_BUFFER_GD || !gdImageTrueColor(rb->data.gd_img));
 #endif
+  if( CheckGDALOverviewLevel( layer ) != MS_SUCCESS )
+    return -1;
+
   if(layer->mask) {
     int ret;
     layerObj *maskLayer = GET_LAYER(map, msGetLayerIndex(map,layer->mask));
@@ -782,9 +804,9 @@ int msDrawRasterLayerGDAL(mapObj *map, layerObj *layer, imageObj *image,
 
       hBandAlpha = GDALGetMaskBand(hBand1);
 
-      eErr = GDALRasterIO( hBandAlpha, GF_Read,
+      eErr = ReadGDALBand( layer, hBand1, TRUE,
                            src_xoff, src_yoff, src_xsize, src_ysize,
-                           pabyRawAlpha, dst_xsize, dst_ysize, GDT_Byte, 0,0);
+                           pabyRawAlpha, dst_xsize, dst_ysize, GDT_Byte );
 
       if( eErr != CE_None ) {
         msSetError( MS_IOERR, "GDALRasterIO() failed: %s",
@@ -1314,6 +1336,265 @@ static int ApplyLUT( int iColorIndex, layerObj *layer,
   return 0;
 }
 
+/************************************************************************/
+/*                       CheckGDALOverviewLevel()                       */
+/*                                                                      */
+/*      PROCESSING "OVERVIEW_LEVEL" must be AUTO, NONE or an overview   */
+/*      number, anything else is reported rather than read as 0.        */
+/************************************************************************/
+
+static int CheckGDALOverviewLevel( layerObj *layer )
+
+{
+  const char *pszLevel = CSLFetchNameValue( layer->processing, "OVERVIEW_LEVEL" );
+  char *pszEnd = NULL;
+
+  if( pszLevel == NULL || EQUAL(pszLevel,"AUTO") || EQUAL(pszLevel,"NONE") )
+    return MS_SUCCESS;
+
+  if( *pszLevel != '\0' && strtol( pszLevel, &pszEnd, 10 ) >= 0
+      && *pszEnd == '\0' )
+    return MS_SUCCESS;
+
+  msSetError( MS_MISCERR,
+              "Invalid PROCESSING OVERVIEW_LEVEL '%s' for layer %s, expected "
+              "AUTO, NONE or an overview number.",
+              "msDrawRasterLayerGDAL()", pszLevel, layer->name );
+  return MS_FAILURE;
+}
+
+/************************************************************************/
+/*                         SelectGDALOverview()                         */
+/*                                                                      */
+/*      Pick the overview of hBand to read a source window of           */
+/*      src_xsize x src_ysize full resolution pixels into a buffer of   */
+/*      dst_xsize x dst_ysize.  Only done when asked for with           */
+/*      PROCESSING "OVERVIEW_LEVEL": AUTO picks the smallest overview   */
+/*      that still has OVERSAMPLE (default 1) pixels per buffer pixel,  */
+/*      n reads from overview n (0 being the first) and NONE from the   */
+/*      full resolution band.  The value was checked by                 */
+/*      CheckGDALOverviewLevel().  Returns -1 for the full resolution   */
+/*      band, or when GDAL is left to choose as it always did.          */
+/************************************************************************/
+
+static int SelectGDALOverview( layerObj *layer, GDALRasterBandH hBand,
+                               int src_xsize, int src_ysize,
+                               int dst_xsize, int dst_ysize )
+
+{
+#ifdef MS_GDAL_OVERVIEW_IO
+  const char *pszLevel = CSLFetchNameValue( layer->processing, "OVERVIEW_LEVEL" );
+  const char *pszOversample = CSLFetchNameValue( layer->processing, "OVERSAMPLE" );
+  int nOverviewCount = GDALGetOverviewCount( hBand );
+  int nFullXSize = GDALGetRasterBandXSize( hBand );
+  int nFullYSize = GDALGetRasterBandYSize( hBand );
+  double dfOversample = 1.0, dfMaxFactor;
+  int iOverview, nBestOverview = -1;
+
+  if( pszLevel == NULL || nOverviewCount == 0 )
+    return -1;
+
+  if( EQUAL(pszLevel,"NONE") )
+    return -1;
+
+  if( !EQUAL(pszLevel,"AUTO") )
+    return MIN(atoi(pszLevel), nOverviewCount-1);
+
+  /* only worth it when we are downsampling */
+  if( pszOversample != NULL )
+    dfOversample = MAX(1.0, atof(pszOversample));
+  dfMaxFactor = MIN( (double) src_xsize / dst_xsize,
+                     (double) src_ysize / dst_ysize ) / dfOversample;
+  if( dfMaxFactor <= 1.0 )
+    return -1;
+
+  /* overviews are not necessarily sorted, keep the smallest adequate one */
+  for( iOverview = 0; iOverview < nOverviewCount; iOverview++ ) {
+    GDALRasterBandH hOverview = GDALGetOverview( hBand, iOverview );
+    double dfFactor;
+
+    if( hOverview == NULL || GDALGetRasterBandXSize(hOverview) == 0 )
+      continue;
+
+    dfFactor = MIN( (double) nFullXSize / GDALGetRasterBandXSize(hOverview),
+                    (double) nFullYSize / GDALGetRasterBandYSize(hOverview) );
+    if( dfFactor > dfMaxFactor )
+      continue;
+
+    if( nBestOverview == -1
+        || GDALGetRasterBandXSize(hOverview)
+        < GDALGetRasterBandXSize(GDALGetOverview(hBand,nBestOverview)) )
+      nBestOverview = iOverview;
+  }
+
+  return nBestOverview;
+#else
+  return -1;
+#endif
+}
+
+/************************************************************************/
+/*                          GDALBytesToRead()                           */
+/*                                                                      */
+/*      Estimate the bytes GDAL reads from hBand for a plain            */
+/*      GDALRasterIO() of src_xsize x src_ysize pixels into a buffer    */
+/*      of dst_xsize x dst_ysize.  When downsampling GDAL picks an      */
+/*      overview on its own: the most reduced one whose reduction       */
+/*      does not exceed the requested one by more than 20%, as          */
+/*      GDALBandGetBestOverviewLevel() does.                            */
+/************************************************************************/
+
+static double GDALBytesToRead( GDALRasterBandH hBand,
+                               int src_xsize, int src_ysize,
+                               int dst_xsize, int dst_ysize )
+
+{
+  int nFullXSize = GDALGetRasterBandXSize( hBand );
+  int nOverviewCount = GDALGetOverviewCount( hBand );
+  double dfWanted, dfBestFactor = 1.0;
+  int iOverview;
+
+  dfWanted = MIN( (double) src_xsize / MAX(dst_xsize,1),
+                  (double) src_ysize / MAX(dst_ysize,1) );
+
+  for( iOverview = 0; dfWanted > 1.0 && iOverview < nOverviewCount; iOverview++ ) {
+    GDALRasterBandH hOverview = GDALGetOverview( hBand, iOverview );
+    double dfFactor;
+
+    if( hOverview == NULL || GDALGetRasterBandXSize(hOverview) == 0 )
+      continue;
+
+    dfFactor = (double) nFullXSize / GDALGetRasterBandXSize(hOverview);
+    if( dfFactor <= dfWanted * 1.2 && dfFactor > dfBestFactor )
+      dfBestFactor = dfFactor;
+  }
+
+  return ceil(src_xsize / dfBestFactor) * ceil(src_ysize / dfBestFactor)
+         * (GDALGetDataTypeSize(GDALGetRasterDataType(hBand))/8);
+}
+
+/************************************************************************/
+/*                            ReadGDALBand()                            */
+/*                                                                      */
+/*      Read a window of hBand (or of its mask with bMask), given in    */
+/*      full resolution pixels, from the overview picked by             */
+/*      SelectGDALOverview().  The window is passed to the overview     */
+/*      in fractional pixels so that it covers exactly the same area.   */
+/*      The mask is read from the overviews of the full resolution      */
+/*      mask, if it has any.  The bytes read are added to the layer     */
+/*      total reported in the request log.                              */
+/************************************************************************/
+
+static CPLErr
+ReadGDALBand( layerObj *layer, GDALRasterBandH hBand, int bMask,
+              int src_xoff, int src_yoff, int src_xsize, int src_ysize,
+              void *pBuffer, int dst_xsize, int dst_ysize,
+              GDALDataType eType )
+
+{
+#ifdef MS_GDAL_OVERVIEW_IO
+  int nOverview;
+#endif
+
+  if( bMask )
+    hBand = GDALGetMaskBand( hBand );
+
+#ifdef MS_GDAL_OVERVIEW_IO
+  nOverview = SelectGDALOverview( layer, hBand, src_xsize, src_ysize,
+                                  dst_xsize, dst_ysize );
+  if( nOverview >= 0 ) {
+    GDALRasterBandH hOverview = GDALGetOverview( hBand, nOverview );
+    GDALRasterIOExtraArg sExtraArg;
+    double dfXRatio, dfYRatio;
+    int nOvrXOff, nOvrYOff, nOvrXEnd, nOvrYEnd;
+
+    dfXRatio = (double) GDALGetRasterBandXSize(hOverview)
+               / GDALGetRasterBandXSize(hBand);
+    dfYRatio = (double) GDALGetRasterBandYSize(hOverview)
+               / GDALGetRasterBandYSize(hBand);
+
+    INIT_RASTERIO_EXTRA_ARG( sExtraArg );
+    sExtraArg.bFloatingPointWindowValidity = TRUE;
+    sExtraArg.dfXOff = src_xoff * dfXRatio;
+    sExtraArg.dfYOff = src_yoff * dfYRatio;
+    sExtraArg.dfXSize = src_xsize * dfXRatio;
+    sExtraArg.dfYSize = src_ysize * dfYRatio;
+
+    /* the integer window must contain the fractional one */
+    nOvrXOff = (int) floor(sExtraArg.dfXOff);
+    nOvrYOff = (int) floor(sExtraArg.dfYOff);
+    nOvrXEnd = (int) ceil(sExtraArg.dfXOff + sExtraArg.dfXSize);
+    nOvrYEnd = (int) ceil(sExtraArg.dfYOff + sExtraArg.dfYSize);
+    nOvrXEnd = MIN(MAX(nOvrXEnd, nOvrXOff+1), GDALGetRasterBandXSize(hOverview));
+    nOvrYEnd = MIN(MAX(nOvrYEnd, nOvrYOff+1), GDALGetRasterBandYSize(hOverview));
+
+    if( layer->debug >= MS_DEBUGLEVEL_VV )
+      msDebug( "msDrawRasterLayerGDAL(%s): reading %.2f,%.2f,%.2f,%.2f of "
+               "overview %d instead of %d,%d,%d,%d.\n", layer->name,
+               sExtraArg.dfXOff, sExtraArg.dfYOff,
+               sExtraArg.dfXSize, sExtraArg.dfYSize,
+               nOverview, src_xoff, src_yoff, src_xsize, src_ysize );
+
+    layer->rasterbytesread += (double) (nOvrXEnd - nOvrXOff) * (nOvrYEnd - nOvrYOff)
+                              * (GDALGetDataTypeSize(GDALGetRasterDataType(hOverview))/8);
+
+    return GDALRasterIOEx( hOverview, GF_Read,
+                           nOvrXOff, nOvrYOff,
+                           nOvrXEnd - nOvrXOff, nOvrYEnd - nOvrYOff,
+                           pBuffer, dst_xsize, dst_ysize, eType, 0, 0,
+                           &sExtraArg );
+  }
+#endif
+
+  layer->rasterbytesread += GDALBytesToRead( hBand, src_xsize, src_ysize,
+                                             dst_xsize, dst_ysize );
+
+  return GDALRasterIO( hBand, GF_Read,
+                       src_xoff, src_yoff, src_xsize, src_ysize,
+                       pBuffer, dst_xsize, dst_ysize, eType, 0, 0 );
+}
+
+/************************************************************************/
+/*                           ReadGDALBands()                            */
+/*                                                                      */
+/*      Same as ReadGDALBand() for several bands of a dataset, into a   */
+/*      band sequential buffer like GDALDatasetRasterIO().              */
+/************************************************************************/
+
+static CPLErr
+ReadGDALBands( layerObj *layer, GDALDatasetH hDS,
+               int band_count, int *band_numbers,
+               int src_xoff, int src_yoff, int src_xsize, int src_ysize,
+               void *pBuffer, int dst_xsize, int dst_ysize,
+               GDALDataType eType )
+
+{
+  int iBand, nBandBytes = dst_xsize * dst_ysize * (GDALGetDataTypeSize(eType)/8);
+  CPLErr eErr = CE_None;
+
+  /* no overview involved, let GDAL read all bands at once */
+  if( SelectGDALOverview( layer, GDALGetRasterBand(hDS,band_numbers[0]),
+                          src_xsize, src_ysize, dst_xsize, dst_ysize ) < 0 ) {
+    for( iBand = 0; iBand < band_count; iBand++ ) {
+      GDALRasterBandH hBand = GDALGetRasterBand(hDS,band_numbers[iBand]);
+      layer->rasterbytesread += GDALBytesToRead( hBand, src_xsize, src_ysize,
+                                                 dst_xsize, dst_ysize );
+    }
+    return GDALDatasetRasterIO( hDS, GF_Read,
+                                src_xoff, src_yoff, src_xsize, src_ysize,
+                                pBuffer, dst_xsize, dst_ysize, eType,
+                                band_count, band_numbers, 0, 0, 0 );
+  }
+
+  for( iBand = 0; iBand < band_count && eErr == CE_None; iBand++ )
+    eErr = ReadGDALBand( layer, GDALGetRasterBand(hDS,band_numbers[iBand]),
+                         FALSE, src_xoff, src_yoff, src_xsize, src_ysize,
+                         ((GByte *) pBuffer) + (size_t) nBandBytes * iBand,
+                         dst_xsize, dst_ysize, eType );
+
+  return eErr;
+}
+
 /************************************************************************/
 /*                           LoadGDALImages()                           */
 /*                                                                      */
@@ -1369,12 +1650,9 @@ LoadGDALImages( GDALDatasetH hDS, int band_numbers[4], int band_count,
       && CSLFetchNameValue( layer->processing, "SCALE_2" ) == NULL
       && CSLFetchNameValue( layer->processing, "SCALE_3" ) == NULL
       && CSLFetchNameValue( layer->processing, "SCALE_4" ) == NULL ) {
-    eErr = GDALDatasetRasterIO( hDS, GF_Read,
-                                src_xoff, src_yoff, src_xsize, src_ysize,
-                                pabyWholeBuffer,
-                                dst_xsize, dst_ysize, GDT_Byte,
-                                band_count, band_numbers,
-                                0,0,0);
+    eErr = ReadGDALBands( layer, hDS, band_count, band_numbers,
+                          src_xoff, src_yoff, src_xsize, src_ysize,
+                          pabyWholeBuffer, dst_xsize, dst_ysize, GDT_Byte );
 
     if( eErr != CE_None ) {
       msSetError( MS_IOERR,
@@ -1424,12 +1702,9 @@ LoadGDALImages( GDALDatasetH hDS, int band_numbers[4], int band_count,
     return -1;
   }
 
-  eErr = GDALDatasetRasterIO(
-           hDS, GF_Read,
-           src_xoff, src_yoff, src_xsize, src_ysize,
-           pafWholeRawData, dst_xsize, dst_ysize, GDT_Float32,
-           band_count, band_numbers,
-           0, 0, 0 );
+  eErr = ReadGDALBands( layer, hDS, band_count, band_numbers,
+                        src_xoff, src_yoff, src_xsize, src_ysize,
+                        pafWholeRawData, dst_xsize, dst_ysize, GDT_Float32 );
 
   if( eErr != CE_None ) {
     msSetError( MS_IOERR, "GDALDatasetRasterIO() failed: %s",
@@ -1983,11 +2258,9 @@ msDrawRasterLayerGDAL_RawMode(
     return -1;
   }
 
-  eErr = GDALDatasetRasterIO( hDS, GF_Read,
-                              src_xoff, src_yoff, src_xsize, src_ysize,
-                              pBuffer, dst_xsize, dst_ysize, eDataType,
-                              image->format->bands, band_list,
-                              0, 0, 0 );
+  eErr = ReadGDALBands( layer, hDS, image->format->bands, band_list,
+                        src_xoff, src_yoff, src_xsize, src_ysize,
+                        pBuffer, dst_xsize, dst_ysize, eDataType );
   free( band_list );
 
   if( eErr != CE_None ) {
@@ -2060,18 +2333,84 @@ msDrawRasterLayerGDAL_RawMode(
   return 0;
 }
 
+/************************************************************************/
+/*                         ClassifyGDALBucket()                         */
+/*                                                                      */
+/*      Fill one entry of the classification lookup table used by       */
+/*      msDrawRasterLayerGDAL_16BitClassification() for the value at    */
+/*      the center of the bucket.  With bExact the bucket holds that    */
+/*      single 32bit integer value, which is then classified with       */
+/*      msGetClass() like palette values rather than through a float.   */
+/************************************************************************/
+
+static void ClassifyGDALBucket( layerObj *layer, rasterBufferObj *rb,
+                                int iBucket, double dfOriginalValue, int bExact,
+                                int *cmap, unsigned char *rb_cmap[4] )
+
+{
+  int c;
+
+  cmap[iBucket] = -1;
+
+  if( bExact && dfOriginalValue >= INT_MIN && dfOriginalValue <= INT_MAX ) {
+    colorObj sColor;
+
+    sColor.red = sColor.green = sColor.blue = -1;
+    c = msGetClass(layer, &sColor, (int) floor(dfOriginalValue + 0.5));
+  } else
+    c = msGetClass_FloatRGB(layer, (float) dfOriginalValue, -1, -1, -1);
+  if( c != -1 ) {
+    int s;
+
+    /* change colour based on colour range? */
+    for(s=0; s<layer->class[c]->numstyles; s++) {
+      if( MS_VALID_COLOR(layer->class[c]->styles[s]->mincolor)
+          && MS_VALID_COLOR(layer->class[c]->styles[s]->maxcolor) )
+        msValueToRange(layer->class[c]->styles[s],dfOriginalValue);
+    }
+#ifdef USE_GD
+    if(rb->type == MS_BUFFER_GD) {
+      RESOLVE_PEN_GD(rb->data.gd_img, layer->class[c]->styles[0]->color);
+      if( MS_TRANSPARENT_COLOR(layer->class[c]->styles[0]->color) )
+        cmap[iBucket] = -1;
+      else if( MS_VALID_COLOR(layer->class[c]->styles[0]->color)) {
+        /* use class color */
+        cmap[iBucket] = layer->class[c]->styles[0]->color.pen;
+      }
+    } else
+#endif
+      if( rb->type == MS_BUFFER_BYTE_RGBA ) {
+        if( MS_TRANSPARENT_COLOR(layer->class[c]->styles[0]->color) ) {
+          /* leave it transparent */
+        } else if( MS_VALID_COLOR(layer->class[c]->styles[0]->color)) {
+          /* use class color */
+          rb_cmap[0][iBucket] = layer->class[c]->styles[0]->color.red;
+          rb_cmap[1][iBucket] = layer->class[c]->styles[0]->color.green;
+          rb_cmap[2][iBucket] = layer->class[c]->styles[0]->color.blue;
+          rb_cmap[3][iBucket] = (255*layer->class[c]->styles[0]->opacity / 100);
+        }
+      }
+  }
+}
+
 /************************************************************************/
 /*              msDrawRasterLayerGDAL_16BitClassifcation()              */
 /*                                                                      */
 /*      Handle the rendering of rasters going through a 16bit           */
 /*      classification lookup instead of the more common 8bit one.      */
 /*                                                                      */
-/*      Currently we are using one data path where we load the          */
-/*      raster into a floating point buffer, and then scale to          */
-/*      16bit.  Eventually we could add optimizations for some of       */
-/*      the 16bit cases at the cost of some complication.               */
+/*      The raster is loaded into a floating point buffer, except      */
+/*      for the 32bit integer types which are loaded as such so that    */
+/*      values above 2^24 keep their own bucket, and then scaled to     */
+/*      16bit.                                                          */
 /************************************************************************/
 
+/* value i of a buffer read by msDrawRasterLayerGDAL_16BitClassification() */
+#define RAW_VALUE(pRaw,eType,i) \
+  ((eType) == GDT_Int32 ? (double) ((GInt32 *) (pRaw))[i] \
+   : (eType) == GDT_UInt32 ? (double) ((GUInt32 *) (pRaw))[i] \
+   : (double) ((float *) (pRaw))[i])
+
 static int
 msDrawRasterLayerGDAL_16BitClassification(
   mapObj *map, layerObj *layer, rasterBufferObj *rb,
@@ -2080,15 +2419,16 @@ msDrawRasterLayerGDAL_16BitClassification(
   int dst_xoff, int dst_yoff, int dst_xsize, int dst_ysize )
 
 {
-  float *pafRawData;
+  void *pRawData;
   double dfScaleMin=0.0, dfScaleMax=0.0, dfScaleRatio;
   int   nPixelCount = dst_xsize * dst_ysize, i, nBucketCount=0;
-  GDALDataType eDataType;
-  float fDataMin=0.0, fDataMax=255.0, fNoDataValue;
+  GDALDataType eDataType, eReadType;
+  double dfDataMin=0.0, dfDataMax=255.0, dfNoDataValue;
   const char *pszScaleInfo;
   const char *pszBuckets;
-  int  *cmap, c, j, k, bGotNoData = FALSE, bGotFirstValue;
-  unsigned char *rb_cmap[4];
+  int  *cmap, j, k, bGotNoData = FALSE, bGotFirstValue;
+  int   nBucketsClassified = 0, bExactBuckets = FALSE;
+  unsigned char *rb_cmap[4], *pabyBucketDone;
   CPLErr eErr;
   rasterBufferObj *mask_rb = NULL;
   if(layer->mask) {
@@ -2104,49 +2444,61 @@ msDrawRasterLayerGDAL_16BitClassification(
 
   /* ==================================================================== */
   /*      Read the requested data in one gulp into a floating point       */
-  /*      buffer.                                                         */
+  /*      buffer, or a 32bit integer one for the 32bit integer types.     */
   /* ==================================================================== */
-  pafRawData = (float *) malloc(sizeof(float) * dst_xsize * dst_ysize );
-  if( pafRawData == NULL ) {
+  eDataType = GDALGetRasterDataType( hBand );
+  if( eDataType == GDT_Int32 || eDataType == GDT_UInt32 )
+    eReadType = eDataType;
+  else
+    eReadType = GDT_Float32;
+
+  pRawData = malloc((GDALGetDataTypeSize(eReadType)/8) * dst_xsize * dst_ysize );
+  if( pRawData == NULL ) {
     msSetError( MS_MEMERR, "Out of memory allocating working buffer.",
                 "msDrawRasterLayerGDAL_16BitClassification()" );
     return -1;
   }
 
-  eErr = GDALRasterIO( hBand, GF_Read,
+  eErr = ReadGDALBand( layer, hBand, FALSE,
                        src_xoff, src_yoff, src_xsize, src_ysize,
-                       pafRawData, dst_xsize, dst_ysize, GDT_Float32, 0, 0 );
+                       pRawData, dst_xsize, dst_ysize, eReadType );
 
   if( eErr != CE_None ) {
-    free( pafRawData );
+    free( pRawData );
     msSetError( MS_IOERR, "GDALRasterIO() failed: %s",
                 "msDrawRasterLayerGDAL_16BitClassification()",
                 CPLGetLastErrorMsg() );
     return -1;
   }
 
-  fNoDataValue = (float) msGetGDALNoDataValue( layer, hBand, &bGotNoData );
+  /* compared in the precision the pixels were read in */
+  dfNoDataValue = msGetGDALNoDataValue( layer, hBand, &bGotNoData );
+  if( eReadType == GDT_Float32 )
+    dfNoDataValue = (float) dfNoDataValue;
 
   /* ==================================================================== */
   /*      Determine scaling.                                              */
   /* ==================================================================== */
-  eDataType = GDALGetRasterDataType( hBand );
 
   /* -------------------------------------------------------------------- */
   /*      Scan for absolute min/max of this block.                        */
   /* -------------------------------------------------------------------- */
   bGotFirstValue = FALSE;
 
-  for( i = 1; i < nPixelCount; i++ ) {
-    if( bGotNoData && pafRawData[i] == fNoDataValue )
+  for( i = 0; i < nPixelCount; i++ ) {
+    double dfValue = RAW_VALUE(pRawData,eReadType,i);
+
+    if( bGotNoData && dfValue == dfNoDataValue )
+      continue;
+    if( msIsNan(dfValue) )
       continue;
 
     if( !bGotFirstValue ) {
-      fDataMin = fDataMax = pafRawData[i];
+      dfDataMin = dfDataMax = dfValue;
       bGotFirstValue = TRUE;
     } else {
-      fDataMin = MIN(fDataMin,pafRawData[i]);
-      fDataMax = MAX(fDataMax,pafRawData[i]);
+      dfDataMin = MIN(dfDataMin,dfValue);
+      dfDataMax = MAX(dfDataMax,dfValue);
     }
   }
 
@@ -2165,7 +2517,7 @@ msDrawRasterLayerGDAL_16BitClassification(
         && EQUAL(papszTokens[0],"AUTO") ) {
       dfScaleMin = dfScaleMax = 0.0;
     } else if( CSLCount(papszTokens) != 2 ) {
-      free( pafRawData );
+      free( pRawData );
       msSetError( MS_MISCERR,
                   "SCALE PROCESSING option unparsable for layer %s.",
                   "msDrawGDAL()",
@@ -2179,20 +2531,23 @@ msDrawRasterLayerGDAL_16BitClassification(
   }
 
   /* -------------------------------------------------------------------- */
-  /*      Special integer cases for scaling.                              */
-  /*                                                                      */
-  /*      TODO: Treat Int32 and UInt32 case the same way *if* the min     */
-  /*      and max are less than 65536 apart.                              */
+  /*      Special integer cases for scaling, one bucket per value.  The   */
+  /*      32bit types are treated the same way if the min and max are     */
+  /*      less than 65536 apart.                                          */
   /* -------------------------------------------------------------------- */
   if( eDataType == GDT_Byte || eDataType == GDT_Int16
-      || eDataType == GDT_UInt16 ) {
+      || eDataType == GDT_UInt16
+      || ((eDataType == GDT_Int32 || eDataType == GDT_UInt32)
+          && dfDataMax - dfDataMin < 65536) ) {
     if( pszScaleInfo == NULL ) {
-      dfScaleMin = fDataMin - 0.5;
-      dfScaleMax = fDataMax + 0.5;
+      dfScaleMin = dfDataMin - 0.5;
+      dfScaleMax = dfDataMax + 0.5;
     }
 
     if( pszBuckets == NULL ) {
-      nBucketCount = (int) floor(fDataMax - fDataMin + 1.1);
+      nBucketCount = (int) floor(dfDataMax - dfDataMin + 1.1);
+      /* like the 8bit path, looked up as an integer beyond float precision */
+      bExactBuckets = (pszScaleInfo == NULL && eReadType != GDT_Float32);
     }
   }
 
@@ -2200,9 +2555,9 @@ msDrawRasterLayerGDAL_16BitClassification(
   /*      General case if no scaling values provided in mapfile.          */
   /* -------------------------------------------------------------------- */
   else if( dfScaleMin == 0.0 && dfScaleMax == 0.0 ) {
-    double dfEpsilon = (fDataMax - fDataMin) / (65536*2);
-    dfScaleMin = fDataMin - dfEpsilon;
-    dfScaleMax = fDataMax + dfEpsilon;
+    double dfEpsilon = (dfDataMax - dfDataMin) / (65536*2);
+    dfScaleMin = dfDataMin - dfEpsilon;
+    dfScaleMax = dfDataMax + dfEpsilon;
   }
 
   /* -------------------------------------------------------------------- */
@@ -2214,7 +2569,7 @@ msDrawRasterLayerGDAL_16BitClassification(
   } else {
     nBucketCount = atoi(pszBuckets);
     if( nBucketCount < 2 ) {
-      free( pafRawData );
+      free( pRawData );
       msSetError( MS_MISCERR,
                   "SCALE_BUCKETS PROCESSING option is not a value of 2 or more: %s.",
                   "msDrawRasterLayerGDAL_16BitClassification()",
@@ -2237,57 +2592,18 @@ msDrawRasterLayerGDAL_16BitClassification(
              layer->name, nBucketCount, dfScaleMin, dfScaleMax );
 
   /* ==================================================================== */
-  /*      Compute classification lookup table.                            */
+  /*      Allocate the classification lookup table.  Buckets are only     */
+  /*      classified the first time a pixel falls in them, so that we     */
+  /*      evaluate the class expressions once per value actually         */
+  /*      present rather than once per possible value.                    */
   /* ==================================================================== */
-
-  cmap = (int *) msSmallCalloc(sizeof(int),nBucketCount);
+  cmap = (int *) msSmallMalloc(sizeof(int) * nBucketCount);
+  pabyBucketDone = (unsigned char *) msSmallCalloc(1,nBucketCount);
   rb_cmap[0] = (unsigned char *) msSmallCalloc(1,nBucketCount);
   rb_cmap[1] = (unsigned char *) msSmallCalloc(1,nBucketCount);
   rb_cmap[2] = (unsigned char *) msSmallCalloc(1,nBucketCount);
   rb_cmap[3] = (unsigned char *) msSmallCalloc(1,nBucketCount);
 
-  for(i=0; i < nBucketCount; i++) {
-    double dfOriginalValue;
-
-    cmap[i] = -1;
-
-    dfOriginalValue = (i+0.5) / dfScaleRatio + dfScaleMin;
-
-    c = msGetClass_FloatRGB(layer, (float) dfOriginalValue, -1, -1, -1);
-    if( c != -1 ) {
-      int s;
-
-      /* change colour based on colour range? */
-      for(s=0; s<layer->class[c]->numstyles; s++) {
-        if( MS_VALID_COLOR(layer->class[c]->styles[s]->mincolor)
-            && MS_VALID_COLOR(layer->class[c]->styles[s]->maxcolor) )
-          msValueToRange(layer->class[c]->styles[s],dfOriginalValue);
-      }
-#ifdef USE_GD
-      if(rb->type == MS_BUFFER_GD) {
-        RESOLVE_PEN_GD(rb->data.gd_img, layer->class[c]->styles[0]->color);
-        if( MS_TRANSPARENT_COLOR(layer->class[c]->styles[0]->color) )
-          cmap[i] = -1;
-        else if( MS_VALID_COLOR(layer->class[c]->styles[0]->color)) {
-          /* use class color */
-          cmap[i] = layer->class[c]->styles[0]->color.pen;
-        }
-      } else
-#endif
-        if( rb->type == MS_BUFFER_BYTE_RGBA ) {
-          if( MS_TRANSPARENT_COLOR(layer->class[c]->styles[0]->color) ) {
-            /* leave it transparent */
-          } else if( MS_VALID_COLOR(layer->class[c]->styles[0]->color)) {
-            /* use class color */
-            rb_cmap[0][i] = layer->class[c]->styles[0]->color.red;
-            rb_cmap[1][i] = layer->class[c]->styles[0]->color.green;
-            rb_cmap[2][i] = layer->class[c]->styles[0]->color.blue;
-            rb_cmap[3][i] = (255*layer->class[c]->styles[0]->opacity / 100);
-          }
-        }
-    }
-  }
-
   /* ==================================================================== */
   /*      Now process the data, applying to the working imageObj.         */
   /* ==================================================================== */
@@ -2295,16 +2611,21 @@ msDrawRasterLayerGDAL_16BitClassification(
 
   for( i = dst_yoff; i < dst_yoff + dst_ysize; i++ ) {
     for( j = dst_xoff; j < dst_xoff + dst_xsize; j++ ) {
-      float fRawValue = pafRawData[k++];
+      double dfRawValue = RAW_VALUE(pRawData,eReadType,k);
       int   iMapIndex;
 
+      k++;
+
       /*
        * Skip nodata pixels ... no processing.
        */
-      if( bGotNoData && fRawValue == fNoDataValue ) {
+      if( bGotNoData && dfRawValue == dfNoDataValue ) {
         continue;
       }
 
+      if( msIsNan(dfRawValue) )
+        continue;
+
       if(SKIP_MASK(j,i))
         continue;
 
@@ -2312,11 +2633,19 @@ msDrawRasterLayerGDAL_16BitClassification(
        * The funny +1/-1 is to avoid odd rounding around zero.
        * We could use floor() but sometimes it is expensive.
        */
-      iMapIndex = (int) ((fRawValue - dfScaleMin) * dfScaleRatio+1)-1;
+      iMapIndex = (int) ((dfRawValue - dfScaleMin) * dfScaleRatio+1)-1;
 
       if( iMapIndex >= nBucketCount || iMapIndex < 0 ) {
         continue;
       }
+
+      if( !pabyBucketDone[iMapIndex] ) {
+        ClassifyGDALBucket( layer, rb, iMapIndex,
+                            (iMapIndex+0.5) / dfScaleRatio + dfScaleMin,
+                            bExactBuckets, cmap, rb_cmap );
+        pabyBucketDone[iMapIndex] = 1;
+        nBucketsClassified++;
+      }
 #ifdef USE_GD
       if( rb->type == MS_BUFFER_GD ) {
         int result = cmap[iMapIndex];
@@ -2338,11 +2667,17 @@ msDrawRasterLayerGDAL_16BitClassification(
     }
   }
 
+  if( layer->debug >= MS_DEBUGLEVEL_V )
+    msDebug( "msDrawRasterGDAL_16BitClassification(%s): "
+             "classified %d of %d buckets.\n",
+             layer->name, nBucketsClassified, nBucketCount );
+
   /* -------------------------------------------------------------------- */
   /*      Cleanup                                                         */
   /* -------------------------------------------------------------------- */
-  free( pafRawData );
+  free( pRawData );
   free( cmap );
+  free( pabyBucketDone );
   free( rb_cmap[0] );
   free( rb_cmap[1] );
   free( rb_cmap[2] );
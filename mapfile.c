@@ -33,6 +33,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <float.h>
+#include <sys/stat.h>
 
 #include "mapserver.h"
 #include "mapfile.h"
@@ -58,6 +59,8 @@ extern int msyysource;
 extern int msyystate;
 extern char *msyystring;
 extern char *msyybasepath;
+extern char **msyyincludes;
+extern int msyynumincludes;
 extern int msyyreturncomments;
 extern char *msyystring_buffer;
 extern char msyystring_icase;
@@ -1071,6 +1074,7 @@ static void writeGrid(FILE *stream, int indent, graticuleObj *pGraticule)
 int msInitProjection(projectionObj *p)
 {
   p->gt.need_geotransform = MS_FALSE;
+  p->approx = NULL;
   p->numargs = 0;
   p->args = NULL;
   p->wellknownprojection = wkp_none;
@@ -1079,7 +1083,7 @@ int msInitProjection(projectionObj *p)
   p->args = (char **)malloc(MS_MAXPROJARGS*sizeof(char *));
   MS_CHECK_ALLOC(p->args, MS_MAXPROJARGS*sizeof(char *), -1);
 #if PJ_VERSION >= 480
-  p->proj_ctx = NULL;
+  p->proj_thread_id = -1;
 #endif
 #endif
   return(0);
@@ -1088,16 +1092,15 @@ int msInitProjection(projectionObj *p)
 void msFreeProjection(projectionObj *p)
 {
 #ifdef USE_PROJ
+  msProjectionFreeApprox(p);
   if(p->proj) {
-    pj_free(p->proj);
+    if(!msProjectionCacheRelease(p->proj))
+      pj_free(p->proj);
     p->proj = NULL;
-  }
 #if PJ_VERSION >= 480
-  if(p->proj_ctx) {
-    pj_ctx_free(p->proj_ctx);
-    p->proj_ctx = NULL;
-  }
+    p->proj_thread_id = -1;
 #endif
+  }
 
   msFreeCharArray(p->args, p->numargs);
   p->args = NULL;
@@ -1258,16 +1261,9 @@ int msProcessProjection(projectionObj *p)
     /*WMS 1.3.0: AUTO2:auto_crs_id,factor,lon0,lat0*/
     return _msProcessAutoProjection(p);
   }
-  msAcquireLock( TLOCK_PROJ );
-#if PJ_VERSION < 480
-  if( !(p->proj = pj_init(p->numargs, p->args)) ) {
-#else
-  p->proj_ctx = pj_ctx_alloc();
-  if( !(p->proj=pj_init_ctx(p->proj_ctx, p->numargs, p->args)) ) {
-#endif
-
+  /* initialized objects are shared, see msProjectionCacheGet() */
+  if( !(p->proj = msProjectionCacheGet(p)) ) {
     int *pj_errno_ref = pj_get_errno_ref();
-    msReleaseLock( TLOCK_PROJ );
     if(p->numargs>1) {
       msSetError(MS_PROJERR, "proj error \"%s\" for \"%s:%s\"",
                  "msProcessProjection()", pj_strerrno(*pj_errno_ref), p->args[0],p->args[1]) ;
@@ -1277,8 +1273,9 @@ int msProcessProjection(projectionObj *p)
     }
     return(-1);
   }
-
-  msReleaseLock( TLOCK_PROJ );
+#if PJ_VERSION >= 480
+  p->proj_thread_id = msGetThreadId();
+#endif
 
 #ifdef USE_PROJ_FASTPATHS
   if(strcasestr(p->args[0],"epsg:4326")) {
@@ -3890,6 +3887,7 @@ int initLayer(layerObj *layer, mapObj *map)
 
   layer->mask = NULL;
   layer->maskimage = NULL;
+  layer->rasterbytesread = 0;
 
   initExpression(&(layer->_geomtransform));
   layer->_geomtransform.type = MS_GEOMTRANSFORM_NONE;
@@ -3976,7 +3974,7 @@ int freeLayer(layerObj *layer)
     freeFeatureList(layer->features);
 
   if(layer->resultcache) {
-    if(layer->resultcache->results) free(layer->resultcache->results);
+    cleanupResultCache(layer->resultcache);
     msFree(layer->resultcache);
   }
 
@@ -5789,6 +5787,10 @@ int initMap(mapObj *map)
   map->cellsize = 0;
   map->shapepath = NULL;
   map->mappath = NULL;
+  map->mapfile = NULL;
+  map->includes = NULL;
+  map->numincludes = 0;
+  map->modified = MS_FALSE;
 
   MS_INIT_COLOR(map->imagecolor, 255,255,255,255); /* white */
 
@@ -6303,6 +6305,22 @@ static int loadMapInternal(mapObj *map)
   } /* next token */
 }
 
+/*
+** Hand the files the lexer INCLUDEd over to the map being loaded, or drop
+** them if map is NULL (ie. what msTokenizeMap() left behind).
+*/
+static void takeIncludes(mapObj *map)
+{
+  if(map) {
+    map->includes = msyyincludes;
+    map->numincludes = msyynumincludes;
+  } else
+    msFreeCharArray(msyyincludes, msyynumincludes);
+
+  msyyincludes = NULL;
+  msyynumincludes = 0;
+}
+
 /*
 ** Sets up string-based mapfile loading and calls loadMapInternal to do the work.
 */
@@ -6312,7 +6330,7 @@ mapObj *msLoadMapFromString(char *buffer, char *new_mappath)
   struct mstimeval starttime, endtime;
   char szPath[MS_MAXPATHLEN], szCWDPath[MS_MAXPATHLEN];
   char *mappath=NULL;
-  int debuglevel;
+  int debuglevel, status;
 
   debuglevel = (int)msGetGlobalDebugLevel();
 
@@ -6359,7 +6377,10 @@ mapObj *msLoadMapFromString(char *buffer, char *new_mappath)
 
   msyybasepath = map->mappath; /* for INCLUDEs */
 
-  if(loadMapInternal(map) != MS_SUCCESS) {
+  takeIncludes(NULL);
+  status = loadMapInternal(map);
+  takeIncludes(map);
+  if(status != MS_SUCCESS) {
     msFreeMap(map);
     msReleaseLock( TLOCK_PARSER );
     if(mappath != NULL) free(mappath);
@@ -6392,7 +6413,7 @@ mapObj *msLoadMap(char *filename, char *new_mappath)
   mapObj *map;
   struct mstimeval starttime, endtime;
   char szPath[MS_MAXPATHLEN], szCWDPath[MS_MAXPATHLEN];
-  int debuglevel;
+  int debuglevel, status;
 
   debuglevel = (int)msGetGlobalDebugLevel();
 
@@ -6482,7 +6503,12 @@ mapObj *msLoadMap(char *filename, char *new_mappath)
 
   msyybasepath = map->mappath; /* for INCLUDEs */
 
-  if(loadMapInternal(map) != MS_SUCCESS) {
+  map->mapfile = msStrdup(msBuildPath(szPath, szCWDPath, filename));
+
+  takeIncludes(NULL);
+  status = loadMapInternal(map);
+  takeIncludes(map);
+  if(status != MS_SUCCESS) {
     msFreeMap(map);
     msReleaseLock( TLOCK_PARSER );
     if( msyyin ) {
@@ -6504,6 +6530,49 @@ mapObj *msLoadMap(char *filename, char *new_mappath)
   return map;
 }
 
+static char *addFileToKey(char *key, const char *path)
+{
+  struct stat sStat;
+  char szTmp[64];
+
+  if(key == NULL || stat(path, &sStat) != 0) {
+    msFree(key);
+    return NULL;
+  }
+
+  key = msStringConcatenate(key, "|");
+  key = msStringConcatenate(key, path);
+  snprintf(szTmp, sizeof(szTmp), "|%ld|%ld", (long) sStat.st_mtime, (long) sStat.st_size);
+  return msStringConcatenate(key, szTmp);
+}
+
+/*
+** Identify the files a map was loaded from, for caches of what is computed
+** from the map: the mapfile, its INCLUDEs, the symbolset and the fontset,
+** each with its modification time and size. Returns NULL if the map was not
+** loaded from a file, was modified since, or one of the files can't be
+** stat'ed. The caller frees the key.
+*/
+char *msGetMapFilesKey(mapObj *map)
+{
+  char szPath[MS_MAXPATHLEN];
+  char *key;
+  int i;
+
+  if(map->mapfile == NULL || map->modified)
+    return NULL;
+
+  key = addFileToKey(msStrdup(""), map->mapfile);
+  for(i=0; i<map->numincludes; i++)
+    key = addFileToKey(key, map->includes[i]);
+  if(map->symbolset.filename)
+    key = addFileToKey(key, msBuildPath(szPath, map->mappath, map->symbolset.filename));
+  if(map->fontset.filename)
+    key = addFileToKey(key, msBuildPath(szPath, map->mappath, map->fontset.filename));
+
+  return key;
+}
+
 /*
 ** Loads mapfile snippets via a URL (only via the CGI so don't worry about thread locks)
 */
@@ -6516,6 +6585,8 @@ int msUpdateMapFromURL(mapObj *map, char *variable, char *string)
   if(msLookupHashTable(&(map->web.validation), "immutable"))
     return(MS_SUCCESS); /* fail silently */
 
+  map->modified = MS_TRUE;
+
   msyystate = MS_TOKENIZE_URL_VARIABLE; /* set lexer state and input to tokenize */
   msyystring = variable;
   msyylineno = 1;
@@ -6886,6 +6957,7 @@ void msApplySubstitutions(mapObj *map, char **names, char **values, int npairs)
           new_filename = msCaseReplaceSubstring(new_filename, tag, values[i]);
           msSetOutputFormatOption(map->outputformatlist[j], "FILENAME", new_filename);
           free(new_filename);
+          map->modified = MS_TRUE;
         }
       }
     }
@@ -6925,6 +6997,7 @@ void msApplySubstitutions(mapObj *map, char **names, char **values, int npairs)
 
         /* validation has succeeded in either class, layer or web */
         classSubstituteString(class, tag, values[i]);
+        map->modified = MS_TRUE;
       }
 
       if(!layerNeedsSubstitutions(layer, tag)) continue;
@@ -6948,6 +7021,7 @@ void msApplySubstitutions(mapObj *map, char **names, char **values, int npairs)
 
       /* validation has succeeded in either layer or web */
       layerSubstituteString(layer, tag, values[i]);
+      map->modified = MS_TRUE;
     }
 
     msFree(tag);
@@ -7097,6 +7171,40 @@ void initResultCache(resultCacheObj *resultcache)
     resultcache->cachesize = 0;
     resultcache->bounds.minx = resultcache->bounds.miny = resultcache->bounds.maxx = resultcache->bounds.maxy = -1;
     resultcache->usegetshape = MS_FALSE;
+    resultcache->shapes = NULL;
+    resultcache->shapeitems = NULL;
+    resultcache->numshapeitems = 0;
+    resultcache->shapememory = resultcache->shapememorymax = 0;
+    resultcache->unprojected = NULL;
+  }
+}
+
+/*
+** Free what a result cache holds, but not the cache itself.
+*/
+void cleanupResultCache(resultCacheObj *resultcache)
+{
+  int i;
+
+  if (resultcache) {
+    if (resultcache->shapes) {
+      for (i = 0; i < resultcache->cachesize; i++) {
+        if (resultcache->shapes[i]) {
+          msFreeShape(resultcache->shapes[i]);
+          free(resultcache->shapes[i]);
+        }
+      }
+      free(resultcache->shapes);
+    }
+    if (resultcache->shapeitems)
+      msFreeCharArray(resultcache->shapeitems, resultcache->numshapeitems);
+    if (resultcache->unprojected) {
+      msFreeShape(resultcache->unprojected);
+      free(resultcache->unprojected);
+    }
+    if (resultcache->results)
+      free(resultcache->results);
+    initResultCache(resultcache);
   }
 }
 
@@ -63,6 +63,183 @@ void msGDALInitialize( void )
   }
 }
 
+/************************************************************************/
+/*                        Dataset handle cache                          */
+/*                                                                      */
+/*      Datasets opened through msGDALAcquireDataset() are kept open    */
+/*      in a process wide list, most recently used first, so that the   */
+/*      tiles of a tile index are not reopened on every request.        */
+/*      Entries are keyed by path and remember the modification time   */
+/*      and size of their file, stat'ed again when reused more than     */
+/*      MS_GDAL_DATASET_RECHECK seconds after the last check, so a      */
+/*      replaced tile is picked up within that delay.  Paths that       */
+/*      can't be stat'ed are not cached.  Each handle is used by one    */
+/*      caller at a time (a busy entry gets a second handle) and idle   */
+/*      handles beyond the requested count are closed, least recently   */
+/*      used first.  All of this happens with TLOCK_GDAL held by the    */
+/*      caller.                                                         */
+/************************************************************************/
+
+#define MS_GDAL_DATASET_RECHECK 5
+
+typedef struct gdalDatasetCacheObj {
+  char *path;
+  time_t mtime;
+  vsi_l_offset size;
+  time_t checked; /* when the file was last stat'ed */
+  GDALDatasetH hDS;
+  int in_use;
+
+  struct gdalDatasetCacheObj *prev, *next;
+} gdalDatasetCacheObj;
+
+static gdalDatasetCacheObj *gdalDatasetCacheHead = NULL;
+static gdalDatasetCacheObj *gdalDatasetCacheTail = NULL;
+static int gdalDatasetCacheCount = 0;
+
+static void msGDALDatasetCacheUnlink( gdalDatasetCacheObj *entry )
+
+{
+  if( entry->prev )
+    entry->prev->next = entry->next;
+  else
+    gdalDatasetCacheHead = entry->next;
+  if( entry->next )
+    entry->next->prev = entry->prev;
+  else
+    gdalDatasetCacheTail = entry->prev;
+  entry->prev = entry->next = NULL;
+}
+
+static void msGDALDatasetCachePushFront( gdalDatasetCacheObj *entry )
+
+{
+  entry->prev = NULL;
+  entry->next = gdalDatasetCacheHead;
+  if( gdalDatasetCacheHead )
+    gdalDatasetCacheHead->prev = entry;
+  else
+    gdalDatasetCacheTail = entry;
+  gdalDatasetCacheHead = entry;
+}
+
+static void msGDALDatasetCacheRemove( gdalDatasetCacheObj *entry )
+
+{
+  msGDALDatasetCacheUnlink( entry );
+  GDALClose( entry->hDS );
+  msFree( entry->path );
+  free( entry );
+  gdalDatasetCacheCount--;
+}
+
+/* Close idle handles, least recently used first, until at most nMax remain */
+static void msGDALDatasetCacheTrim( int nMax )
+
+{
+  gdalDatasetCacheObj *entry = gdalDatasetCacheTail;
+
+  while( entry != NULL && gdalDatasetCacheCount > nMax ) {
+    gdalDatasetCacheObj *prev = entry->prev;
+    if( !entry->in_use )
+      msGDALDatasetCacheRemove( entry );
+    entry = prev;
+  }
+}
+
+/************************************************************************/
+/*                        msGDALAcquireDataset()                        */
+/*                                                                      */
+/*      Return an open read-only handle on pszPath for the exclusive    */
+/*      use of the caller, reusing a cached one if its file is          */
+/*      unchanged.  NULL if GDAL can't open it.  Must be called with    */
+/*      TLOCK_GDAL held and given back with msGDALReleaseDataset().     */
+/************************************************************************/
+
+void *msGDALAcquireDataset( const char *pszPath, int nMaxDatasets )
+
+{
+  gdalDatasetCacheObj *entry, *next;
+  GDALDatasetH hDS;
+  VSIStatBufL sStat;
+  time_t now = time( NULL );
+  int bStat = -1; /* not stat'ed yet */
+
+  for( entry = gdalDatasetCacheHead; entry != NULL; entry = next ) {
+    next = entry->next;
+    if( strcmp(entry->path, pszPath) != 0 )
+      continue;
+
+    if( now - entry->checked >= MS_GDAL_DATASET_RECHECK ) {
+      if( bStat == -1 )
+        bStat = VSIStatL( pszPath, &sStat ) == 0;
+      if( !bStat || entry->mtime != sStat.st_mtime
+          || entry->size != (vsi_l_offset) sStat.st_size ) {
+        /* the file changed, a busy handle goes at the next lookup */
+        if( !entry->in_use )
+          msGDALDatasetCacheRemove( entry );
+        continue;
+      }
+      entry->checked = now;
+    }
+
+    if( !entry->in_use ) {
+      entry->in_use = MS_TRUE;
+      msGDALDatasetCacheUnlink( entry );
+      msGDALDatasetCachePushFront( entry );
+      return entry->hDS;
+    }
+  }
+
+  if( bStat == -1 )
+    bStat = VSIStatL( pszPath, &sStat ) == 0;
+
+  hDS = GDALOpen( pszPath, GA_ReadOnly );
+  if( hDS == NULL || !bStat )
+    return hDS; /* msGDALReleaseDataset() closes what isn't cached */
+
+  entry = (gdalDatasetCacheObj *) msSmallMalloc( sizeof(gdalDatasetCacheObj) );
+  entry->path = msStrdup( pszPath );
+  entry->mtime = sStat.st_mtime;
+  entry->size = (vsi_l_offset) sStat.st_size;
+  entry->checked = now;
+  entry->hDS = hDS;
+  entry->in_use = MS_TRUE;
+  msGDALDatasetCachePushFront( entry );
+  gdalDatasetCacheCount++;
+
+  msGDALDatasetCacheTrim( nMaxDatasets );
+
+  return hDS;
+}
+
+/************************************************************************/
+/*                        msGDALReleaseDataset()                        */
+/*                                                                      */
+/*      Give back a handle from msGDALAcquireDataset(), it stays open   */
+/*      for reuse if it is among the nMaxDatasets most recently used.   */
+/*      Must be called with TLOCK_GDAL held.                            */
+/************************************************************************/
+
+void msGDALReleaseDataset( void *hDS, int nMaxDatasets )
+
+{
+  gdalDatasetCacheObj *entry;
+
+  for( entry = gdalDatasetCacheHead; entry != NULL; entry = entry->next ) {
+    if( entry->hDS == (GDALDatasetH) hDS && entry->in_use )
+      break;
+  }
+
+  if( entry == NULL ) {
+    GDALClose( (GDALDatasetH) hDS );
+    return;
+  }
+
+  entry->in_use = MS_FALSE;
+  msGDALDatasetCacheTrim( nMaxDatasets );
+}
+
 /************************************************************************/
 /*                           msGDALCleanup()                            */
 /************************************************************************/
@@ -74,6 +251,8 @@ void msGDALCleanup( void )
     int iRepeat = 5;
     msAcquireLock( TLOCK_GDAL );
 
+    msGDALDatasetCacheTrim( 0 );
+
 #if GDAL_RELEASE_DATE > 20101207
     {
       /*
@@ -146,7 +325,7 @@ void CleanVSIDir( const char *pszDir )
 int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
 
 {
-  int  bFileIsTemporary = MS_FALSE;
+  int  bFileIsTemporary = MS_FALSE, bWrapBuffer = MS_FALSE;
   GDALDatasetH hMemDS, hOutputDS;
   GDALDriverH  hMemDriver, hOutputDriver;
   int          nBands = 1;
@@ -214,6 +393,7 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
     nBands = 3;
     assert( MS_RENDERER_PLUGIN(format) && format->vtable->supports_pixel_buffer );
     format->vtable->getRasterBufferHandle(image,&rb);
+    bWrapBuffer = (rb.type == MS_BUFFER_BYTE_RGBA && rb.data.rgba.a == NULL);
   } else if( format->imagemode == MS_IMAGEMODE_RGBA ) {
     pabyAlphaLine = (GByte *) calloc(image->width,1);
     if (pabyAlphaLine == NULL) {
@@ -227,12 +407,15 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
   } else if( format->imagemode == MS_IMAGEMODE_INT16 ) {
     nBands = format->bands;
     eDataType = GDT_Int16;
+    bWrapBuffer = MS_TRUE;
   } else if( format->imagemode == MS_IMAGEMODE_FLOAT32 ) {
     nBands = format->bands;
     eDataType = GDT_Float32;
+    bWrapBuffer = MS_TRUE;
   } else if( format->imagemode == MS_IMAGEMODE_BYTE ) {
     nBands = format->bands;
     eDataType = GDT_Byte;
+    bWrapBuffer = MS_TRUE;
   } else {
 #ifdef USE_GD
     assert( format->imagemode == MS_IMAGEMODE_PC256
@@ -249,7 +432,9 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
 
   /* -------------------------------------------------------------------- */
   /*      Create a memory dataset which we can use as a source for a      */
-  /*      CreateCopy().                                                   */
+  /*      CreateCopy().  When the image buffer already has a layout       */
+  /*      GDAL can read (raw modes, RGB without alpha) the bands of the   */
+  /*      memory dataset point into it instead of holding a copy.         */
   /* -------------------------------------------------------------------- */
   hMemDriver = GDALGetDriverByName( "MEM" );
   if( hMemDriver == NULL ) {
@@ -260,7 +445,7 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
   }
 
   hMemDS = GDALCreate( hMemDriver, "msSaveImageGDAL_temp",
-                       image->width, image->height, nBands,
+                       image->width, image->height, bWrapBuffer ? 0 : nBands,
                        eDataType, NULL );
   if( hMemDS == NULL ) {
     msReleaseLock( TLOCK_GDAL );
@@ -269,10 +454,47 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
     return MS_FAILURE;
   }
 
+  if( bWrapBuffer ) {
+    int iBand, nPixelOffset, nLineOffset;
+
+    for( iBand = 0; iBand < nBands; iBand++ ) {
+      char **papszBandOptions = NULL;
+      char szPointer[64];
+      GByte *pabyBand;
+      int nLen;
+
+      if( format->imagemode == MS_IMAGEMODE_RGB ) {
+        pabyBand = (iBand == 0) ? rb.data.rgba.r : (iBand == 1) ? rb.data.rgba.g : rb.data.rgba.b;
+        nPixelOffset = rb.data.rgba.pixel_step;
+        nLineOffset = rb.data.rgba.row_step;
+      } else {
+        nPixelOffset = GDALGetDataTypeSize( eDataType ) / 8;
+        nLineOffset = nPixelOffset * image->width;
+        if( format->imagemode == MS_IMAGEMODE_INT16 )
+          pabyBand = (GByte *) image->img.raw_16bit;
+        else if( format->imagemode == MS_IMAGEMODE_FLOAT32 )
+          pabyBand = (GByte *) image->img.raw_float;
+        else
+          pabyBand = (GByte *) image->img.raw_byte;
+        pabyBand += (size_t) iBand * nLineOffset * image->height;
+      }
+
+      nLen = CPLPrintPointer( szPointer, pabyBand, sizeof(szPointer) );
+      szPointer[nLen] = '\0';
+      papszBandOptions = CSLSetNameValue( papszBandOptions, "DATAPOINTER", szPointer );
+      papszBandOptions = CSLSetNameValue( papszBandOptions, "PIXELOFFSET",
+                                          CPLSPrintf( "%d", nPixelOffset ) );
+      papszBandOptions = CSLSetNameValue( papszBandOptions, "LINEOFFSET",
+                                          CPLSPrintf( "%d", nLineOffset ) );
+      GDALAddBand( hMemDS, eDataType, papszBandOptions );
+      CSLDestroy( papszBandOptions );
+    }
+  }
+
   /* -------------------------------------------------------------------- */
   /*      Copy the gd image into the memory dataset.                      */
   /* -------------------------------------------------------------------- */
-  for( iLine = 0; iLine < image->height; iLine++ ) {
+  for( iLine = 0; !bWrapBuffer && iLine < image->height; iLine++ ) {
     int iBand;
 
     for( iBand = 0; iBand < nBands; iBand++ ) {
@@ -616,8 +616,16 @@ void msGEOSFreeGeometry(shapeObj *shape)
   if(!shape || !shape->geometry)
     return;
 
+#if GEOS_VERSION_MAJOR > 3 || (GEOS_VERSION_MAJOR == 3 && GEOS_VERSION_MINOR >= 3)
+  if(shape->prepared) { /* refers to the geometry, goes first */
+    GEOSPreparedGeom_destroy((const GEOSPreparedGeometry *) shape->prepared);
+    shape->prepared = NULL;
+  }
+#endif
+
   g = (GEOSGeom) shape->geometry;
   GEOSGeom_destroy(g);
+  shape->geometry = NULL;
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSFreeGEOSGeom()");
   return;
@@ -951,34 +959,183 @@ shapeObj *msGEOSSymDifference(shapeObj *shape1, shapeObj *shape2)
 #endif
 }
 
+#ifdef USE_GEOS
+
+#if GEOS_VERSION_MAJOR > 3 || (GEOS_VERSION_MAJOR == 3 && GEOS_VERSION_MINOR >= 3)
+#define MS_GEOS_PREPARED
+#endif
+
+#ifdef MS_GEOS_PREPARED
 /*
-** Binary predicates exposed to MapServer/MapScript
+** Bounds of a shape from its vertices, shape->bounds is not always set.
 */
+static void msGEOSComputeBounds(shapeObj *shape, rectObj *bounds)
+{
+  int i, j, first = MS_TRUE;
+  pointObj *point;
+
+  for(i=0; i<shape->numlines; i++) {
+    for(j=0; j<shape->line[i].numpoints; j++) {
+      point = &(shape->line[i].point[j]);
+      if(first) {
+        bounds->minx = bounds->maxx = point->x;
+        bounds->miny = bounds->maxy = point->y;
+        first = MS_FALSE;
+      } else {
+        bounds->minx = MS_MIN(bounds->minx, point->x);
+        bounds->maxx = MS_MAX(bounds->maxx, point->x);
+        bounds->miny = MS_MIN(bounds->miny, point->y);
+        bounds->maxy = MS_MAX(bounds->maxy, point->y);
+      }
+    }
+  }
+  if(first) /* no vertices */
+    bounds->minx = bounds->miny = bounds->maxx = bounds->maxy = 0;
+}
+#endif
 
 /*
-** Does shape1 contain shape2, returns MS_TRUE/MS_FALSE or -1 for an error.
+** Evaluates a binary predicate (MS_GEOS_OPERATOR), MS_TRUE/MS_FALSE or -1
+** for an error.
+**
+** A shape that already carries its GEOS geometry when it is tested is being
+** reused, like a literal shape in a FILTER expression or the selection shape
+** of msQueryByShape() checked against every candidate. Its geometry is then
+** prepared once (GEOS >= 3.3), and the candidates are first checked against
+** its bounds so that the ones that can't match are never converted.
 */
-int msGEOSContains(shapeObj *shape1, shapeObj *shape2)
+static int msGEOSPredicate(shapeObj *shape1, shapeObj *shape2, int predicate)
 {
-#ifdef USE_GEOS
   GEOSGeom g1, g2;
   int result;
+#ifdef MS_GEOS_PREPARED
+  shapeObj *reused = NULL, *other = NULL;
+  const GEOSPreparedGeometry *prepared;
+  rectObj bounds;
+#endif
 
   if(!shape1 || !shape2)
     return -1;
 
+#ifdef MS_GEOS_PREPARED
+  if(shape1->prepared || (shape1->geometry && !shape2->geometry)) {
+    reused = shape1;
+    other = shape2;
+  } else if(shape2->prepared || (shape2->geometry && !shape1->geometry)) {
+    reused = shape2;
+    other = shape1;
+  }
+
+  if(reused) {
+    if(!reused->prepared) {
+      reused->prepared = (void *) GEOSPrepare((GEOSGeom) reused->geometry);
+      if(!reused->prepared) return -1;
+      msComputeBounds(reused);
+    }
+    prepared = (const GEOSPreparedGeometry *) reused->prepared;
+
+    /* bounding box rejection */
+    if(!other->geometry && other->numlines > 0) {
+      msGEOSComputeBounds(other, &bounds);
+      switch(predicate) {
+        case MS_GEOS_DISJOINT:
+          if(msRectOverlap(&bounds, &(reused->bounds)) != MS_TRUE) return MS_TRUE;
+          break;
+        case MS_GEOS_CONTAINS: /* reused contains other or other within reused, the other can't stick out */
+        case MS_GEOS_WITHIN:
+          if((predicate == MS_GEOS_CONTAINS) == (reused == shape1)) {
+            if(msRectContained(&bounds, &(reused->bounds)) != MS_TRUE) return MS_FALSE;
+          } else {
+            if(msRectContained(&(reused->bounds), &bounds) != MS_TRUE) return MS_FALSE;
+          }
+          break;
+        default:
+          if(msRectOverlap(&bounds, &(reused->bounds)) != MS_TRUE) return MS_FALSE;
+          break;
+      }
+    }
+
+    if(!other->geometry) /* if no geometry for the other shape then build one */
+      other->geometry = (GEOSGeom) msGEOSShape2Geometry(other);
+    g2 = (GEOSGeom) other->geometry;
+    if(!g2) return -1;
+
+    switch(predicate) {
+      case MS_GEOS_INTERSECTS:
+        result = GEOSPreparedIntersects(prepared, g2);
+        break;
+      case MS_GEOS_DISJOINT:
+        result = GEOSPreparedDisjoint(prepared, g2);
+        break;
+      case MS_GEOS_TOUCHES:
+        result = GEOSPreparedTouches(prepared, g2);
+        break;
+      case MS_GEOS_OVERLAPS:
+        result = GEOSPreparedOverlaps(prepared, g2);
+        break;
+      case MS_GEOS_CROSSES:
+        result = GEOSPreparedCrosses(prepared, g2);
+        break;
+      default: /* contains and within swap when the reused shape comes second */
+        if((predicate == MS_GEOS_CONTAINS) == (reused == shape1))
+          result = GEOSPreparedContains(prepared, g2);
+        else
+          result = GEOSPreparedWithin(prepared, g2);
+        break;
+    }
+    return ((result==2) ? -1 : result);
+  }
+#endif /* MS_GEOS_PREPARED */
+
   if(!shape1->geometry) /* if no geometry for shape1 then build one */
     shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = shape1->geometry;
+  g1 = (GEOSGeom) shape1->geometry;
   if(!g1) return -1;
 
   if(!shape2->geometry) /* if no geometry for shape2 then build one */
     shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = shape2->geometry;
+  g2 = (GEOSGeom) shape2->geometry;
   if(!g2) return -1;
 
-  result = GEOSContains(g1, g2);
+  switch(predicate) {
+    case MS_GEOS_INTERSECTS:
+      result = GEOSIntersects(g1, g2);
+      break;
+    case MS_GEOS_DISJOINT:
+      result = GEOSDisjoint(g1, g2);
+      break;
+    case MS_GEOS_TOUCHES:
+      result = GEOSTouches(g1, g2);
+      break;
+    case MS_GEOS_OVERLAPS:
+      result = GEOSOverlaps(g1, g2);
+      break;
+    case MS_GEOS_CROSSES:
+      result = GEOSCrosses(g1, g2);
+      break;
+    case MS_GEOS_CONTAINS:
+      result = GEOSContains(g1, g2);
+      break;
+    default:
+      result = GEOSWithin(g1, g2);
+      break;
+  }
   return ((result==2) ? -1 : result);
+}
+
+#endif /* USE_GEOS */
+
+/*
+** Binary predicates exposed to MapServer/MapScript
+*/
+
+/*
+** Does shape1 contain shape2, returns MS_TRUE/MS_FALSE or -1 for an error.
+*/
+int msGEOSContains(shapeObj *shape1, shapeObj *shape2)
+{
+#ifdef USE_GEOS
+  return msGEOSPredicate(shape1, shape2, MS_GEOS_CONTAINS);
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSContains()");
   return -1;
@@ -991,24 +1148,7 @@ int msGEOSContains(shapeObj *shape1, shapeObj *shape2)
 int msGEOSOverlaps(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
-  GEOSGeom g1, g2;
-  int result;
-
-  if(!shape1 || !shape2)
-    return -1;
-
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = shape1->geometry;
-  if(!g1) return -1;
-
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = shape2->geometry;
-  if(!g2) return -1;
-
-  result = GEOSOverlaps(g1, g2);
-  return ((result==2) ? -1 : result);
+  return msGEOSPredicate(shape1, shape2, MS_GEOS_OVERLAPS);
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSOverlaps()");
   return -1;
@@ -1021,24 +1161,7 @@ int msGEOSOverlaps(shapeObj *shape1, shapeObj *shape2)
 int msGEOSWithin(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
-  GEOSGeom g1, g2;
-  int result;
-
-  if(!shape1 || !shape2)
-    return -1;
-
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = shape1->geometry;
-  if(!g1) return -1;
-
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = shape2->geometry;
-  if(!g2) return -1;
-
-  result = GEOSWithin(g1, g2);
-  return ((result==2) ? -1 : result);
+  return msGEOSPredicate(shape1, shape2, MS_GEOS_WITHIN);
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSWithin()");
   return -1;
@@ -1051,24 +1174,7 @@ int msGEOSWithin(shapeObj *shape1, shapeObj *shape2)
 int msGEOSCrosses(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
-  GEOSGeom g1, g2;
-  int result;
-
-  if(!shape1 || !shape2)
-    return -1;
-
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = shape1->geometry;
-  if(!g1) return -1;
-
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = shape2->geometry;
-  if(!g2) return -1;
-
-  result = GEOSCrosses(g1, g2);
-  return ((result==2) ? -1 : result);
+  return msGEOSPredicate(shape1, shape2, MS_GEOS_CROSSES);
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSCrosses()");
   return -1;
@@ -1081,24 +1187,7 @@ int msGEOSCrosses(shapeObj *shape1, shapeObj *shape2)
 int msGEOSIntersects(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
-  GEOSGeom g1, g2;
-  int result;
-
-  if(!shape1 || !shape2)
-    return -1;
-
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = (GEOSGeom) shape1->geometry;
-  if(!g1) return -1;
-
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = (GEOSGeom) shape2->geometry;
-  if(!g2) return -1;
-
-  result = GEOSIntersects(g1, g2);
-  return ((result==2) ? -1 : result);
+  return msGEOSPredicate(shape1, shape2, MS_GEOS_INTERSECTS);
 #else
   if(!shape1 || !shape2)
     return -1;
@@ -1132,24 +1221,7 @@ int msGEOSIntersects(shapeObj *shape1, shapeObj *shape2)
 int msGEOSTouches(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
-  GEOSGeom g1, g2;
-  int result;
-
-  if(!shape1 || !shape2)
-    return -1;
-
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = (GEOSGeom) shape1->geometry;
-  if(!g1) return -1;
-
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = (GEOSGeom) shape2->geometry;
-  if(!g2) return -1;
-
-  result = GEOSTouches(g1, g2);
-  return ((result==2) ? -1 : result);
+  return msGEOSPredicate(shape1, shape2, MS_GEOS_TOUCHES);
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSTouches()");
   return -1;
@@ -1192,24 +1264,7 @@ int msGEOSEquals(shapeObj *shape1, shapeObj *shape2)
 int msGEOSDisjoint(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
-  GEOSGeom g1, g2;
-  int result;
-
-  if(!shape1 || !shape2)
-    return -1;
-
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = (GEOSGeom) shape1->geometry;
-  if(!g1) return -1;
-
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = (GEOSGeom) shape2->geometry;
-  if(!g2) return -1;
-
-  result = GEOSDisjoint(g1, g2);
-  return ((result==2) ? -1 : result);
+  return msGEOSPredicate(shape1, shape2, MS_GEOS_DISJOINT);
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSDisjoint()");
   return -1;
@@ -119,6 +119,25 @@ static void gmlEndGeometryContainer(FILE *stream, char *name, char *namespace, c
     msIO_fprintf(stream, "%s</%s>\n", tab, tag_name);
 }
 
+/*
+** Write the vertices of a line as "x<separator>y " tuples, the same text as
+** printing each with "%f<separator>%f " but without one msIO call per vertex.
+*/
+static void gmlWritePoints(FILE *stream, lineObj *line, char separator)
+{
+  msIOWriteBuffer wb;
+  int j;
+
+  msIO_writeBufferInit(&wb, stream);
+  for(j=0; j<line->numpoints; j++) {
+    msIO_writeBufferAppendDouble(&wb, line->point[j].x, 6);
+    msIO_writeBufferAppend(&wb, &separator, 1);
+    msIO_writeBufferAppendDouble(&wb, line->point[j].y, 6);
+    msIO_writeBufferAppend(&wb, " ", 1);
+  }
+  msIO_writeBufferFlush(&wb);
+}
+
 /* GML 2.1.2 */
 static int gmlWriteGeometry_GML2(FILE *stream, gmlGeometryListObj *geometryList, shapeObj *shape, const char *srsname, char *namespace, char *tab)
 {
@@ -212,8 +231,7 @@ static int gmlWriteGeometry_GML2(FILE *stream, gmlGeometryListObj *geometryList,
             msIO_fprintf(stream, "%s<gml:LineString>\n", tab);
 
           msIO_fprintf(stream, "%s  <gml:coordinates>", tab);
-          for(j=0; j<shape->line[i].numpoints; j++)
-            msIO_fprintf(stream, "%f,%f ", shape->line[i].point[j].x, shape->line[i].point[j].y);
+          gmlWritePoints(stream, &(shape->line[i]), ',');
           msIO_fprintf(stream, "</gml:coordinates>\n");
 
           msIO_fprintf(stream, "%s</gml:LineString>\n", tab);
@@ -234,8 +252,7 @@ static int gmlWriteGeometry_GML2(FILE *stream, gmlGeometryListObj *geometryList,
           msIO_fprintf(stream, "%s    <gml:LineString>\n", tab); /* no srsname at this point */
 
           msIO_fprintf(stream, "%s      <gml:coordinates>", tab);
-          for(i=0; i<shape->line[j].numpoints; i++)
-            msIO_fprintf(stream, "%f,%f ", shape->line[j].point[i].x, shape->line[j].point[i].y);
+          gmlWritePoints(stream, &(shape->line[j]), ',');
           msIO_fprintf(stream, "</gml:coordinates>\n");
           msIO_fprintf(stream, "%s    </gml:LineString>\n", tab);
           msIO_fprintf(stream, "%s  </gml:lineStringMember>\n", tab);
@@ -283,8 +300,7 @@ static int gmlWriteGeometry_GML2(FILE *stream, gmlGeometryListObj *geometryList,
           msIO_fprintf(stream, "%s    <gml:LinearRing>\n", tab);
 
           msIO_fprintf(stream, "%s      <gml:coordinates>", tab);
-          for(j=0; j<shape->line[i].numpoints; j++)
-            msIO_fprintf(stream, "%f,%f ", shape->line[i].point[j].x, shape->line[i].point[j].y);
+          gmlWritePoints(stream, &(shape->line[i]), ',');
           msIO_fprintf(stream, "</gml:coordinates>\n");
 
           msIO_fprintf(stream, "%s    </gml:LinearRing>\n", tab);
@@ -296,8 +312,7 @@ static int gmlWriteGeometry_GML2(FILE *stream, gmlGeometryListObj *geometryList,
               msIO_fprintf(stream, "%s    <gml:LinearRing>\n", tab);
 
               msIO_fprintf(stream, "%s      <gml:coordinates>", tab);
-              for(j=0; j<shape->line[k].numpoints; j++)
-                msIO_fprintf(stream, "%f,%f ", shape->line[k].point[j].x, shape->line[k].point[j].y);
+              gmlWritePoints(stream, &(shape->line[k]), ',');
               msIO_fprintf(stream, "</gml:coordinates>\n");
 
               msIO_fprintf(stream, "%s    </gml:LinearRing>\n", tab);
@@ -331,8 +346,7 @@ static int gmlWriteGeometry_GML2(FILE *stream, gmlGeometryListObj *geometryList,
             msIO_fprintf(stream, "%s      <gml:LinearRing>\n", tab);
 
             msIO_fprintf(stream, "%s        <gml:coordinates>", tab);
-            for(j=0; j<shape->line[i].numpoints; j++)
-              msIO_fprintf(stream, "%f,%f ", shape->line[i].point[j].x, shape->line[i].point[j].y);
+            gmlWritePoints(stream, &(shape->line[i]), ',');
             msIO_fprintf(stream, "</gml:coordinates>\n");
 
             msIO_fprintf(stream, "%s      </gml:LinearRing>\n", tab);
@@ -344,8 +358,7 @@ static int gmlWriteGeometry_GML2(FILE *stream, gmlGeometryListObj *geometryList,
                 msIO_fprintf(stream, "%s      <gml:LinearRing>\n", tab);
 
                 msIO_fprintf(stream, "%s        <gml:coordinates>", tab);
-                for(j=0; j<shape->line[k].numpoints; j++)
-                  msIO_fprintf(stream, "%f,%f ", shape->line[k].point[j].x, shape->line[k].point[j].y);
+                gmlWritePoints(stream, &(shape->line[k]), ',');
                 msIO_fprintf(stream, "</gml:coordinates>\n");
 
                 msIO_fprintf(stream, "%s      </gml:LinearRing>\n", tab);
@@ -472,8 +485,7 @@ static int gmlWriteGeometry_GML3(FILE *stream, gmlGeometryListObj *geometryList,
             msIO_fprintf(stream, "%s  <gml:LineString>\n", tab);
 
           msIO_fprintf(stream, "%s    <gml:posList srsDimension=\"2\">", tab);
-          for(j=0; j<shape->line[i].numpoints; j++)
-            msIO_fprintf(stream, "%f %f ", shape->line[i].point[j].x, shape->line[i].point[j].y);
+          gmlWritePoints(stream, &(shape->line[i]), ' ');
           msIO_fprintf(stream, "</gml:posList>\n");
 
           msIO_fprintf(stream, "%s  </gml:LineString>\n", tab);
@@ -494,8 +506,7 @@ static int gmlWriteGeometry_GML3(FILE *stream, gmlGeometryListObj *geometryList,
           msIO_fprintf(stream, "%s      <gml:LineString>\n", tab); /* no srsname at this point */
 
           msIO_fprintf(stream, "%s        <gml:posList srsDimension=\"2\">", tab);
-          for(j=0; j<shape->line[i].numpoints; j++)
-            msIO_fprintf(stream, "%f %f ", shape->line[i].point[j].x, shape->line[i].point[j].y);
+          gmlWritePoints(stream, &(shape->line[i]), ' ');
           msIO_fprintf(stream, "</gml:posList>\n");
           msIO_fprintf(stream, "%s      </gml:LineString>\n", tab);
         }
@@ -543,8 +554,7 @@ static int gmlWriteGeometry_GML3(FILE *stream, gmlGeometryListObj *geometryList,
           msIO_fprintf(stream, "%s      <gml:LinearRing>\n", tab);
 
           msIO_fprintf(stream, "%s        <gml:posList srsDimension=\"2\">", tab);
-          for(j=0; j<shape->line[i].numpoints; j++)
-            msIO_fprintf(stream, "%f %f ", shape->line[i].point[j].x, shape->line[i].point[j].y);
+          gmlWritePoints(stream, &(shape->line[i]), ' ');
           msIO_fprintf(stream, "</gml:posList>\n");
 
           msIO_fprintf(stream, "%s      </gml:LinearRing>\n", tab);
@@ -556,8 +566,7 @@ static int gmlWriteGeometry_GML3(FILE *stream, gmlGeometryListObj *geometryList,
               msIO_fprintf(stream, "%s      <gml:LinearRing>\n", tab);
 
               msIO_fprintf(stream, "%s        <gml:posList srsDimension=\"2\">", tab);
-              for(j=0; j<shape->line[k].numpoints; j++)
-                msIO_fprintf(stream, "%f %f ", shape->line[k].point[j].x, shape->line[k].point[j].y);
+              gmlWritePoints(stream, &(shape->line[k]), ' ');
               msIO_fprintf(stream, "</gml:posList>\n");
 
               msIO_fprintf(stream, "%s      </gml:LinearRing>\n", tab);
@@ -593,8 +602,7 @@ static int gmlWriteGeometry_GML3(FILE *stream, gmlGeometryListObj *geometryList,
             msIO_fprintf(stream, "%s          <gml:LinearRing>\n", tab);
 
             msIO_fprintf(stream, "%s            <gml:posList srsDimension=\"2\">", tab);
-            for(j=0; j<shape->line[i].numpoints; j++)
-              msIO_fprintf(stream, "%f %f ", shape->line[i].point[j].x, shape->line[i].point[j].y);
+            gmlWritePoints(stream, &(shape->line[i]), ' ');
             msIO_fprintf(stream, "</gml:posList>\n");
 
             msIO_fprintf(stream, "%s          </gml:LinearRing>\n", tab);
@@ -606,8 +614,7 @@ static int gmlWriteGeometry_GML3(FILE *stream, gmlGeometryListObj *geometryList,
                 msIO_fprintf(stream, "%s          <gml:LinearRing>\n", tab);
 
                 msIO_fprintf(stream, "%s            <gml:posList srsDimension=\"2\">", tab);
-                for(j=0; j<shape->line[k].numpoints; j++)
-                  msIO_fprintf(stream, "%f %f ", shape->line[k].point[j].x, shape->line[k].point[j].y);
+                gmlWritePoints(stream, &(shape->line[k]), ' ');
                 msIO_fprintf(stream, "</gml:posList>\n");
 
                 msIO_fprintf(stream, "%s          </gml:LinearRing>\n", tab);
@@ -1336,6 +1343,172 @@ void msAxisSwapShape(shapeObj *shape)
     shape->bounds.maxy = tmp;
   }
 }
+#ifdef USE_WFS_SVR
+/*
+** Per layer state used while writing the features of a WFS layer.
+*/
+typedef struct {
+  layerObj *lp;
+  char *layerName;
+  char *namespace_prefix;
+  int featureIdIndex;
+  gmlItemListObj *itemList;
+  gmlConstantListObj *constantList;
+  gmlGroupListObj *groupList;
+  gmlGeometryListObj *geometryList;
+} gmlWFSLayerInfo;
+
+static int gmlWFSLayerInfoInit(FILE *stream, layerObj *lp, char *default_namespace_prefix, gmlWFSLayerInfo *info)
+{
+  const char *value;
+  int j;
+
+  memset(info, 0, sizeof(gmlWFSLayerInfo));
+  info->featureIdIndex = -1; /* no feature id */
+
+  /* setup namespace, a layer can override the default */
+  info->namespace_prefix = (char*) msOWSLookupMetadata(&(lp->metadata), "OFG", "namespace_prefix");
+  if(!info->namespace_prefix) info->namespace_prefix = default_namespace_prefix;
+
+  value = msOWSLookupMetadata(&(lp->metadata), "OFG", "featureid");
+  if(value) { /* find the featureid amongst the items for this layer */
+    for(j=0; j<lp->numitems; j++) {
+      if(strcasecmp(lp->items[j], value) == 0) { /* found it */
+        info->featureIdIndex = j;
+        break;
+      }
+    }
+
+    /* Produce a warning if a featureid was set but the corresponding item is not found. */
+    if (info->featureIdIndex == -1)
+      msIO_fprintf(stream, "<!-- WARNING: FeatureId item '%s' not found in typename '%s'. -->\n", value, lp->name);
+  }
+
+  /* populate item and group metadata structures */
+  info->itemList = msGMLGetItems(lp, "G");
+  info->constantList = msGMLGetConstants(lp, "G");
+  info->groupList = msGMLGetGroups(lp, "G");
+  info->geometryList = msGMLGetGeometries(lp, "GFO");
+  if (info->itemList == NULL || info->constantList == NULL || info->groupList == NULL || info->geometryList == NULL) {
+    msSetError(MS_MISCERR, "Unable to populate item and group metadata structures", "msGMLWriteWFSQuery()");
+    return MS_FAILURE;
+  }
+
+  if (info->namespace_prefix) {
+    info->layerName = (char *) msSmallMalloc(strlen(info->namespace_prefix)+strlen(lp->name)+2);
+    sprintf(info->layerName, "%s:%s", info->namespace_prefix, lp->name);
+  } else {
+    info->layerName = msStrdup(lp->name);
+  }
+
+  info->lp = lp;
+
+  return MS_SUCCESS;
+}
+
+static void gmlWFSLayerInfoFree(gmlWFSLayerInfo *info)
+{
+  msFree(info->layerName);
+
+  if(info->groupList) msGMLFreeGroups(info->groupList);
+  if(info->constantList) msGMLFreeConstants(info->constantList);
+  if(info->itemList) msGMLFreeItems(info->itemList);
+  if(info->geometryList) msGMLFreeGeometries(info->geometryList);
+
+  memset(info, 0, sizeof(gmlWFSLayerInfo));
+}
+
+/*
+** Write one feature member, the shape must already be in the map projection.
+*/
+static void gmlWriteWFSFeature(FILE *stream, mapObj *map, gmlWFSLayerInfo *info, shapeObj *shape, int outputformat, int bSwapAxis)
+{
+  int k;
+  layerObj *lp = info->lp;
+  gmlItemObj *item=NULL;
+  gmlConstantObj *constant=NULL;
+#ifdef USE_PROJ
+  const char *srsMap = NULL;
+#endif
+
+  /*
+  ** start this feature
+  */
+  msIO_fprintf(stream, "    <gml:featureMember>\n");
+  if(msIsXMLTagValid(info->layerName) == MS_FALSE)
+    msIO_fprintf(stream, "<!-- WARNING: The value '%s' is not valid in a XML tag context. -->\n", info->layerName);
+  if(info->featureIdIndex != -1) {
+    if(outputformat == OWS_GML2)
+      msIO_fprintf(stream, "      <%s fid=\"%s.%s\">\n", info->layerName, lp->name, shape->values[info->featureIdIndex]);
+    else  /* OWS_GML3 */
+      msIO_fprintf(stream, "      <%s gml:id=\"%s.%s\">\n", info->layerName, lp->name, shape->values[info->featureIdIndex]);
+  } else
+    msIO_fprintf(stream, "      <%s>\n", info->layerName);
+
+  if (bSwapAxis)
+    msAxisSwapShape(shape);
+
+  /* write the feature geometry and bounding box */
+  if(!(info->geometryList && info->geometryList->numgeometries == 1 && strcasecmp(info->geometryList->geometries[0].name, "none") == 0)) {
+#ifdef USE_PROJ
+    srsMap = msOWSGetEPSGProj(&(map->projection), NULL, "FGO", MS_TRUE);
+    if (!srsMap)
+      msOWSGetEPSGProj(&(map->projection), &(map->web.metadata), "FGO", MS_TRUE);
+    if(srsMap) { /* use the map projection first*/
+      gmlWriteBounds(stream, outputformat, &(shape->bounds), srsMap, "        ");
+      gmlWriteGeometry(stream, info->geometryList, outputformat, shape, srsMap, info->namespace_prefix, "        ");
+    } else { /* then use the layer projection and/or metadata */
+      gmlWriteBounds(stream, outputformat, &(shape->bounds), msOWSGetEPSGProj(&(lp->projection), &(lp->metadata), "FGO", MS_TRUE), "        ");
+      gmlWriteGeometry(stream, info->geometryList, outputformat, shape, msOWSGetEPSGProj(&(lp->projection), &(lp->metadata), "FGO", MS_TRUE), info->namespace_prefix, "        ");
+    }
+#else
+    gmlWriteBounds(stream, outputformat, &(shape->bounds), NULL, "        "); /* no projection information */
+    gmlWriteGeometry(stream, info->geometryList, outputformat, shape, NULL, info->namespace_prefix, "        ");
+#endif
+  }
+
+  /* write any item/values */
+  for(k=0; k<info->itemList->numitems; k++) {
+    item = &(info->itemList->items[k]);
+    if(msItemInGroups(item->name, info->groupList) == MS_FALSE)
+      msGMLWriteItem(stream, item, shape->values[k], info->namespace_prefix, "        ");
+  }
+
+  /* write any constants */
+  for(k=0; k<info->constantList->numconstants; k++) {
+    constant = &(info->constantList->constants[k]);
+    if(msItemInGroups(constant->name, info->groupList) == MS_FALSE)
+      msGMLWriteConstant(stream, constant, info->namespace_prefix, "        ");
+  }
+
+  /* write any groups */
+  for(k=0; k<info->groupList->numgroups; k++)
+    msGMLWriteGroup(stream, &(info->groupList->groups[k]), shape, info->itemList, info->constantList, info->namespace_prefix, "        ");
+
+  /* end this feature */
+  msIO_fprintf(stream, "      </%s>\n", info->layerName);
+  msIO_fprintf(stream, "    </gml:featureMember>\n");
+}
+
+/*
+** Is the map projection set to be north-east?
+*/
+static int gmlMapSwapAxis(mapObj *map)
+{
+  const char *axis = NULL;
+  int i;
+
+  for( i = 0; i < map->projection.numargs; i++ ) {
+    if( strstr(map->projection.args[i],"epsgaxis=") != NULL ) {
+      axis = strstr(map->projection.args[i],"=") + 1;
+      break;
+    }
+  }
+
+  return (axis && strcasecmp(axis,"ne") == 0) ? MS_TRUE : MS_FALSE;
+}
+#endif /* USE_WFS_SVR */
+
 /*
 ** msGMLWriteWFSQuery()
 **
@@ -1345,37 +1518,20 @@ int msGMLWriteWFSQuery(mapObj *map, FILE *stream, char *default_namespace_prefix
 {
 #ifdef USE_WFS_SVR
   int status;
-  int i,j,k;
+  int i,j;
   layerObj *lp=NULL;
   shapeObj shape;
   rectObj  resultBounds = {-1.0,-1.0,-1.0,-1.0};
-  int features = 0;
+  gmlWFSLayerInfo info;
 
-  gmlGroupListObj *groupList=NULL;
-  gmlItemListObj *itemList=NULL;
-  gmlConstantListObj *constantList=NULL;
-  gmlGeometryListObj *geometryList=NULL;
-  gmlItemObj *item=NULL;
-  gmlConstantObj *constant=NULL;
-
-  char *namespace_prefix=NULL;
-  const char *axis = NULL;
-  int bSwapAxis = 0;
+  int bSwapAxis;
   double tmp;
   const char *srsMap =  NULL;
 
   msInitShape(&shape);
 
   /*add a check to see if the map projection is set to be north-east*/
-  for( i = 0; i < map->projection.numargs; i++ ) {
-    if( strstr(map->projection.args[i],"epsgaxis=") != NULL ) {
-      axis = strstr(map->projection.args[i],"=") + 1;
-      break;
-    }
-  }
-
-  if (axis && strcasecmp(axis,"ne") == 0 )
-    bSwapAxis = 1;
+  bSwapAxis = gmlMapSwapAxis(map);
 
 
   /* Need to start with BBOX of the whole resultset */
@@ -1402,52 +1558,19 @@ int msGMLWriteWFSQuery(mapObj *map, FILE *stream, char *default_namespace_prefix
     lp = GET_LAYER(map, map->layerorder[i]);
 
     if(lp->resultcache && lp->resultcache->numresults > 0)  { /* found results */
-      char *layerName;
-      const char *value;
-      int featureIdIndex=-1; /* no feature id */
-
-
-      /* setup namespace, a layer can override the default */
-      namespace_prefix = (char*) msOWSLookupMetadata(&(lp->metadata), "OFG", "namespace_prefix");
-      if(!namespace_prefix) namespace_prefix = default_namespace_prefix;
-
-      value = msOWSLookupMetadata(&(lp->metadata), "OFG", "featureid");
-      if(value) { /* find the featureid amongst the items for this layer */
-        for(j=0; j<lp->numitems; j++) {
-          if(strcasecmp(lp->items[j], value) == 0) { /* found it */
-            featureIdIndex = j;
-            break;
-          }
-        }
 
-        /* Produce a warning if a featureid was set but the corresponding item is not found. */
-        if (featureIdIndex == -1)
-          msIO_fprintf(stream, "<!-- WARNING: FeatureId item '%s' not found in typename '%s'. -->\n", value, lp->name);
-      }
-
-      /* populate item and group metadata structures */
-      itemList = msGMLGetItems(lp, "G");
-      constantList = msGMLGetConstants(lp, "G");
-      groupList = msGMLGetGroups(lp, "G");
-      geometryList = msGMLGetGeometries(lp, "GFO");
-      if (itemList == NULL || constantList == NULL || groupList == NULL || geometryList == NULL) {
-        msSetError(MS_MISCERR, "Unable to populate item and group metadata structures", "msGMLWriteWFSQuery()");
+      if(gmlWFSLayerInfoInit(stream, lp, default_namespace_prefix, &info) != MS_SUCCESS) {
+        gmlWFSLayerInfoFree(&info);
         return MS_FAILURE;
       }
 
-
-      if (namespace_prefix) {
-        layerName = (char *) msSmallMalloc(strlen(namespace_prefix)+strlen(lp->name)+2);
-        sprintf(layerName, "%s:%s", namespace_prefix, lp->name);
-      } else {
-        layerName = msStrdup(lp->name);
-      }
-
       for(j=0; j<lp->resultcache->numresults; j++) {
 
         status = msLayerGetShape(lp, &shape, &(lp->resultcache->results[j]));
-        if(status != MS_SUCCESS)
+        if(status != MS_SUCCESS) {
+          gmlWFSLayerInfoFree(&info);
           return(status);
+        }
 
 #ifdef USE_PROJ
         /* project the shape into the map projection (if necessary), note that this projects the bounds as well */
@@ -1455,76 +1578,13 @@ int msGMLWriteWFSQuery(mapObj *map, FILE *stream, char *default_namespace_prefix
           msProjectShape(&lp->projection, &map->projection, &shape);
 #endif
 
-        /*
-        ** start this feature
-        */
-        msIO_fprintf(stream, "    <gml:featureMember>\n");
-        if(msIsXMLTagValid(layerName) == MS_FALSE)
-          msIO_fprintf(stream, "<!-- WARNING: The value '%s' is not valid in a XML tag context. -->\n", layerName);
-        if(featureIdIndex != -1) {
-          if(outputformat == OWS_GML2)
-            msIO_fprintf(stream, "      <%s fid=\"%s.%s\">\n", layerName, lp->name, shape.values[featureIdIndex]);
-          else  /* OWS_GML3 */
-            msIO_fprintf(stream, "      <%s gml:id=\"%s.%s\">\n", layerName, lp->name, shape.values[featureIdIndex]);
-        } else
-          msIO_fprintf(stream, "      <%s>\n", layerName);
-
-        if (bSwapAxis)
-          msAxisSwapShape(&shape);
-
-        /* write the feature geometry and bounding box */
-        if(!(geometryList && geometryList->numgeometries == 1 && strcasecmp(geometryList->geometries[0].name, "none") == 0)) {
-#ifdef USE_PROJ
-          srsMap = msOWSGetEPSGProj(&(map->projection), NULL, "FGO", MS_TRUE);
-          if (!srsMap)
-            msOWSGetEPSGProj(&(map->projection), &(map->web.metadata), "FGO", MS_TRUE);
-          if(srsMap) { /* use the map projection first*/
-            gmlWriteBounds(stream, outputformat, &(shape.bounds), srsMap, "        ");
-            gmlWriteGeometry(stream, geometryList, outputformat, &(shape), srsMap, namespace_prefix, "        ");
-          } else { /* then use the layer projection and/or metadata */
-            gmlWriteBounds(stream, outputformat, &(shape.bounds), msOWSGetEPSGProj(&(lp->projection), &(lp->metadata), "FGO", MS_TRUE), "        ");
-            gmlWriteGeometry(stream, geometryList, outputformat, &(shape), msOWSGetEPSGProj(&(lp->projection), &(lp->metadata), "FGO", MS_TRUE), namespace_prefix, "        ");
-          }
-#else
-          gmlWriteBounds(stream, outputformat, &(shape.bounds), NULL, "        "); /* no projection information */
-          gmlWriteGeometry(stream, geometryList, outputformat, &(shape), NULL, namespace_prefix, "        ");
-#endif
-        }
-
-        /* write any item/values */
-        for(k=0; k<itemList->numitems; k++) {
-          item = &(itemList->items[k]);
-          if(msItemInGroups(item->name, groupList) == MS_FALSE)
-            msGMLWriteItem(stream, item, shape.values[k], namespace_prefix, "        ");
-        }
-
-        /* write any constants */
-        for(k=0; k<constantList->numconstants; k++) {
-          constant = &(constantList->constants[k]);
-          if(msItemInGroups(constant->name, groupList) == MS_FALSE)
-            msGMLWriteConstant(stream, constant, namespace_prefix, "        ");
-        }
-
-        /* write any groups */
-        for(k=0; k<groupList->numgroups; k++)
-          msGMLWriteGroup(stream, &(groupList->groups[k]), &shape, itemList, constantList, namespace_prefix, "        ");
-
-        /* end this feature */
-        msIO_fprintf(stream, "      </%s>\n", layerName);
-        msIO_fprintf(stream, "    </gml:featureMember>\n");
+        gmlWriteWFSFeature(stream, map, &info, &shape, outputformat, bSwapAxis);
 
         msFreeShape(&shape); /* init too */
-
-        features++;
       }
 
       /* done with this layer, do a little clean-up */
-      msFree(layerName);
-
-      msGMLFreeGroups(groupList);
-      msGMLFreeConstants(constantList);
-      msGMLFreeItems(itemList);
-      msGMLFreeGeometries(geometryList);
+      gmlWFSLayerInfoFree(&info);
 
       /* msLayerClose(lp); */
     }
@@ -1539,6 +1599,69 @@ int msGMLWriteWFSQuery(mapObj *map, FILE *stream, char *default_namespace_prefix
 #endif /* USE_WFS_SVR */
 }
 
+#ifdef USE_WFS_SVR
+typedef struct {
+  mapObj *map;
+  FILE *stream;
+  char *default_namespace_prefix;
+  int outputformat;
+  int bSwapAxis;
+  int features;
+  gmlWFSLayerInfo info;
+} gmlWFSStreamInfo;
+
+static int gmlWFSStreamShape(void *cbData, layerObj *lp, shapeObj *shape)
+{
+  gmlWFSStreamInfo *psStream = (gmlWFSStreamInfo *) cbData;
+
+  if(psStream->info.lp != lp) { /* first feature of a layer */
+    gmlWFSLayerInfoFree(&(psStream->info));
+    if(gmlWFSLayerInfoInit(psStream->stream, lp, psStream->default_namespace_prefix, &(psStream->info)) != MS_SUCCESS)
+      return MS_FAILURE;
+  }
+
+  gmlWriteWFSFeature(psStream->stream, psStream->map, &(psStream->info), shape, psStream->outputformat, psStream->bSwapAxis);
+  psStream->features++;
+
+  return MS_SUCCESS;
+}
+#endif /* USE_WFS_SVR */
+
+/*
+** msGMLWriteWFSQueryStream()
+**
+** Runs the rect query set up in map->query and writes each matching feature
+** as it is read, without going through the layer result caches. Unlike
+** msGMLWriteWFSQuery() no collection level bounding box is written since it
+** is not known until the last feature. The number of features written is
+** added to *pnFeatures. Returns the msQueryByRect() status, so MS_FAILURE
+** with an MS_NOTFOUND error when nothing matched.
+*/
+int msGMLWriteWFSQueryStream(mapObj *map, FILE *stream, char *default_namespace_prefix, int outputformat, int *pnFeatures)
+{
+#ifdef USE_WFS_SVR
+  gmlWFSStreamInfo sStream;
+  int status;
+
+  memset(&sStream, 0, sizeof(sStream));
+  sStream.map = map;
+  sStream.stream = stream;
+  sStream.default_namespace_prefix = default_namespace_prefix;
+  sStream.outputformat = outputformat;
+  sStream.bSwapAxis = gmlMapSwapAxis(map);
+
+  status = msQueryByRectStream(map, gmlWFSStreamShape, &sStream);
+
+  gmlWFSLayerInfoFree(&(sStream.info));
+  *pnFeatures += sStream.features;
+
+  return status;
+#else /* Stub for mapscript */
+  msSetError(MS_MISCERR, "WFS server support not enabled", "msGMLWriteWFSQueryStream()");
+  return MS_FAILURE;
+#endif /* USE_WFS_SVR */
+}
+
 
 #ifdef USE_LIBXML2
 
@@ -274,6 +274,103 @@ int msIO_contextWrite( msIOContext *context, const void *data, int byteCount )
                                    byteCount );
 }
 
+/* ==================================================================== */
+/* ==================================================================== */
+/*      Write buffer, batching many small writes into one per           */
+/*      MS_IO_WRITEBUFFER_SIZE bytes.                                   */
+/* ==================================================================== */
+/* ==================================================================== */
+
+/************************************************************************/
+/*                         msIO_writeBufferInit()                       */
+/*                                                                      */
+/*      The IO context of fp is looked up once here rather than on      */
+/*      every write.                                                    */
+/************************************************************************/
+
+void msIO_writeBufferInit( msIOWriteBuffer *wb, FILE *fp )
+
+{
+  wb->fp = fp;
+  wb->context = msIO_getHandler( fp );
+  wb->used = 0;
+}
+
+/************************************************************************/
+/*                        msIO_writeBufferFlush()                       */
+/************************************************************************/
+
+int msIO_writeBufferFlush( msIOWriteBuffer *wb )
+
+{
+  int ret_val = 0;
+
+  if( wb->used > 0 ) {
+    if( wb->context == NULL )
+      ret_val = fwrite( wb->data, 1, wb->used, wb->fp );
+    else
+      ret_val = msIO_contextWrite( wb->context, wb->data, wb->used );
+  }
+  wb->used = 0;
+
+  return ret_val;
+}
+
+/************************************************************************/
+/*                        msIO_writeBufferAppend()                      */
+/************************************************************************/
+
+int msIO_writeBufferAppend( msIOWriteBuffer *wb, const char *data, int byteCount )
+
+{
+  if( byteCount < 0 )
+    byteCount = strlen( data );
+
+  if( wb->used + byteCount > MS_IO_WRITEBUFFER_SIZE )
+    msIO_writeBufferFlush( wb );
+
+  if( byteCount > MS_IO_WRITEBUFFER_SIZE ) { /* won't fit anyway */
+    if( wb->context == NULL )
+      return fwrite( data, 1, byteCount, wb->fp );
+    return msIO_contextWrite( wb->context, data, byteCount );
+  }
+
+  memcpy( wb->data + wb->used, data, byteCount );
+  wb->used += byteCount;
+
+  return byteCount;
+}
+
+/************************************************************************/
+/*                    msIO_writeBufferAppendDouble()                    */
+/*                                                                      */
+/*      Same output as "%.*f".                                          */
+/************************************************************************/
+
+int msIO_writeBufferAppendDouble( msIOWriteBuffer *wb, double value, int precision )
+
+{
+  char largeBuf[512];
+  int len;
+
+  if( MS_IO_WRITEBUFFER_SIZE - wb->used < 64 )
+    msIO_writeBufferFlush( wb );
+
+  len = msFormatDoubleFixed( wb->data + wb->used, MS_IO_WRITEBUFFER_SIZE - wb->used,
+                             value, precision );
+  if( len >= 0 && len < MS_IO_WRITEBUFFER_SIZE - wb->used ) {
+    wb->used += len;
+    return len;
+  }
+
+  /* very large values in %f notation */
+  len = snprintf( largeBuf, sizeof(largeBuf), "%.*f", precision, value );
+  if( len < 0 || len >= (int) sizeof(largeBuf) )
+    return -1;
+
+  return msIO_writeBufferAppend( wb, largeBuf, len );
+}
+
 /* ==================================================================== */
 /* ==================================================================== */
 /*      Stdio-like cover functions.                                     */
@@ -81,6 +81,25 @@ extern "C" {
   int msIO_contextRead( msIOContext *context, void *data, int byteCount );
   int msIO_contextWrite( msIOContext *context, const void *data, int byteCount );
 
+  /*
+  ** Buffered writing for output made of many small pieces, such as the
+  ** coordinates of a geometry. Call msIO_writeBufferFlush() when done.
+  */
+
+#define MS_IO_WRITEBUFFER_SIZE 16384
+
+  typedef struct {
+    FILE          *fp;
+    msIOContext   *context;
+    int            used;
+    char           data[MS_IO_WRITEBUFFER_SIZE];
+  } msIOWriteBuffer;
+
+  void MS_DLL_EXPORT msIO_writeBufferInit( msIOWriteBuffer *wb, FILE *fp );
+  int MS_DLL_EXPORT msIO_writeBufferAppend( msIOWriteBuffer *wb, const char *data, int byteCount );
+  int MS_DLL_EXPORT msIO_writeBufferAppendDouble( msIOWriteBuffer *wb, double value, int precision );
+  int MS_DLL_EXPORT msIO_writeBufferFlush( msIOWriteBuffer *wb );
+
   /*
   ** For redirecting IO to a memory buffer.
   */
@@ -28,6 +28,10 @@
  ****************************************************************************/
 
 #include "mapserver.h"
+#include "mapthread.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
 
 
 
@@ -154,6 +158,313 @@ int msJoinClose(joinObj *join)
   return MS_FAILURE;
 }
 
+/*  */
+/* Join table cache, shared by the XBASE and CSV joins */
+/*  */
+
+/*
+** File based join tables are indexed on the "to" column the first time
+** they are joined, and the index is kept for the life of the process so
+** that each msJoinPrepare()/msJoinNext() is a hash lookup instead of a
+** scan of the whole table.  Entries are keyed by path, join column and
+** file modification time; a stale entry is replaced (and freed once the
+** last join using it is closed).  CSV tables are loaded in memory once as
+** well.  The cache is protected by TLOCK_JOIN, entries are read-only once
+** built.
+*/
+typedef struct joinTableObj {
+  char *path;
+  time_t mtime;
+  int connectiontype;
+  int toindex;
+
+  int refcount;
+  int stale;
+
+  /* CSV only: the whole table */
+  char ***rows;
+  int *rowsizes;
+  int numitems;
+
+  /* the index: records with the same key hash are chained in ascending order */
+  int numrecords;
+  char **keys;
+  int numbuckets;
+  int *buckets;
+  int *nextrecord;
+
+  struct joinTableObj *next;
+} joinTableObj;
+
+static joinTableObj *joinTables = NULL;
+
+static unsigned msJoinTableHash(const char *key, int numbuckets)
+{
+  unsigned hashval;
+
+  for(hashval=0; *key != '\0'; key++)
+    hashval = *key + 31 * hashval;
+
+  return hashval % numbuckets;
+}
+
+/* Follow the hash chain from record until a key matches, -1 if none. */
+static int msJoinTableFind(joinTableObj *table, const char *target, int record)
+{
+  for(; record >= 0; record = table->nextrecord[record]) {
+    if(table->keys[record] && strcmp(target, table->keys[record]) == 0)
+      return record;
+  }
+
+  return -1;
+}
+
+static int msJoinTableFirst(joinTableObj *table, const char *target)
+{
+  if(table->numrecords == 0) return -1;
+  return msJoinTableFind(table, target, table->buckets[msJoinTableHash(target, table->numbuckets)]);
+}
+
+static int msJoinTableBuildIndex(joinTableObj *table)
+{
+  int i;
+
+  table->numbuckets = table->numrecords + 1;
+  table->buckets = (int *) malloc(sizeof(int)*table->numbuckets);
+  table->nextrecord = (int *) malloc(sizeof(int)*(table->numrecords + 1));
+  if(!table->buckets || !table->nextrecord) {
+    msSetError(MS_MEMERR, "Error allocating join index.", "msJoinTableBuildIndex()");
+    return MS_FAILURE;
+  }
+
+  for(i=0; i<table->numbuckets; i++)
+    table->buckets[i] = -1;
+
+  /* walk backwards so that chains end up in record order */
+  for(i=table->numrecords-1; i>=0; i--) {
+    unsigned hashval;
+    if(!table->keys[i]) {
+      table->nextrecord[i] = -1;
+      continue;
+    }
+    hashval = msJoinTableHash(table->keys[i], table->numbuckets);
+    table->nextrecord[i] = table->buckets[hashval];
+    table->buckets[hashval] = i;
+  }
+
+  return MS_SUCCESS;
+}
+
+static void msJoinTableFree(joinTableObj *table)
+{
+  int i;
+
+  if(table->rows) { /* CSV keys point into the rows */
+    for(i=0; i<table->numrecords; i++)
+      msFreeCharArray(table->rows[i], table->rowsizes[i]);
+    free(table->rows);
+    free(table->rowsizes);
+  } else if(table->keys) {
+    for(i=0; i<table->numrecords; i++)
+      msFree(table->keys[i]);
+  }
+  msFree(table->keys);
+  msFree(table->buckets);
+  msFree(table->nextrecord);
+  msFree(table->path);
+  free(table);
+}
+
+static joinTableObj *msJoinTableCreate(const char *path, time_t mtime, int connectiontype, int toindex)
+{
+  joinTableObj *table = (joinTableObj *) calloc(1, sizeof(joinTableObj));
+
+  if(!table) {
+    msSetError(MS_MEMERR, "Error allocating join table.", "msJoinTableCreate()");
+    return NULL;
+  }
+  table->path = msStrdup(path);
+  table->mtime = mtime;
+  table->connectiontype = connectiontype;
+  table->toindex = toindex;
+
+  return table;
+}
+
+static joinTableObj *msDBFJoinTableLoad(DBFHandle hDBF, const char *path, time_t mtime, int toindex)
+{
+  int i;
+  joinTableObj *table = msJoinTableCreate(path, mtime, MS_DB_XBASE, toindex);
+
+  if(!table) return NULL;
+
+  table->numrecords = msDBFGetRecordCount(hDBF);
+  table->keys = (char **) calloc(table->numrecords + 1, sizeof(char *));
+  if(!table->keys) {
+    msSetError(MS_MEMERR, "Error allocating join keys.", "msDBFJoinTableLoad()");
+    msJoinTableFree(table);
+    return NULL;
+  }
+  for(i=0; i<table->numrecords; i++)
+    table->keys[i] = msStrdup(msDBFReadStringAttribute(hDBF, i, toindex));
+
+  if(msJoinTableBuildIndex(table) != MS_SUCCESS) {
+    msJoinTableFree(table);
+    return NULL;
+  }
+
+  return table;
+}
+
+static joinTableObj *msCSVJoinTableLoad(FILE *stream, const char *path, time_t mtime, int toindex)
+{
+  int i;
+  char buffer[MS_BUFFER_LENGTH];
+  joinTableObj *table = msJoinTableCreate(path, mtime, MS_DB_CSV, toindex);
+
+  if(!table) return NULL;
+
+  /* once through to get the number of rows */
+  while(fgets(buffer, MS_BUFFER_LENGTH, stream) != NULL) table->numrecords++;
+  rewind(stream);
+
+  table->rows = (char ***) calloc(table->numrecords + 1, sizeof(char **));
+  table->rowsizes = (int *) calloc(table->numrecords + 1, sizeof(int));
+  table->keys = (char **) calloc(table->numrecords + 1, sizeof(char *));
+  if(!table->rows || !table->rowsizes || !table->keys) {
+    msSetError(MS_MEMERR, "Error allocating rows.", "msCSVJoinTableLoad()");
+    msJoinTableFree(table);
+    return NULL;
+  }
+
+  /* load the rows */
+  i = 0;
+  while(i < table->numrecords && fgets(buffer, MS_BUFFER_LENGTH, stream) != NULL) {
+    msStringTrimEOL(buffer);
+    table->rows[i] = msStringSplitComplex(buffer, ",", &(table->rowsizes[i]), MS_ALLOWEMPTYTOKENS);
+    table->numitems = table->rowsizes[i];
+    if(toindex < table->rowsizes[i])
+      table->keys[i] = table->rows[i][toindex];
+    i++;
+  }
+  table->numrecords = i;
+
+  if(msJoinTableBuildIndex(table) != MS_SUCCESS) {
+    msJoinTableFree(table);
+    return NULL;
+  }
+
+  return table;
+}
+
+/*
+** Return a cached table for path/toindex, if it's still current. The
+** reference count is incremented.
+*/
+static joinTableObj *msJoinTableAcquire(const char *path, int connectiontype, int toindex, time_t *mtime)
+{
+  struct stat stat_buf;
+  joinTableObj **link, *table = NULL;
+
+  *mtime = 0;
+  if(stat(path, &stat_buf) == 0)
+    *mtime = stat_buf.st_mtime;
+
+  msAcquireLock(TLOCK_JOIN);
+  link = &joinTables;
+  while(*link != NULL) {
+    joinTableObj *candidate = *link;
+    if(!candidate->stale && candidate->connectiontype == connectiontype && candidate->toindex == toindex
+        && strcmp(candidate->path, path) == 0) {
+      if(candidate->mtime == *mtime) {
+        candidate->refcount++;
+        table = candidate;
+        break;
+      }
+
+      /* file changed, drop the entry now or once the last join using it is closed */
+      candidate->stale = MS_TRUE;
+      if(candidate->refcount == 0) {
+        *link = candidate->next;
+        msJoinTableFree(candidate);
+        continue;
+      }
+    }
+    link = &(candidate->next);
+  }
+  msReleaseLock(TLOCK_JOIN);
+
+  return table;
+}
+
+/*
+** Add a freshly loaded table to the cache, unless another thread beat us
+** to it, in which case the new one is discarded. The returned table is
+** referenced.
+*/
+static joinTableObj *msJoinTableAdd(joinTableObj *newtable)
+{
+  joinTableObj *table;
+
+  msAcquireLock(TLOCK_JOIN);
+  for(table=joinTables; table!=NULL; table=table->next) {
+    if(!table->stale && table->connectiontype == newtable->connectiontype && table->toindex == newtable->toindex
+        && table->mtime == newtable->mtime && strcmp(table->path, newtable->path) == 0)
+      break;
+  }
+  if(table) {
+    msJoinTableFree(newtable);
+  } else {
+    table = newtable;
+    table->next = joinTables;
+    joinTables = table;
+  }
+  table->refcount++;
+  msReleaseLock(TLOCK_JOIN);
+
+  return table;
+}
+
+static void msJoinTableRelease(joinTableObj *table)
+{
+  joinTableObj **link;
+
+  msAcquireLock(TLOCK_JOIN);
+  table->refcount--;
+  if(table->stale && table->refcount == 0) {
+    for(link=&joinTables; *link!=NULL; link=&((*link)->next)) {
+      if(*link == table) {
+        *link = table->next;
+        break;
+      }
+    }
+    msJoinTableFree(table);
+  }
+  msReleaseLock(TLOCK_JOIN);
+}
+
+/*
+** Free all unreferenced cached join tables, called from msCleanup().
+*/
+void msJoinCleanup()
+{
+  joinTableObj **link;
+
+  msAcquireLock(TLOCK_JOIN);
+  link = &joinTables;
+  while(*link != NULL) {
+    joinTableObj *table = *link;
+    if(table->refcount == 0) {
+      *link = table->next;
+      msJoinTableFree(table);
+    } else {
+      table->stale = MS_TRUE;
+      link = &(table->next);
+    }
+  }
+  msReleaseLock(TLOCK_JOIN);
+}
+
 /*  */
 /* XBASE join functions */
 /*  */
@@ -162,12 +473,14 @@ typedef struct {
   int fromindex, toindex;
   char *target;
   int nextrecord;
+  joinTableObj *table;
 } msDBFJoinInfo;
 
 int msDBFJoinConnect(layerObj *layer, joinObj *join)
 {
   int i;
   char szPath[MS_MAXPATHLEN];
+  time_t mtime;
   msDBFJoinInfo *joininfo;
 
   if(join->joininfo) return(MS_SUCCESS); /* already open */
@@ -185,7 +498,8 @@ int msDBFJoinConnect(layerObj *layer, joinObj *join)
 
   /* initialize any members that won't get set later on in this function */
   joininfo->target = NULL;
-  joininfo->nextrecord = 0;
+  joininfo->nextrecord = -1;
+  joininfo->table = NULL;
 
   join->joininfo = joininfo;
 
@@ -203,6 +517,13 @@ int msDBFJoinConnect(layerObj *layer, joinObj *join)
     return(MS_FAILURE);
   }
 
+  /* get the index on the "to" item, building it if necessary */
+  if((joininfo->table = msJoinTableAcquire(szPath, MS_DB_XBASE, joininfo->toindex, &mtime)) == NULL) {
+    joinTableObj *table = msDBFJoinTableLoad(joininfo->hDBF, szPath, mtime, joininfo->toindex);
+    if(!table) return(MS_FAILURE);
+    joininfo->table = msJoinTableAdd(table);
+  }
+
   /* get "from" item index   */
   for(i=0; i<layer->numitems; i++) {
     if(strcasecmp(layer->items[i],join->from) == 0) { /* found it */
@@ -243,17 +564,17 @@ int msDBFJoinPrepare(joinObj *join, shapeObj *shape)
     return(MS_FAILURE);
   }
 
-  joininfo->nextrecord = 0; /* starting with the first record */
-
   if(joininfo->target) free(joininfo->target); /* clear last target */
   joininfo->target = msStrdup(shape->values[joininfo->fromindex]);
 
+  joininfo->nextrecord = msJoinTableFirst(joininfo->table, joininfo->target); /* starting with the first match */
+
   return(MS_SUCCESS);
 }
 
 int msDBFJoinNext(joinObj *join)
 {
-  int i, n;
+  int i;
   msDBFJoinInfo *joininfo = join->joininfo;
 
   if(!joininfo) {
@@ -272,13 +593,9 @@ int msDBFJoinNext(joinObj *join)
     join->values = NULL;
   }
 
-  n = msDBFGetRecordCount(joininfo->hDBF);
+  i = joininfo->nextrecord; /* find a match */
 
-  for(i=joininfo->nextrecord; i<n; i++) { /* find a match */
-    if(strcmp(joininfo->target, msDBFReadStringAttribute(joininfo->hDBF, i, joininfo->toindex)) == 0) break;
-  }
-
-  if(i == n) { /* unable to do the join */
+  if(i < 0) { /* unable to do the join */
     if((join->values = (char **)malloc(sizeof(char *)*join->numitems)) == NULL) {
       msSetError(MS_MEMERR, NULL, "msDBFJoinNext()");
       return(MS_FAILURE);
@@ -286,14 +603,14 @@ int msDBFJoinNext(joinObj *join)
     for(i=0; i<join->numitems; i++)
       join->values[i] = msStrdup("\0"); /* intialize to zero length strings */
 
-    joininfo->nextrecord = n;
     return(MS_DONE);
   }
 
   if((join->values = msDBFGetValues(joininfo->hDBF,i)) == NULL)
     return(MS_FAILURE);
 
-  joininfo->nextrecord = i+1; /* so we know where to start looking next time through */
+  /* so we know where to start looking next time through */
+  joininfo->nextrecord = msJoinTableFind(joininfo->table, joininfo->target, joininfo->table->nextrecord[i]);
 
   return(MS_SUCCESS);
 }
@@ -305,6 +622,7 @@ int msDBFJoinClose(joinObj *join)
   if(!joininfo) return(MS_SUCCESS); /* already closed */
 
   if(joininfo->hDBF) msDBFClose(joininfo->hDBF);
+  if(joininfo->table) msJoinTableRelease(joininfo->table);
   if(joininfo->target) free(joininfo->target);
   free(joininfo);
   joininfo = NULL;
@@ -318,9 +636,8 @@ int msDBFJoinClose(joinObj *join)
 typedef struct {
   int fromindex, toindex;
   char *target;
-  char ***rows;
-  int numrows;
   int nextrow;
+  joinTableObj *table; /* cached rows and index */
 } msCSVJoinInfo;
 
 int msCSVJoinConnect(layerObj *layer, joinObj *join)
@@ -328,8 +645,8 @@ int msCSVJoinConnect(layerObj *layer, joinObj *join)
   int i;
   FILE *stream;
   char szPath[MS_MAXPATHLEN];
+  time_t mtime;
   msCSVJoinInfo *joininfo;
-  char buffer[MS_BUFFER_LENGTH];
 
   if(join->joininfo) return(MS_SUCCESS); /* already open */
   if ( msCheckParentPointer(layer->map,"map")==MS_FAILURE )
@@ -344,36 +661,39 @@ int msCSVJoinConnect(layerObj *layer, joinObj *join)
 
   /* initialize any members that won't get set later on in this function */
   joininfo->target = NULL;
-  joininfo->nextrow = 0;
+  joininfo->nextrow = -1;
+  joininfo->table = NULL;
 
   join->joininfo = joininfo;
 
-  /* open the CSV file */
-  if((stream = fopen( msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, join->table), "r" )) == NULL) {
-    if((stream = fopen( msBuildPath(szPath, layer->map->mappath, join->table), "r" )) == NULL) {
-      msSetError(MS_IOERR, "(%s)", "msCSVJoinConnect()", join->table);
-      return(MS_FAILURE);
-    }
+  /* get "to" index (for now the user tells us which column, 1..n) */
+  joininfo->toindex = atoi(join->to) - 1;
+  if(joininfo->toindex < 0) {
+    msSetError(MS_JOINERR, "Invalid column index %s.", "msCSVJoinConnect()", join->to);
+    return(MS_FAILURE);
   }
 
-  /* once through to get the number of rows */
-  joininfo->numrows = 0;
-  while(fgets(buffer, MS_BUFFER_LENGTH, stream) != NULL) joininfo->numrows++;
-  rewind(stream);
-
-  if((joininfo->rows = (char ***) malloc(joininfo->numrows*sizeof(char **))) == NULL) {
-    msSetError(MS_MEMERR, "Error allocating rows.", "msCSVJoinConnect()");
-    return(MS_FAILURE);
+  /* locate the CSV file */
+  msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, join->table);
+  if((joininfo->table = msJoinTableAcquire(szPath, MS_DB_CSV, joininfo->toindex, &mtime)) == NULL && mtime == 0) {
+    msBuildPath(szPath, layer->map->mappath, join->table);
+    joininfo->table = msJoinTableAcquire(szPath, MS_DB_CSV, joininfo->toindex, &mtime);
   }
 
-  /* load the rows */
-  i = 0;
-  while(fgets(buffer, MS_BUFFER_LENGTH, stream) != NULL) {
-    msStringTrimEOL(buffer);
-    joininfo->rows[i] = msStringSplitComplex(buffer, ",", &(join->numitems), MS_ALLOWEMPTYTOKENS);
-    i++;
+  /* load the rows, unless they are cached already */
+  if(!joininfo->table) {
+    joinTableObj *table;
+
+    if((stream = fopen(szPath, "r")) == NULL) {
+      msSetError(MS_IOERR, "(%s)", "msCSVJoinConnect()", join->table);
+      return(MS_FAILURE);
+    }
+    table = msCSVJoinTableLoad(stream, szPath, mtime, joininfo->toindex);
+    fclose(stream);
+    if(!table) return(MS_FAILURE);
+    joininfo->table = msJoinTableAdd(table);
   }
-  fclose(stream);
+  join->numitems = joininfo->table->numitems;
 
   /* get "from" item index   */
   for(i=0; i<layer->numitems; i++) {
@@ -388,9 +708,7 @@ int msCSVJoinConnect(layerObj *layer, joinObj *join)
     return(MS_FAILURE);
   }
 
-  /* get "to" index (for now the user tells us which column, 1..n) */
-  joininfo->toindex = atoi(join->to) - 1;
-  if(joininfo->toindex < 0 || joininfo->toindex > join->numitems) {
+  if(joininfo->toindex > join->numitems) {
     msSetError(MS_JOINERR, "Invalid column index %s.", "msCSVJoinConnect()", join->to);
     return(MS_FAILURE);
   }
@@ -427,11 +745,11 @@ int msCSVJoinPrepare(joinObj *join, shapeObj *shape)
     return(MS_FAILURE);
   }
 
-  joininfo->nextrow = 0; /* starting with the first record */
-
   if(joininfo->target) free(joininfo->target); /* clear last target */
   joininfo->target = msStrdup(shape->values[joininfo->fromindex]);
 
+  joininfo->nextrow = msJoinTableFirst(joininfo->table, joininfo->target); /* starting with the first match */
+
   return(MS_SUCCESS);
 }
 
@@ -451,41 +769,36 @@ int msCSVJoinNext(joinObj *join)
     join->values = NULL;
   }
 
-  for(i=joininfo->nextrow; i<joininfo->numrows; i++) { /* find a match     */
-    if(strcmp(joininfo->target, joininfo->rows[i][joininfo->toindex]) == 0) break;
-  }
+  i = joininfo->nextrow; /* find a match     */
 
   if((join->values = (char ** )malloc(sizeof(char *)*join->numitems)) == NULL) {
     msSetError(MS_MEMERR, NULL, "msCSVJoinNext()");
     return(MS_FAILURE);
   }
 
-  if(i == joininfo->numrows) { /* unable to do the join     */
+  if(i < 0) { /* unable to do the join     */
     for(j=0; j<join->numitems; j++)
       join->values[j] = msStrdup("\0"); /* intialize to zero length strings */
 
-    joininfo->nextrow = joininfo->numrows;
     return(MS_DONE);
   }
 
   for(j=0; j<join->numitems; j++)
-    join->values[j] = msStrdup(joininfo->rows[i][j]);
+    join->values[j] = msStrdup(j < joininfo->table->rowsizes[i] ? joininfo->table->rows[i][j] : "");
 
-  joininfo->nextrow = i+1; /* so we know where to start looking next time through */
+  /* so we know where to start looking next time through */
+  joininfo->nextrow = msJoinTableFind(joininfo->table, joininfo->target, joininfo->table->nextrecord[i]);
 
   return(MS_SUCCESS);
 }
 
 int msCSVJoinClose(joinObj *join)
 {
-  int i;
   msCSVJoinInfo *joininfo = join->joininfo;
 
   if(!joininfo) return(MS_SUCCESS); /* already closed */
 
-  for(i=0; i<joininfo->numrows; i++)
-    msFreeCharArray(joininfo->rows[i], join->numitems);
-  free(joininfo->rows);
+  if(joininfo->table) msJoinTableRelease(joininfo->table);
   if(joininfo->target) free(joininfo->target);
   free(joininfo);
   joininfo = NULL;
@@ -665,26 +665,40 @@ void KmlRenderer::renderPolygon(imageObj*, shapeObj *p, colorObj *color)
 
 void KmlRenderer::addCoordsNode(xmlNodePtr parentNode, pointObj *pts, int numPts)
 {
-  char lineBuf[128];
+  char lineBuf[1024]; /* room for three doubles of any magnitude in %.8f */
+  int len;
 
   xmlNodePtr coordsNode = xmlNewChild(parentNode, NULL, BAD_CAST "coordinates", NULL);
-  xmlNodeAddContent(coordsNode, BAD_CAST "\n");
+
+  /* collect the whole coordinate list first, adding content to the node piece by piece copies it every time */
+  xmlBufferPtr coordsBuf = xmlBufferCreate();
+  xmlBufferAdd(coordsBuf, BAD_CAST "\n", 1);
 
   for (int i=0; i<numPts; i++) {
+    lineBuf[0] = '\t';
+    len = 1;
+    len += msFormatDoubleFixed(lineBuf + len, sizeof(lineBuf) - len, pts[i].x, 8);
+    lineBuf[len++] = ',';
+    len += msFormatDoubleFixed(lineBuf + len, sizeof(lineBuf) - len, pts[i].y, 8);
     if( mElevationFromAttribute ) {
-      sprintf(lineBuf, "\t%.8f,%.8f,%.8f\n", pts[i].x, pts[i].y, mCurrentElevationValue);
+      lineBuf[len++] = ',';
+      len += msFormatDoubleFixed(lineBuf + len, sizeof(lineBuf) - len, mCurrentElevationValue, 8);
     } else if (AltitudeMode == relativeToGround || AltitudeMode == absolute) {
 #ifdef USE_POINT_Z_M
-      sprintf(lineBuf, "\t%.8f,%.8f,%.8f\n", pts[i].x, pts[i].y, pts[i].z);
+      lineBuf[len++] = ',';
+      len += msFormatDoubleFixed(lineBuf + len, sizeof(lineBuf) - len, pts[i].z, 8);
 #else
       msSetError(MS_MISCERR, "Z coordinates support not available  (mapserver not compiled with USE_POINT_Z_M option)", "KmlRenderer::addCoordsNode()");
 #endif
-    } else
-      sprintf(lineBuf, "\t%.8f,%.8f\n", pts[i].x, pts[i].y);
+    }
+    lineBuf[len++] = '\n';
 
-    xmlNodeAddContent(coordsNode, BAD_CAST lineBuf);
+    xmlBufferAdd(coordsBuf, BAD_CAST lineBuf, len);
   }
-  xmlNodeAddContent(coordsNode, BAD_CAST "\t");
+  xmlBufferAdd(coordsBuf, BAD_CAST "\t", 1);
+
+  xmlNodeAddContentLen(coordsNode, xmlBufferContent(coordsBuf), xmlBufferLength(coordsBuf));
+  xmlBufferFree(coordsBuf);
 }
 
 void KmlRenderer::renderGlyphs(imageObj*, double x, double y, labelStyleObj *style, char *text)
@@ -322,6 +322,11 @@ int msLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
   ** tagged on to the main attributes with the naming scheme [join name].[item name].
   */
 
+  /* the query may have kept a copy of the shape (already geomtransformed) */
+  rv = msResultCacheGetShape(layer, shape, record);
+  if(rv != MS_DONE)
+    return rv;
+
   rv = layer->vtable->LayerGetShape(layer, shape, record);
   
   /* RFC89 Apply Layer GeomTransform */
@@ -591,6 +596,623 @@ parse_error:
   return MS_FAILURE;
 }
 
+/*
+** Translation of tokenized MapServer expressions into SQL WHERE clauses so
+** that drivers can push FILTERs down to the datasource. Only a subset of the
+** expression language is supported: comparisons, logical operators, IN lists,
+** regular expressions that can be expressed as LIKE patterns and basic
+** arithmetic. Anything else makes the whole translation fail and the caller
+** is expected to evaluate the expression itself.
+**
+** The PostgreSQL translation replaces the expression, so it has to see the
+** values the way MapServer does: NULL attributes as empty strings (or 0),
+** hence the COALESCE around every attribute, which keeps <> and NOT right.
+** Numeric bindings are only translated for the columns the caller knows to
+** be numeric, comparing a text column with a number is left to MapServer.
+**
+** The OGR one is only used as a prefilter and has to select a superset of
+** the features: NOT, <> and regular expressions are not translated, and
+** each comparison also lets through the rows where one of its attributes
+** is NULL.
+*/
+
+#define MS_SQLEXP_BOOLEAN 1
+#define MS_SQLEXP_NUMBER  2
+#define MS_SQLEXP_STRING  3
+
+typedef struct {
+  tokenListNodeObjPtr node;
+  int dialect;
+  char **numericitems; /* PostgreSQL: the numeric columns */
+  int numnumericitems;
+  char *nulls; /* OGR: " OR x IS NULL" for the attributes of the current comparison */
+} sqlExpressionParserObj;
+
+static char *msSQLExpressionOr(sqlExpressionParserObj *parser, int *type);
+
+static int msSQLExpressionPeek(sqlExpressionParserObj *parser)
+{
+  return parser->node ? parser->node->token : 0;
+}
+
+static char *msSQLExpressionQuoteString(const char *value, int dialect)
+{
+  char *sql;
+  int i = 0;
+
+  sql = (char *) msSmallMalloc(strlen(value)*2 + 4);
+  if(dialect == MS_SQL_DIALECT_POSTGRESQL) sql[i++] = 'E'; /* independent of standard_conforming_strings */
+  sql[i++] = '\'';
+  for(; *value != '\0'; value++) {
+    if(*value == '\'' || (*value == '\\' && dialect == MS_SQL_DIALECT_POSTGRESQL))
+      sql[i++] = *value;
+    sql[i++] = *value;
+  }
+  sql[i++] = '\'';
+  sql[i] = '\0';
+
+  return sql;
+}
+
+static char *msSQLExpressionQuoteIdentifier(const char *item)
+{
+  char *sql = (char *) msSmallMalloc(strlen(item)*2 + 3);
+  int i = 0;
+
+  sql[i++] = '"';
+  for(; *item != '\0'; item++) {
+    if(*item == '"') sql[i++] = '"';
+    sql[i++] = *item;
+  }
+  sql[i++] = '"';
+  sql[i] = '\0';
+
+  return sql;
+}
+
+static char *msSQLExpressionNumber(double value)
+{
+  char buffer[64];
+
+  if(value < 0)
+    snprintf(buffer, sizeof(buffer), "(%.17g)", value);
+  else
+    snprintf(buffer, sizeof(buffer), "%.17g", value);
+
+  return msStrdup(buffer);
+}
+
+/*
+** Convert a regular expression into a LIKE pattern (using '!' as escape
+** character). Only patterns made of literal characters, '.', '.*' and the
+** '^'/'$' anchors can be converted, for anything else NULL is returned.
+*/
+static char *msSQLExpressionRegexToLike(const char *regex)
+{
+  char *like = (char *) msSmallMalloc(strlen(regex)*2 + 3);
+  const char *p = regex;
+  size_t len = strlen(regex);
+  int i = 0, anchored_end = MS_FALSE;
+
+  if(*p == '^')
+    p++;
+  else
+    like[i++] = '%';
+
+  if(len > 0 && regex[len-1] == '$' && (len < 2 || regex[len-2] != '\\')) {
+    anchored_end = MS_TRUE;
+    len--;
+  }
+
+  for(; p < regex + len; p++) {
+    if(*p == '.' && p+1 < regex + len && *(p+1) == '*') {
+      like[i++] = '%';
+      p++;
+    } else if(*p == '.') {
+      like[i++] = '_';
+    } else if(*p == '\\' && p+1 < regex + len && strchr(".[]()*+?{}|\\^$", *(p+1)) != NULL) {
+      p++;
+      like[i++] = *p;
+    } else if(strchr("[]()*+?{}|\\^$", *p) != NULL) {
+      free(like);
+      return NULL;
+    } else {
+      if(*p == '%' || *p == '_' || *p == '!') like[i++] = '!';
+      like[i++] = *p;
+    }
+  }
+
+  if(!anchored_end && (i == 0 || like[i-1] != '%'))
+    like[i++] = '%';
+  like[i] = '\0';
+
+  return like;
+}
+
+static char *msSQLExpressionEscapeLike(const char *value)
+{
+  char *like = (char *) msSmallMalloc(strlen(value)*2 + 1);
+  int i = 0;
+
+  for(; *value != '\0'; value++) {
+    if(*value == '%' || *value == '_' || *value == '!') like[i++] = '!';
+    like[i++] = *value;
+  }
+  like[i] = '\0';
+
+  return like;
+}
+
+static char *msSQLExpressionBinary(char *left, const char *op, char *right)
+{
+  char *sql = msStringConcatenate(msStrdup("("), left);
+  sql = msStringConcatenate(sql, op);
+  sql = msStringConcatenate(sql, right);
+  sql = msStringConcatenate(sql, ")");
+  free(left);
+  free(right);
+  return sql;
+}
+
+static void msSQLExpressionAddNull(sqlExpressionParserObj *parser, const char *identifier)
+{
+  if(parser->dialect != MS_SQL_DIALECT_OGR) return;
+  parser->nulls = msStringConcatenate(parser->nulls, " OR ");
+  parser->nulls = msStringConcatenate(parser->nulls, (char *) identifier);
+  parser->nulls = msStringConcatenate(parser->nulls, " IS NULL");
+}
+
+/* PostgreSQL: the attribute as MapServer sees it, NULL being "" or 0 */
+static char *msSQLExpressionCoalesce(char *identifier, const char *cast, const char *empty)
+{
+  char *sql = msStrdup("COALESCE(");
+
+  if(cast) {
+    sql = msStringConcatenate(sql, "CAST(");
+    sql = msStringConcatenate(sql, identifier);
+    sql = msStringConcatenate(sql, " AS ");
+    sql = msStringConcatenate(sql, cast);
+    sql = msStringConcatenate(sql, ")");
+  } else
+    sql = msStringConcatenate(sql, identifier);
+  sql = msStringConcatenate(sql, ",");
+  sql = msStringConcatenate(sql, empty);
+  sql = msStringConcatenate(sql, ")");
+  free(identifier);
+
+  return sql;
+}
+
+static char *msSQLExpressionPrimary(sqlExpressionParserObj *parser, int *type)
+{
+  tokenListNodeObjPtr node = parser->node;
+  char *sql = NULL;
+  int i;
+
+  if(!node) return NULL;
+
+  switch(node->token) {
+    case MS_TOKEN_LITERAL_NUMBER:
+      parser->node = node->next;
+      *type = MS_SQLEXP_NUMBER;
+      return msSQLExpressionNumber(node->tokenval.dblval);
+    case MS_TOKEN_LITERAL_STRING:
+      parser->node = node->next;
+      *type = MS_SQLEXP_STRING;
+      return msSQLExpressionQuoteString(node->tokenval.strval, parser->dialect);
+    case MS_TOKEN_BINDING_DOUBLE:
+    case MS_TOKEN_BINDING_INTEGER:
+      if(parser->dialect == MS_SQL_DIALECT_POSTGRESQL) { /* MapServer would atof() a text column */
+        for(i=0; i<parser->numnumericitems; i++) {
+          if(strcmp(parser->numericitems[i], node->tokenval.bindval.item) == 0)
+            break;
+        }
+        if(i == parser->numnumericitems)
+          return NULL;
+      }
+      parser->node = node->next;
+      *type = MS_SQLEXP_NUMBER;
+      sql = msSQLExpressionQuoteIdentifier(node->tokenval.bindval.item);
+      msSQLExpressionAddNull(parser, sql);
+      if(parser->dialect == MS_SQL_DIALECT_POSTGRESQL)
+        sql = msSQLExpressionCoalesce(sql, NULL, "0");
+      return sql;
+    case MS_TOKEN_BINDING_STRING:
+      parser->node = node->next;
+      *type = MS_SQLEXP_STRING;
+      sql = msSQLExpressionQuoteIdentifier(node->tokenval.bindval.item);
+      msSQLExpressionAddNull(parser, sql);
+      if(parser->dialect == MS_SQL_DIALECT_POSTGRESQL) /* string comparisons, whatever the column type */
+        sql = msSQLExpressionCoalesce(sql, "text", "''");
+      return sql;
+    case '(':
+      parser->node = node->next;
+      sql = msSQLExpressionOr(parser, type);
+      if(!sql || msSQLExpressionPeek(parser) != ')') {
+        msFree(sql);
+        return NULL;
+      }
+      parser->node = parser->node->next;
+      return sql;
+    default: /* functions, time and shape values, unary minus... */
+      return NULL;
+  }
+}
+
+static char *msSQLExpressionPower(sqlExpressionParserObj *parser, int *type)
+{
+  char *left, *right, *sql;
+  int right_type;
+
+  if((left = msSQLExpressionPrimary(parser, type)) == NULL)
+    return NULL;
+
+  if(msSQLExpressionPeek(parser) != '^')
+    return left;
+
+  parser->node = parser->node->next;
+  right = msSQLExpressionPower(parser, &right_type);
+  if(!right || *type != MS_SQLEXP_NUMBER || right_type != MS_SQLEXP_NUMBER
+      || parser->dialect != MS_SQL_DIALECT_POSTGRESQL) {
+    free(left);
+    msFree(right);
+    return NULL;
+  }
+
+  sql = msStringConcatenate(msStrdup("power("), left);
+  sql = msStringConcatenate(sql, ",");
+  sql = msStringConcatenate(sql, right);
+  sql = msStringConcatenate(sql, ")");
+  free(left);
+  free(right);
+  return sql;
+}
+
+static char *msSQLExpressionProduct(sqlExpressionParserObj *parser, int *type)
+{
+  char *left, *right;
+  int op, right_type;
+
+  if((left = msSQLExpressionPower(parser, type)) == NULL)
+    return NULL;
+
+  while((op = msSQLExpressionPeek(parser)) == '*' || op == '/' || op == '%') {
+    parser->node = parser->node->next;
+    right = msSQLExpressionPower(parser, &right_type);
+
+    /* the parser does double division and integer modulo, only the */
+    /* former has an obvious SQL equivalent                          */
+    if(!right || *type != MS_SQLEXP_NUMBER || right_type != MS_SQLEXP_NUMBER
+        || op == '%' || (op == '/' && parser->dialect != MS_SQL_DIALECT_POSTGRESQL)) {
+      free(left);
+      msFree(right);
+      return NULL;
+    }
+
+    if(op == '/') {
+      char *cast = msStringConcatenate(msStrdup("CAST("), left);
+      free(left);
+      left = msStringConcatenate(cast, " AS double precision)");
+    }
+    left = msSQLExpressionBinary(left, op == '*' ? " * " : " / ", right);
+  }
+
+  return left;
+}
+
+static char *msSQLExpressionSum(sqlExpressionParserObj *parser, int *type)
+{
+  char *left, *right;
+  int op, right_type;
+
+  if((left = msSQLExpressionProduct(parser, type)) == NULL)
+    return NULL;
+
+  while((op = msSQLExpressionPeek(parser)) == '+' || op == '-') {
+    parser->node = parser->node->next;
+    right = msSQLExpressionProduct(parser, &right_type);
+
+    if(!right || *type != right_type) {
+      free(left);
+      msFree(right);
+      return NULL;
+    }
+
+    if(*type == MS_SQLEXP_NUMBER) {
+      left = msSQLExpressionBinary(left, op == '+' ? " + " : " - ", right);
+    } else if(*type == MS_SQLEXP_STRING && op == '+' && parser->dialect == MS_SQL_DIALECT_POSTGRESQL) {
+      left = msSQLExpressionBinary(left, " || ", right);
+    } else {
+      free(left);
+      free(right);
+      return NULL;
+    }
+  }
+
+  return left;
+}
+
+static char *msSQLExpressionCompare(sqlExpressionParserObj *parser, int *type)
+{
+  char *left, *right = NULL, *sql = NULL;
+  const char *literal;
+  int op, right_type;
+
+  if((left = msSQLExpressionSum(parser, type)) == NULL)
+    return NULL;
+
+  op = msSQLExpressionPeek(parser);
+
+  /* the OGR prefilter must not drop anything the expression would keep */
+  if(parser->dialect == MS_SQL_DIALECT_OGR && (op == MS_TOKEN_COMPARISON_NE ||
+      op == MS_TOKEN_COMPARISON_RE || op == MS_TOKEN_COMPARISON_IRE)) {
+    free(left);
+    return NULL;
+  }
+
+  switch(op) {
+    case MS_TOKEN_COMPARISON_EQ:
+    case MS_TOKEN_COMPARISON_NE:
+    case MS_TOKEN_COMPARISON_GT:
+    case MS_TOKEN_COMPARISON_LT:
+    case MS_TOKEN_COMPARISON_GE:
+    case MS_TOKEN_COMPARISON_LE:
+      parser->node = parser->node->next;
+      right = msSQLExpressionSum(parser, &right_type);
+      if(!right || *type != right_type || *type == MS_SQLEXP_BOOLEAN)
+        break;
+      /* string ordering depends on the database collation */
+      if(*type == MS_SQLEXP_STRING && op != MS_TOKEN_COMPARISON_EQ && op != MS_TOKEN_COMPARISON_NE)
+        break;
+      *type = MS_SQLEXP_BOOLEAN;
+      switch(op) {
+        case MS_TOKEN_COMPARISON_EQ:
+          return msSQLExpressionBinary(left, " = ", right);
+        case MS_TOKEN_COMPARISON_NE:
+          return msSQLExpressionBinary(left, " <> ", right);
+        case MS_TOKEN_COMPARISON_GT:
+          return msSQLExpressionBinary(left, " > ", right);
+        case MS_TOKEN_COMPARISON_LT:
+          return msSQLExpressionBinary(left, " < ", right);
+        case MS_TOKEN_COMPARISON_GE:
+          return msSQLExpressionBinary(left, " >= ", right);
+        default:
+          return msSQLExpressionBinary(left, " <= ", right);
+      }
+    case MS_TOKEN_COMPARISON_IEQ:
+    case MS_TOKEN_COMPARISON_RE:
+    case MS_TOKEN_COMPARISON_IRE:
+    case IN:
+      /* the right hand side has to be a plain string */
+      parser->node = parser->node->next;
+      if(!parser->node || parser->node->token != MS_TOKEN_LITERAL_STRING)
+        break;
+      literal = parser->node->tokenval.strval;
+      parser->node = parser->node->next;
+
+      if(op == IN) {
+        char **values;
+        int i, numvalues = 0;
+
+        if(*type != MS_SQLEXP_NUMBER && *type != MS_SQLEXP_STRING)
+          break;
+        values = msStringSplit(literal, ',', &numvalues);
+        sql = msStringConcatenate(msStrdup("("), left);
+        sql = msStringConcatenate(sql, " IN (");
+        for(i=0; i<numvalues; i++) {
+          char *value = (*type == MS_SQLEXP_NUMBER) ? msSQLExpressionNumber(atof(values[i])) : msSQLExpressionQuoteString(values[i], parser->dialect);
+          if(i > 0) sql = msStringConcatenate(sql, ",");
+          sql = msStringConcatenate(sql, value);
+          free(value);
+        }
+        sql = msStringConcatenate(sql, "))");
+        msFreeCharArray(values, numvalues);
+        free(left);
+        *type = MS_SQLEXP_BOOLEAN;
+        return sql;
+      }
+
+      if(*type != MS_SQLEXP_STRING)
+        break;
+
+      if(op == MS_TOKEN_COMPARISON_IEQ) {
+        if(parser->dialect == MS_SQL_DIALECT_POSTGRESQL) {
+          right = msSQLExpressionQuoteString(literal, parser->dialect);
+          sql = msStringConcatenate(msStrdup("(lower("), left);
+          sql = msStringConcatenate(sql, ") = lower(");
+          sql = msStringConcatenate(sql, right);
+          sql = msStringConcatenate(sql, "))");
+        } else { /* OGR SQL LIKE is case insensitive */
+          char *like = msSQLExpressionEscapeLike(literal);
+          right = msSQLExpressionQuoteString(like, parser->dialect);
+          free(like);
+          sql = msStringConcatenate(msStrdup("("), left);
+          sql = msStringConcatenate(sql, " LIKE ");
+          sql = msStringConcatenate(sql, right);
+          sql = msStringConcatenate(sql, " ESCAPE '!')");
+        }
+      } else {
+        char *like = msSQLExpressionRegexToLike(literal);
+
+        if(like) {
+          right = msSQLExpressionQuoteString(like, parser->dialect);
+          free(like);
+          sql = msStringConcatenate(msStrdup("("), left);
+          if(op == MS_TOKEN_COMPARISON_IRE && parser->dialect == MS_SQL_DIALECT_POSTGRESQL)
+            sql = msStringConcatenate(sql, " ILIKE ");
+          else
+            sql = msStringConcatenate(sql, " LIKE ");
+          sql = msStringConcatenate(sql, right);
+          sql = msStringConcatenate(sql, " ESCAPE '!')");
+        } else {
+          right = msSQLExpressionQuoteString(literal, parser->dialect);
+          sql = msStringConcatenate(msStrdup("("), left);
+          sql = msStringConcatenate(sql, op == MS_TOKEN_COMPARISON_IRE ? " ~* " : " ~ ");
+          sql = msStringConcatenate(sql, right);
+          sql = msStringConcatenate(sql, ")");
+        }
+      }
+      free(left);
+      free(right);
+      *type = MS_SQLEXP_BOOLEAN;
+      return sql;
+    default:
+      return left;
+  }
+
+  free(left);
+  msFree(right);
+  return NULL;
+}
+
+/*
+** A comparison, with the NULL checks of its attributes for the OGR
+** dialect. Attributes of a non boolean result (ie. an operand in
+** parentheses) are left to the enclosing comparison.
+*/
+static char *msSQLExpressionComparison(sqlExpressionParserObj *parser, int *type)
+{
+  char *saved = parser->nulls, *sql;
+
+  parser->nulls = NULL;
+  sql = msSQLExpressionCompare(parser, type);
+
+  if(sql && *type == MS_SQLEXP_BOOLEAN && parser->nulls) {
+    char *nullable = msStringConcatenate(msStrdup("("), sql);
+    nullable = msStringConcatenate(nullable, parser->nulls);
+    nullable = msStringConcatenate(nullable, ")");
+    free(sql);
+    sql = nullable;
+  } else if(sql && parser->nulls) {
+    saved = msStringConcatenate(saved, parser->nulls);
+  }
+
+  msFree(parser->nulls);
+  parser->nulls = saved;
+
+  return sql;
+}
+
+static char *msSQLExpressionNot(sqlExpressionParserObj *parser, int *type)
+{
+  char *operand, *sql;
+
+  if(msSQLExpressionPeek(parser) != MS_TOKEN_LOGICAL_NOT)
+    return msSQLExpressionComparison(parser, type);
+
+  /* not a superset once negated */
+  if(parser->dialect == MS_SQL_DIALECT_OGR)
+    return NULL;
+
+  parser->node = parser->node->next;
+  operand = msSQLExpressionNot(parser, type);
+  if(!operand || *type != MS_SQLEXP_BOOLEAN) {
+    msFree(operand);
+    return NULL;
+  }
+
+  sql = msStringConcatenate(msStrdup("(NOT "), operand);
+  sql = msStringConcatenate(sql, ")");
+  free(operand);
+  return sql;
+}
+
+static char *msSQLExpressionAnd(sqlExpressionParserObj *parser, int *type)
+{
+  char *left, *right;
+  int right_type;
+
+  if((left = msSQLExpressionNot(parser, type)) == NULL)
+    return NULL;
+
+  while(msSQLExpressionPeek(parser) == MS_TOKEN_LOGICAL_AND) {
+    parser->node = parser->node->next;
+    right = msSQLExpressionNot(parser, &right_type);
+    if(!right || *type != MS_SQLEXP_BOOLEAN || right_type != MS_SQLEXP_BOOLEAN) {
+      free(left);
+      msFree(right);
+      return NULL;
+    }
+    left = msSQLExpressionBinary(left, " AND ", right);
+  }
+
+  return left;
+}
+
+static char *msSQLExpressionOr(sqlExpressionParserObj *parser, int *type)
+{
+  char *left, *right;
+  int right_type;
+
+  if((left = msSQLExpressionAnd(parser, type)) == NULL)
+    return NULL;
+
+  while(msSQLExpressionPeek(parser) == MS_TOKEN_LOGICAL_OR) {
+    parser->node = parser->node->next;
+    right = msSQLExpressionAnd(parser, &right_type);
+    if(!right || *type != MS_SQLEXP_BOOLEAN || right_type != MS_SQLEXP_BOOLEAN) {
+      free(left);
+      msFree(right);
+      return NULL;
+    }
+    left = msSQLExpressionBinary(left, " OR ", right);
+  }
+
+  return left;
+}
+
+/*
+** msExpressionToSQL()
+**
+** Translate a MapServer (MS_EXPRESSION) expression into an SQL WHERE clause
+** for the given dialect (MS_SQL_DIALECT_*). Returns a malloc'ed string, or
+** NULL if the expression (or part of it) cannot be represented in SQL. No
+** error is set in the latter case, the caller should simply evaluate the
+** expression on its own. For PostgreSQL numericitems lists the numeric
+** columns, other columns used as numbers aren't translated. OGR checks the
+** types itself and ignores the list.
+*/
+char *msExpressionToSQL(expressionObj *expression, int dialect,
+                        char **numericitems, int numnumericitems)
+{
+  sqlExpressionParserObj parser;
+  expressionObj tmp;
+  char *sql = NULL;
+  int type = 0;
+
+  if(!expression || expression->type != MS_EXPRESSION || !expression->string)
+    return NULL;
+
+  /* tokenize a private copy if the layer hasn't done it yet */
+  initExpression(&tmp);
+  if(expression->tokens == NULL) {
+    tmp.string = msStrdup(expression->string);
+    tmp.type = expression->type;
+    if(msTokenizeExpression(&tmp, NULL, NULL) != MS_SUCCESS) {
+      freeExpression(&tmp);
+      return NULL;
+    }
+    parser.node = tmp.tokens;
+  } else {
+    parser.node = expression->tokens;
+  }
+  parser.dialect = dialect;
+  parser.numericitems = numericitems;
+  parser.numnumericitems = numericitems ? numnumericitems : 0;
+  parser.nulls = NULL;
+
+  sql = msSQLExpressionOr(&parser, &type);
+  if(sql && (parser.node != NULL || type != MS_SQLEXP_BOOLEAN)) {
+    free(sql);
+    sql = NULL;
+  }
+  msFree(parser.nulls);
+
+  freeExpression(&tmp);
+
+  return sql;
+}
+
 /*
 ** This function builds a list of items necessary to draw or query a particular layer by
 ** examining the contents of the various xxxxitem parameters and expressions. That list is
@@ -746,6 +1368,9 @@ int msLayerWhichItems(layerObj *layer, int get_all, char *metadata)
     /* cluster expressions */
     if(layer->cluster.group.type == MS_EXPRESSION) msTokenizeExpression(&(layer->cluster.group), layer->items, &(layer->numitems));
     if(layer->cluster.filter.type == MS_EXPRESSION) msTokenizeExpression(&(layer->cluster.filter), layer->items, &(layer->numitems));
+  } else if(layer->filter.type == MS_EXPRESSION) {
+    /* a filter without attributes must still be tokenized to be evaluated */
+    msTokenizeExpression(&(layer->filter), layer->items, &(layer->numitems));
   }
 
   if(metadata) {
@@ -887,6 +1512,27 @@ int msLayerGetNumFeatures(layerObj *layer)
   return layer->vtable->LayerGetNumFeatures(layer);
 }
 
+/*
+** Returns the number of shapes of an open layer intersecting rect (in the
+** layer projection) and matching the layer FILTER, or -1 on failure. Must be
+** called after msLayerWhichItems(), in place of msLayerWhichShapes(). Data
+** sources that can count without handing out every shape override this.
+*/
+int msLayerGetShapeCount(layerObj *layer, rectObj rect)
+{
+  if ( ! layer->vtable) {
+    int rv =  msInitializeVirtualTable(layer);
+    if (rv != MS_SUCCESS)
+      return -1;
+  }
+
+  /* the transformed shapes can only be counted one by one */
+  if(layer->_geomtransform.type != MS_GEOMTRANSFORM_NONE)
+    return msLayerDefaultGetShapeCount(layer, rect);
+
+  return layer->vtable->LayerGetShapeCount(layer, rect);
+}
+
 void
 msLayerSetProcessingKey( layerObj *layer, const char *key, const char *value)
 
@@ -1325,12 +1971,44 @@ int msLayerSupportsPaging(layerObj *layer)
 {
   if (layer &&
       ((layer->connectiontype == MS_ORACLESPATIAL) ||
-       (layer->connectiontype == MS_POSTGIS)) )
+       (layer->connectiontype == MS_POSTGIS) ||
+       (layer->connectiontype == MS_SHAPEFILE) ||
+       (layer->connectiontype == MS_TILED_SHAPEFILE) ||
+       (layer->connectiontype == MS_OGR)) )
     return MS_TRUE;
 
   return MS_FALSE;
 }
 
+/*
+** For the drivers that page by skipping their own candidates (shapefile,
+** tiled shapefile and OGR): the first STARTINDEX-1 features can only be
+** dropped before queryByRect() sees them if every candidate that falls in
+** the search rectangle ends up in the result, that is with no FILTER, no
+** class based selection, no MINFEATURESIZE, no GEOMTRANSFORM and no
+** reprojection.
+*/
+int msLayerCanPageCandidates(layerObj *layer)
+{
+  mapObj *map = layer->map;
+
+  if(!map || map->query.type != MS_QUERY_BY_RECT)
+    return MS_FALSE;
+
+  if(layer->filter.string || layer->filteritem || !layer->template)
+    return MS_FALSE;
+
+  if(layer->minfeaturesize > 0 || layer->_geomtransform.type != MS_GEOMTRANSFORM_NONE)
+    return MS_FALSE;
+
+#ifdef USE_PROJ
+  if(msProjectionsDiffer(&(layer->projection), &(map->projection)))
+    return MS_FALSE;
+#endif
+
+  return MS_TRUE;
+}
+
 int
 msLayerApplyPlainFilterToLayer(FilterEncodingNode *psNode, mapObj *map,
                                int iLayerIndex)
@@ -1399,6 +2077,27 @@ int LayerDefaultGetNumFeatures(layerObj *layer)
   return MS_FAILURE;
 }
 
+int msLayerDefaultGetShapeCount(layerObj *layer, rectObj rect)
+{
+  int status, count = 0;
+  shapeObj shape;
+
+  status = msLayerWhichShapes(layer, rect, MS_TRUE);
+  if(status == MS_DONE)
+    return 0;
+  else if(status != MS_SUCCESS)
+    return -1;
+
+  msInitShape(&shape);
+  while((status = msLayerNextShape(layer, &shape)) == MS_SUCCESS) {
+    if(msIntersectShapeRect(&shape, &rect) == MS_TRUE)
+      count++;
+    msFreeShape(&shape);
+  }
+
+  return (status == MS_DONE) ? count : -1;
+}
+
 int LayerDefaultAutoProjection(layerObj *layer, projectionObj* projection)
 {
   msSetError(MS_MISCERR, "This data driver does not implement AUTO projection support", "LayerDefaultAutoProjection()");
@@ -1554,6 +2253,8 @@ static int populateVirtualTable(layerVTableObj *vtable)
   vtable->LayerEnablePaging = msLayerDefaultEnablePaging;
   vtable->LayerGetPaging = msLayerDefaultGetPaging;
 
+  vtable->LayerGetShapeCount = msLayerDefaultGetShapeCount;
+
   return MS_SUCCESS;
 }
 
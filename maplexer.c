@@ -2152,6 +2152,8 @@ YY_BUFFER_STATE include_stack[MAX_INCLUDE_DEPTH];
 int include_lineno[MAX_INCLUDE_DEPTH];
 int include_stack_ptr = 0;
 char path[MS_MAXPATHLEN];
+char **msyyincludes = NULL; /* the files INCLUDEd so far, taken over by msLoadMap() */
+int msyynumincludes = 0;
 
 
 
@@ -4285,6 +4287,9 @@ YY_RULE_SETUP
                                                    return(-1);
                                                  }
 
+                                                 msyyincludes = (char **) msSmallRealloc(msyyincludes, sizeof(char *) * (msyynumincludes + 1));
+                                                 msyyincludes[msyynumincludes++] = msStrdup(path);
+
                                                  msyy_switch_to_buffer( msyy_create_buffer(msyyin, YY_BUF_SIZE) );
                                                  msyylineno = 1;
 
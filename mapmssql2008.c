@@ -635,6 +635,12 @@ int msMSSQL2008LayerOpen(layerObj *layer)
       msDebug("MSMSSQL2008LayerOpen -- shared connection not available.\n");
     }
 
+    /* CONNECTION_MAX reached, the error is already set */
+    if (!msConnPoolCanOpen(layer)) {
+      free(layerinfo);
+      return(MS_FAILURE);
+    }
+
     /* Decrypt any encrypted token in connection and attempt to connect */
     conn_decrypted = msDecryptStringTokens(layer->map, layer->connection);
     if (conn_decrypted == NULL) {
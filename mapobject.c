@@ -91,6 +91,8 @@ void msFreeMap(mapObj *map)
   msFree(map->name);
   msFree(map->shapepath);
   msFree(map->mappath);
+  msFree(map->mapfile);
+  msFreeCharArray(map->includes, map->numincludes);
 
   msFreeProjection(&(map->projection));
   msFreeProjection(&(map->latlon));
@@ -130,6 +130,9 @@ int FLTApplyExpressionToLayer(layerObj *lp, char *pszExpression)
           msFree(escapedTextString);
     */
     msLoadExpressionString(&lp->filter, pszBuffer);
+    if (lp->connectiontype == MS_POSTGIS || lp->connectiontype ==  MS_ORACLESPATIAL ||
+        lp->connectiontype == MS_SDE || lp->connectiontype == MS_PLUGIN)
+      lp->filter.flags |= MS_EXP_NATIVE;
 
 
     msFree(pszFinalExpression);
@@ -631,6 +634,9 @@ int FLTApplySimpleSQLFilter(FilterEncodingNode *psNode, mapObj *map,
       pszBuffer = msStringConcatenate(pszBuffer, ")");
 
     msLoadExpressionString(&lp->filter, pszBuffer);
+    if (lp->connectiontype == MS_POSTGIS || lp->connectiontype ==  MS_ORACLESPATIAL ||
+        lp->connectiontype == MS_SDE || lp->connectiontype == MS_PLUGIN)
+      lp->filter.flags |= MS_EXP_NATIVE;
     free(szExpression);
   }
 
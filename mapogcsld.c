@@ -29,6 +29,7 @@
 #include "mapogcsld.h"
 #include "mapogcfilter.h"
 #include "mapserver.h"
+#include "mapthread.h"
 
 #ifdef USE_OGR
 #include "cpl_string.h"
@@ -51,6 +52,353 @@
 #define SLD_MARK_SYMBOL_X "sld_mark_symbol_x"
 #define SLD_MARK_SYMBOL_X_FILLED "sld_mark_symbol_x_filled"
 
+/*
+** Parsed SLD cache (CONFIG "MS_SLD_CACHE" "ON").
+**
+** The layers msSLDParseSLD() builds out of an SLD document are kept in
+** process, keyed on the files the map was loaded from (msGetMapFilesKey())
+** and the SLD text, so that a repeated SLD or SLD_BODY only has its classes
+** copied onto the request's map. The symbols the styles refer to are kept
+** with the entry and added by name to maps that don't have them yet. The
+** SLD texts, layers and symbols held add up to MS_SLD_CACHE_MAX_BYTES at
+** most. Maps modified since they were loaded (mapscript, map.* URL updates,
+** runtime substitutions) skip the cache.
+*/
+
+#define MS_SLD_CACHE_MAX 16
+#define MS_SLD_CACHE_MAX_BYTES (1024*1024)
+
+typedef struct sldCacheObj {
+  char *key;
+  char *sld;
+  size_t sldlen;
+  size_t bytes; /* SLD text, layers and symbols held */
+  unsigned long hash;
+  int numlayers;
+  layerObj *layers;
+  int numsymbols;
+  symbolObj **symbols;
+  struct sldCacheObj *next;
+} sldCacheObj;
+
+static sldCacheObj *sldCache = NULL;
+
+static void msSLDCacheFreeEntry(sldCacheObj *entry)
+{
+  int i;
+
+  for (i = 0; i < entry->numlayers; i++)
+    freeLayer(&entry->layers[i]);
+  msFree(entry->layers);
+  for (i = 0; i < entry->numsymbols; i++) {
+    msFreeSymbol(entry->symbols[i]);
+    msFree(entry->symbols[i]);
+  }
+  msFree(entry->symbols);
+  msFree(entry->key);
+  msFree(entry->sld);
+  msFree(entry);
+}
+
+void msSLDCacheCleanup(void)
+{
+  sldCacheObj *entry;
+
+  msAcquireLock(TLOCK_SLD);
+  while (sldCache != NULL) {
+    entry = sldCache;
+    sldCache = entry->next;
+    msSLDCacheFreeEntry(entry);
+  }
+  msReleaseLock(TLOCK_SLD);
+}
+
+#ifdef USE_OGR
+
+static char *msSLDCacheKey(mapObj *map)
+{
+  const char *value;
+
+  value = msGetConfigOption(map, "MS_SLD_CACHE");
+  if (value == NULL || strcasecmp(value, "ON") != 0)
+    return NULL;
+
+  /* aliases, fonts and symbols come from the map, only maps as loaded */
+  return msGetMapFilesKey(map);
+}
+
+static size_t msSLDCacheStringBytes(const char *string)
+{
+  return string ? strlen(string) + 1 : 0;
+}
+
+/* memory held by a parsed layer copy, its classes, styles and labels */
+static size_t msSLDCacheLayerBytes(layerObj *layer)
+{
+  size_t bytes;
+  int i, j;
+
+  bytes = sizeof(layerObj) + sizeof(classObj *) * layer->maxclasses;
+  bytes += msSLDCacheStringBytes(layer->name) + msSLDCacheStringBytes(layer->classgroup) +
+           msSLDCacheStringBytes(layer->labelitem) + msSLDCacheStringBytes(layer->classitem);
+
+  for (i = 0; i < layer->numclasses; i++) {
+    classObj *psClass = layer->class[i];
+
+    bytes += sizeof(classObj) + msSLDCacheStringBytes(psClass->name) +
+             msSLDCacheStringBytes(psClass->title) +
+             msSLDCacheStringBytes(psClass->expression.string) +
+             msSLDCacheStringBytes(psClass->text.string);
+    for (j = 0; j < psClass->numstyles; j++)
+      bytes += sizeof(styleObj) + msSLDCacheStringBytes(psClass->styles[j]->symbolname);
+    bytes += sizeof(labelObj) * psClass->numlabels;
+  }
+
+  return bytes;
+}
+
+/* memory held by a symbol copy, pixmap included */
+static size_t msSLDCacheSymbolBytes(symbolObj *symbol)
+{
+  size_t bytes;
+
+  bytes = sizeof(symbolObj) + msSLDCacheStringBytes(symbol->name) +
+          msSLDCacheStringBytes(symbol->imagepath) +
+          msSLDCacheStringBytes(symbol->full_pixmap_path) +
+          msSLDCacheStringBytes(symbol->character) + msSLDCacheStringBytes(symbol->font);
+  if (symbol->pixmap_buffer)
+    bytes += sizeof(rasterBufferObj) +
+             (size_t) symbol->pixmap_buffer->width * symbol->pixmap_buffer->height * 4;
+
+  return bytes;
+}
+
+/* FNV-1a hash of the SLD text */
+static unsigned long msSLDCacheHash(const char *sld)
+{
+  unsigned long hash = 2166136261UL;
+  const unsigned char *p;
+
+  for (p = (const unsigned char *) sld; *p; p++)
+    hash = ((hash ^ *p) * 16777619UL) & 0xffffffffUL;
+
+  return hash;
+}
+
+/*
+** Copy what msSLDApplySLD() uses of a parsed layer. Classes point back to
+** dst, the map is the one given (NULL for the layers held in the cache).
+*/
+static int msSLDCopyParsedLayer(layerObj *dst, layerObj *src, mapObj *map)
+{
+  int i;
+
+  initLayer(dst, map);
+  dst->name = src->name ? msStrdup(src->name) : NULL;
+  dst->type = src->type;
+  dst->classgroup = src->classgroup ? msStrdup(src->classgroup) : NULL;
+  dst->labelitem = src->labelitem ? msStrdup(src->labelitem) : NULL;
+  dst->classitem = src->classitem ? msStrdup(src->classitem) : NULL;
+  dst->opacity = src->opacity;
+
+  for (i = 0; i < src->numclasses; i++) {
+    if (msGrowLayerClasses(dst) == NULL)
+      return MS_FAILURE;
+    initClass(dst->class[i]);
+    if (msCopyClass(dst->class[i], src->class[i], dst) != MS_SUCCESS)
+      return MS_FAILURE;
+    dst->class[i]->layer = dst;
+    dst->numclasses++;
+  }
+
+  return MS_SUCCESS;
+}
+
+static void msSLDCacheStore(mapObj *map, const char *key, const char *sld,
+                            size_t sldlen, unsigned long hash,
+                            layerObj *pasLayers, int nLayers)
+{
+  sldCacheObj *entry, *prev = NULL;
+  size_t bytes = 0;
+  int i, j, k, s, count = 0;
+
+  if (sldlen > MS_SLD_CACHE_MAX_BYTES)
+    return;
+
+  /* a spatial filter is consumed when applied, don't keep those */
+  for (i = 0; i < nLayers; i++) {
+    if (pasLayers[i].layerinfo)
+      return;
+  }
+
+  entry = (sldCacheObj *) msSmallCalloc(1, sizeof(sldCacheObj));
+  entry->key = msStrdup(key);
+  entry->sld = msStrdup(sld);
+  entry->sldlen = sldlen;
+  entry->bytes = sizeof(sldCacheObj) + strlen(key) + 1 + sldlen + 1;
+  entry->hash = hash;
+  entry->layers = (layerObj *) msSmallMalloc(sizeof(layerObj) * nLayers);
+
+  for (i = 0; i < nLayers; i++) {
+    entry->numlayers++;
+    if (msSLDCopyParsedLayer(&entry->layers[i], &pasLayers[i], NULL) != MS_SUCCESS) {
+      msSLDCacheFreeEntry(entry);
+      return;
+    }
+    entry->bytes += msSLDCacheLayerBytes(&entry->layers[i]);
+
+    /* keep a copy of every symbol the styles refer to by name */
+    for (j = 0; j < pasLayers[i].numclasses; j++) {
+      classObj *psClass = pasLayers[i].class[j];
+      for (k = 0; k < psClass->numstyles; k++) {
+        styleObj *psStyle = psClass->styles[k];
+        if (!psStyle->symbolname || psStyle->symbol <= 0 ||
+            psStyle->symbol >= map->symbolset.numsymbols)
+          continue;
+        for (s = 0; s < entry->numsymbols; s++) {
+          if (strcasecmp(entry->symbols[s]->name, psStyle->symbolname) == 0)
+            break;
+        }
+        if (s < entry->numsymbols)
+          continue;
+        entry->symbols = (symbolObj **) msSmallRealloc(entry->symbols,
+                         sizeof(symbolObj *) * (entry->numsymbols + 1));
+        entry->symbols[s] = (symbolObj *) msSmallMalloc(sizeof(symbolObj));
+        msCopySymbol(entry->symbols[s], map->symbolset.symbol[psStyle->symbol], NULL);
+        entry->bytes += sizeof(symbolObj *) + msSLDCacheSymbolBytes(entry->symbols[s]);
+        entry->numsymbols++;
+      }
+    }
+  }
+
+  if (entry->bytes > MS_SLD_CACHE_MAX_BYTES) {
+    msSLDCacheFreeEntry(entry);
+    return;
+  }
+
+  msAcquireLock(TLOCK_SLD);
+  entry->next = sldCache;
+  sldCache = entry;
+
+  /* drop the least recently used past the limits */
+  for (entry = sldCache; entry != NULL; prev = entry, entry = entry->next) {
+    bytes += entry->bytes;
+    if (++count > MS_SLD_CACHE_MAX || bytes > MS_SLD_CACHE_MAX_BYTES) {
+      prev->next = NULL;
+      while (entry != NULL) {
+        sldCacheObj *next = entry->next;
+        msSLDCacheFreeEntry(entry);
+        entry = next;
+      }
+      break;
+    }
+  }
+  msReleaseLock(TLOCK_SLD);
+}
+
+/*
+** Copy the layers of a cached SLD for this map. Returns NULL if the SLD
+** is not in the cache. Called with TLOCK_SLD held.
+*/
+static layerObj *msSLDCacheCopyLayers(mapObj *map, sldCacheObj *entry)
+{
+  layerObj *pasLayers;
+  int i, j, k, s, nSymbol;
+
+  pasLayers = (layerObj *) msSmallMalloc(sizeof(layerObj) * entry->numlayers);
+  for (i = 0; i < entry->numlayers; i++) {
+    if (msSLDCopyParsedLayer(&pasLayers[i], &entry->layers[i], map) != MS_SUCCESS) {
+      for (j = 0; j <= i; j++)
+        freeLayer(&pasLayers[j]);
+      msFree(pasLayers);
+      return NULL;
+    }
+
+    /* symbol indexes belong to the map the SLD was parsed with */
+    for (j = 0; j < pasLayers[i].numclasses; j++) {
+      classObj *psClass = pasLayers[i].class[j];
+      for (k = 0; k < psClass->numstyles; k++) {
+        styleObj *psStyle = psClass->styles[k];
+        if (!psStyle->symbolname)
+          continue;
+        nSymbol = msGetSymbolIndex(&map->symbolset, psStyle->symbolname, MS_FALSE);
+        if (nSymbol < 0) {
+          for (s = 0; s < entry->numsymbols; s++) {
+            if (strcasecmp(entry->symbols[s]->name, psStyle->symbolname) == 0)
+              break;
+          }
+          if (s < entry->numsymbols && msGrowSymbolSet(&map->symbolset) != NULL) {
+            nSymbol = map->symbolset.numsymbols;
+            msCopySymbol(map->symbolset.symbol[nSymbol], entry->symbols[s], map);
+            map->symbolset.numsymbols++;
+          } else
+            nSymbol = 0;
+        }
+        psStyle->symbol = nSymbol;
+      }
+    }
+  }
+
+  return pasLayers;
+}
+
+/************************************************************************/
+/*                           msSLDParseSLDCached                        */
+/*                                                                      */
+/*      Same as msSLDParseSLD, going through the parsed SLD cache       */
+/*      when it is enabled.                                             */
+/************************************************************************/
+static layerObj *msSLDParseSLDCached(mapObj *map, char *psSLDXML, int *pnLayers)
+{
+  sldCacheObj *entry, *prev = NULL;
+  layerObj *pasLayers = NULL;
+  unsigned long hash;
+  size_t sldlen;
+  char *key;
+  int nLayers = 0;
+
+  if (map == NULL || psSLDXML == NULL || (key = msSLDCacheKey(map)) == NULL)
+    return msSLDParseSLD(map, psSLDXML, pnLayers);
+
+  hash = msSLDCacheHash(psSLDXML);
+  sldlen = strlen(psSLDXML);
+
+  msAcquireLock(TLOCK_SLD);
+  for (entry = sldCache; entry != NULL; prev = entry, entry = entry->next) {
+    /* the text is only compared once the hash and length match */
+    if (entry->hash == hash && entry->sldlen == sldlen &&
+        memcmp(entry->sld, psSLDXML, sldlen) == 0 &&
+        strcmp(entry->key, key) == 0) {
+      if (prev != NULL) { /* move to the front */
+        prev->next = entry->next;
+        entry->next = sldCache;
+        sldCache = entry;
+      }
+      pasLayers = msSLDCacheCopyLayers(map, entry);
+      nLayers = entry->numlayers;
+      break;
+    }
+  }
+  msReleaseLock(TLOCK_SLD);
+
+  if (pasLayers) {
+    if (map->debug >= MS_DEBUGLEVEL_V)
+      msDebug("msSLDApplySLD(): SLD served from cache (%d named layers).\n", nLayers);
+  } else {
+    pasLayers = msSLDParseSLD(map, psSLDXML, &nLayers);
+    if (pasLayers && nLayers > 0)
+      msSLDCacheStore(map, key, psSLDXML, sldlen, hash, pasLayers, nLayers);
+  }
+  msFree(key);
+
+  if (pnLayers)
+    *pnLayers = nLayers;
+
+  return pasLayers;
+}
+
+#endif /* USE_OGR */
+
 /************************************************************************/
 /*                             msSLDApplySLDURL                         */
 /*                                                                      */
@@ -150,7 +498,7 @@ int msSLDApplySLD(mapObj *map, char *psSLDXML, int iLayer,
   FilterEncodingNode *psExpressionNode =NULL;
   int bFailedExpression=0;
 
-  pasLayers = msSLDParseSLD(map, psSLDXML, &nLayers);
+  pasLayers = msSLDParseSLDCached(map, psSLDXML, &nLayers);
   /* -------------------------------------------------------------------- */
   /*      If the same layer is given more that once, we need to           */
   /*      duplicate it.                                                   */
@@ -428,6 +776,7 @@ int msSLDApplySLD(mapObj *map, char *psSLDXML, int iLayer,
                       snprintf(szTmp, sizeof(szTmp), "%s", "))");
                       pszBuffer =msStringConcatenate(pszBuffer, szTmp);
                       msLoadExpressionString(&lp->filter, pszBuffer);
+                      lp->filter.flags |= MS_EXP_NATIVE;
                     }
                     msFree(pszBuffer);
                     pszBuffer = NULL;
@@ -1981,6 +1981,8 @@ this request. Check sos/ows_enable_request settings.", "msSOSGetObservation()",
               pszBuffer = msStringConcatenate(pszBuffer, ")");
 
             loadExpressionString(&lp->filter, pszBuffer);
+            if (bSpatialDB && lp->connectiontype != MS_OGR)
+              lp->filter.flags |= MS_EXP_NATIVE;
             if (pszBuffer)
               msFree(pszBuffer);
           }
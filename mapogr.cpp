@@ -45,6 +45,19 @@
 #define ACQUIRE_OGR_LOCK       msAcquireLock( TLOCK_OGR )
 #define RELEASE_OGR_LOCK       msReleaseLock( TLOCK_OGR )
 
+/* Feature reads only touch the layer's own datasource, which a pooled
+ * connection never shares between threads.  From GDAL 1.8 on OGR drivers
+ * are safe to use from several threads as long as each works on its own
+ * datasource, so reads need not serialize on the global OGR lock;
+ * opening, closing and the OGR filter/style parsers still do. */
+#if defined(USE_OGR) && GDAL_VERSION_NUM >= 1800
+#  define ACQUIRE_OGR_READ_LOCK
+#  define RELEASE_OGR_READ_LOCK
+#else
+#  define ACQUIRE_OGR_READ_LOCK  ACQUIRE_OGR_LOCK
+#  define RELEASE_OGR_READ_LOCK  RELEASE_OGR_LOCK
+#endif
+
 #ifdef USE_OGR
 
 #include "ogr_api.h"
@@ -63,10 +76,16 @@ typedef struct ms_ogr_file_info_t {
 
   int         last_record_index_read;
 
+  int         bPaging;                  /* layer STARTINDEX applied by OGR */
+  int         bExactFilter;             /* spatial filter matches exactly */
+
+  int         bIgnoredFields;           /* OGR_L_SetIgnoredFields() applied */
+
 } msOGRFileInfo;
 
 static int msOGRLayerIsOpen(layerObj *layer);
 static int msOGRLayerInitItemInfo(layerObj *layer);
+static void msOGRFileSetIgnoredFields(layerObj *layer, msOGRFileInfo *psInfo);
 static int msOGRLayerGetAutoStyle(mapObj *map, layerObj *layer, classObj *c,
                                   shapeObj* shape);
 static void msOGRCloseConnection( void *conn_handle );
@@ -1023,6 +1042,13 @@ msOGRFileOpen(layerObj *layer, const char *connection )
     char szPath[MS_MAXPATHLEN] = "";
     const char *pszDSSelectedName = pszDSName;
 
+    /* CONNECTION_MAX reached, the error is already set */
+    if( !msConnPoolCanOpen( layer ) ) {
+      CPLFree( pszDSName );
+      CPLFree( pszLayerDef );
+      return NULL;
+    }
+
     if( layer->debug )
       msDebug("msOGRFileOpen(%s)...\n", connection);
 
@@ -1138,6 +1164,14 @@ msOGRFileOpen(layerObj *layer, const char *connection )
   psInfo->rect.minx = psInfo->rect.maxx = 0;
   psInfo->rect.miny = psInfo->rect.maxy = 0;
   psInfo->last_record_index_read = -1;
+  psInfo->bPaging = MS_TRUE;
+
+  // OGR drivers may only compare the feature extents with the spatial
+  // filter, which is exact for points only.
+  ACQUIRE_OGR_LOCK;
+  psInfo->bExactFilter =
+    wkbFlatten( OGR_L_GetGeomType( hLayer ) ) == wkbPoint;
+  RELEASE_OGR_LOCK;
 
   return psInfo;
 }
@@ -1180,6 +1214,10 @@ static int msOGRFileClose(layerObj *layer, msOGRFileInfo *psInfo )
   /* If nLayerIndex == -1 then the layer is an SQL result ... free it */
   if( psInfo->nLayerIndex == -1 )
     OGR_DS_ReleaseResultSet( psInfo->hDS, psInfo->hLayer );
+#if GDAL_VERSION_NUM >= 1800
+  else if( psInfo->bIgnoredFields )
+    OGR_L_SetIgnoredFields( psInfo->hLayer, NULL ); /* pooled, leave it clean */
+#endif
 
   // Release (potentially close) the datasource connection.
   // Make sure we aren't holding the lock when the callback may need it.
@@ -1198,6 +1236,76 @@ static int msOGRFileClose(layerObj *layer, msOGRFileInfo *psInfo )
   return MS_SUCCESS;
 }
 
+/**********************************************************************
+ *                     msOGRFileSetIgnoredFields()
+ *
+ * Tell the driver which fields it does not need to decode: all fields
+ * not in layer->items and the style string unless STYLEITEM AUTO or an
+ * OGR:* label attribute needs it.  Called when the items change and
+ * from msOGRFileWhichShapes(), which a layer sharing the pooled OGR
+ * layer also goes through before reading.  msOGRFileClose() clears
+ * the list again.  Drivers without OLCIgnoreFields support just read
+ * it all.
+ *
+ * The geometry is always read: the attribute queries still need the
+ * shapes for their bounds and output.
+ **********************************************************************/
+static void msOGRFileSetIgnoredFields(layerObj *layer, msOGRFileInfo *psInfo)
+{
+#if GDAL_VERSION_NUM >= 1800
+  OGRFeatureDefnH hDefn;
+  char **papszIgnored = NULL;
+  char *pabyUsed;
+  int *itemindexes = (int*)layer->iteminfo;
+  int i, nFields, bNeedStyle = MS_FALSE;
+
+  if( psInfo->hLayer == NULL
+      || !OGR_L_TestCapability( psInfo->hLayer, OLCIgnoreFields )
+      || (hDefn = OGR_L_GetLayerDefn( psInfo->hLayer )) == NULL )
+    return;
+
+  nFields = OGR_FD_GetFieldCount( hDefn );
+  pabyUsed = (char *) CPLCalloc( nFields + 1, 1 );
+
+  for( i = 0; i < layer->numitems; i++ ) {
+    int iField = itemindexes ? itemindexes[i]
+                 : OGR_FD_GetFieldIndex( hDefn, layer->items[i] );
+    if( iField >= 0 && iField < nFields )
+      pabyUsed[iField] = 1;
+    else
+      bNeedStyle = MS_TRUE; /* OGR:* pseudo attribute */
+  }
+
+  if( layer->styleitem && EQUAL(layer->styleitem, "AUTO") )
+    bNeedStyle = MS_TRUE;
+
+  /* A native WHERE clause may reference any field. */
+  if( !(layer->filter.string && EQUALN(layer->filter.string,"WHERE ",6)) ) {
+    for( i = 0; i < nFields; i++ ) {
+      if( !pabyUsed[i] )
+        papszIgnored = CSLAddString( papszIgnored,
+                                     OGR_Fld_GetNameRef( OGR_FD_GetFieldDefn( hDefn, i ) ) );
+    }
+  }
+  CPLFree( pabyUsed );
+
+  if( !bNeedStyle )
+    papszIgnored = CSLAddString( papszIgnored, "OGR_STYLE" );
+
+  if( layer->debug >= MS_DEBUGLEVEL_VVV )
+    msDebug("msOGRFileSetIgnoredFields(): %d of %d fields and special "
+            "fields ignored.\n", CSLCount(papszIgnored), nFields);
+
+  if( OGR_L_SetIgnoredFields( psInfo->hLayer, (const char **) papszIgnored )
+      != OGRERR_NONE ) {
+    CPLErrorReset();
+    OGR_L_SetIgnoredFields( psInfo->hLayer, NULL );
+  }
+  psInfo->bIgnoredFields = (papszIgnored != NULL);
+  CSLDestroy( papszIgnored );
+#endif /* GDAL_VERSION_NUM >= 1800 */
+}
+
 /**********************************************************************
  *                     msOGRFileWhichShapes()
  *
@@ -1287,6 +1395,31 @@ static int msOGRFileWhichShapes(layerObj *layer, rectObj rect,
       RELEASE_OGR_LOCK;
       return MS_FAILURE;
     }
+  } else if( layer->filter.type == MS_EXPRESSION ) {
+    /* ------------------------------------------------------------------
+     * Let the driver prefilter features with an OGR SQL translation of
+     * a MapServer expression.  msOGRFileNextShape() still evaluates the
+     * expression, so this only has to select a superset of the features:
+     * the OGR dialect declines NOT, <> and regular expressions and keeps
+     * rows with NULL attributes.
+     * ------------------------------------------------------------------ */
+    char *pszFilterSQL = msExpressionToSQL( &(layer->filter),
+                                            MS_SQL_DIALECT_OGR, NULL, 0 );
+
+    CPLErrorReset();
+    if( pszFilterSQL == NULL
+        || OGR_L_SetAttributeFilter( psInfo->hLayer, pszFilterSQL )
+        != OGRERR_NONE ) {
+      if( layer->debug && pszFilterSQL != NULL )
+        msDebug("msOGRFileWhichShapes: SetAttributeFilter(%s) failed (%s), "
+                "evaluating FILTER locally.\n",
+                pszFilterSQL, CPLGetLastErrorMsg() );
+      CPLErrorReset();
+      OGR_L_SetAttributeFilter( psInfo->hLayer, NULL );
+    } else if( layer->debug )
+      msDebug("msOGRFileWhichShapes: Setting attribute filter to %s\n",
+              pszFilterSQL );
+    msFree( pszFilterSQL );
   } else
     OGR_L_SetAttributeFilter( psInfo->hLayer, NULL );
 
@@ -1296,6 +1429,13 @@ static int msOGRFileWhichShapes(layerObj *layer, rectObj rect,
   OGR_L_ResetReading( psInfo->hLayer );
   psInfo->last_record_index_read = -1;
 
+  /* ------------------------------------------------------------------
+   * Set the fields this layer can skip, once for the whole read: the
+   * filter may have changed since the items were set, and the pooled
+   * OGR layer may have been used by another layer in between.
+   * ------------------------------------------------------------------ */
+  msOGRFileSetIgnoredFields( layer, psInfo );
+
   RELEASE_OGR_LOCK;
 
   return MS_SUCCESS;
@@ -1478,7 +1618,7 @@ msOGRFileNextShape(layerObj *layer, shapeObj *shape,
   msFreeShape(shape);
   shape->type = MS_SHAPE_NULL;
 
-  ACQUIRE_OGR_LOCK;
+  ACQUIRE_OGR_READ_LOCK;
   while (shape->type == MS_SHAPE_NULL) {
     if( hFeature )
       OGR_F_Destroy( hFeature );
@@ -1488,10 +1628,10 @@ msOGRFileNextShape(layerObj *layer, shapeObj *shape,
       if( CPLGetLastErrorType() == CE_Failure ) {
         msSetError(MS_OGRERR, "%s", "msOGRFileNextShape()",
                    CPLGetLastErrorMsg() );
-        RELEASE_OGR_LOCK;
+        RELEASE_OGR_READ_LOCK;
         return MS_FAILURE;
       } else {
-        RELEASE_OGR_LOCK;
+        RELEASE_OGR_READ_LOCK;
         if (layer->debug >= MS_DEBUGLEVEL_VV)
           msDebug("msOGRFileNextShape: Returning MS_DONE (no more shapes)\n" );
         return MS_DONE;  // No more features to read
@@ -1505,7 +1645,7 @@ msOGRFileNextShape(layerObj *layer, shapeObj *shape,
       shape->numvalues = layer->numitems;
       if(!shape->values) {
         OGR_F_Destroy( hFeature );
-        RELEASE_OGR_LOCK;
+        RELEASE_OGR_READ_LOCK;
         return(MS_FAILURE);
       }
     }
@@ -1530,7 +1670,7 @@ msOGRFileNextShape(layerObj *layer, shapeObj *shape,
       } else {
         msFreeShape(shape);
         OGR_F_Destroy( hFeature );
-        RELEASE_OGR_LOCK;
+        RELEASE_OGR_READ_LOCK;
         return MS_FAILURE; // Error message already produced.
       }
     }
@@ -1553,7 +1693,7 @@ msOGRFileNextShape(layerObj *layer, shapeObj *shape,
     OGR_F_Destroy( psInfo->hLastFeature );
   psInfo->hLastFeature = hFeature;
 
-  RELEASE_OGR_LOCK;
+  RELEASE_OGR_READ_LOCK;
 
   return MS_SUCCESS;
 }
@@ -1587,9 +1727,9 @@ msOGRFileGetShape(layerObj *layer, shapeObj *shape, long record,
   /*      Support reading feature by fid.                                 */
   /* -------------------------------------------------------------------- */
   if( record_is_fid ) {
-    ACQUIRE_OGR_LOCK;
+    ACQUIRE_OGR_READ_LOCK;
     if( (hFeature = OGR_L_GetFeature( psInfo->hLayer, record )) == NULL ) {
-      RELEASE_OGR_LOCK;
+      RELEASE_OGR_READ_LOCK;
       return MS_FAILURE;
     }
   }
@@ -1599,7 +1739,7 @@ msOGRFileGetShape(layerObj *layer, shapeObj *shape, long record,
   /*      resultset.                                                      */
   /* -------------------------------------------------------------------- */
   else if( !record_is_fid ) {
-    ACQUIRE_OGR_LOCK;
+    ACQUIRE_OGR_READ_LOCK;
     if( record <= psInfo->last_record_index_read
         || psInfo->last_record_index_read == -1 ) {
       OGR_L_ResetReading( psInfo->hLayer );
@@ -1613,7 +1753,7 @@ msOGRFileGetShape(layerObj *layer, shapeObj *shape, long record,
         hFeature = NULL;
       }
       if( (hFeature = OGR_L_GetNextFeature( psInfo->hLayer )) == NULL ) {
-        RELEASE_OGR_LOCK;
+        RELEASE_OGR_READ_LOCK;
         return MS_FAILURE;
       }
       psInfo->last_record_index_read++;
@@ -1626,7 +1766,7 @@ msOGRFileGetShape(layerObj *layer, shapeObj *shape, long record,
   // shape->type will be set if geom is compatible with layer type
   if (ogrConvertGeometry(OGR_F_GetGeometryRef( hFeature ), shape,
                          layer->type) != MS_SUCCESS) {
-    RELEASE_OGR_LOCK;
+    RELEASE_OGR_READ_LOCK;
     return MS_FAILURE; // Error message already produced.
   }
 
@@ -1634,7 +1774,7 @@ msOGRFileGetShape(layerObj *layer, shapeObj *shape, long record,
     msSetError(MS_OGRERR,
                "Requested feature is incompatible with layer type",
                "msOGRLayerGetShape()");
-    RELEASE_OGR_LOCK;
+    RELEASE_OGR_READ_LOCK;
     return MS_FAILURE;
   }
 
@@ -1645,7 +1785,7 @@ msOGRFileGetShape(layerObj *layer, shapeObj *shape, long record,
     shape->values = msOGRGetValues(layer, hFeature);
     shape->numvalues = layer->numitems;
     if(!shape->values) {
-      RELEASE_OGR_LOCK;
+      RELEASE_OGR_READ_LOCK;
       return(MS_FAILURE);
     }
 
@@ -1666,7 +1806,7 @@ msOGRFileGetShape(layerObj *layer, shapeObj *shape, long record,
     OGR_F_Destroy( psInfo->hLastFeature );
   psInfo->hLastFeature = hFeature;
 
-  RELEASE_OGR_LOCK;
+  RELEASE_OGR_READ_LOCK;
 
   return MS_SUCCESS;
 }
@@ -1968,6 +2108,53 @@ static int msOGRLayerIsOpen(layerObj *layer)
 #endif /* USE_OGR */
 }
 
+/**********************************************************************
+ *                     msOGRLayerGetPaging()
+ *
+ * Registered vtable->LayerGetPaging.  STARTINDEX is applied with
+ * OGR_L_SetNextByIndex(), so it counts the features of the OGR result
+ * set (the spatial filter), much like the OFFSET of the PostGIS driver.
+ * That set is the query result only when the filter is exact, that is
+ * for point layers. Other layers and tile indexes are left to the
+ * generic skipping in mapquery.c.  The geometry type is only known
+ * once the layer is open, so the layer is opened here if needed, like
+ * msOGRLayerEnablePaging() does: the answer must not change when the
+ * caller opens the layer afterwards.
+ **********************************************************************/
+static int msOGRLayerGetPaging(layerObj *layer)
+{
+#ifdef USE_OGR
+  msOGRFileInfo *psInfo;
+
+  if( layer->tileindex != NULL )
+    return MS_FALSE;
+
+  if( !msOGRLayerIsOpen(layer) && msOGRLayerOpen(layer, NULL) != MS_SUCCESS )
+    return MS_FALSE;
+
+  psInfo =(msOGRFileInfo*)layer->layerinfo;
+  if( !psInfo->bPaging || !psInfo->bExactFilter )
+    return MS_FALSE;
+
+  return msLayerCanPageCandidates(layer);
+#else
+  return MS_FALSE;
+#endif /* USE_OGR */
+}
+
+/**********************************************************************
+ *                     msOGRLayerEnablePaging()
+ **********************************************************************/
+static void msOGRLayerEnablePaging(layerObj *layer, int value)
+{
+#ifdef USE_OGR
+  if( !msOGRLayerIsOpen(layer) && msOGRLayerOpen(layer, NULL) != MS_SUCCESS )
+    return;
+
+  ((msOGRFileInfo*)layer->layerinfo)->bPaging = value;
+#endif /* USE_OGR */
+}
+
 /**********************************************************************
  *                     msOGRLayerWhichShapes()
  *
@@ -1990,6 +2177,26 @@ int msOGRLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
 
   status = msOGRFileWhichShapes( layer, rect, psInfo );
 
+  if( status == MS_SUCCESS && isQuery && layer->startindex > 1
+      && msOGRLayerGetPaging( layer ) ) {
+    // Position the reading past the first STARTINDEX-1 features of the
+    // result set, drivers that can seek do it without reading them.
+    OGRErr eErr;
+
+    ACQUIRE_OGR_LOCK;
+    if( layer->debug )
+      msDebug("msOGRLayerWhichShapes: skipping %d features%s.\n",
+              layer->startindex - 1,
+              OGR_L_TestCapability( psInfo->hLayer, OLCFastSetNextByIndex )
+              ? " (fast seek)" : "" );
+    eErr = OGR_L_SetNextByIndex( psInfo->hLayer, layer->startindex - 1 );
+    psInfo->last_record_index_read = layer->startindex - 2;
+    RELEASE_OGR_LOCK;
+
+    if( eErr != OGRERR_NONE )
+      return MS_DONE; // The page starts past the last feature.
+  }
+
   if( status != MS_SUCCESS || layer->tileindex == NULL )
     return status;
 
@@ -2010,6 +2217,60 @@ int msOGRLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
 #endif /* USE_OGR */
 }
 
+/**********************************************************************
+ *                     msOGRLayerGetShapeCount()
+ *
+ * Registered vtable->LayerGetShapeCount.  When OGR applies the whole
+ * FILTER itself, the counting is left to OGR_L_GetFeatureCount() so
+ * drivers with a fast count don't have to hand out every feature.
+ **********************************************************************/
+static int msOGRLayerGetShapeCount(layerObj *layer, rectObj rect)
+{
+#ifdef USE_OGR
+  msOGRFileInfo *psInfo =(msOGRFileInfo*)layer->layerinfo;
+  int   status, nCount;
+
+  if (psInfo == NULL || psInfo->hLayer == NULL) {
+    msSetError(MS_MISCERR, "Assertion failed: OGR layer not opened!!!",
+               "msOGRLayerGetShapeCount()");
+    return -1;
+  }
+
+  // Tiles and FILTERs evaluated by msOGRFileNextShape() need the features.
+  if( layer->tileindex != NULL
+      || (layer->filter.string && !EQUALN(layer->filter.string,"WHERE ",6)) )
+    return msLayerDefaultGetShapeCount( layer, rect );
+
+  status = msOGRFileWhichShapes( layer, rect, psInfo );
+  if( status != MS_SUCCESS )
+    return (status == MS_DONE) ? 0 : -1;
+
+  ACQUIRE_OGR_LOCK;
+  CPLErrorReset();
+  nCount = (int) OGR_L_GetFeatureCount( psInfo->hLayer, TRUE );
+  if( nCount < 0 || CPLGetLastErrorType() == CE_Failure ) {
+    msSetError(MS_OGRERR, "%s", "msOGRLayerGetShapeCount()",
+               CPLGetLastErrorMsg() );
+    nCount = -1;
+  }
+  RELEASE_OGR_LOCK;
+
+  if (layer->debug >= MS_DEBUGLEVEL_VV)
+    msDebug("msOGRLayerGetShapeCount: %d feature(s)\n", nCount );
+
+  return nCount;
+#else
+  /* ------------------------------------------------------------------
+   * OGR Support not included...
+   * ------------------------------------------------------------------ */
+
+  msSetError(MS_MISCERR, "OGR support is not available.",
+             "msOGRLayerGetShapeCount()");
+  return -1;
+
+#endif /* USE_OGR */
+}
+
 /**********************************************************************
  *                     msOGRLayerGetItems()
  *
@@ -2070,8 +2331,14 @@ static int msOGRLayerInitItemInfo(layerObj *layer)
   int   i;
   OGRFeatureDefnH hDefn;
 
-  if (layer->numitems == 0)
+  if (layer->numitems == 0) {
+    /* No attributes wanted at all, let the driver skip them. */
+    if( layer->tileindex != NULL && psInfo != NULL )
+      psInfo = psInfo->poCurTile;
+    if( psInfo != NULL && psInfo->hLayer != NULL )
+      msOGRFileSetIgnoredFields( layer, psInfo );
     return MS_SUCCESS;
+  }
 
   if( layer->tileindex != NULL ) {
     if( psInfo->poCurTile == NULL
@@ -2159,6 +2426,8 @@ static int msOGRLayerInitItemInfo(layerObj *layer)
     }
   }
 
+  msOGRFileSetIgnoredFields( layer, psInfo );
+
   return(MS_SUCCESS);
 #else
   /* ------------------------------------------------------------------
@@ -3009,6 +3278,9 @@ msOGRLayerInitializeVirtualTable(layerObj *layer)
   /* layer->vtable->LayerCreateItems, use default */
   /* layer->vtable->LayerGetNumFeatures, use default */
   /* layer->vtable->LayerGetAutoProjection, use defaut*/
+  layer->vtable->LayerGetShapeCount = msOGRLayerGetShapeCount;
+  layer->vtable->LayerEnablePaging = msOGRLayerEnablePaging;
+  layer->vtable->LayerGetPaging = msOGRLayerGetPaging;
 
   layer->vtable->LayerEscapeSQLParam = msOGREscapeSQLParam;
   layer->vtable->LayerEscapePropertyName = msOGREscapePropertyName;
@@ -1681,6 +1681,20 @@ int msOracleSpatialLayerOpen( layerObj *layer )
 
   hand = (msOracleSpatialHandler *) msConnPoolRequest( layer );
 
+  if( hand == NULL && !msConnPoolCanOpen( layer ) ) {
+    /* CONNECTION_MAX reached, the error is already set */
+    msOCICloseDataHandlers( dthand );
+    msOCIFinishStatement( sthand );
+    msOCIFinishStatement( sthand2 );
+    msOCIClearLayerInfo( layerinfo );
+
+    if (username) free(username);
+    if (password) free(password);
+    if (dblink) free(dblink);
+
+    return MS_FAILURE;
+  }
+
   if( hand == NULL ) {
 
     hand = msOCISetHandlers( username, password, dblink );
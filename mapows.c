@@ -30,6 +30,7 @@
 #include "mapserver.h"
 #include "maptime.h"
 #include "maptemplate.h"
+#include "mapthread.h"
 
 #if defined(USE_LIBXML2)
 #include "maplibxml2.h"
@@ -41,6 +42,7 @@
 #include <ctype.h> /* isalnum() */
 #include <stdarg.h>
 #include <assert.h>
+#include <sys/stat.h>
 
 
 
@@ -197,6 +199,331 @@ static int msOWSPreParseRequest(cgiRequestObj *request,
   return MS_SUCCESS;
 }
 
+/*
+** GetCapabilities document cache (CONFIG "MS_OWS_CAPABILITIES_CACHE" "ON").
+**
+** The output of a GetCapabilities request, HTTP headers included, is kept
+** in process keyed on the files the map was loaded from (msGetMapFilesKey()),
+** the SERVICE, VERSION, REQUEST, LANGUAGE, SECTIONS and UPDATESEQUENCE
+** parameters and what goes into the online resource. Requests with any other
+** parameter are not cached, nor are maps modified since they were loaded
+** (mapscript, map.* URL updates, runtime substitutions) or copied with
+** msCopyMap(). With CONFIG "MS_OWS_CAPABILITIES_CACHE_DIR" set the documents
+** are also written to that directory, in a fixed number of files, so that
+** they survive the process and can be shared between processes.
+**
+** A change to data the document is computed from (layer extents) is seen
+** when the document expires, MS_OWS_CAPABILITIES_CACHE_TTL seconds after it
+** was generated (default 300, 0 for never).
+*/
+
+#define MS_OWS_CAPABILITIES_CACHE_MAX 32
+#define MS_OWS_CAPABILITIES_CACHE_FILES 256
+#define MS_OWS_CAPABILITIES_CACHE_DEFAULT_TTL 300
+
+typedef struct owsCapabilitiesCacheObj {
+  char *key;
+  unsigned char *data;
+  int size;
+  time_t created;
+  struct owsCapabilitiesCacheObj *next;
+} owsCapabilitiesCacheObj;
+
+static owsCapabilitiesCacheObj *capabilitiesCache = NULL;
+
+typedef struct {
+  msIOContext saved;
+  msIOBuffer buffer;
+} owsCapabilitiesCaptureObj;
+
+static char *msOWSCapabilitiesCacheKey(mapObj *map, cgiRequestObj *request)
+{
+  static const char *envNames[] = { "SERVER_NAME", "SERVER_PORT", "SCRIPT_NAME", "HTTPS", NULL };
+  static const char *paramNames[] = { "SERVICE", "VERSION", "REQUEST", "LANGUAGE", "SECTIONS",
+                                      "UPDATESEQUENCE", NULL
+                                    };
+  const char *value, *mapparam = "";
+  const char *paramValues[6] = { "", "", "", "", "", "" };
+  char *key = NULL;
+  msIOContext *context;
+  int i, j;
+
+  value = msGetConfigOption(map, "MS_OWS_CAPABILITIES_CACHE");
+  if (value == NULL || strcasecmp(value, "ON") != 0)
+    return NULL;
+
+  /* only plain GET requests */
+  if (request->type != MS_GET_REQUEST)
+    return NULL;
+
+  /* headers don't go through stdout under the apache module */
+  context = msIO_getHandler(stdout);
+  if (context && context->label && strcmp(context->label, "apache") == 0)
+    return NULL;
+
+  /*
+  ** Any other parameter may change the document or the map (runtime
+  ** substitutions, map.* updates), those requests are not cached. MAP goes
+  ** into the online resource.
+  */
+  for (i = 0; i < request->NumParams; i++) {
+    if (strcasecmp(request->ParamNames[i], "MAP") == 0) {
+      mapparam = request->ParamValues[i];
+      continue;
+    }
+    for (j = 0; paramNames[j] != NULL; j++) {
+      if (strcasecmp(request->ParamNames[i], paramNames[j]) == 0)
+        break;
+    }
+    if (paramNames[j] == NULL) {
+      if (map->debug >= MS_DEBUGLEVEL_V)
+        msDebug("msOWSDispatch(): GetCapabilities with parameter %s not cached.\n",
+                request->ParamNames[i]);
+      return NULL;
+    }
+    paramValues[j] = request->ParamValues[i];
+  }
+
+  /* on a map as loaded from its files */
+  if ((key = msGetMapFilesKey(map)) == NULL)
+    return NULL;
+
+  /* the server variables and MAP parameter msBuildOnlineResource() reads */
+  for (i = 0; envNames[i] != NULL; i++) {
+    key = msStringConcatenate(key, "|");
+    if ((value = getenv(envNames[i])) != NULL)
+      key = msStringConcatenate(key, (char *) value);
+  }
+  key = msStringConcatenate(key, "|");
+  key = msStringConcatenate(key, (char *) mapparam);
+
+  for (j = 0; paramNames[j] != NULL; j++) {
+    key = msStringConcatenate(key, j == 0 ? "|" : "&");
+    key = msStringConcatenate(key, (char *) paramNames[j]);
+    key = msStringConcatenate(key, "=");
+    key = msStringConcatenate(key, (char *) paramValues[j]);
+  }
+
+  return key;
+}
+
+/*
+** File name in the cache directory, one of MS_OWS_CAPABILITIES_CACHE_FILES
+** slots picked by a FNV-1a hash of the key. Keys sharing a slot replace
+** each other, the key on the first line of the file tells them apart.
+*/
+static char *msOWSCapabilitiesCacheFile(mapObj *map, const char *key)
+{
+  const char *dir = msGetConfigOption(map, "MS_OWS_CAPABILITIES_CACHE_DIR");
+  unsigned long hash = 2166136261UL;
+  char szName[64], szPath[MS_MAXPATHLEN];
+  const unsigned char *p;
+
+  if (dir == NULL || strchr(key, '\n') != NULL)
+    return NULL;
+
+  for (p = (const unsigned char *) key; *p; p++)
+    hash = ((hash ^ *p) * 16777619UL) & 0xffffffffUL;
+  snprintf(szName, sizeof(szName), "capabilities_%03lx.cache",
+           hash % MS_OWS_CAPABILITIES_CACHE_FILES);
+
+  return msStrdup(msBuildPath(szPath, dir, szName));
+}
+
+/* seconds a document is served from the cache, 0 for no limit */
+static int msOWSCapabilitiesCacheTTL(mapObj *map)
+{
+  const char *value = msGetConfigOption(map, "MS_OWS_CAPABILITIES_CACHE_TTL");
+
+  if (value == NULL)
+    return MS_OWS_CAPABILITIES_CACHE_DEFAULT_TTL;
+
+  return MS_MAX(0, atoi(value));
+}
+
+static void msOWSCapabilitiesCacheAdd(const char *key, const unsigned char *data, int size,
+                                      time_t created)
+{
+  owsCapabilitiesCacheObj *entry, *prev = NULL;
+  int count = 0;
+
+  entry = (owsCapabilitiesCacheObj *) msSmallMalloc(sizeof(owsCapabilitiesCacheObj));
+  entry->key = msStrdup(key);
+  entry->data = (unsigned char *) msSmallMalloc(size);
+  memcpy(entry->data, data, size);
+  entry->size = size;
+  entry->created = created;
+
+  msAcquireLock(TLOCK_OWSCAPS);
+  entry->next = capabilitiesCache;
+  capabilitiesCache = entry;
+
+  /* drop the least recently used past the limit */
+  for (entry = capabilitiesCache; entry != NULL; prev = entry, entry = entry->next) {
+    if (++count > MS_OWS_CAPABILITIES_CACHE_MAX) {
+      prev->next = NULL;
+      while (entry != NULL) {
+        owsCapabilitiesCacheObj *next = entry->next;
+        msFree(entry->key);
+        msFree(entry->data);
+        msFree(entry);
+        entry = next;
+      }
+      break;
+    }
+  }
+  msReleaseLock(TLOCK_OWSCAPS);
+}
+
+/*
+** Write a cached document to stdout. Returns MS_SUCCESS if there was one.
+*/
+static int msOWSCapabilitiesCacheFetch(mapObj *map, const char *key)
+{
+  owsCapabilitiesCacheObj *entry, *prev = NULL;
+  unsigned char *data = NULL;
+  int size = 0, ttl = msOWSCapabilitiesCacheTTL(map);
+  time_t now = time(NULL);
+  struct stat sStat;
+  char *filename;
+  FILE *fp;
+
+  msAcquireLock(TLOCK_OWSCAPS);
+  for (entry = capabilitiesCache; entry != NULL; prev = entry, entry = entry->next) {
+    if (strcmp(entry->key, key) == 0) {
+      if (ttl > 0 && now - entry->created >= ttl) { /* expired, generate it again */
+        if (prev != NULL)
+          prev->next = entry->next;
+        else
+          capabilitiesCache = entry->next;
+        msFree(entry->key);
+        msFree(entry->data);
+        msFree(entry);
+        break;
+      }
+      if (prev != NULL) { /* move to the front */
+        prev->next = entry->next;
+        entry->next = capabilitiesCache;
+        capabilitiesCache = entry;
+      }
+      data = (unsigned char *) msSmallMalloc(entry->size);
+      memcpy(data, entry->data, entry->size);
+      size = entry->size;
+      break;
+    }
+  }
+  msReleaseLock(TLOCK_OWSCAPS);
+
+  if (data == NULL && (filename = msOWSCapabilitiesCacheFile(map, key)) != NULL) {
+    /* the file holds the key on its first line, then the document */
+    if (stat(filename, &sStat) == 0 && (ttl == 0 || now - sStat.st_mtime < ttl) &&
+        (fp = fopen(filename, "rb")) != NULL) {
+      int keylen = strlen(key);
+      char *filekey = (char *) msSmallMalloc(keylen + 2);
+
+      if (fgets(filekey, keylen + 2, fp) != NULL &&
+          strncmp(filekey, key, keylen) == 0 && filekey[keylen] == '\n' &&
+          fseek(fp, 0, SEEK_END) == 0 && (size = ftell(fp) - (keylen + 1)) > 0 &&
+          fseek(fp, keylen + 1, SEEK_SET) == 0) {
+        data = (unsigned char *) msSmallMalloc(size);
+        if (fread(data, 1, size, fp) != (size_t) size) {
+          msFree(data);
+          data = NULL;
+        } else
+          msOWSCapabilitiesCacheAdd(key, data, size, sStat.st_mtime);
+      }
+      msFree(filekey);
+      fclose(fp);
+    }
+    msFree(filename);
+  }
+
+  if (data == NULL)
+    return MS_FAILURE;
+
+  if (map->debug >= MS_DEBUGLEVEL_V)
+    msDebug("msOWSDispatch(): GetCapabilities served from cache (%d bytes).\n", size);
+
+  msIO_fwrite(data, 1, size, stdout);
+  msFree(data);
+
+  return MS_SUCCESS;
+}
+
+static void msOWSCapabilitiesCacheStore(mapObj *map, const char *key, const unsigned char *data, int size)
+{
+  char *filename, *tmpname, *tmpid;
+  FILE *fp;
+
+  msOWSCapabilitiesCacheAdd(key, data, size, time(NULL));
+
+  if ((filename = msOWSCapabilitiesCacheFile(map, key)) == NULL)
+    return;
+
+  /* write aside and rename so readers never see a partial file */
+  tmpid = msTmpFilename("tmp");
+  tmpname = msStringConcatenate(msStrdup(filename), ".");
+  tmpname = msStringConcatenate(tmpname, tmpid);
+  msFree(tmpid);
+  if ((fp = fopen(tmpname, "wb")) != NULL) {
+    if (fwrite(key, 1, strlen(key), fp) == strlen(key) && fputc('\n', fp) != EOF &&
+        fwrite(data, 1, size, fp) == (size_t) size && fclose(fp) == 0) {
+      if (rename(tmpname, filename) != 0)
+        remove(tmpname);
+    } else
+      remove(tmpname);
+  } else if (map->debug) {
+    msDebug("msOWSDispatch(): Unable to write capabilities cache file %s.\n", tmpname);
+  }
+
+  msFree(tmpname);
+  msFree(filename);
+}
+
+/* send stdout to a buffer while the document is generated */
+static void msOWSCapabilitiesCaptureStart(owsCapabilitiesCaptureObj *capture)
+{
+  msIOContext context;
+
+  capture->saved = *msIO_getHandler(stdout);
+  memset(&capture->buffer, 0, sizeof(msIOBuffer));
+
+  context.label = "buffer";
+  context.write_channel = MS_TRUE;
+  context.readWriteFunc = msIO_bufferWrite;
+  context.cbData = &capture->buffer;
+
+  msIO_installHandlers(msIO_getHandler(stdin), &context, msIO_getHandler(stderr));
+}
+
+/* restore stdout and pass the captured document on, keeping it if all went well */
+static void msOWSCapabilitiesCaptureEnd(mapObj *map, owsCapabilitiesCaptureObj *capture, const char *key, int status)
+{
+  msIO_installHandlers(msIO_getHandler(stdin), &capture->saved, msIO_getHandler(stderr));
+
+  if (capture->buffer.data_offset > 0) {
+    if (status == MS_SUCCESS)
+      msOWSCapabilitiesCacheStore(map, key, capture->buffer.data, capture->buffer.data_offset);
+    msIO_fwrite(capture->buffer.data, 1, capture->buffer.data_offset, stdout);
+  }
+  msFree(capture->buffer.data);
+}
+
+void msOWSCapabilitiesCacheCleanup(void)
+{
+  owsCapabilitiesCacheObj *entry;
+
+  msAcquireLock(TLOCK_OWSCAPS);
+  while (capabilitiesCache != NULL) {
+    entry = capabilitiesCache;
+    capabilitiesCache = entry->next;
+    msFree(entry->key);
+    msFree(entry->data);
+    msFree(entry);
+  }
+  msReleaseLock(TLOCK_OWSCAPS);
+}
+
 /*
 ** msOWSDispatch() is the entry point for any OWS request (WMS, WFS, ...)
 ** - If this is a valid request then it is processed and MS_SUCCESS is returned
@@ -211,6 +538,8 @@ int msOWSDispatch(mapObj *map, cgiRequestObj *request, int ows_mode)
 {
   int status = MS_DONE, force_ows_mode = 0;
   owsRequestObj ows_request;
+  owsCapabilitiesCaptureObj capture;
+  char *capabilities_key = NULL;
 
   if (!request) {
     return status;
@@ -228,6 +557,17 @@ int msOWSDispatch(mapObj *map, cgiRequestObj *request, int ows_mode)
       status = MS_DONE;
   }
 
+  if (ows_request.service != NULL && ows_request.request != NULL &&
+      EQUAL(ows_request.request, "GetCapabilities") &&
+      (capabilities_key = msOWSCapabilitiesCacheKey(map, request)) != NULL) {
+    if (msOWSCapabilitiesCacheFetch(map, capabilities_key) == MS_SUCCESS) {
+      msFree(capabilities_key);
+      msOWSClearRequestObj(&ows_request);
+      return MS_SUCCESS;
+    }
+    msOWSCapabilitiesCaptureStart(&capture);
+  }
+
   if (ows_request.service == NULL) {
     /* exit if service is not set */
     if(force_ows_mode) {
@@ -277,6 +617,11 @@ int msOWSDispatch(mapObj *map, cgiRequestObj *request, int ows_mode)
     status = MS_FAILURE;
   }
 
+  if (capabilities_key != NULL) {
+    msOWSCapabilitiesCaptureEnd(map, &capture, capabilities_key, status);
+    msFree(capabilities_key);
+  }
+
   msOWSClearRequestObj(&ows_request);
   return status;
 }
@@ -114,6 +114,7 @@ typedef struct {
 } owsRequestObj;
 
 MS_DLL_EXPORT int msOWSDispatch(mapObj *map, cgiRequestObj *request, int ows_mode);
+MS_DLL_EXPORT void msOWSCapabilitiesCacheCleanup(void);
 
 MS_DLL_EXPORT const char * msOWSLookupMetadata(hashTableObj *metadata,
     const char *namespaces, const char *name);
@@ -388,6 +389,7 @@ MS_DLL_EXPORT int msGMLWriteQuery(mapObj *map, char *filename, const char *names
 
 #ifdef USE_WFS_SVR
 MS_DLL_EXPORT int msGMLWriteWFSQuery(mapObj *map, FILE *stream, char *wfs_namespace, int outputformat);
+MS_DLL_EXPORT int msGMLWriteWFSQueryStream(mapObj *map, FILE *stream, char *wfs_namespace, int outputformat, int *pnFeatures);
 #endif
 
 
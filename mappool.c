@@ -85,8 +85,13 @@ We will use POSTGIS names for convenience.
         layerinfo->conn = (PGconn *) msConnPoolRequest( layer );
 
 2) In msPOSTGISLayerOpen(): if msConnPoolRequest() returned NULL then
-   manually open a connection to the database (ie. PQconnectcb()) and then
-   register this handle with the pool API by calling msmsConnPoolRegister().
+   check msConnPoolCanOpen() (it returns MS_FALSE with an error set when
+   CONNECTION_MAX is reached), manually open a connection to the database
+   (ie. PQconnectcb()) and then register this handle with the pool API by
+   calling msmsConnPoolRegister().
+
+      if( !msConnPoolCanOpen( layer ) )
+         return MS_FAILURE;
 
       layerinfo->conn = PQconnectdb( layer->connection );
 
@@ -129,8 +134,44 @@ o The connection pooling API will let a connection be used/referenced multiple
   between different threads concurrently.  But if a connection is released
   by one thread, it is available for use by another thread.
 
+o Connections are grouped by connection type and connection string into
+  pool keys held in a small hash table, so requests and releases only look
+  at the connections opened for the same key.  Unreferenced connections are
+  kept on a per-key free list, most recently used first.
+
+o The following additional PROCESSING options control pooled connections:
+
+    CONNECTION_IDLE_TIMEOUT=<seconds>: with CLOSE_CONNECTION=DEFER, close
+      unreferenced connections that have not been used for this long.
+
+    CONNECTION_MAX=<n>: don't open more than n connections for the same
+      connection string.  The limit is read from the requesting layer on
+      every request, so layers sharing a connection string may each set
+      their own.  A request that would exceed the limit waits for
+      another thread to release a connection.  A request that misses takes
+      a slot for its thread under the lock, which msConnPoolRegister()
+      then fills.  A slot whose connection was never registered is given
+      up when the same thread requests again, or after the wait timeout.
+
+    CONNECTION_WAIT_TIMEOUT=<seconds>: how long to wait for a connection
+      when CONNECTION_MAX is reached (default 30).  After the timeout the
+      request fails and msConnPoolCanOpen() returns MS_FALSE.  Builds
+      without thread support can't wait and fail right away.
+
+    CONNECTION_PING=ON: check a pooled connection is still alive before
+      handing it out again.  Only effective for drivers that registered a
+      ping callback with msConnPoolSetPing() (ie. mappostgis.c).  Dead
+      connections are closed and another one is tried.
+
+o Hit, miss, wait, close and eviction counters are kept for the whole
+  process.  msConnPoolDumpStats() writes them to the debug log, which is
+  also done by msConnPoolFinalCleanup() when the global debug level is
+  MS_DEBUGLEVEL_TUNING or higher.
+
  ****************************************************************************/
 
+#include <ctype.h>
+
 #include "mapserver.h"
 #include "mapthread.h"
 
@@ -143,10 +184,21 @@ o The connection pooling API will let a connection be used/referenced multiple
 #define MS_LIFE_ZEROREF       -2
 #define MS_LIFE_SINGLE        -3
 
-typedef struct {
-  enum MS_CONNECTION_TYPE connectiontype;
-  char *connection;
+#define MS_POOL_HASHSIZE      41
+#define MS_POOL_WAIT_TIMEOUT  30
+
+typedef struct connectionPoolKeyObj connectionPoolKeyObj;
+typedef struct connectionObj connectionObj;
+typedef struct connectionSlotObj connectionSlotObj;
+
+/* a connection a thread was allowed to open but has not registered yet */
+struct connectionSlotObj {
+  int   thread_id;
+  time_t expires;
+  connectionSlotObj *next;
+};
 
+struct connectionObj {
   int   lifespan;
   int   ref_count;
   int   thread_id;
@@ -157,15 +209,203 @@ typedef struct {
   void  *conn_handle;
 
   void  (*close)( void * );
-} connectionObj;
+  int   (*ping)( void * );
+
+  connectionPoolKeyObj *key;
+  connectionObj *next;
+};
+
+struct connectionPoolKeyObj {
+  enum MS_CONNECTION_TYPE connectiontype;
+  char *connection;
+
+  int   count;            /* open connections, busy or idle */
+  int   max_connections;  /* of the last request, 0 means no limit */
+
+  connectionSlotObj *slots; /* reserved under CONNECTION_MAX */
+  int   nslots;
+
+  connectionObj *busy;    /* referenced connections */
+  connectionObj *idle;    /* free list, most recently used first */
+
+  connectionPoolKeyObj *next;
+};
+
+typedef struct {
+  long hits;
+  long misses;
+  long waits;
+  long wait_timeouts;
+  long closes;
+  long idle_evictions;
+  long ping_failures;
+} connectionPoolStatsObj;
 
 /*
 ** These static structures are protected by the TLOCK_POOL mutex.
 */
 
-static int connectionCount = 0;
-static int connectionMax = 0;
-static connectionObj *connections = NULL;
+static connectionPoolKeyObj *poolKeys[MS_POOL_HASHSIZE];
+static connectionPoolStatsObj poolStats;
+static time_t lastIdleCheck = 0;
+
+/************************************************************************/
+/*                          msConnPoolHash()                            */
+/*                                                                      */
+/*      Connection strings are compared case insensitively, so hash     */
+/*      them that way too.                                              */
+/************************************************************************/
+
+static unsigned msConnPoolHash( enum MS_CONNECTION_TYPE connectiontype,
+                                const char *connection )
+
+{
+  unsigned hashval = (unsigned) connectiontype;
+
+  for( ; *connection != '\0'; connection++ )
+    hashval = tolower((unsigned char) *connection) + 31 * hashval;
+
+  return hashval % MS_POOL_HASHSIZE;
+}
+
+/************************************************************************/
+/*                          msConnPoolGetKey()                          */
+/*                                                                      */
+/*      Find the pool key for the layer's connection, optionally        */
+/*      creating it.  Caller must hold TLOCK_POOL.                      */
+/************************************************************************/
+
+static connectionPoolKeyObj *msConnPoolGetKey( layerObj *layer, int create )
+
+{
+  unsigned hashval = msConnPoolHash( layer->connectiontype, layer->connection );
+  connectionPoolKeyObj *key;
+
+  for( key = poolKeys[hashval]; key != NULL; key = key->next ) {
+    if( key->connectiontype == layer->connectiontype
+        && strcasecmp( key->connection, layer->connection ) == 0 )
+      return key;
+  }
+
+  if( !create )
+    return NULL;
+
+  key = (connectionPoolKeyObj *) calloc( 1, sizeof(connectionPoolKeyObj) );
+  if( key == NULL ) {
+    msSetError(MS_MEMERR, NULL, "msConnPoolGetKey()");
+    return NULL;
+  }
+
+  key->connectiontype = layer->connectiontype;
+  key->connection = msStrdup( layer->connection );
+  key->next = poolKeys[hashval];
+  poolKeys[hashval] = key;
+
+  return key;
+}
+
+/************************************************************************/
+/*                        msConnPoolRemoveKey()                         */
+/*                                                                      */
+/*      Drop a pool key once it has no connections left.                */
+/************************************************************************/
+
+static void msConnPoolRemoveKey( connectionPoolKeyObj *key )
+
+{
+  connectionPoolKeyObj **link =
+    poolKeys + msConnPoolHash( key->connectiontype, key->connection );
+
+  while( *link != NULL && *link != key )
+    link = &((*link)->next);
+
+  if( *link == key )
+    *link = key->next;
+
+  while( key->slots != NULL ) {
+    connectionSlotObj *slot = key->slots;
+    key->slots = slot->next;
+    free( slot );
+  }
+
+  free( key->connection );
+  free( key );
+}
+
+/************************************************************************/
+/*                          msConnPoolUnlink()                          */
+/************************************************************************/
+
+static void msConnPoolUnlink( connectionObj **list, connectionObj *conn )
+
+{
+  while( *list != NULL && *list != conn )
+    list = &((*list)->next);
+
+  if( *list == conn )
+    *list = conn->next;
+
+  conn->next = NULL;
+}
+
+/************************************************************************/
+/*                        msConnPoolDropSlots()                         */
+/*                                                                      */
+/*      Give up the slot held by a thread, and any expired slot.  A     */
+/*      thread that requests again is done with its previous open,      */
+/*      whether it registered the connection or not.  Caller must       */
+/*      hold TLOCK_POOL.                                                */
+/************************************************************************/
+
+static void msConnPoolDropSlots( connectionPoolKeyObj *key, int thread_id,
+                                 time_t now )
+
+{
+  connectionSlotObj **link = &(key->slots);
+
+  while( *link != NULL ) {
+    connectionSlotObj *slot = *link;
+
+    if( slot->thread_id == thread_id || slot->expires <= now ) {
+      *link = slot->next;
+      free( slot );
+      key->nslots--;
+    } else
+      link = &(slot->next);
+  }
+}
+
+/************************************************************************/
+/*                        msConnPoolFindSlot()                          */
+/************************************************************************/
+
+static connectionSlotObj **msConnPoolFindSlot( connectionPoolKeyObj *key,
+    int thread_id )
+
+{
+  connectionSlotObj **link = &(key->slots);
+
+  while( *link != NULL && (*link)->thread_id != thread_id )
+    link = &((*link)->next);
+
+  return *link != NULL ? link : NULL;
+}
+
+/************************************************************************/
+/*                      msConnPoolGetIntegerKey()                       */
+/************************************************************************/
+
+static int msConnPoolGetIntegerKey( layerObj *layer, const char *name,
+                                    int default_value )
+
+{
+  const char *value = msLayerGetProcessingKey( layer, name );
+
+  if( value == NULL )
+    return default_value;
+
+  return atoi( value );
+}
 
 /************************************************************************/
 /*                         msConnPoolRegister()                         */
@@ -179,6 +419,7 @@ void msConnPoolRegister( layerObj *layer,
 
 {
   const char *close_connection = NULL;
+  connectionPoolKeyObj *key = NULL;
   connectionObj *conn = NULL;
 
   if( layer->debug )
@@ -206,33 +447,17 @@ void msConnPoolRegister( layerObj *layer,
     return;
   }
 
-  /* -------------------------------------------------------------------- */
-  /*      Grow the array of connection information objects if needed.     */
-  /* -------------------------------------------------------------------- */
-  msAcquireLock( TLOCK_POOL );
-
-  if( connectionCount == connectionMax ) {
-    connectionMax += 10;
-    connections = (connectionObj *)
-                  realloc(connections,
-                          sizeof(connectionObj) * connectionMax );
-    if( connections == NULL ) {
-      msSetError(MS_MEMERR, NULL, "msConnPoolRegister()");
-      msReleaseLock( TLOCK_POOL );
-      return;
-    }
+  conn = (connectionObj *) calloc( 1, sizeof(connectionObj) );
+  if( conn == NULL ) {
+    msSetError(MS_MEMERR, NULL, "msConnPoolRegister()");
+    return;
   }
 
   /* -------------------------------------------------------------------- */
   /*      Set the new connection information.                             */
   /* -------------------------------------------------------------------- */
-  conn = connections + connectionCount;
-
-  connectionCount++;
-
-  conn->connectiontype = layer->connectiontype;
-  conn->connection = msStrdup( layer->connection );
   conn->close = close_func;
+  conn->ping = NULL;
   conn->ref_count = 1;
   conn->thread_id = msGetThreadId();
   conn->last_used = time(NULL);
@@ -250,9 +475,11 @@ void msConnPoolRegister( layerObj *layer,
 
   if( strcasecmp(close_connection,"NORMAL") == 0 )
     conn->lifespan = MS_LIFE_ZEROREF;
-  else if( strcasecmp(close_connection,"DEFER") == 0 )
-    conn->lifespan = MS_LIFE_FOREVER;
-  else if( strcasecmp(close_connection,"ALWAYS") == 0 )
+  else if( strcasecmp(close_connection,"DEFER") == 0 ) {
+    conn->lifespan = msConnPoolGetIntegerKey( layer, "CONNECTION_IDLE_TIMEOUT", 0 );
+    if( conn->lifespan <= 0 )
+      conn->lifespan = MS_LIFE_FOREVER;
+  } else if( strcasecmp(close_connection,"ALWAYS") == 0 )
     conn->lifespan = MS_LIFE_SINGLE;
   else {
     msDebug("msConnPoolRegister(): "
@@ -265,56 +492,160 @@ void msConnPoolRegister( layerObj *layer,
     conn->lifespan = MS_LIFE_ZEROREF;
   }
 
+  /* -------------------------------------------------------------------- */
+  /*      Add it to the busy list of its pool key.                        */
+  /* -------------------------------------------------------------------- */
+  msAcquireLock( TLOCK_POOL );
+
+  key = msConnPoolGetKey( layer, MS_TRUE );
+  if( key == NULL ) {
+    msReleaseLock( TLOCK_POOL );
+    free( conn );
+    return;
+  }
+
+  /* the connection fills the slot msConnPoolRequest() reserved */
+  {
+    connectionSlotObj **link = msConnPoolFindSlot( key, conn->thread_id );
+    if( link != NULL ) {
+      connectionSlotObj *slot = *link;
+      *link = slot->next;
+      free( slot );
+      key->nslots--;
+    }
+  }
+
+  conn->key = key;
+  conn->next = key->busy;
+  key->busy = conn;
+  key->count++;
+
+  msReleaseLock( TLOCK_POOL );
+}
+
+/************************************************************************/
+/*                         msConnPoolSetPing()                          */
+/*                                                                      */
+/*      Attach a liveness check to an already registered connection.    */
+/*      The callback returns MS_TRUE if the connection is usable and    */
+/*      is only invoked for layers with CONNECTION_PING=ON.             */
+/************************************************************************/
+
+void msConnPoolSetPing( layerObj *layer, void *conn_handle,
+                        int (*ping_func)( void * ) )
+
+{
+  connectionPoolKeyObj *key;
+  connectionObj *conn;
+
+  if( layer->connection == NULL )
+    return;
+
+  msAcquireLock( TLOCK_POOL );
+
+  key = msConnPoolGetKey( layer, MS_FALSE );
+  if( key != NULL ) {
+    for( conn = key->busy; conn != NULL; conn = conn->next ) {
+      if( conn->conn_handle == conn_handle ) {
+        conn->ping = ping_func;
+        break;
+      }
+    }
+  }
+
   msReleaseLock( TLOCK_POOL );
 }
 
 /************************************************************************/
 /*                          msConnPoolClose()                           */
 /*                                                                      */
-/*      Close the indicated connection.  The index in the connection    */
-/*      table is passed.  Remove the connection from the table as       */
-/*      well.                                                           */
+/*      Close the indicated connection and remove it from its pool      */
+/*      key.  The key is freed when it has no connections left.         */
+/*      Caller must hold TLOCK_POOL.                                    */
 /************************************************************************/
 
-static void msConnPoolClose( int conn_index )
+static void msConnPoolClose( connectionObj *conn )
 
 {
-  connectionObj *conn = connections + conn_index;
+  connectionPoolKeyObj *key = conn->key;
 
   if( conn->ref_count > 0 ) {
     if( conn->debug )
       msDebug( "msConnPoolClose(): "
                "Closing connection %s even though ref_count=%d.\n",
-               conn->connection, conn->ref_count );
+               key->connection, conn->ref_count );
 
     msSetError( MS_MISCERR,
                 "Closing connection %s even though ref_count=%d.",
                 "msConnPoolClose()",
-                conn->connection,
+                key->connection,
                 conn->ref_count );
   }
 
   if( conn->debug )
     msDebug( "msConnPoolClose(%s,%p)\n",
-             conn->connection, conn->conn_handle );
+             key->connection, conn->conn_handle );
 
   if( conn->close != NULL )
     conn->close( conn->conn_handle );
 
-  /* free malloced() stuff in this connection */
-  free( conn->connection );
-
-  connectionCount--;
-  if( connectionCount == 0 ) {
-    /* if there are no connections left we will "cleanup".  */
-    connectionMax = 0;
-    free( connections );
-    connections = NULL;
-  } else {
-    /* move the last connection in place of our now closed one */
-    memcpy( connections + conn_index,
-            connections + connectionCount,
-            sizeof(connectionObj) );
+  poolStats.closes++;
+
+  msConnPoolUnlink( conn->ref_count > 0 ? &(key->busy) : &(key->idle), conn );
+  free( conn );
+
+  key->count--;
+  if( key->count == 0 && key->slots == NULL )
+    msConnPoolRemoveKey( key );
+
+  /* someone may be waiting for the connection count to drop */
+  msSignalLock( TLOCK_POOL );
+}
+
+/************************************************************************/
+/*                         msConnPoolCloseIdle()                        */
+/*                                                                      */
+/*      Close unreferenced connections whose idle timeout has           */
+/*      expired.  Only runs once a second.  Caller must hold            */
+/*      TLOCK_POOL.                                                     */
+/************************************************************************/
+
+static void msConnPoolCloseIdle()
+
+{
+  time_t now = time(NULL);
+  int  i;
+
+  if( now == lastIdleCheck )
+    return;
+  lastIdleCheck = now;
+
+  for( i = 0; i < MS_POOL_HASHSIZE; i++ ) {
+    connectionPoolKeyObj *key = poolKeys[i];
+
+    while( key != NULL ) {
+      connectionPoolKeyObj *next_key = key->next;
+      connectionObj *conn = key->idle;
+
+      /* closing the last connection frees the key, so stop as soon */
+      /* as that could have happened.                               */
+      while( conn != NULL ) {
+        connectionObj *next = conn->next;
+        int last = (key->count == 1);
+
+        if( conn->lifespan > 0 && now - conn->last_used > conn->lifespan ) {
+          if( conn->debug )
+            msDebug( "msConnPoolCloseIdle(): %s idle for %ld seconds.\n",
+                     key->connection, (long) (now - conn->last_used) );
+          poolStats.idle_evictions++;
+          msConnPoolClose( conn );
+          if( last )
+            break;
+        }
+        conn = next;
+      }
+      key = next_key;
+    }
   }
 }
 
@@ -330,8 +661,11 @@ static void msConnPoolClose( int conn_index )
 void *msConnPoolRequest( layerObj *layer )
 
 {
-  int  i;
   const char* close_connection;
+  const char* ping;
+  int  thread_id = msGetThreadId();
+  int  max_connections, wait_timeout, do_ping;
+  time_t deadline;
 
   if( layer->connection == NULL )
     return NULL;
@@ -341,51 +675,184 @@ void *msConnPoolRequest( layerObj *layer )
   if( close_connection && strcasecmp(close_connection,"ALWAYS") == 0 )
     return NULL;
 
+  max_connections = msConnPoolGetIntegerKey( layer, "CONNECTION_MAX", 0 );
+  wait_timeout = msConnPoolGetIntegerKey( layer, "CONNECTION_WAIT_TIMEOUT",
+                                          MS_POOL_WAIT_TIMEOUT );
+  ping = msLayerGetProcessingKey( layer, "CONNECTION_PING" );
+  do_ping = (ping != NULL && strcasecmp(ping,"ON") == 0);
+  deadline = time(NULL) + wait_timeout;
+
   msAcquireLock( TLOCK_POOL );
-  for( i = 0; i < connectionCount; i++ ) {
-    connectionObj *conn = connections + i;
-
-    if( layer->connectiontype == conn->connectiontype
-        && strcasecmp( layer->connection, conn->connection ) == 0
-        && (conn->ref_count == 0 || conn->thread_id == msGetThreadId())
-        && conn->lifespan != MS_LIFE_SINGLE) {
-      void *conn_handle = NULL;
-
-      conn->ref_count++;
-      conn->thread_id = msGetThreadId();
-      conn->last_used = time(NULL);
-
-      if( layer->debug ) {
-        msDebug( "msConnPoolRequest(%s,%s) -> got %p\n",
-                 layer->name, layer->connection, conn->conn_handle );
-        conn->debug = layer->debug;
+
+  msConnPoolCloseIdle();
+
+  for( ;; ) {
+    /* with a cap the key must exist to hold the slot we may reserve */
+    connectionPoolKeyObj *key = msConnPoolGetKey( layer, max_connections > 0 );
+    connectionObj *conn;
+    void *conn_handle;
+
+    if( key == NULL )
+      break;
+
+    /* the cap is the requesting layer's, kept on the key for the stats */
+    key->max_connections = max_connections;
+
+    msConnPoolDropSlots( key, thread_id, time(NULL) );
+
+    /* -------------------------------------------------------------------- */
+    /*      A connection already in use by this thread can be shared.       */
+    /* -------------------------------------------------------------------- */
+    for( conn = key->busy; conn != NULL; conn = conn->next ) {
+      if( conn->thread_id == thread_id && conn->lifespan != MS_LIFE_SINGLE )
+        break;
+    }
+
+    /* -------------------------------------------------------------------- */
+    /*      Otherwise take the most recently used one from the free list.   */
+    /* -------------------------------------------------------------------- */
+    if( conn == NULL && key->idle != NULL ) {
+      conn = key->idle;
+      key->idle = conn->next;
+      conn->next = key->busy;
+      key->busy = conn;
+    }
+
+    if( conn == NULL ) {
+      /* -------------------------------------------------------------------- */
+      /*      Nothing free.  If we are at the cap wait for a release.         */
+      /* -------------------------------------------------------------------- */
+      time_t now = time(NULL);
+
+      if( max_connections <= 0 )
+        break;
+
+      if( key->count + key->nslots < max_connections ) {
+        /* take the slot now, msConnPoolRegister() fills it */
+        connectionSlotObj *slot =
+          (connectionSlotObj *) calloc( 1, sizeof(connectionSlotObj) );
+        if( slot == NULL ) {
+          msSetError(MS_MEMERR, NULL, "msConnPoolRequest()");
+          break;
+        }
+        slot->thread_id = thread_id;
+        slot->expires = now + (wait_timeout > 0 ? wait_timeout : MS_POOL_WAIT_TIMEOUT);
+        slot->next = key->slots;
+        key->slots = slot;
+        key->nslots++;
+        break;
       }
 
-      conn_handle = conn->conn_handle;
+      if( now >= deadline ) {
+        poolStats.wait_timeouts++;
+        if( layer->debug )
+          msDebug( "msConnPoolRequest(%s,%s): timed out waiting for one of "
+                   "%d connections.\n",
+                   layer->name, layer->connection, key->count );
+        msSetError( MS_MISCERR,
+                    "Timed out waiting for one of the %d connections allowed "
+                    "by CONNECTION_MAX on layer %s.",
+                    "msConnPoolRequest()",
+                    max_connections, layer->name );
+        break;
+      }
+
+      /* msWaitLock() returns immediately in non thread-safe builds */
+      poolStats.waits++;
+      if( !msWaitLock( TLOCK_POOL, (int) (deadline - now) * 1000 ) )
+        deadline = now;
+      continue;
+    }
+
+    conn->ref_count++;
+    conn->thread_id = thread_id;
+    conn->last_used = time(NULL);
+    conn_handle = conn->conn_handle;
+
+    if( layer->debug ) {
+      msDebug( "msConnPoolRequest(%s,%s) -> got %p\n",
+               layer->name, layer->connection, conn_handle );
+      conn->debug = layer->debug;
+    }
+
+    /* -------------------------------------------------------------------- */
+    /*      Check a connection coming off the free list is still alive.     */
+    /*      The ping may involve a round trip so don't hold the lock.       */
+    /* -------------------------------------------------------------------- */
+    if( do_ping && conn->ping != NULL && conn->ref_count == 1 ) {
+      int (*ping_func)( void * ) = conn->ping;
+      int alive;
 
       msReleaseLock( TLOCK_POOL );
-      return conn_handle;
+      alive = ping_func( conn_handle );
+      msAcquireLock( TLOCK_POOL );
+
+      if( !alive ) {
+        if( layer->debug )
+          msDebug( "msConnPoolRequest(%s,%s): ping failed on %p, closing.\n",
+                   layer->name, layer->connection, conn_handle );
+        poolStats.ping_failures++;
+        conn->ref_count = 0;
+        msConnPoolUnlink( &(conn->key->busy), conn );
+        conn->next = conn->key->idle;
+        conn->key->idle = conn;
+        msConnPoolClose( conn );
+        continue;
+      }
     }
+
+    poolStats.hits++;
+    msReleaseLock( TLOCK_POOL );
+    return conn_handle;
   }
 
+  poolStats.misses++;
   msReleaseLock( TLOCK_POOL );
 
   return NULL;
 }
 
+/************************************************************************/
+/*                         msConnPoolCanOpen()                          */
+/*                                                                      */
+/*      To be called by a driver when msConnPoolRequest() returned      */
+/*      NULL, before it opens a new connection.  Returns MS_FALSE       */
+/*      when CONNECTION_MAX applies and msConnPoolRequest() did not     */
+/*      reserve a slot for this thread (the error is already set).      */
+/************************************************************************/
+
+int msConnPoolCanOpen( layerObj *layer )
+
+{
+  connectionPoolKeyObj *key;
+  int  can_open;
+
+  if( layer->connection == NULL
+      || msConnPoolGetIntegerKey( layer, "CONNECTION_MAX", 0 ) <= 0 )
+    return MS_TRUE;
+
+  msAcquireLock( TLOCK_POOL );
+  key = msConnPoolGetKey( layer, MS_FALSE );
+  can_open = (key != NULL
+              && msConnPoolFindSlot( key, msGetThreadId() ) != NULL);
+  msReleaseLock( TLOCK_POOL );
+
+  return can_open;
+}
+
 /************************************************************************/
 /*                         msConnPoolRelease()                          */
 /*                                                                      */
 /*      Release the passed connection for the given layer.              */
 /*      Internally the reference count is dropped, and the              */
-/*      connection may be closed.  We assume the caller has already     */
-/*      acquired the pool lock.                                         */
+/*      connection may be closed or put back on the free list.          */
 /************************************************************************/
 
 void msConnPoolRelease( layerObj *layer, void *conn_handle )
 
 {
-  int  i;
+  connectionPoolKeyObj *key;
+  connectionObj *conn = NULL;
 
   if( layer->debug )
     msDebug( "msConnPoolRelease(%s,%s,%p)\n",
@@ -395,24 +862,34 @@ void msConnPoolRelease( layerObj *layer, void *conn_handle )
     return;
 
   msAcquireLock( TLOCK_POOL );
-  for( i = 0; i < connectionCount; i++ ) {
-    connectionObj *conn = connections + i;
 
-    if( layer->connectiontype == conn->connectiontype
-        && strcasecmp( layer->connection, conn->connection ) == 0
-        && conn->conn_handle == conn_handle ) {
-      conn->ref_count--;
-      conn->last_used = time(NULL);
+  key = msConnPoolGetKey( layer, MS_FALSE );
+  if( key != NULL ) {
+    for( conn = key->busy; conn != NULL; conn = conn->next ) {
+      if( conn->conn_handle == conn_handle )
+        break;
+    }
+  }
 
-      if( conn->ref_count == 0 )
-        conn->thread_id = 0;
+  if( conn != NULL ) {
+    conn->ref_count--;
+    conn->last_used = time(NULL);
 
-      if( conn->ref_count == 0 && (conn->lifespan == MS_LIFE_ZEROREF || conn->lifespan == MS_LIFE_SINGLE) )
-        msConnPoolClose( i );
+    if( conn->ref_count == 0 ) {
+      conn->thread_id = 0;
 
-      msReleaseLock( TLOCK_POOL );
-      return;
+      msConnPoolUnlink( &(key->busy), conn );
+      conn->next = key->idle;
+      key->idle = conn;
+
+      if( conn->lifespan == MS_LIFE_ZEROREF || conn->lifespan == MS_LIFE_SINGLE )
+        msConnPoolClose( conn );
+      else
+        msSignalLock( TLOCK_POOL );
     }
+
+    msReleaseLock( TLOCK_POOL );
+    return;
   }
 
   msReleaseLock( TLOCK_POOL );
@@ -442,15 +919,63 @@ void msConnPoolCloseUnreferenced()
   /* msDebug( "msConnPoolCloseUnreferenced()\n" ); */
 
   msAcquireLock( TLOCK_POOL );
-  for( i = connectionCount - 1; i >= 0; i-- ) {
-    connectionObj *conn = connections + i;
+  for( i = 0; i < MS_POOL_HASHSIZE; i++ ) {
+    connectionPoolKeyObj *key = poolKeys[i];
+
+    while( key != NULL ) {
+      connectionPoolKeyObj *next_key = key->next;
+
+      /* the key goes away with its last connection */
+      while( key->idle != NULL ) {
+        int last = (key->count == 1);
+        msConnPoolClose( key->idle );
+        if( last )
+          break;
+      }
+      key = next_key;
+    }
+  }
+  msReleaseLock( TLOCK_POOL );
+}
 
-    if( conn->ref_count == 0 ) {
-      /* for now we don't assume the locks are re-entrant, so release */
-      /* it so msConnPoolClose() can get it.  */
-      msConnPoolClose( i );
+/************************************************************************/
+/*                        msConnPoolDumpStats()                         */
+/*                                                                      */
+/*      Write the pool counters and currently open connections to      */
+/*      the debug log.                                                  */
+/************************************************************************/
+
+void msConnPoolDumpStats()
+
+{
+  int  i;
+
+  msAcquireLock( TLOCK_POOL );
+
+  msDebug( "msConnPoolDumpStats(): hits=%ld misses=%ld waits=%ld "
+           "wait_timeouts=%ld closes=%ld idle_evictions=%ld "
+           "ping_failures=%ld\n",
+           poolStats.hits, poolStats.misses, poolStats.waits,
+           poolStats.wait_timeouts, poolStats.closes,
+           poolStats.idle_evictions, poolStats.ping_failures );
+
+  for( i = 0; i < MS_POOL_HASHSIZE; i++ ) {
+    connectionPoolKeyObj *key;
+
+    for( key = poolKeys[i]; key != NULL; key = key->next ) {
+      connectionObj *conn;
+      int busy = 0, idle = 0;
+
+      for( conn = key->busy; conn != NULL; conn = conn->next )
+        busy++;
+      for( conn = key->idle; conn != NULL; conn = conn->next )
+        idle++;
+
+      msDebug( "msConnPoolDumpStats():   type=%d busy=%d idle=%d max=%d\n",
+               (int) key->connectiontype, busy, idle, key->max_connections );
     }
   }
+
   msReleaseLock( TLOCK_POOL );
 }
 
@@ -464,11 +989,24 @@ void msConnPoolCloseUnreferenced()
 void msConnPoolFinalCleanup()
 
 {
+  int  i;
+
   /* this really needs to be commented out before commiting.  */
   /* msDebug( "msConnPoolFinalCleanup()\n" ); */
 
+  if( msGetGlobalDebugLevel() >= MS_DEBUGLEVEL_TUNING )
+    msConnPoolDumpStats();
+
   msAcquireLock( TLOCK_POOL );
-  while( connectionCount > 0 )
-    msConnPoolClose( 0 );
+  for( i = 0; i < MS_POOL_HASHSIZE; i++ ) {
+    while( poolKeys[i] != NULL ) {
+      connectionPoolKeyObj *key = poolKeys[i];
+      if( key->busy == NULL && key->idle == NULL )
+        msConnPoolRemoveKey( key ); /* only reserved slots left */
+      else
+        msConnPoolClose( key->busy != NULL ? key->busy : key->idle );
+    }
+  }
+  memset( &poolStats, 0, sizeof(poolStats) );
   msReleaseLock( TLOCK_POOL );
 }
@@ -51,6 +51,12 @@
 ** msPostGISNextShape reads a row, increments layerinfo->rownum, and returns
 ** MS_SUCCESS, until rownum reaches ntuples, and it returns MS_DONE instead.
 **
+** FILTERs written in MapServer expression syntax (referencing attributes as
+** [item]) are translated to SQL with msExpressionToSQL. If that isn't possible
+** the filter is left out of the query and evaluated in msPostGISNextShape,
+** and paging is left to MapServer. Any other FILTER is passed through as
+** native SQL.
+**
 */
 
 /* GNU needs this for strcasestr */
@@ -89,6 +95,27 @@ void msPostGISCloseConnection(void *pgconn)
   PQfinish((PGconn*)pgconn);
 }
 
+/*
+** msPostGISPingConnection()
+**
+** Handler registered with msConnPoolSetPing so that the pool can
+** check an idle connection is still usable before reusing it.
+*/
+static int msPostGISPingConnection(void *pgconn)
+{
+  PGresult *pgresult = NULL;
+  int alive;
+
+  if (PQstatus((PGconn*)pgconn) != CONNECTION_OK)
+    return MS_FALSE;
+
+  pgresult = PQexec((PGconn*)pgconn, "SELECT 1");
+  alive = (pgresult && PQresultStatus(pgresult) == PGRES_TUPLES_OK);
+  if (pgresult) PQclear(pgresult);
+
+  return alive;
+}
+
 /*
 ** msPostGISCreateLayerInfo()
 */
@@ -106,6 +133,9 @@ msPostGISLayerInfo *msPostGISCreateLayerInfo(void)
   layerinfo->rownum = 0;
   layerinfo->version = 0;
   layerinfo->paging = MS_TRUE;
+  layerinfo->clientfilter = MS_FALSE;
+  layerinfo->numericitems = NULL;
+  layerinfo->numnumericitems = -1;
   return layerinfo;
 }
 
@@ -121,6 +151,7 @@ void msPostGISFreeLayerInfo(layerObj *layer)
   if ( layerinfo->srid ) free(layerinfo->srid);
   if ( layerinfo->geomcolumn ) free(layerinfo->geomcolumn);
   if ( layerinfo->fromsource ) free(layerinfo->fromsource);
+  if ( layerinfo->numericitems ) msFreeCharArray(layerinfo->numericitems, layerinfo->numnumericitems);
   if ( layerinfo->pgresult ) PQclear(layerinfo->pgresult);
   if ( layerinfo->pgconn ) msConnPoolRelease(layer, layerinfo->pgconn);
   free(layerinfo);
@@ -1859,6 +1890,44 @@ char *msPostGISBuildSQLFrom(layerObj *layer, rectObj *rect)
   return strFrom;
 }
 
+/*
+** msPostGISIsExpressionFilter()
+**
+** A FILTER is taken as a MapServer expression (rather than native SQL in
+** parentheses) if it is of MS_EXPRESSION type, wasn't built as SQL by
+** MapServer itself (OGC filters, SLD, time filters, see MS_EXP_NATIVE)
+** and its tokens reference attributes with the [item] syntax. Brackets
+** inside SQL string literals don't tokenize as attribute bindings.
+*/
+static void msPostGISReadNumericItems(layerObj *layer);
+
+static int msPostGISIsExpressionFilter(layerObj *layer)
+{
+  expressionObj tmp;
+  tokenListNodeObjPtr node;
+  int bindings = MS_FALSE;
+
+  if (layer->filter.type != MS_EXPRESSION || !layer->filter.string ||
+      (layer->filter.flags & MS_EXP_NATIVE))
+    return MS_FALSE;
+
+  initExpression(&tmp);
+  tmp.string = msStrdup(layer->filter.string);
+  tmp.type = MS_EXPRESSION;
+  if (msTokenizeExpression(&tmp, NULL, NULL) == MS_SUCCESS) {
+    for (node = tmp.tokens; node != NULL; node = node->next) {
+      if (node->token == MS_TOKEN_BINDING_DOUBLE || node->token == MS_TOKEN_BINDING_INTEGER ||
+          node->token == MS_TOKEN_BINDING_STRING || node->token == MS_TOKEN_BINDING_TIME) {
+        bindings = MS_TRUE;
+        break;
+      }
+    }
+  }
+  freeExpression(&tmp);
+
+  return bindings;
+}
+
 /*
 ** msPostGISBuildSQLWhere()
 **
@@ -1868,6 +1937,7 @@ char *msPostGISBuildSQLWhere(layerObj *layer, rectObj *rect, long *uid)
 {
   char *strRect = 0;
   char *strFilter = 0;
+  char *strFilterSQL = 0;
   char *strUid = 0;
   char *strWhere = 0;
   char *strLimit = 0;
@@ -1894,8 +1964,24 @@ char *msPostGISBuildSQLWhere(layerObj *layer, rectObj *rect, long *uid)
     return NULL;
   }
 
+  /* Translate MapServer expressions, or leave them to msPostGISLayerNextShape. */
+  layerinfo->clientfilter = MS_FALSE;
+  if ( msPostGISIsExpressionFilter(layer) ) {
+    msPostGISReadNumericItems(layer);
+    strFilterSQL = msExpressionToSQL(&(layer->filter), MS_SQL_DIALECT_POSTGRESQL,
+                                     layerinfo->numericitems, layerinfo->numnumericitems);
+    if ( ! strFilterSQL ) {
+      layerinfo->clientfilter = MS_TRUE;
+      if (layer->debug) {
+        msDebug("msPostGISBuildSQLWhere: FILTER %s can't be translated to SQL, evaluating it locally.\n", layer->filter.string);
+      }
+    }
+  } else if ( layer->filter.string ) {
+    strFilterSQL = msStrdup(layer->filter.string);
+  }
+
   /* Populate strLimit, if necessary. */
-  if ( layerinfo->paging && layer->maxfeatures >= 0 ) {
+  if ( layerinfo->paging && !layerinfo->clientfilter && layer->maxfeatures >= 0 ) {
     static char *strLimitTemplate = " limit %d";
     strLimit = msSmallMalloc(strlen(strLimitTemplate) + 12);
     sprintf(strLimit, strLimitTemplate, layer->maxfeatures);
@@ -1903,7 +1989,7 @@ char *msPostGISBuildSQLWhere(layerObj *layer, rectObj *rect, long *uid)
   }
 
   /* Populate strOffset, if necessary. */
-  if ( layerinfo->paging && layer->startindex > 0 ) {
+  if ( layerinfo->paging && !layerinfo->clientfilter && layer->startindex > 0 ) {
     static char *strOffsetTemplate = " offset %d";
     strOffset = msSmallMalloc(strlen(strOffsetTemplate) + 12);
     sprintf(strOffset, strOffsetTemplate, layer->startindex-1);
@@ -1939,11 +2025,12 @@ char *msPostGISBuildSQLWhere(layerObj *layer, rectObj *rect, long *uid)
   }
 
   /* Populate strFilter, if necessary. */
-  if ( layer->filter.string ) {
+  if ( strFilterSQL ) {
     static char *strFilterTemplate = "(%s)";
-    strFilter = (char*)msSmallMalloc(strlen(strFilterTemplate) + strlen(layer->filter.string));
-    sprintf(strFilter, strFilterTemplate, layer->filter.string);
+    strFilter = (char*)msSmallMalloc(strlen(strFilterTemplate) + strlen(strFilterSQL));
+    sprintf(strFilter, strFilterTemplate, strFilterSQL);
     strFilterLength = strlen(strFilter);
+    free(strFilterSQL);
   }
 
   /* Populate strUid, if necessary. */
@@ -2267,6 +2354,12 @@ int msPostGISLayerOpen(layerObj *layer)
       return MS_FAILURE;
     }
 
+    /* CONNECTION_MAX reached, the error is already set. */
+    if (!msConnPoolCanOpen(layer)) {
+      free(layerinfo);
+      return MS_FAILURE;
+    }
+
     /*
     ** Decrypt any encrypted token in connection string and attempt to connect.
     */
@@ -2308,6 +2401,7 @@ int msPostGISLayerOpen(layerObj *layer)
 
     /* Save this connection in the pool for later. */
     msConnPoolRegister(layer, layerinfo->pgconn, msPostGISCloseConnection);
+    msConnPoolSetPing(layer, layerinfo->pgconn, msPostGISPingConnection);
   } else {
     /* Connection in the pool should be tested to see if backend is alive. */
     if( PQstatus(layerinfo->pgconn) != CONNECTION_OK ) {
@@ -2593,6 +2687,11 @@ int msPostGISLayerNextShape(layerObj *layer, shapeObj *shape)
     if (layerinfo->rownum < PQntuples(layerinfo->pgresult)) {
       /* Retrieve this shape, cursor access mode. */
       msPostGISReadShape(layer, shape);
+      if( shape->type != MS_SHAPE_NULL && layerinfo->clientfilter &&
+          msEvalExpression(layer, shape, &(layer->filter), layer->filteritemindex) != MS_TRUE ) {
+        msFreeShape(shape); /* filter wasn't part of the SQL */
+        shape->type = MS_SHAPE_NULL;
+      }
       if( shape->type != MS_SHAPE_NULL ) {
         (layerinfo->rownum)++; /* move to next shape */
         return MS_SUCCESS;
@@ -2803,6 +2902,57 @@ int msPostGISLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
 #endif
 
 #ifdef USE_POSTGIS
+/*
+** msPostGISReadNumericItems()
+**
+** Find the numeric columns of the record source, once per layer open, for
+** the FILTER translation. MapServer compares the other columns as numbers
+** by converting their text, which SQL can't do. If the query fails no
+** column is taken as numeric and such FILTERs are evaluated locally.
+*/
+static void msPostGISReadNumericItems(layerObj *layer)
+{
+  msPostGISLayerInfo *layerinfo = (msPostGISLayerInfo *) layer->layerinfo;
+  static char *strSQLTemplate = "select * from %s where false limit 0";
+  PGresult *pgresult;
+  char *sql, *strFrom;
+  rectObj rect;
+  int t;
+
+  if ( layerinfo->numnumericitems >= 0 )
+    return;
+  layerinfo->numnumericitems = 0;
+
+  if ( ! layerinfo->fromsource && msPostGISParseData(layer) != MS_SUCCESS )
+    return;
+
+  rect.minx = rect.miny = rect.maxx = rect.maxy = 0.0;
+  strFrom = msPostGISReplaceBoxToken(layer, &rect, layerinfo->fromsource);
+  sql = (char*) msSmallMalloc(strlen(strSQLTemplate) + strlen(strFrom));
+  sprintf(sql, strSQLTemplate, strFrom);
+  free(strFrom);
+
+  if (layer->debug) {
+    msDebug("msPostGISReadNumericItems executing SQL: %s\n", sql);
+  }
+
+  pgresult = PQexecParams(layerinfo->pgconn, sql, 0, NULL, NULL, NULL, NULL, 0);
+  if ( pgresult && PQresultStatus(pgresult) == PGRES_TUPLES_OK ) {
+    layerinfo->numericitems = (char**) msSmallMalloc(sizeof(char*) * (PQnfields(pgresult) + 1));
+    for ( t = 0; t < PQnfields(pgresult); t++ ) {
+      int oid = PQftype(pgresult, t);
+      if ( oid == INT2OID || oid == INT4OID || oid == INT8OID ||
+           oid == FLOAT4OID || oid == FLOAT8OID || oid == NUMERICOID )
+        layerinfo->numericitems[layerinfo->numnumericitems++] = msStrdup(PQfname(pgresult, t));
+    }
+  } else if (layer->debug) {
+    msDebug("msPostGISReadNumericItems: %s", PQerrorMessage(layerinfo->pgconn));
+  }
+
+  if (pgresult) PQclear(pgresult);
+  free(sql);
+}
+
 static void
 msPostGISPassThroughFieldDefinitions( layerObj *layer,
                                       PGresult *pgresult )
@@ -3263,6 +3413,7 @@ int msPostGISLayerSetTimeFilter(layerObj *lp, const char *timestring, const char
       freeExpression(&lp->filter);
       loadExpressionString(&lp->filter, buffer);
     }
+    lp->filter.flags |= MS_EXP_NATIVE;
   }
 
 
@@ -3341,6 +3492,18 @@ int msPostGISGetPaging(layerObj *layer)
   assert( layer->layerinfo != NULL);
 
   layerinfo = (msPostGISLayerInfo *)layer->layerinfo;
+
+  /* LIMIT/OFFSET can't be used if the FILTER is evaluated locally. */
+  if ( layerinfo->paging && msPostGISIsExpressionFilter(layer) ) {
+    char *strFilterSQL;
+    msPostGISReadNumericItems(layer);
+    strFilterSQL = msExpressionToSQL(&(layer->filter), MS_SQL_DIALECT_POSTGRESQL,
+                                     layerinfo->numericitems, layerinfo->numnumericitems);
+    if ( ! strFilterSQL )
+      return MS_FALSE;
+    free(strFilterSQL);
+  }
+
   return layerinfo->paging;
 #else
   msSetError( MS_MISCERR,
@@ -3350,6 +3513,133 @@ int msPostGISGetPaging(layerObj *layer)
 #endif
 }
 
+/*
+** msPostGISLayerGetShapeCount()
+**
+** Registered vtable->LayerGetShapeCount function. Lets the database do the
+** counting with a "select count(*)" over the same FROM and WHERE clauses as
+** msPostGISLayerWhichShapes(), the box test refined with ST_Intersects().
+*/
+int msPostGISLayerGetShapeCount(layerObj *layer, rectObj rect)
+{
+#ifdef USE_POSTGIS
+  msPostGISLayerInfo *layerinfo = NULL;
+  char *strFrom = NULL, *strWhere = NULL, *strSQL = NULL;
+  char *strSRID = NULL, *strBox = NULL;
+  PGresult *pgresult = NULL;
+  char *layer_bind_values[1000];
+  char bind_key[20];
+  char *bind_value;
+  int num_bind_values = 0, paging, bBoxToken, count;
+  size_t sz;
+
+  assert(layer != NULL);
+  assert(layer->layerinfo != NULL);
+
+  if (layer->debug) {
+    msDebug("msPostGISLayerGetShapeCount called.\n");
+  }
+
+  /* Fill out layerinfo with our current DATA state. */
+  if ( msPostGISParseData(layer) != MS_SUCCESS) {
+    return -1;
+  }
+
+  layerinfo = (msPostGISLayerInfo*) layer->layerinfo;
+  bBoxToken = (strstr(layerinfo->fromsource, BOXTOKEN) != NULL);
+
+  /* No LIMIT/OFFSET on the count. */
+  paging = layerinfo->paging;
+  layerinfo->paging = MS_FALSE;
+  strWhere = msPostGISBuildSQLWhere(layer, bBoxToken ? NULL : &rect, NULL);
+  layerinfo->paging = paging;
+  if ( ! strWhere ) {
+    msSetError(MS_MISCERR, "Failed to build SQL 'where'.", "msPostGISLayerGetShapeCount()");
+    return -1;
+  }
+
+  /* A FILTER the database can't evaluate has to be counted here. */
+  if ( layerinfo->clientfilter ) {
+    free(strWhere);
+    return msLayerDefaultGetShapeCount(layer, rect);
+  }
+
+  strFrom = msPostGISBuildSQLFrom(layer, &rect);
+  if ( ! strFrom ) {
+    free(strWhere);
+    msSetError(MS_MISCERR, "Failed to build SQL 'from'.", "msPostGISLayerGetShapeCount()");
+    return -1;
+  }
+
+  if ( ! bBoxToken && layerinfo->geomcolumn ) {
+    strSRID = msPostGISBuildSQLSRID(layer);
+    if ( strSRID )
+      strBox = msPostGISBuildSQLBox(layer, &rect, strSRID);
+    if ( ! strBox ) {
+      free(strSRID);
+      free(strFrom);
+      free(strWhere);
+      msSetError(MS_MISCERR, "Unable to build box SQL.", "msPostGISLayerGetShapeCount()");
+      return -1;
+    }
+  }
+
+  sz = strlen(strFrom) + strlen(strWhere) + (strBox ? strlen(strBox) + strlen(layerinfo->geomcolumn) : 0) + 64;
+  strSQL = (char*)msSmallMalloc(sz);
+  snprintf(strSQL, sz, "select count(*) from %s%s%s", strFrom, strlen(strWhere) ? " where " : "", strWhere);
+  if ( strBox ) {
+    strlcat(strSQL, " and ST_Intersects(", sz);
+    strlcat(strSQL, layerinfo->geomcolumn, sz);
+    strlcat(strSQL, ", ", sz);
+    strlcat(strSQL, strBox, sz);
+    strlcat(strSQL, ")", sz);
+  }
+  free(strSRID);
+  free(strBox);
+  free(strFrom);
+  free(strWhere);
+
+  if (layer->debug) {
+    msDebug("msPostGISLayerGetShapeCount query: %s\n", strSQL);
+  }
+
+  /* the bind values are passed the same way as in msPostGISLayerWhichShapes() */
+  bind_value = msLookupHashTable(&layer->bindvals, "1");
+  while(bind_value != NULL && num_bind_values < 1000) {
+    layer_bind_values[num_bind_values++] = bind_value;
+    sprintf(bind_key, "%d", num_bind_values+1);
+    bind_value = msLookupHashTable(&layer->bindvals, bind_key);
+  }
+
+  if(num_bind_values > 0) {
+    pgresult = PQexecParams(layerinfo->pgconn, strSQL, num_bind_values, NULL, (const char**)layer_bind_values, NULL, NULL, 0);
+  } else {
+    pgresult = PQexecParams(layerinfo->pgconn, strSQL, 0, NULL, NULL, NULL, NULL, 0);
+  }
+
+  if (!pgresult || PQresultStatus(pgresult) != PGRES_TUPLES_OK || PQntuples(pgresult) != 1) {
+    msSetError(MS_QUERYERR, "Error executing query: %s ", "msPostGISLayerGetShapeCount()", PQerrorMessage(layerinfo->pgconn));
+    free(strSQL);
+    if (pgresult) {
+      PQclear(pgresult);
+    }
+    return -1;
+  }
+
+  count = atoi(PQgetvalue(pgresult, 0, 0));
+
+  PQclear(pgresult);
+  free(strSQL);
+
+  return count;
+#else
+  msSetError( MS_MISCERR,
+              "PostGIS support is not available.",
+              "msPostGISLayerGetShapeCount()");
+  return -1;
+#endif
+}
+
 int msPostGISLayerInitializeVirtualTable(layerObj *layer)
 {
   assert(layer != NULL);
@@ -3371,6 +3661,7 @@ int msPostGISLayerInitializeVirtualTable(layerObj *layer)
   layer->vtable->LayerSetTimeFilter = msPostGISLayerSetTimeFilter;
   /* layer->vtable->LayerCreateItems, use default */
   /* layer->vtable->LayerGetNumFeatures, use default */
+  layer->vtable->LayerGetShapeCount = msPostGISLayerGetShapeCount;
 
   /* layer->vtable->LayerGetAutoProjection, use defaut*/
 
@@ -64,6 +64,9 @@ typedef struct {
   int         endian;      /* Endianness of the mapserver host */
   int         version;     /* PostGIS version of the database */
   int         paging;      /* Driver handling of pagination, enabled by default */
+  int         clientfilter; /* FILTER couldn't be translated to SQL, evaluate it in NextShape */
+  char        **numericitems; /* Numeric columns for the FILTER translation, see msPostGISReadNumericItems */
+  int         numnumericitems; /* -1 until read */
 }
 msPostGISLayerInfo;
 
@@ -53,16 +53,213 @@
 
 
 
+/*
+** Join rows are memoized per key value so that a key seen several times
+** during a request costs only one lookup.  On the first miss the keys of
+** the result shapes kept by the query (QUERY_SHAPE_CACHE) are loaded in
+** batches by msPOSTGRESQLJoinPrefetch() (one "WHERE to = ANY($1)" query per
+** MS_POSTGRESQL_JOIN_BATCH keys), anything else is fetched on demand.
+**
+** Batching therefore needs PROCESSING "QUERY_SHAPE_CACHE=ON" on the joined
+** layer: without the copies the join values of the results are only known
+** as the shapes are read one by one, and reading them all up front would
+** cost a second read of every feature.  Such layers get one query per
+** distinct key value.
+*/
+#define MS_POSTGRESQL_JOIN_BUCKETS 1021
+#define MS_POSTGRESQL_JOIN_BATCH 500    /* keys per ANY($1) query */
+#define MS_POSTGRESQL_JOIN_MAXKEYS 20000 /* memoized keys before we start over */
+
+typedef struct msPOSTGRESQLJoinKey {
+  char        *key;
+  int         resolved;       /* MS_TRUE once the rows for key are known */
+  int         numrows;
+  char        ***rows;        /* numrows arrays of join->numitems values */
+  struct msPOSTGRESQLJoinKey *next;
+} msPOSTGRESQLJoinKey;
+
 typedef struct {
   PGconn      *conn;          /* connection to db */
   long        row_num;        /* what row is the NEXT to be read (for random access) */
-  PGresult    *query_result;  /* for fetching rows from the db */
+  msPOSTGRESQLJoinKey *current; /* memoized rows for the prepared value */
+  msPOSTGRESQLJoinKey **buckets; /* memoized join keys */
+  int         numkeys;
+  char        *columns;       /* select list, join-to column first */
   int         from_index;
   char        *to_column;
   char        *from_value;
+  layerObj    *layer;         /* the joined layer, for its result cache */
+  resultCacheObj *prefetched; /* result cache whose keys were already loaded */
   int         layer_debug;    /* there's no debug on the join, so use the layer */
 } msPOSTGRESQLJoinInfo;
 
+static unsigned msPOSTGRESQLJoinHash(const char *key)
+{
+  unsigned hashval = 0;
+
+  for(; *key != '\0'; key++)
+    hashval = *((unsigned char *) key) + 31 * hashval;
+  return hashval % MS_POSTGRESQL_JOIN_BUCKETS;
+}
+
+/*
+** Returns the memo entry for key, creating an unresolved one if requested.
+*/
+static msPOSTGRESQLJoinKey *msPOSTGRESQLJoinGetKey(msPOSTGRESQLJoinInfo *joininfo, const char *key, int create)
+{
+  msPOSTGRESQLJoinKey *entry;
+  unsigned hashval = msPOSTGRESQLJoinHash(key);
+
+  for(entry = joininfo->buckets[hashval]; entry; entry = entry->next) {
+    if(strcmp(entry->key, key) == 0)
+      return entry;
+  }
+  if(!create)
+    return NULL;
+
+  entry = (msPOSTGRESQLJoinKey *) msSmallMalloc(sizeof(msPOSTGRESQLJoinKey));
+  entry->key = msStrdup(key);
+  entry->resolved = MS_FALSE;
+  entry->numrows = 0;
+  entry->rows = NULL;
+  entry->next = joininfo->buckets[hashval];
+  joininfo->buckets[hashval] = entry;
+  joininfo->numkeys++;
+
+  return entry;
+}
+
+static void msPOSTGRESQLJoinAddRow(msPOSTGRESQLJoinKey *entry, PGresult *result, int row, int numitems)
+{
+  int i;
+  char **values = (char **) msSmallMalloc(sizeof(char *) * numitems);
+
+  for(i = 0; i < numitems; i++)
+    values[i] = msStrdup(PQgetvalue(result, row, i));
+
+  entry->rows = (char ***) msSmallRealloc(entry->rows, sizeof(char **) * (entry->numrows + 1));
+  entry->rows[entry->numrows++] = values;
+}
+
+static void msPOSTGRESQLJoinFreeKeys(msPOSTGRESQLJoinInfo *joininfo, int numitems)
+{
+  int i, j;
+  msPOSTGRESQLJoinKey *entry, *next;
+
+  joininfo->current = NULL;
+  joininfo->numkeys = 0;
+  if(!joininfo->buckets)
+    return;
+
+  for(i = 0; i < MS_POSTGRESQL_JOIN_BUCKETS; i++) {
+    for(entry = joininfo->buckets[i]; entry; entry = next) {
+      next = entry->next;
+      for(j = 0; j < entry->numrows; j++)
+        msFreeCharArray(entry->rows[j], numitems);
+      free(entry->rows);
+      free(entry->key);
+      free(entry);
+    }
+    joininfo->buckets[i] = NULL;
+  }
+}
+
+/*
+** Runs "SELECT columns FROM table WHERE to = <filter>" with a single text
+** parameter and returns the result, or NULL after setting an error.
+*/
+static PGresult *msPOSTGRESQLJoinQuery(joinObj *join, const char *filter, const char *param)
+{
+  msPOSTGRESQLJoinInfo *joininfo = join->joininfo;
+  PGresult *result;
+  char *sql;
+
+  sql = (char *) msSmallMalloc(22 + strlen(joininfo->columns) + strlen(join->table) +
+                               strlen(join->to) + strlen(filter));
+  sprintf(sql, "SELECT %s FROM %s WHERE %s = %s", joininfo->columns, join->table, join->to, filter);
+  if(joininfo->layer_debug) {
+    msDebug("msPOSTGRESQLJoinQuery(): executing %s.\n", sql);
+  }
+
+  result = PQexecParams(joininfo->conn, sql, 1, NULL, &param, NULL, NULL, 0);
+  if(!result || PQresultStatus(result) != PGRES_TUPLES_OK) {
+    msSetError(MS_QUERYERR, "Error executing query %s: %s\n",
+               "msPOSTGRESQLJoinQuery()", sql,
+               PQerrorMessage(joininfo->conn));
+    if(result)
+      PQclear(result);
+    free(sql);
+    return NULL;
+  }
+  free(sql);
+
+  return result;
+}
+
+/*
+** Fetches the rows for a batch of unresolved keys with one query.  The
+** parameter is a text[] literal, PostgreSQL coerces it to an array of the
+** join column's type so an index on that column can be used.
+*/
+static int msPOSTGRESQLJoinFetchBatch(joinObj *join, msPOSTGRESQLJoinKey **batch, int numbatch)
+{
+  msPOSTGRESQLJoinInfo *joininfo = join->joininfo;
+  PGresult *result;
+  msPOSTGRESQLJoinKey *entry;
+  char *array, *p;
+  const char *c;
+  size_t length = 3;
+  int i, row_count, inexact = MS_FALSE;
+
+  for(i = 0; i < numbatch; i++)
+    length += 2 * strlen(batch[i]->key) + 3;
+
+  array = p = (char *) msSmallMalloc(length);
+  *p++ = '{';
+  for(i = 0; i < numbatch; i++) {
+    if(i > 0) *p++ = ',';
+    *p++ = '"';
+    for(c = batch[i]->key; *c; c++) {
+      if(*c == '"' || *c == '\\') *p++ = '\\';
+      *p++ = *c;
+    }
+    *p++ = '"';
+  }
+  *p++ = '}';
+  *p = '\0';
+
+  result = msPOSTGRESQLJoinQuery(join, "ANY($1)", array);
+  free(array);
+  if(!result)
+    return MS_FAILURE;
+
+  row_count = PQntuples(result);
+  for(i = 0; i < row_count; i++) {
+    entry = msPOSTGRESQLJoinGetKey(joininfo, PQgetvalue(result, i, 0), MS_FALSE);
+    if(entry && !entry->resolved)
+      msPOSTGRESQLJoinAddRow(entry, result, i, join->numitems);
+    else if(!entry)
+      inexact = MS_TRUE; /* key spelled differently in the table, e.g. '007' vs 7 */
+  }
+  PQclear(result);
+
+  /*
+  ** If some rows could not be matched back to their key textually, keys that
+  ** got no rows are left unresolved and will be looked up one at a time.
+  */
+  for(i = 0; i < numbatch; i++) {
+    if(batch[i]->numrows > 0 || !inexact)
+      batch[i]->resolved = MS_TRUE;
+  }
+
+  if(joininfo->layer_debug) {
+    msDebug("msPOSTGRESQLJoinFetchBatch(): %d keys, %d rows.\n", numbatch, row_count);
+  }
+
+  return MS_SUCCESS;
+}
+
+
 /************************************************************************/
 /*                      msPOSTGRESQLJoinConnect()                       */
 /*                                                                      */
@@ -91,10 +288,15 @@ int msPOSTGRESQLJoinConnect(layerObj *layer, joinObj *join)
   }
   joininfo->conn = NULL;
   joininfo->row_num = 0;
-  joininfo->query_result = NULL;
+  joininfo->current = NULL;
+  joininfo->buckets = (msPOSTGRESQLJoinKey **) msSmallCalloc(MS_POSTGRESQL_JOIN_BUCKETS, sizeof(msPOSTGRESQLJoinKey *));
+  joininfo->numkeys = 0;
+  joininfo->columns = NULL;
   joininfo->from_index = 0;
   joininfo->to_column = join->to;
   joininfo->from_value = NULL;
+  joininfo->layer = layer;
+  joininfo->prefetched = NULL;
   joininfo->layer_debug = layer->debug;
   join->joininfo = joininfo;
 
@@ -144,6 +346,7 @@ int msPOSTGRESQLJoinConnect(layerObj *layer, joinObj *join)
     if(!joininfo->conn) {
       free(joininfo->conn);
     }
+    free(joininfo->buckets);
     free(joininfo);
     join->joininfo = NULL;
     return MS_FAILURE;
@@ -199,6 +402,17 @@ int msPOSTGRESQLJoinConnect(layerObj *layer, joinObj *join)
     }
   }
 
+  /* Write the list of column names, used by every join query. */
+  joininfo->columns = msStrdup("");
+  for(i = 0; i < join->numitems; i++) {
+    joininfo->columns = msStringConcatenate(joininfo->columns, "\"");
+    joininfo->columns = msStringConcatenate(joininfo->columns, join->items[i]);
+    joininfo->columns = msStringConcatenate(joininfo->columns, "\"::text");
+    if(i != join->numitems - 1) {
+      joininfo->columns = msStringConcatenate(joininfo->columns, ", ");
+    }
+  }
+
   /* Determine the index of the join from column. */
   for(i = 0; i < layer->numitems; i++) {
     if(strcasecmp(layer->items[i], join->from) == 0) {
@@ -244,18 +458,13 @@ int msPOSTGRESQLJoinPrepare(joinObj *join, shapeObj *shape)
     return MS_FAILURE;
   }
   joininfo->row_num = 0;
+  joininfo->current = NULL;
 
   /* Free the previous join value, if any. */
   if(joininfo->from_value) {
     free(joininfo->from_value);
   }
 
-  /* Free the previous results, if any. */
-  if(joininfo->query_result) {
-    PQclear(joininfo->query_result);
-    joininfo->query_result = NULL;
-  }
-
   /* Copy the next join value from the shape. */
   joininfo->from_value = msStrdup(shape->values[joininfo->from_index]);
 
@@ -267,6 +476,68 @@ int msPOSTGRESQLJoinPrepare(joinObj *join, shapeObj *shape)
   return MS_SUCCESS;
 }
 
+/************************************************************************/
+/*                      msPOSTGRESQLJoinPrefetch()                      */
+/*                                                                      */
+/* Collects the join values of the result shapes the query kept in the  */
+/* layer's result cache and loads the matching rows with one query per  */
+/* MS_POSTGRESQL_JOIN_BATCH keys, so that the msPOSTGRESQLJoinNext()    */
+/* calls that follow don't each need a round trip to the database.      */
+/* Shapes that weren't kept are not read again, their values are        */
+/* looked up one at a time.  Runs once per result cache.                */
+/************************************************************************/
+
+static int msPOSTGRESQLJoinPrefetch(joinObj *join)
+{
+  msPOSTGRESQLJoinInfo *joininfo = join->joininfo;
+  resultCacheObj *cache = joininfo->layer->resultcache;
+  msPOSTGRESQLJoinKey **batch;
+  shapeObj *shape;
+  int i, from_index, numbatch = 0, status = MS_SUCCESS;
+
+  if(!cache || cache == joininfo->prefetched || !cache->shapes)
+    return MS_SUCCESS;
+  joininfo->prefetched = cache;
+
+  /* the copies carry the values of the items current at query time */
+  for(from_index = 0; from_index < cache->numshapeitems; from_index++) {
+    if(strcasecmp(cache->shapeitems[from_index], join->from) == 0)
+      break;
+  }
+  if(from_index == cache->numshapeitems)
+    return MS_SUCCESS;
+
+  /* Keep the memo bounded, the prefetched keys are never split between two memos. */
+  if(joininfo->numkeys + cache->numresults > MS_POSTGRESQL_JOIN_MAXKEYS)
+    msPOSTGRESQLJoinFreeKeys(joininfo, join->numitems);
+
+  batch = (msPOSTGRESQLJoinKey **) msSmallMalloc(sizeof(msPOSTGRESQLJoinKey *) * MS_POSTGRESQL_JOIN_BATCH);
+
+  for(i = 0; i < cache->numresults && joininfo->numkeys < MS_POSTGRESQL_JOIN_MAXKEYS; i++) {
+    shape = cache->shapes[i];
+    if(!shape || !shape->values || from_index >= shape->numvalues)
+      continue;
+
+    /* keys already known, or already in this batch, are skipped */
+    if(msPOSTGRESQLJoinGetKey(joininfo, shape->values[from_index], MS_FALSE))
+      continue;
+    batch[numbatch++] = msPOSTGRESQLJoinGetKey(joininfo, shape->values[from_index], MS_TRUE);
+
+    if(numbatch == MS_POSTGRESQL_JOIN_BATCH) {
+      if((status = msPOSTGRESQLJoinFetchBatch(join, batch, numbatch)) != MS_SUCCESS)
+        break;
+      numbatch = 0;
+    }
+  }
+
+  if(status == MS_SUCCESS && numbatch > 0)
+    status = msPOSTGRESQLJoinFetchBatch(join, batch, numbatch);
+
+  free(batch);
+
+  return status;
+}
+
 /************************************************************************/
 /*                       msPOSTGRESQLJoinNext()                         */
 /*                                                                      */
@@ -275,14 +546,16 @@ int msPOSTGRESQLJoinPrepare(joinObj *join, shapeObj *shape)
 /* only once for a one-to-one join, with msPOSTGRESQLJoinPrepare()      */
 /* being called before each.  It will be called repeatedly for          */
 /* one-to-many joins, until in returns MS_DONE.  To accomodate this,    */
-/* we store the next row number and query results in the joininfo and   */
-/* process the next tuple on each call.                                 */
+/* we store the next row number and the memoized rows in the joininfo   */
+/* and process the next row on each call.  Values that weren't loaded   */
+/* by msPOSTGRESQLJoinPrefetch() are queried (and memoized) here.       */
 /************************************************************************/
 int msPOSTGRESQLJoinNext(joinObj *join)
 {
   msPOSTGRESQLJoinInfo *joininfo = join->joininfo;
-  int i, length, row_count;
-  char *sql, *columns;
+  msPOSTGRESQLJoinKey *entry;
+  PGresult *result;
+  int i, row_count;
 
   /* We need a connection, and a join value. */
   if(!joininfo || !joininfo->conn) {
@@ -303,78 +576,47 @@ int msPOSTGRESQLJoinNext(joinObj *join)
     join->values = NULL;
   }
 
-  /* We only need to execute the query if no results exist. */
-  if(!joininfo->query_result) {
-    /* Write the list of column names. */
-    length = 0;
-    for(i = 0; i < join->numitems; i++) {
-      length += 8 + strlen(join->items[i]) + 2;
+  /* We only need to execute the query if the value hasn't been seen yet. */
+  if(!joininfo->current) {
+    entry = msPOSTGRESQLJoinGetKey(joininfo, joininfo->from_value, MS_FALSE);
+    if(!entry && joininfo->prefetched != joininfo->layer->resultcache) {
+      if(msPOSTGRESQLJoinPrefetch(join) != MS_SUCCESS)
+        return MS_FAILURE;
+      entry = msPOSTGRESQLJoinGetKey(joininfo, joininfo->from_value, MS_FALSE);
     }
-
-    columns = (char *)malloc(length);
-    if(!columns) {
-      msSetError(MS_MEMERR, "Failure to malloc.\n",
-                 "msPOSTGRESQLJoinNext()");
-      return MS_FAILURE;
-    }
-
-    strcpy(columns, "");
-    for(i = 0; i < join->numitems; i++) {
-      strcat(columns, "\"");
-      strcat(columns, join->items[i]);
-      strcat(columns, "\"::text");
-      if(i != join->numitems - 1) {
-        strcat(columns, ", ");
+    if(!entry || !entry->resolved) {
+      if(!entry) {
+        if(joininfo->numkeys >= MS_POSTGRESQL_JOIN_MAXKEYS)
+          msPOSTGRESQLJoinFreeKeys(joininfo, join->numitems);
+        entry = msPOSTGRESQLJoinGetKey(joininfo, joininfo->from_value, MS_TRUE);
       }
-    }
 
-    /* Create the query string. */
-    sql = (char *)malloc(26 + strlen(columns) + strlen(join->table) +
-                         strlen(join->to) + strlen(joininfo->from_value));
-    if(!sql) {
-      msSetError(MS_MEMERR, "Failure to malloc.\n",
-                 "msPOSTGRESQLJoinNext()");
-      return MS_FAILURE;
-    }
-    sprintf(sql, "SELECT %s FROM %s WHERE %s = '%s'", columns, join->table, join->to, joininfo->from_value);
-    if(joininfo->layer_debug) {
-      msDebug("msPOSTGRESQLJoinNext(): executing %s.\n", sql);
-    }
+      result = msPOSTGRESQLJoinQuery(join, "$1", joininfo->from_value);
+      if(!result)
+        return MS_FAILURE;
 
-    free(columns);
-
-    joininfo->query_result = PQexec(joininfo->conn, sql);
-
-    if(!joininfo->query_result ||
-        PQresultStatus(joininfo->query_result) != PGRES_TUPLES_OK) {
-      msSetError(MS_QUERYERR, "Error executing queri %s: %s\n",
-                 "msPOSTGRESQLJoinNext()", sql,
-                 PQerrorMessage(joininfo->conn));
-      if(joininfo->query_result) {
-        PQclear(joininfo->query_result);
-        joininfo->query_result = NULL;
-      }
-      free(sql);
-      return MS_FAILURE;
+      row_count = PQntuples(result);
+      for(i = 0; i < row_count; i++)
+        msPOSTGRESQLJoinAddRow(entry, result, i, join->numitems);
+      entry->resolved = MS_TRUE;
+      PQclear(result);
     }
-    free(sql);
+    joininfo->current = entry;
   }
-  row_count = PQntuples(joininfo->query_result);
 
   /* see if we're done processing this set */
-  if(joininfo->row_num >= row_count) {
+  if(joininfo->row_num >= joininfo->current->numrows) {
     return(MS_DONE);
   }
   if(joininfo->layer_debug) {
-    msDebug("msPOSTGRESQLJoinNext(): fetching row %d.\n",
+    msDebug("msPOSTGRESQLJoinNext(): fetching row %ld.\n",
             joininfo->row_num);
   }
 
   /* Copy the resulting values into the joinObj. */
   join->values = (char **)malloc(sizeof(char *) * join->numitems);
   for(i = 0; i < join->numitems; i++) {
-    join->values[i] = msStrdup(PQgetvalue(
-                                 joininfo->query_result, joininfo->row_num, i));
+    join->values[i] = msStrdup(joininfo->current->rows[joininfo->row_num][i]);
   }
 
   joininfo->row_num++;
@@ -397,11 +639,9 @@ int msPOSTGRESQLJoinClose(joinObj *join)
     return MS_SUCCESS;
   }
 
-  if(joininfo->query_result) {
-    msDebug("msPOSTGRESQLJoinClose(): clearing query_result.\n");
-    PQclear(joininfo->query_result);
-    joininfo->query_result = NULL;
-  }
+  msPOSTGRESQLJoinFreeKeys(joininfo, join->numitems);
+  free(joininfo->buckets);
+  free(joininfo->columns);
 
   if(joininfo->conn) {
     msDebug("msPOSTGRESQLJoinClose(): closing connection.\n");
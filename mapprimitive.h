@@ -74,6 +74,7 @@ typedef struct {
   lineObj *line;
   char **values;
   void *geometry;
+  void *prepared; /* GEOS prepared geometry, see msGEOSPredicate() */
   void *renderer_cache;
 #endif
 
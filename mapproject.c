@@ -31,6 +31,7 @@
 #include "mapproject.h"
 #include "mapthread.h"
 #include <assert.h>
+#include <ctype.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include "mapaxisorder.h"
@@ -70,6 +71,9 @@ int msProjectPoint(projectionObj *in, projectionObj *out, pointObj *point)
   projUV p;
   int  error;
 
+  msProjectionBindThread(in);
+  msProjectionBindThread(out);
+
   if( in && in->gt.need_geotransform ) {
     double x_out, y_out;
 
@@ -184,6 +188,375 @@ int msProjectPoint(projectionObj *in, projectionObj *out, pointObj *point)
 #endif
 }
 
+/************************************************************************/
+/*                        msProjectPointsExact()                        */
+/*                                                                      */
+/*      Same as calling msProjectPoint() on each of the points, but     */
+/*      the points are handed to pj_transform() as one array.  Points   */
+/*      that could not be projected are flagged in failed[] (left       */
+/*      untouched otherwise) and reported with msSetError() as          */
+/*      msProjectPoint() does, the function itself only fails on        */
+/*      allocation errors.                                              */
+/************************************************************************/
+#ifdef USE_PROJ
+static int msProjectPointsExact(projectionObj *in, projectionObj *out,
+                                pointObj *points, int numpoints, char *failed)
+{
+  int i, error, failures = 0;
+  pointObj *work;
+
+  memset( failed, 0, numpoints );
+  msProjectionBindThread(in);
+  msProjectionBindThread(out);
+
+  /* Only the pj_transform() case gains anything from batching. */
+  if( numpoints < 2 || !(in && in->proj && out && out->proj)
+      || (in->numargs == 1 && out->numargs == 1
+          && strcmp(in->args[0],out->args[0]) == 0) ) {
+    for( i = 0; i < numpoints; i++ )
+      failed[i] = msProjectPoint(in, out, points + i) == MS_FAILURE;
+    return MS_SUCCESS;
+  }
+
+  /* work on a copy so failed points are left as msProjectPoint() would */
+  work = (pointObj *) msSmallMalloc(sizeof(pointObj) * numpoints);
+  memcpy( work, points, sizeof(pointObj) * numpoints );
+
+  if( in->gt.need_geotransform ) {
+    for( i = 0; i < numpoints; i++ ) {
+      double x = work[i].x;
+      work[i].x = in->gt.geotransform[0] + in->gt.geotransform[1] * x
+                  + in->gt.geotransform[2] * work[i].y;
+      work[i].y = in->gt.geotransform[3] + in->gt.geotransform[4] * x
+                  + in->gt.geotransform[5] * work[i].y;
+    }
+  }
+
+  if( pj_is_latlong(in->proj) ) {
+    for( i = 0; i < numpoints; i++ ) {
+      work[i].x *= DEG_TO_RAD;
+      work[i].y *= DEG_TO_RAD;
+    }
+  }
+
+#if PJ_VERSION < 480
+  msAcquireLock( TLOCK_PROJ );
+#endif
+  error = pj_transform( in->proj, out->proj, numpoints,
+                        sizeof(pointObj) / sizeof(double),
+                        &(work[0].x), &(work[0].y), NULL );
+#if PJ_VERSION < 480
+  msReleaseLock( TLOCK_PROJ );
+#endif
+
+  /*
+  ** pj_transform() gives up on the whole array for errors that aren't
+  ** transient, redo those point by point to know which ones failed.
+  */
+  if( error ) {
+    free( work );
+    for( i = 0; i < numpoints; i++ )
+      failed[i] = msProjectPoint(in, out, points + i) == MS_FAILURE;
+    return MS_SUCCESS;
+  }
+
+  for( i = 0; i < numpoints; i++ ) {
+    if( work[i].x == HUGE_VAL || work[i].y == HUGE_VAL ) {
+      /* same report as msProjectPoint(), once per array */
+      if( !failures++ )
+        msSetError(MS_PROJERR,"proj says: %s","msProjectPoints()",
+                   pj_strerrno(*pj_get_errno_ref()));
+      failed[i] = 1;
+      continue;
+    }
+
+    if( pj_is_latlong(out->proj) ) {
+      work[i].x *= RAD_TO_DEG;
+      work[i].y *= RAD_TO_DEG;
+    }
+
+    if( out->gt.need_geotransform ) {
+      double x = work[i].x;
+      work[i].x = out->gt.invgeotransform[0] + out->gt.invgeotransform[1] * x
+                  + out->gt.invgeotransform[2] * work[i].y;
+      work[i].y = out->gt.invgeotransform[3] + out->gt.invgeotransform[4] * x
+                  + out->gt.invgeotransform[5] * work[i].y;
+    }
+
+    points[i] = work[i];
+  }
+
+  free( work );
+  return MS_SUCCESS;
+}
+#endif
+
+/*
+** Approximate transformer: the transformation is sampled exactly on a
+** regular grid of nodes over an extent of the source coordinate system
+** and points are then bilinearly interpolated within their cell.  The
+** grid is refined until the interpolation error measured at the cell
+** centers and the midpoints of all four cell edges (each edge sampled once,
+** shared by its two cells) is below max_error (in output units),
+** cells still off at the finest level (or touching a node that could not
+** be projected) are flagged and their points projected exactly.
+*/
+#define MS_PROJ_APPROX_MIN_CELLS 4
+#define MS_PROJ_APPROX_MAX_CELLS 64
+
+struct projApproxObj {
+  projectionObj *out; /* the only target the approximation is valid for */
+  rectObj extent;     /* in source coordinates */
+  int n;              /* n x n cells, (n+1) x (n+1) nodes */
+  double cellx, celly;
+  pointObj *nodes;
+  char *exact;        /* cells whose points must be projected exactly */
+};
+
+#ifdef USE_PROJ
+static void msProjectionApproxInterpolate(projApproxObj *approx, int cell_i, int cell_j,
+    double u, double v, pointObj *point)
+{
+  int stride = approx->n + 1;
+  pointObj *n00 = approx->nodes + cell_j * stride + cell_i;
+  pointObj *n10 = n00 + 1;
+  pointObj *n01 = n00 + stride;
+  pointObj *n11 = n01 + 1;
+
+  point->x = (n00->x * (1-u) + n10->x * u) * (1-v) + (n01->x * (1-u) + n11->x * u) * v;
+  point->y = (n00->y * (1-u) + n10->y * u) * (1-v) + (n01->y * (1-u) + n11->y * u) * v;
+}
+
+/*
+** Samples the grid with n x n cells, returns the number of cells that
+** don't meet max_error (these are flagged exact).  The test points are the
+** n x n cell centers, then the midpoints of the n x (n+1) horizontal edges
+** and of the (n+1) x n vertical edges.
+*/
+static int msProjectionApproxBuildGrid(projectionObj *in, projApproxObj *approx, double max_error)
+{
+  int i, j, k, n = approx->n, stride = n + 1, numbad = 0;
+  int numnodes = stride * stride, numtests = n * n + 2 * n * stride;
+  pointObj *tests, *expected;
+  char *failed;
+  static const double test_u[5] = { 0.5, 0.5, 0.5, 0.0, 1.0 }; /* center, bottom, top, left, right */
+  static const double test_v[5] = { 0.5, 0.0, 1.0, 0.5, 0.5 };
+
+  approx->cellx = (approx->extent.maxx - approx->extent.minx) / n;
+  approx->celly = (approx->extent.maxy - approx->extent.miny) / n;
+  approx->nodes = (pointObj *) msSmallMalloc(sizeof(pointObj) * numnodes);
+  approx->exact = (char *) msSmallCalloc(n * n, 1);
+
+  tests = (pointObj *) msSmallCalloc(numnodes + numtests, sizeof(pointObj));
+  failed = (char *) msSmallMalloc(numnodes + numtests);
+
+  for( j = 0; j <= n; j++ ) {
+    for( i = 0; i <= n; i++ ) {
+      tests[j * stride + i].x = approx->extent.minx + i * approx->cellx;
+      tests[j * stride + i].y = approx->extent.miny + j * approx->celly;
+    }
+  }
+  expected = tests + numnodes;
+  for( j = 0; j < n; j++ ) {
+    for( i = 0; i < n; i++ ) {
+      expected[j * n + i].x = approx->extent.minx + (i + 0.5) * approx->cellx;
+      expected[j * n + i].y = approx->extent.miny + (j + 0.5) * approx->celly;
+    }
+  }
+  for( j = 0; j <= n; j++ ) {
+    for( i = 0; i < n; i++ ) {
+      expected[n * n + j * n + i].x = approx->extent.minx + (i + 0.5) * approx->cellx;
+      expected[n * n + j * n + i].y = approx->extent.miny + j * approx->celly;
+    }
+  }
+  for( j = 0; j < n; j++ ) {
+    for( i = 0; i <= n; i++ ) {
+      expected[n * n + n * stride + j * stride + i].x = approx->extent.minx + i * approx->cellx;
+      expected[n * n + n * stride + j * stride + i].y = approx->extent.miny + (j + 0.5) * approx->celly;
+    }
+  }
+
+  /* nodes and test points go through PROJ together */
+  msProjectPointsExact( in, approx->out, tests, numnodes + numtests, failed );
+  memcpy( approx->nodes, tests, sizeof(pointObj) * numnodes );
+
+  for( j = 0; j < n; j++ ) {
+    for( i = 0; i < n; i++ ) {
+      int node = j * stride + i;
+      int t[5];
+
+      if( failed[node] || failed[node + 1] || failed[node + stride]
+          || failed[node + stride + 1] ) {
+        approx->exact[j * n + i] = 1;
+        numbad++;
+        continue;
+      }
+
+      t[0] = j * n + i;
+      t[1] = n * n + j * n + i;
+      t[2] = n * n + (j + 1) * n + i;
+      t[3] = n * n + n * stride + j * stride + i;
+      t[4] = t[3] + 1;
+
+      for( k = 0; k < 5; k++ ) {
+        pointObj interpolated;
+
+        if( failed[numnodes + t[k]] )
+          break;
+        msProjectionApproxInterpolate( approx, i, j, test_u[k], test_v[k], &interpolated );
+        if( fabs(interpolated.x - expected[t[k]].x) > max_error
+            || fabs(interpolated.y - expected[t[k]].y) > max_error )
+          break;
+      }
+      if( k < 5 ) {
+        approx->exact[j * n + i] = 1;
+        numbad++;
+      }
+    }
+  }
+
+  free( tests );
+  free( failed );
+
+  return numbad;
+}
+#endif
+
+/************************************************************************/
+/*                       msProjectionInitApprox()                       */
+/*                                                                      */
+/*      Build an approximate transformer from "in" to "out" over        */
+/*      extent (in source coordinates) and attach it to "in": until     */
+/*      msProjectionFreeApprox() is called, shapes projected from       */
+/*      "in" to "out" have their vertices inside extent interpolated    */
+/*      with an error below max_error (output units) instead of going   */
+/*      through PROJ.  Returns MS_FAILURE (without error) when the      */
+/*      transformation isn't suitable for approximation.                */
+/************************************************************************/
+int msProjectionInitApprox(projectionObj *in, projectionObj *out,
+                           rectObj *extent, double max_error, int debug)
+{
+#ifdef USE_PROJ
+  projApproxObj *approx;
+  int numbad;
+
+  msProjectionFreeApprox( in );
+
+  /*
+  ** Interpolation can't follow a dateline wrap, and geotransforms are
+  ** rare enough (raster sources) not to bother.
+  */
+  if( !in->proj || !out->proj || max_error <= 0
+      || (pj_is_latlong(out->proj) && !pj_is_latlong(in->proj))
+      || in->gt.need_geotransform || out->gt.need_geotransform
+      || extent->maxx <= extent->minx || extent->maxy <= extent->miny )
+    return MS_FAILURE;
+
+  approx = (projApproxObj *) msSmallMalloc(sizeof(projApproxObj));
+  approx->out = out;
+  approx->extent = *extent;
+
+  for( approx->n = MS_PROJ_APPROX_MIN_CELLS; ; approx->n *= 2 ) {
+    numbad = msProjectionApproxBuildGrid( in, approx, max_error );
+    if( numbad == 0 || approx->n * 2 > MS_PROJ_APPROX_MAX_CELLS )
+      break;
+    free( approx->nodes );
+    free( approx->exact );
+  }
+
+  if( debug >= MS_DEBUGLEVEL_TUNING )
+    msDebug("msProjectionInitApprox(): %dx%d grid, %d cells projected exactly.\n",
+            approx->n, approx->n, numbad);
+
+  /* nothing to gain if (nearly) everything has to be exact */
+  if( numbad * 2 > approx->n * approx->n ) {
+    free( approx->nodes );
+    free( approx->exact );
+    free( approx );
+    return MS_FAILURE;
+  }
+
+  in->approx = approx;
+  return MS_SUCCESS;
+#else
+  msSetError(MS_PROJERR, "Projection support is not available.", "msProjectionInitApprox()");
+  return(MS_FAILURE);
+#endif
+}
+
+/************************************************************************/
+/*                       msProjectionFreeApprox()                       */
+/************************************************************************/
+void msProjectionFreeApprox(projectionObj *in)
+{
+  if( in->approx ) {
+    free( in->approx->nodes );
+    free( in->approx->exact );
+    free( in->approx );
+    in->approx = NULL;
+  }
+}
+
+/************************************************************************/
+/*                          msProjectPoints()                           */
+/*                                                                      */
+/*      msProjectPointsExact(), except that points covered by an        */
+/*      approximate transformer attached to "in" for "out" are          */
+/*      interpolated instead.                                           */
+/************************************************************************/
+#ifdef USE_PROJ
+static int msProjectPoints(projectionObj *in, projectionObj *out,
+                           pointObj *points, int numpoints, char *failed)
+{
+  projApproxObj *approx = in ? in->approx : NULL;
+  pointObj *rest;
+  int *restindex;
+  int i, numrest = 0;
+
+  if( approx == NULL || approx->out != out )
+    return msProjectPointsExact( in, out, points, numpoints, failed );
+
+  rest = (pointObj *) msSmallMalloc(sizeof(pointObj) * numpoints);
+  restindex = (int *) msSmallMalloc(sizeof(int) * numpoints);
+
+  for( i = 0; i < numpoints; i++ ) {
+    double fx = (points[i].x - approx->extent.minx) / approx->cellx;
+    double fy = (points[i].y - approx->extent.miny) / approx->celly;
+    int cell_i, cell_j;
+
+    failed[i] = 0;
+    if( fx >= 0 && fx <= approx->n && fy >= 0 && fy <= approx->n ) {
+      cell_i = MS_MIN((int) fx, approx->n - 1);
+      cell_j = MS_MIN((int) fy, approx->n - 1);
+      if( !approx->exact[cell_j * approx->n + cell_i] ) {
+        msProjectionApproxInterpolate( approx, cell_i, cell_j, fx - cell_i, fy - cell_j,
+                                       points + i );
+        continue;
+      }
+    }
+
+    rest[numrest] = points[i];
+    restindex[numrest++] = i;
+  }
+
+  if( numrest > 0 ) {
+    char *restfailed = (char *) msSmallMalloc(numrest);
+
+    msProjectPointsExact( in, out, rest, numrest, restfailed );
+    for( i = 0; i < numrest; i++ ) {
+      points[restindex[i]] = rest[i];
+      failed[restindex[i]] = restfailed[i];
+    }
+    free( restfailed );
+  }
+
+  free( rest );
+  free( restindex );
+
+  return MS_SUCCESS;
+}
+#endif
+
 /************************************************************************/
 /*                         msProjectGrowRect()                          */
 /************************************************************************/
@@ -299,6 +672,8 @@ msProjectShapeLine(projectionObj *in, projectionObj *out,
   int numpoints_in = line->numpoints;
   int line_alloc = numpoints_in;
   int wrap_test;
+  pointObj *projected;
+  char *failed;
 
 #ifdef USE_PROJ_FASTPATHS
 #define MAXEXTENT 20037508.34
@@ -327,6 +702,20 @@ msProjectShapeLine(projectionObj *in, projectionObj *out,
   wrap_test = out != NULL && out->proj != NULL && pj_is_latlong(out->proj)
               && !pj_is_latlong(in->proj);
 
+  /* -------------------------------------------------------------------- */
+  /*      Project all the points in one go, the loop below only applies   */
+  /*      the wrap and horizon logic to the results.                      */
+  /* -------------------------------------------------------------------- */
+  if( numpoints_in > 0 ) {
+    projected = (pointObj *) msSmallMalloc(sizeof(pointObj) * numpoints_in);
+    failed = (char *) msSmallMalloc(numpoints_in);
+    memcpy( projected, line->point, sizeof(pointObj) * numpoints_in );
+    msProjectPoints( in, out, projected, numpoints_in, failed );
+  } else {
+    projected = NULL;
+    failed = NULL;
+  }
+
   line->numpoints = 0;
 
   if( numpoints_in > 0 )
@@ -339,9 +728,10 @@ msProjectShapeLine(projectionObj *in, projectionObj *out,
   /* -------------------------------------------------------------------- */
   for( i=0; i < numpoints_in; i++ ) {
     int ms_err;
-    wrkPoint = thisPoint = line->point[i];
+    thisPoint = line->point[i];
+    wrkPoint = projected[i];
 
-    ms_err = msProjectPoint(in, out, &wrkPoint );
+    ms_err = failed[i] ? MS_FAILURE : MS_SUCCESS;
 
     /* -------------------------------------------------------------------- */
     /*      Apply wrap logic.                                               */
@@ -464,6 +854,9 @@ msProjectShapeLine(projectionObj *in, projectionObj *out,
     lastPoint = thisPoint;
   }
 
+  free( projected );
+  free( failed );
+
   /* -------------------------------------------------------------------- */
   /*      Make sure that polygons are closed, even if the trip over       */
   /*      the horizon left them unclosed.                                 */
@@ -548,26 +941,37 @@ int msProjectLine(projectionObj *in, projectionObj *out, lineObj *line)
 {
 #ifdef USE_PROJ
   int i, be_careful = 1;
+  pointObj *original;
+  char *failed;
+
+  if( line->numpoints == 0 )
+    return(MS_SUCCESS);
 
   if( be_careful )
     be_careful = out->proj != NULL && pj_is_latlong(out->proj)
                  && !pj_is_latlong(in->proj);
 
+  failed = (char *) msSmallMalloc(line->numpoints);
+
   if( be_careful ) {
     pointObj  startPoint, thisPoint; /* locations in projected space */
 
-    startPoint = line->point[0];
+    /* the wrap test needs the unprojected points */
+    original = (pointObj *) msSmallMalloc(sizeof(pointObj) * line->numpoints);
+    memcpy( original, line->point, sizeof(pointObj) * line->numpoints );
+    msProjectPoints(in, out, line->point, line->numpoints, failed);
+
+    startPoint = original[0];
 
     for(i=0; i<line->numpoints; i++) {
       double  dist;
 
-      thisPoint = line->point[i];
+      thisPoint = original[i];
 
       /*
       ** Read comments before msTestNeedWrap() to better understand
       ** this dateline wrapping logic.
       */
-      msProjectPoint(in, out, &(line->point[i]));
       if( i > 0 ) {
         dist = line->point[i].x - line->point[0].x;
         if( fabs(dist) > 180.0 ) {
@@ -583,13 +987,18 @@ int msProjectLine(projectionObj *in, projectionObj *out, lineObj *line)
 
       }
     }
+    free( original );
   } else {
+    msProjectPoints(in, out, line->point, line->numpoints, failed);
     for(i=0; i<line->numpoints; i++) {
-      if( msProjectPoint(in, out, &(line->point[i])) == MS_FAILURE )
+      if( failed[i] ) {
+        free( failed );
         return MS_FAILURE;
+      }
     }
   }
 
+  free( failed );
   return(MS_SUCCESS);
 #else
   msSetError(MS_PROJERR, "Projection support is not available.", "msProjectLine()");
@@ -1067,6 +1476,426 @@ static const char *msProjFinder( const char *filename)
 }
 #endif /* def USE_PROJ */
 
+/*
+** Projection object cache.
+**
+** pj_init() is expensive, especially for "init=epsg:XXXX" definitions that
+** make PROJ scan its epsg file, and the same handful of definitions are
+** initialized over and over: the map and layer projections of every map
+** loaded, WMS SRS= overrides, projections of temporary objects...  So
+** initialized projPJ objects are kept in a process wide cache keyed by
+** their normalized argument list, and handed out refcounted by
+** msProcessProjection().  A projPJ (and its context) may only be used by
+** one thread at a time, so in threaded builds entries are per thread: each
+** thread gets its own projCtx, and its own projPJ objects built from the
+** expanded definitions shared by all threads.  With PROJ >= 4.8 pj_init()
+** is reentrant given distinct contexts, and TLOCK_PROJ only protects the
+** cache lists themselves.
+**
+** EPSG codes are resolved through an in-memory index of the epsg init file,
+** loaded once, rather than by PROJ searching the file for every lookup.
+*/
+#ifdef USE_PROJ
+
+#define MS_PROJ_CACHE_MAX_UNUSED 100 /* unused entries kept around */
+
+typedef struct projCacheEntryObj {
+  char *key;
+  int thread_id;
+  projPJ proj;
+  int refcount;
+  struct projCacheEntryObj *next;
+} projCacheEntryObj;
+
+static projCacheEntryObj *projCache = NULL;
+
+#if PJ_VERSION >= 480
+typedef struct projThreadContextObj {
+  int thread_id;
+  projCtx ctx;
+  struct projThreadContextObj *next;
+} projThreadContextObj;
+
+static projThreadContextObj *projThreadContexts = NULL;
+
+typedef struct projDefinitionObj {
+  char *key;
+  char *definition; /* fully expanded, as returned by pj_get_def() */
+  struct projDefinitionObj *next;
+} projDefinitionObj;
+
+static projDefinitionObj *projDefinitions = NULL;
+
+/*
+** Returns the calling thread's PROJ context, called with TLOCK_PROJ held.
+*/
+static projCtx msProjectionGetThreadContext(int thread_id)
+{
+  projThreadContextObj *link;
+
+  for(link = projThreadContexts; link; link = link->next) {
+    if(link->thread_id == thread_id)
+      return link->ctx;
+  }
+
+  link = (projThreadContextObj *) msSmallMalloc(sizeof(projThreadContextObj));
+  link->thread_id = thread_id;
+  link->ctx = pj_ctx_alloc();
+  link->next = projThreadContexts;
+  projThreadContexts = link;
+
+  return link->ctx;
+}
+
+static const char *msProjectionGetDefinition(const char *key)
+{
+  projDefinitionObj *link;
+
+  for(link = projDefinitions; link; link = link->next) {
+    if(strcmp(link->key, key) == 0)
+      return link->definition;
+  }
+  return NULL;
+}
+#endif
+
+typedef struct {
+  int code;
+  char *definition;
+} epsgIndexEntryObj;
+
+static epsgIndexEntryObj *epsgIndex = NULL;
+static int epsgIndexSize = 0;
+static int epsgIndexLoaded = MS_FALSE;
+
+static void msProjectionCacheFreeEntry(projCacheEntryObj *entry)
+{
+  pj_free(entry->proj);
+  free(entry->key);
+  free(entry);
+}
+
+static int msEPSGIndexCompare(const void *a, const void *b)
+{
+  return ((const epsgIndexEntryObj *) a)->code - ((const epsgIndexEntryObj *) b)->code;
+}
+
+static void msEPSGIndexFree(void)
+{
+  int i;
+
+  for(i = 0; i < epsgIndexSize; i++)
+    free(epsgIndex[i].definition);
+  free(epsgIndex);
+  epsgIndex = NULL;
+  epsgIndexSize = 0;
+  epsgIndexLoaded = MS_FALSE;
+}
+
+/*
+** Parse the epsg init file ("<code> +proj=... <>" lines) in a sorted array.
+** Called with TLOCK_PROJ held.  The file is looked up where msProjFinder()
+** would find it (PROJ_LIB config option, else the PROJ_LIB environment
+** variable). Otherwise the index stays empty and pj_init() resolves
+** init=epsg: definitions itself, from its own search path.
+*/
+static void msEPSGIndexLoad(void)
+{
+  const char *dir;
+  char path[MS_MAXPATHLEN], line[2048];
+  FILE *fp;
+  int allocated = 0;
+
+  epsgIndexLoaded = MS_TRUE;
+
+  dir = ms_proj_lib ? ms_proj_lib : getenv("PROJ_LIB");
+  if(dir == NULL)
+    return;
+
+  snprintf(path, sizeof(path), "%s/epsg", dir);
+  if((fp = fopen(path, "r")) == NULL)
+    return;
+
+  while(fgets(line, sizeof(line), fp)) {
+    char *start, *end;
+
+    if(line[0] != '<' || !isdigit((unsigned char) line[1]))
+      continue;
+    start = strchr(line, '>');
+    end = strstr(line + 1, "<>");
+    if(!start || !end || end < start)
+      continue;
+    *end = '\0';
+
+    if(epsgIndexSize == allocated) {
+      allocated = allocated ? allocated * 2 : 1024;
+      epsgIndex = (epsgIndexEntryObj *) msSmallRealloc(epsgIndex, sizeof(epsgIndexEntryObj) * allocated);
+    }
+    epsgIndex[epsgIndexSize].code = atoi(line + 1);
+    epsgIndex[epsgIndexSize].definition = msStrdup(start + 1);
+    msStringTrim(epsgIndex[epsgIndexSize].definition);
+    epsgIndexSize++;
+  }
+  fclose(fp);
+
+  qsort(epsgIndex, epsgIndexSize, sizeof(epsgIndexEntryObj), msEPSGIndexCompare);
+}
+
+/*
+** Returns the argument list to hand to pj_init(): args itself, or without
+** its "init=epsg:XXXX" argument and the definition from the index appended.
+** That is the order pj_init() puts an init file in, and as PROJ takes the
+** first occurrence of a parameter the user's (ie. +towgs84) still win.
+*/
+static char **msProjectionExpandArgs(char **args, int numargs, int *numexpanded)
+{
+  char **expanded, **definition = NULL;
+  int i, j, numdefinition = 0;
+
+  for(i = 0; i < numargs; i++) {
+    const char *arg = args[i][0] == '+' ? args[i] + 1 : args[i];
+    if(strncasecmp(arg, "init=epsg:", 10) == 0) {
+      epsgIndexEntryObj target, *found;
+
+      if(!epsgIndexLoaded)
+        msEPSGIndexLoad();
+      target.code = atoi(arg + 10);
+      found = epsgIndexSize ? (epsgIndexEntryObj *) bsearch(&target, epsgIndex, epsgIndexSize,
+              sizeof(epsgIndexEntryObj), msEPSGIndexCompare) : NULL;
+      if(found)
+        definition = msStringSplit(found->definition, ' ', &numdefinition);
+      break;
+    }
+  }
+
+  if(definition == NULL) {
+    *numexpanded = numargs;
+    return args;
+  }
+
+  expanded = (char **) msSmallMalloc(sizeof(char *) * (numargs + numdefinition));
+  *numexpanded = 0;
+  for(j = 0; j < numargs; j++) {
+    if(j != i)
+      expanded[(*numexpanded)++] = msStrdup(args[j]);
+  }
+  for(j = 0; j < numdefinition; j++) {
+    if(definition[j][0] != '\0')
+      expanded[(*numexpanded)++] = msStrdup(definition[j][0] == '+' ? definition[j] + 1 : definition[j]);
+  }
+  msFreeCharArray(definition, numdefinition);
+
+  return expanded;
+}
+
+/************************************************************************/
+/*                        msProjectionCacheGet()                        */
+/*                                                                      */
+/*      Returns an initialized projPJ for p's arguments, from the       */
+/*      cache when possible.  Returns NULL, with the PROJ error number   */
+/*      available through pj_get_errno_ref(), if pj_init() failed.      */
+/*      The object must be given back with msProjectionCacheRelease().  */
+/************************************************************************/
+projPJ msProjectionCacheGet(projectionObj *p)
+{
+  projCacheEntryObj *entry, *added, *prev, *next;
+  char *key = msStrdup("");
+  char **args;
+  int i, numargs, numunused = 0, thread_id = msGetThreadId();
+  projPJ proj;
+#if PJ_VERSION >= 480
+  projCtx ctx;
+  char *definition = NULL;
+#endif
+
+  for(i = 0; i < p->numargs; i++) {
+    if(i > 0) key = msStringConcatenate(key, " ");
+    key = msStringConcatenate(key, p->args[i][0] == '+' ? p->args[i] + 1 : p->args[i]);
+  }
+
+  msAcquireLock( TLOCK_PROJ );
+
+  for(entry = projCache; entry; entry = entry->next) {
+    if(entry->thread_id == thread_id && strcmp(entry->key, key) == 0) {
+      entry->refcount++;
+      msReleaseLock( TLOCK_PROJ );
+      free(key);
+      return entry->proj;
+    }
+  }
+
+#if PJ_VERSION < 480
+  args = msProjectionExpandArgs(p->args, p->numargs, &numargs);
+  proj = pj_init(numargs, args);
+#else
+  /*
+  ** Another thread may already have expanded this definition, otherwise
+  ** resolve it through the epsg index.  Either way pj_init() itself runs
+  ** outside of the lock, with this thread's context.
+  */
+  ctx = msProjectionGetThreadContext(thread_id);
+  if(msProjectionGetDefinition(key))
+    definition = msStrdup(msProjectionGetDefinition(key));
+  args = definition ? NULL : msProjectionExpandArgs(p->args, p->numargs, &numargs);
+  msReleaseLock( TLOCK_PROJ );
+
+  if(definition)
+    proj = pj_init_plus_ctx(ctx, definition);
+  else
+    proj = pj_init_ctx(ctx, numargs, args);
+
+  msAcquireLock( TLOCK_PROJ );
+  if(proj && !definition && !msProjectionGetDefinition(key)) {
+    char *expanded = pj_get_def(proj, 0);
+    if(expanded) {
+      projDefinitionObj *link = (projDefinitionObj *) msSmallMalloc(sizeof(projDefinitionObj));
+      link->key = msStrdup(key);
+      link->definition = msStrdup(expanded);
+      link->next = projDefinitions;
+      projDefinitions = link;
+      pj_dalloc(expanded);
+    }
+  }
+  free(definition);
+#endif
+  if(args && args != p->args)
+    msFreeCharArray(args, numargs);
+
+  if(proj == NULL) {
+    free(key);
+    msReleaseLock( TLOCK_PROJ );
+    return NULL;
+  }
+
+  added = (projCacheEntryObj *) msSmallMalloc(sizeof(projCacheEntryObj));
+  added->key = key;
+  added->thread_id = thread_id;
+  added->proj = proj;
+  added->refcount = 1;
+
+  /* most recently created first, drop the oldest unused ones past the limit */
+  added->next = projCache;
+  projCache = added;
+  for(prev = added, entry = added->next; entry; entry = next) {
+    next = entry->next;
+    if(entry->refcount == 0 && ++numunused > MS_PROJ_CACHE_MAX_UNUSED) {
+      prev->next = next;
+      msProjectionCacheFreeEntry(entry);
+    } else
+      prev = entry;
+  }
+
+  msReleaseLock( TLOCK_PROJ );
+
+  return proj;
+}
+
+/************************************************************************/
+/*                       msProjectionBindThread()                       */
+/*                                                                      */
+/*      A cached projPJ is bound to the PROJ context of the thread      */
+/*      that created it.  When a projection is used from another        */
+/*      thread (ie. a map loaded by one thread and drawn by another)    */
+/*      it is switched to the calling thread's own object first.        */
+/*      Called before each transformation, so cheap when bound.         */
+/************************************************************************/
+void msProjectionBindThread(projectionObj *p)
+{
+#if PJ_VERSION >= 480
+  int thread_id;
+  projPJ proj;
+
+  if(p == NULL || p->proj == NULL || p->proj_thread_id == -1)
+    return;
+
+  thread_id = msGetThreadId();
+  if(p->proj_thread_id == thread_id)
+    return;
+
+  if((proj = msProjectionCacheGet(p)) == NULL)
+    return; /* keep the old one, pj_init() already worked once */
+
+  msProjectionCacheRelease(p->proj);
+  p->proj = proj;
+  p->proj_thread_id = thread_id;
+#endif
+}
+
+/************************************************************************/
+/*                      msProjectionCacheRelease()                      */
+/*                                                                      */
+/*      Gives back an object from msProjectionCacheGet().  Returns      */
+/*      MS_FALSE if proj doesn't come from the cache (the caller then   */
+/*      owns it and has to pj_free() it).                               */
+/************************************************************************/
+int msProjectionCacheRelease(projPJ proj)
+{
+  projCacheEntryObj *entry;
+
+  msAcquireLock( TLOCK_PROJ );
+  for(entry = projCache; entry; entry = entry->next) {
+    if(entry->proj == proj && entry->refcount > 0) {
+      entry->refcount--;
+      msReleaseLock( TLOCK_PROJ );
+      return MS_TRUE;
+    }
+  }
+  msReleaseLock( TLOCK_PROJ );
+
+  return MS_FALSE;
+}
+#endif /* def USE_PROJ */
+
+/************************************************************************/
+/*                      msProjectionCacheCleanup()                      */
+/*                                                                      */
+/*      Frees the cached projection objects that are not in use and     */
+/*      the EPSG index.                                                 */
+/************************************************************************/
+void msProjectionCacheCleanup(void)
+{
+#ifdef USE_PROJ
+  projCacheEntryObj *entry, **link;
+
+  msAcquireLock( TLOCK_PROJ );
+  for(link = &projCache; (entry = *link) != NULL; ) {
+    if(entry->refcount == 0) {
+      *link = entry->next;
+      msProjectionCacheFreeEntry(entry);
+    } else
+      link = &(entry->next);
+  }
+  msEPSGIndexFree();
+
+#if PJ_VERSION >= 480
+  while(projDefinitions) {
+    projDefinitionObj *link = projDefinitions;
+    projDefinitions = link->next;
+    free(link->key);
+    free(link->definition);
+    free(link);
+  }
+
+  /* contexts of threads that still have objects in use have to stay */
+  {
+    projThreadContextObj *link, **prevlink;
+
+    for(prevlink = &projThreadContexts; (link = *prevlink) != NULL; ) {
+      for(entry = projCache; entry && entry->thread_id != link->thread_id; entry = entry->next)
+        ;
+      if(entry == NULL) {
+        *prevlink = link->next;
+        pj_ctx_free(link->ctx);
+        free(link);
+      } else
+        prevlink = &(link->next);
+    }
+  }
+#endif
+  msReleaseLock( TLOCK_PROJ );
+#endif
+}
+
 /************************************************************************/
 /*                           msSetPROJ_LIB()                            */
 /************************************************************************/
@@ -1119,6 +1948,9 @@ void msSetPROJ_LIB( const char *proj_lib, const char *pszRelToPath )
   if( proj_lib != NULL )
     ms_proj_lib = msStrdup( proj_lib );
 
+  /* the epsg file may now be found elsewhere */
+  msEPSGIndexFree();
+
   msReleaseLock( TLOCK_PROJ );
 
   if ( extended_path )
@@ -48,6 +48,9 @@ extern "C" {
 #define wkp_lonlat 1
 #define wkp_gmerc 2
 
+  /* grid based approximation of a transformation, see msProjectionInitApprox() */
+  typedef struct projApproxObj projApproxObj;
+
 
   typedef struct {
 #ifdef SWIG
@@ -63,12 +66,13 @@ extern "C" {
 #ifdef USE_PROJ
     projPJ proj; /* a projection structure for the PROJ package */
 #if PJ_VERSION >= 480
-    projCtx proj_ctx;
+    int proj_thread_id; /* thread whose context (owned by mapproject.c, one per thread) the cached proj is bound to, -1 if not cached */
 #endif
 #else
     void *proj;
 #endif
     geotransformObj gt; /* extra transformation to apply */
+    projApproxObj *approx; /* optional approximate transformer, to one target */
 #endif
     int wellknownprojection;
   } projectionObj;
@@ -81,6 +85,9 @@ extern "C" {
   MS_DLL_EXPORT int msProjectLine(projectionObj *in, projectionObj *out, lineObj *line);
   MS_DLL_EXPORT int msProjectRect(projectionObj *in, projectionObj *out, rectObj *rect);
   MS_DLL_EXPORT int msProjectionsDiffer(projectionObj *, projectionObj *);
+  MS_DLL_EXPORT int msProjectionInitApprox(projectionObj *in, projectionObj *out,
+      rectObj *extent, double max_error, int debug);
+  MS_DLL_EXPORT void msProjectionFreeApprox(projectionObj *in);
   MS_DLL_EXPORT int msOGCWKT2ProjectionObj( const char *pszWKT, projectionObj *proj, int
       debug_flag );
   MS_DLL_EXPORT char *msProjectionObj2OGCWKT( projectionObj *proj );
@@ -98,6 +105,13 @@ extern "C" {
 
   MS_DLL_EXPORT void msSetPROJ_LIB( const char *, const char * );
 
+#ifdef USE_PROJ
+  MS_DLL_EXPORT projPJ msProjectionCacheGet(projectionObj *p);
+  MS_DLL_EXPORT int msProjectionCacheRelease(projPJ proj);
+  MS_DLL_EXPORT void msProjectionBindThread(projectionObj *p);
+#endif
+  MS_DLL_EXPORT void msProjectionCacheCleanup(void);
+
   /* Provides compatiblity with PROJ.4 4.4.2 */
 #ifndef PJ_VERSION
 #  define pj_is_latlong(x)  ((x)->is_latlong)
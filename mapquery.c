@@ -141,19 +141,154 @@ int msIsLayerQueryable(layerObj *lp)
   return MS_FALSE;
 }
 
-static int addResult(resultCacheObj *cache, shapeObj *shape)
+/*
+** Result shape copies (PROCESSING QUERY_SHAPE_CACHE=ON) spare the consumers of
+** the results a second read of every shape through msLayerGetShape(), which
+** for database layers means one more round trip per feature. The copies are
+** capped at QUERY_SHAPE_CACHE_SIZE megabytes (default 16) per layer, results
+** added beyond that are kept as indexes only. PostgreSQL joins also take
+** their keys from the copies to look them up in batches, without the copies
+** they look up each distinct key on its own.
+*/
+static size_t getResultShapeCacheSize(layerObj *lp)
+{
+  const char *value;
+
+  value = msLayerGetProcessingKey(lp, "QUERY_SHAPE_CACHE");
+  if(!value || strcasecmp(value, "ON") != 0)
+    return 0;
+
+  value = msLayerGetProcessingKey(lp, "QUERY_SHAPE_CACHE_SIZE");
+  if(!value)
+    value = msGetConfigOption(lp->map, "MS_QUERY_SHAPE_CACHE_SIZE");
+  if(value)
+    return (size_t) MS_MAX(atof(value), 0) * 1024 * 1024;
+
+  return 16 * 1024 * 1024;
+}
+
+static size_t getShapeMemorySize(shapeObj *shape)
+{
+  size_t size = sizeof(shapeObj);
+  int i;
+
+  for(i=0; i<shape->numlines; i++)
+    size += sizeof(lineObj) + sizeof(pointObj)*shape->line[i].numpoints;
+  for(i=0; i<shape->numvalues; i++)
+    size += sizeof(char *) + (shape->values[i] ? strlen(shape->values[i]) + 1 : 0);
+  if(shape->text)
+    size += strlen(shape->text) + 1;
+
+  return size;
+}
+
+/* are the copies still in step with the layer item list? */
+static int resultShapeItemsMatch(layerObj *lp)
+{
+  resultCacheObj *cache = lp->resultcache;
+  int i;
+
+  if(cache->numshapeitems != lp->numitems)
+    return MS_FALSE;
+  for(i=0; i<lp->numitems; i++) {
+    if(strcmp(cache->shapeitems[i], lp->items[i]) != 0)
+      return MS_FALSE;
+  }
+
+  return MS_TRUE;
+}
+
+/*
+** The copies kept with the results are in the layer projection, like the
+** shapes msLayerGetShape() hands out, so queries that project candidates
+** to the map call this once every test that doesn't need the projected
+** geometry has passed.  addResult() takes the copy if the candidate makes
+** it into the results, otherwise the next candidate reuses it.  Nothing is
+** kept when the shapes go to a callback instead of the result cache.
+*/
+static void keepUnprojectedShape(layerObj *lp, shapeObj *shape)
+{
+  resultCacheObj *cache = lp->resultcache;
+  size_t maxsize;
+
+  if(!cache)
+    return;
+
+  maxsize = cache->cachesize ? cache->shapememorymax : getResultShapeCacheSize(lp);
+  if(maxsize == 0 || cache->shapememory + getShapeMemorySize(shape) > maxsize)
+    return;
+
+  if(!cache->unprojected) {
+    cache->unprojected = (shapeObj *) msSmallMalloc(sizeof(shapeObj));
+    msInitShape(cache->unprojected);
+  } else
+    msFreeShape(cache->unprojected);
+  msCopyShape(shape, cache->unprojected);
+}
+
+static void addResultShape(layerObj *lp, int i, shapeObj *shape, int projected)
+{
+  resultCacheObj *cache = lp->resultcache;
+  shapeObj *copy;
+  size_t size;
+  int j;
+
+  if(cache->shapes[i]) { /* slot reused, MS_QUERY_SINGLE */
+    cache->shapememory -= getShapeMemorySize(cache->shapes[i]);
+    msFreeShape(cache->shapes[i]);
+    free(cache->shapes[i]);
+    cache->shapes[i] = NULL;
+  }
+
+  size = getShapeMemorySize(shape);
+  if(cache->shapememory + size > cache->shapememorymax)
+    return;
+
+  if(!cache->shapeitems) {
+    cache->shapeitems = (char **) msSmallMalloc(sizeof(char *)*MS_MAX(lp->numitems, 1));
+    for(j=0; j<lp->numitems; j++)
+      cache->shapeitems[j] = msStrdup(lp->items[j]);
+    cache->numshapeitems = lp->numitems;
+  } else if(!resultShapeItemsMatch(lp)) {
+    return;
+  }
+
+  if(projected) { /* use the copy taken before projecting, see keepUnprojectedShape() */
+    copy = cache->unprojected;
+    if(!copy || copy->index != shape->index || copy->tileindex != shape->tileindex
+        || copy->resultindex != shape->resultindex)
+      return;
+    cache->unprojected = NULL;
+    copy->classindex = shape->classindex;
+  } else {
+    copy = (shapeObj *) msSmallMalloc(sizeof(shapeObj));
+    msInitShape(copy);
+    msCopyShape(shape, copy);
+  }
+
+  cache->shapes[i] = copy;
+  cache->shapememory += size;
+}
+
+static int addResult(mapObj *map, layerObj *lp, shapeObj *shape, int projected)
 {
+  resultCacheObj *cache = lp->resultcache;
   int i;
 
   if(cache->numresults == cache->cachesize) { /* just add it to the end */
-    if(cache->cachesize == 0)
+    if(cache->cachesize == 0) {
       cache->results = (resultObj *) malloc(sizeof(resultObj)*MS_RESULTCACHEINCREMENT);
-    else
+      cache->shapememorymax = getResultShapeCacheSize(lp);
+    } else
       cache->results = (resultObj *) realloc(cache->results, sizeof(resultObj)*(cache->cachesize+MS_RESULTCACHEINCREMENT));
     if(!cache->results) {
       msSetError(MS_MEMERR, "Realloc() error.", "addResult()");
       return(MS_FAILURE);
     }
+    if(cache->shapememorymax > 0) {
+      cache->shapes = (shapeObj **) msSmallRealloc(cache->shapes, sizeof(shapeObj *)*(cache->cachesize+MS_RESULTCACHEINCREMENT));
+      memset(cache->shapes + cache->cachesize, 0, sizeof(shapeObj *)*MS_RESULTCACHEINCREMENT);
+    }
     cache->cachesize += MS_RESULTCACHEINCREMENT;
   }
 
@@ -165,6 +300,9 @@ static int addResult(resultCacheObj *cache, shapeObj *shape)
   cache->results[i].resultindex = shape->resultindex;
   cache->numresults++;
 
+  if(cache->shapes)
+    addResultShape(lp, i, shape, projected);
+
   if(cache->numresults == 1)
     cache->bounds = shape->bounds;
   else
@@ -173,6 +311,28 @@ static int addResult(resultCacheObj *cache, shapeObj *shape)
   return(MS_SUCCESS);
 }
 
+/*
+** Hand out the copy of a result shape kept by the query, if there is one.
+** Returns MS_DONE when the shape has to be read from the data source.
+*/
+int msResultCacheGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
+{
+  resultCacheObj *cache = layer->resultcache;
+  shapeObj *copy;
+
+  if(!cache || !cache->shapes || record < cache->results || record >= cache->results + cache->numresults)
+    return MS_DONE;
+
+  copy = cache->shapes[record - cache->results];
+  if(!copy || !resultShapeItemsMatch(layer))
+    return MS_DONE;
+
+  msFreeShape(shape);
+  msCopyShape(copy, shape);
+
+  return MS_SUCCESS;
+}
+
 /*
 ** Serialize a query result set to disk.
 */
@@ -238,6 +398,7 @@ static int loadQueryResults(mapObj *map, FILE *stream)
     /* inialize the results for this layer */
     GET_LAYER(map, j)->resultcache = (resultCacheObj *)malloc(sizeof(resultCacheObj)); /* allocate and initialize the result cache */
     MS_CHECK_ALLOC(GET_LAYER(map, j)->resultcache, sizeof(resultCacheObj), MS_FAILURE);
+    initResultCache(GET_LAYER(map, j)->resultcache);
 
     if(1 != fread(&(GET_LAYER(map, j)->resultcache->numresults), sizeof(int), 1, stream)) { /* number of results */
       msSetError(MS_MISCERR,"failed to read number of results from query file stream", "loadQueryResults()");
@@ -503,7 +664,7 @@ int msQueryByIndex(mapObj *map)
 
   if(map->query.clear_resultcache) {
     if(lp->resultcache) {
-      if(lp->resultcache->results) free(lp->resultcache->results);
+      cleanupResultCache(lp->resultcache);
       free(lp->resultcache);
       lp->resultcache = NULL;
     }
@@ -566,7 +727,7 @@ int msQueryByIndex(mapObj *map)
     return(MS_FAILURE);
   }
   
-  addResult(lp->resultcache, &shape);
+  addResult(map, lp, &shape, MS_FALSE);
 
   msFreeShape(&shape);
   /* msLayerClose(lp); */
@@ -632,7 +793,7 @@ int msQueryByAttributes(mapObj *map)
 
   /* free any previous search results, do now in case one of the following tests fails */
   if(lp->resultcache) {
-    if(lp->resultcache->results) free(lp->resultcache->results);
+    cleanupResultCache(lp->resultcache);
     free(lp->resultcache);
     lp->resultcache = NULL;
   }
@@ -737,13 +898,6 @@ int msQueryByAttributes(mapObj *map)
       continue;
     }
 
-#ifdef USE_PROJ
-    if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
-      msProjectShape(&(lp->projection), &(map->projection), &shape);
-    else
-      lp->project = MS_FALSE;
-#endif
-
     /* Should we skip this feature? */
     if (!paging && map->query.startindex > 1) {
       --map->query.startindex;
@@ -751,7 +905,15 @@ int msQueryByAttributes(mapObj *map)
       continue;
     }
 
-    addResult(lp->resultcache, &shape);
+#ifdef USE_PROJ
+    if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection))) {
+      keepUnprojectedShape(lp, &shape);
+      msProjectShape(&(lp->projection), &(map->projection), &shape);
+    } else
+      lp->project = MS_FALSE;
+#endif
+
+    addResult(map, lp, &shape, lp->project);
     msFreeShape(&shape);
 
     if(map->query.mode == MS_QUERY_SINGLE) { /* no need to look any further */
@@ -840,7 +1002,7 @@ int msQueryByFilter(mapObj *map)
 
     /* free any previous search results, do it now in case one of the next few tests fail */
     if(lp->resultcache) {
-      if(lp->resultcache->results) free(lp->resultcache->results);
+      cleanupResultCache(lp->resultcache);
       free(lp->resultcache);
       lp->resultcache = NULL;
     }
@@ -937,21 +1099,22 @@ int msQueryByFilter(mapObj *map)
         continue;
       }
 
-#ifdef USE_PROJ
-      if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
-        msProjectShape(&(lp->projection), &(map->projection), &shape);
-      else
-        lp->project = MS_FALSE;
-#endif
-
       /* Should we skip this feature? */
       if (!msLayerGetPaging(lp) && map->query.startindex > 1) {
         --map->query.startindex;
         msFreeShape(&shape);
         continue;
       }
-      
-      addResult(lp->resultcache, &shape);
+
+#ifdef USE_PROJ
+      if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection))) {
+        keepUnprojectedShape(lp, &shape);
+        msProjectShape(&(lp->projection), &(map->projection), &shape);
+      } else
+        lp->project = MS_FALSE;
+#endif
+
+      addResult(map, lp, &shape, lp->project);
       msFreeShape(&shape);
 
       /* check shape count */
@@ -987,10 +1150,42 @@ query_error:
   return MS_FAILURE;
 }
 
-int msQueryByRect(mapObj *map)
+/*
+** Rect query worker shared by msQueryByRect() and msQueryByRectStream(). With
+** a shape function each matching shape is handed to it as soon as it has been
+** read (already in the map projection) and nothing is kept in the result cache.
+*/
+/*
+** Callback of msQueryByRectCount() for the layers it can't count in one go.
+*/
+static int countQueryShape(void *cbData, layerObj *layer, shapeObj *shape)
+{
+  (*((int *) cbData))++;
+  return MS_SUCCESS;
+}
+
+/*
+** Whether msLayerGetShapeCount() gives the number of results a rect query
+** of the layer would find: no per shape tests are left besides the rect
+** and the FILTER. A reprojected search rect is wider than the query rect,
+** its shapes get tested one by one.
+*/
+static int canCountQueryShapes(mapObj *map, layerObj *lp)
+{
+  if(!lp->template) return MS_FALSE; /* the classes decide */
+  if(lp->minfeaturesize > 0) return MS_FALSE;
+  if(map->query.startindex > 1) return MS_FALSE;
+#ifdef USE_PROJ
+  if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection))) return MS_FALSE;
+#endif
+  return MS_TRUE;
+}
+
+static int queryByRect(mapObj *map, msQueryShapeFunc pfnShape, void *cbData)
 {
   int l; /* counters */
   int start, stop=0;
+  int numresults, numfound=0;
 
   layerObj *lp;
 
@@ -1035,7 +1230,7 @@ int msQueryByRect(mapObj *map)
 
     /* free any previous search results, do it now in case one of the next few tests fail */
     if(lp->resultcache) {
-      if(lp->resultcache->results) free(lp->resultcache->results);
+      cleanupResultCache(lp->resultcache);
       free(lp->resultcache);
       lp->resultcache = NULL;
     }
@@ -1085,8 +1280,8 @@ int msQueryByRect(mapObj *map)
     if(status != MS_SUCCESS) return(MS_FAILURE);
     msLayerEnablePaging(lp, paging);
 
-    /* build item list, we want *all* items */
-    status = msLayerWhichItems(lp, MS_TRUE, NULL);
+    /* build item list, we want *all* items unless only counting */
+    status = msLayerWhichItems(lp, (pfnShape == countQueryShape) ? MS_FALSE : MS_TRUE, NULL);
     if(status != MS_SUCCESS) return(MS_FAILURE);
 
 #ifdef USE_PROJ
@@ -1095,6 +1290,22 @@ int msQueryByRect(mapObj *map)
     else
       lp->project = MS_FALSE;
 #endif
+
+    if(pfnShape == countQueryShape && canCountQueryShapes(map, lp)) {
+      numresults = msLayerGetShapeCount(lp, searchrect);
+      msLayerClose(lp);
+      if(numresults < 0) {
+        msFreeShape(&searchshape);
+        return(MS_FAILURE);
+      }
+      if(lp->maxfeatures > 0 && numresults > lp->maxfeatures)
+        numresults = lp->maxfeatures;
+      *((int *) cbData) += numresults;
+      map->query.maxfeatures -= numresults;
+      numfound += numresults;
+      continue;
+    }
+
     status = msLayerWhichShapes(lp, searchrect, MS_TRUE);
     if(status == MS_DONE) { /* no overlap */
       msLayerClose(lp);
@@ -1104,9 +1315,12 @@ int msQueryByRect(mapObj *map)
       return(MS_FAILURE);
     }
 
-    lp->resultcache = (resultCacheObj *)malloc(sizeof(resultCacheObj)); /* allocate and initialize the result cache */
-    MS_CHECK_ALLOC(lp->resultcache, sizeof(resultCacheObj), MS_FAILURE);
-    initResultCache( lp->resultcache);
+    if(!pfnShape) {
+      lp->resultcache = (resultCacheObj *)malloc(sizeof(resultCacheObj)); /* allocate and initialize the result cache */
+      MS_CHECK_ALLOC(lp->resultcache, sizeof(resultCacheObj), MS_FAILURE);
+      initResultCache( lp->resultcache);
+    }
+    numresults = 0;
 
     nclasses = 0;
     classgroup = NULL;
@@ -1122,7 +1336,7 @@ int msQueryByRect(mapObj *map)
       if ( (shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) && (minfeaturesize > 0) ) {
         if (msShapeCheckSize(&shape, minfeaturesize) == MS_FALSE) {
           if( lp->debug >= MS_DEBUGLEVEL_V )
-            msDebug("msQueryByRect(): Skipping shape (%d) because LAYER::MINFEATURESIZE is bigger than shape size\n", shape.index);
+            msDebug("queryByRect(): Skipping shape (%d) because LAYER::MINFEATURESIZE is bigger than shape size\n", shape.index);
           msFreeShape(&shape);
           continue;
         }
@@ -1140,9 +1354,10 @@ int msQueryByRect(mapObj *map)
       }
 
 #ifdef USE_PROJ
-      if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
+      if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection))) {
+        keepUnprojectedShape(lp, &shape);
         msProjectShape(&(lp->projection), &(map->projection), &shape);
-      else
+      } else
         lp->project = MS_FALSE;
 #endif
 
@@ -1171,13 +1386,21 @@ int msQueryByRect(mapObj *map)
           msFreeShape(&shape);
           continue;
         }
-        addResult(lp->resultcache, &shape);
+        if(pfnShape) {
+          if(pfnShape(cbData, lp, &shape) != MS_SUCCESS) {
+            msFreeShape(&shape);
+            status = MS_FAILURE;
+            break;
+          }
+        } else
+          addResult(map, lp, &shape, lp->project);
+        numresults++;
         --map->query.maxfeatures;
       }
       msFreeShape(&shape);
 
       /* check shape count */
-      if(lp->maxfeatures > 0 && lp->maxfeatures == lp->resultcache->numresults) {
+      if(lp->maxfeatures > 0 && lp->maxfeatures == numresults) {
         status = MS_DONE;
         break;
       }
@@ -1187,14 +1410,21 @@ int msQueryByRect(mapObj *map)
     if (classgroup)
       msFree(classgroup);
 
-    if(status != MS_DONE) return(MS_FAILURE);
+    if(status != MS_DONE) {
+      if(pfnShape) msLayerClose(lp);
+      msFreeShape(&searchshape);
+      return(MS_FAILURE);
+    }
 
-    if(lp->resultcache->numresults == 0) msLayerClose(lp); /* no need to keep the layer open */
+    numfound += numresults;
+    if(pfnShape || numresults == 0) msLayerClose(lp); /* no need to keep the layer open */
   } /* next layer */
 
   msFreeShape(&searchshape);
 
   /* was anything found? */
+  if(numfound > 0)
+    return(MS_SUCCESS);
   for(l=start; l>=stop; l--) {
     if(GET_LAYER(map, l)->resultcache && GET_LAYER(map, l)->resultcache->numresults > 0)
       return(MS_SUCCESS);
@@ -1204,6 +1434,34 @@ int msQueryByRect(mapObj *map)
   return(MS_FAILURE);
 }
 
+int msQueryByRect(mapObj *map)
+{
+  return queryByRect(map, NULL, NULL);
+}
+
+/*
+** Same query as msQueryByRect(), but the matching shapes are passed to
+** pfnShape one at a time instead of being collected in the layer result
+** caches, so the data is only read once and output can start right away.
+** The shape is freed when pfnShape returns; a return other than MS_SUCCESS
+** aborts the query.
+*/
+int msQueryByRectStream(mapObj *map, msQueryShapeFunc pfnShape, void *cbData)
+{
+  return queryByRect(map, pfnShape, cbData);
+}
+
+/*
+** Adds the number of features msQueryByRect() would find to *pnCount, without
+** keeping them. Layers are counted by the data source where possible (see
+** msLayerGetShapeCount()), so most geometries are never read or decoded.
+** Raster layers still fill their result caches.
+*/
+int msQueryByRectCount(mapObj *map, int *pnCount)
+{
+  return queryByRect(map, countQueryShape, pnCount);
+}
+
 static int is_duplicate(resultCacheObj *resultcache, int shapeindex, int tileindex)
 {
   int i;
@@ -1277,7 +1535,7 @@ int msQueryByFeatures(mapObj *map)
 
     /* free any previous search results, do it now in case one of the next few tests fail */
     if(lp->resultcache) {
-      if(lp->resultcache->results) free(lp->resultcache->results);
+      cleanupResultCache(lp->resultcache);
       free(lp->resultcache);
       lp->resultcache = NULL;
     }
@@ -1411,9 +1669,10 @@ int msQueryByFeatures(mapObj *map)
         }
 
 #ifdef USE_PROJ
-        if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
+        if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection))) {
+          keepUnprojectedShape(lp, &shape);
           msProjectShape(&(lp->projection), &(map->projection), &shape);
-        else
+        } else
           lp->project = MS_FALSE;
 #endif
 
@@ -1492,7 +1751,7 @@ int msQueryByFeatures(mapObj *map)
             msFreeShape(&shape);
             continue;
           }
-          addResult(lp->resultcache, &shape);
+          addResult(map, lp, &shape, lp->project);
         }
         msFreeShape(&shape);
 
@@ -1536,11 +1795,192 @@ int msQueryByFeatures(mapObj *map)
  *   Set maxresults = 0 to have an unlimited number of results.
  *   Set maxresults > 0 to limit the number of results per layer (the shapes
  *     returned are the first ones found in each layer and are not necessarily
- *     the closest ones).
+ *     the closest ones, except on plain shapefile layers where they are the
+ *     closest ones, see queryByPointNearest()).
+ *
+ * In both modes the results of a layer are in the order of the layer.
  */
+typedef struct {
+  long shapeindex;
+  double distance; /* squared, from the point to the shape bounds */
+} queryCandidateObj;
+
+static int compareShapeIndexes(const void *a, const void *b)
+{
+  const shapeObj *sa = (const shapeObj *) a;
+  const shapeObj *sb = (const shapeObj *) b;
+
+  return (sa->index < sb->index) ? -1 : (sa->index > sb->index);
+}
+
+static int compareQueryCandidates(const void *a, const void *b)
+{
+  const queryCandidateObj *ca = (const queryCandidateObj *) a;
+  const queryCandidateObj *cb = (const queryCandidateObj *) b;
+
+  if(ca->distance < cb->distance) return -1;
+  if(ca->distance > cb->distance) return 1;
+  return (ca->shapeindex < cb->shapeindex) ? -1 : (ca->shapeindex > cb->shapeindex);
+}
+
+static double squareDistancePointToRect(pointObj *p, rectObj *rect)
+{
+  double dx = 0, dy = 0;
+
+  if(p->x < rect->minx) dx = rect->minx - p->x;
+  else if(p->x > rect->maxx) dx = p->x - rect->maxx;
+  if(p->y < rect->miny) dy = rect->miny - p->y;
+  else if(p->y > rect->maxy) dy = p->y - rect->maxy;
+
+  return dx*dx + dy*dy;
+}
+
+/*
+** Number of closest features msQueryByPoint() needs from a layer, or 0 when
+** it wants all of them and nothing can be gained from a nearest search.
+*/
+static int getNearestQueryCount(mapObj *map, layerObj *lp)
+{
+  int k = 0;
+
+  if(lp->connectiontype != MS_SHAPEFILE || lp->tileindex || lp->type == MS_LAYER_TILEINDEX)
+    return 0; /* only plain shapefiles hand out bounds without reading the shapes */
+  if(lp->_geomtransform.type != MS_GEOMTRANSFORM_NONE)
+    return 0; /* the stored bounds are not those of the transformed shapes */
+  if(map->query.startindex > 1)
+    return 0;
+#ifdef USE_PROJ
+  if(lp->project)
+    return 0; /* the bounds are not in map units */
+#endif
+
+  if(map->query.mode == MS_QUERY_SINGLE)
+    k = 1;
+  else if(map->query.maxresults > 0)
+    k = map->query.maxresults;
+  if(lp->maxfeatures > 0 && (k == 0 || lp->maxfeatures < k))
+    k = lp->maxfeatures;
+
+  return k;
+}
+
+/*
+** Point query of a shapefile layer returning the k closest features within
+** the tolerance t, added to the results in shape index order like the
+** msLayerNextShape() loop would add them. The candidates selected by
+** msLayerWhichShapes() are ranked by the distance to their bounds, read from
+** the .shp record headers, and only read, filtered and classified in that
+** order until no remaining candidate can be closer than the k-th hit. Returns
+** MS_DONE like the msLayerNextShape() loop it replaces.
+*/
+static int queryByPointNearest(mapObj *map, layerObj *lp, double t, int k, int *classgroup, int nclasses, double minfeaturesize)
+{
+  queryCandidateObj *candidates = NULL;
+  int numcandidates = 0, maxcandidates = 0, numread = 0;
+  shapeObj shape, *hits;
+  double *hitdistances, d, t2 = t*t;
+  int i, j, numhits = 0, status;
+  long shapeindex;
+  rectObj bounds;
+  resultObj record;
+
+  while((status = msSHPLayerNextBounds(lp, &shapeindex, &bounds)) == MS_SUCCESS) {
+    d = squareDistancePointToRect(&(map->query.point), &bounds);
+    if(d > t2) continue;
+
+    if(numcandidates == maxcandidates) {
+      maxcandidates = (maxcandidates == 0) ? 64 : maxcandidates*2;
+      candidates = (queryCandidateObj *) msSmallRealloc(candidates, sizeof(queryCandidateObj)*maxcandidates);
+    }
+    candidates[numcandidates].shapeindex = shapeindex;
+    candidates[numcandidates].distance = d;
+    numcandidates++;
+  }
+  if(status != MS_DONE) {
+    free(candidates);
+    return MS_FAILURE;
+  }
+
+  if(numcandidates > 1)
+    qsort(candidates, numcandidates, sizeof(queryCandidateObj), compareQueryCandidates);
+
+  hits = (shapeObj *) msSmallMalloc(sizeof(shapeObj)*k);
+  hitdistances = (double *) msSmallMalloc(sizeof(double)*k);
+
+  for(i=0; i<numcandidates; i++) {
+    if(numhits == k && candidates[i].distance >= hitdistances[k-1])
+      break; /* nothing left can be closer */
+
+    msInitShape(&shape);
+    record.resultindex = -1;
+    record.classindex = -1;
+    record.tileindex = -1;
+    record.shapeindex = candidates[i].shapeindex;
+    if(msLayerGetShape(lp, &shape, &record) != MS_SUCCESS) {
+      msFreeShape(&shape);
+      status = MS_FAILURE;
+      break;
+    }
+    numread++;
+
+    /* msLayerGetShape() does not apply the layer FILTER, msLayerNextShape() does */
+    if(lp->numitems > 0 && lp->iteminfo && msEvalExpression(lp, &shape, &(lp->filter), lp->filteritemindex) != MS_TRUE) {
+      msFreeShape(&shape);
+      continue;
+    }
+
+    if((shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) && minfeaturesize > 0 && msShapeCheckSize(&shape, minfeaturesize) == MS_FALSE) {
+      msFreeShape(&shape);
+      continue;
+    }
+
+    d = msSquareDistancePointToShape(&(map->query.point), &shape);
+    if(d < 0 || d > t2 || (numhits == k && d >= hitdistances[k-1])) {
+      msFreeShape(&shape);
+      continue;
+    }
+
+    shape.classindex = msShapeGetClass(lp, map, &shape, classgroup, nclasses);
+    if(!(lp->template) && ((shape.classindex == -1) || (lp->class[shape.classindex]->status == MS_OFF) || !(lp->class[shape.classindex]->template))) {
+      msFreeShape(&shape);
+      continue;
+    }
+
+    /* keep the hits sorted by distance, dropping the farthest one */
+    if(numhits == k)
+      msFreeShape(&(hits[--numhits]));
+    for(j=numhits; j>0 && hitdistances[j-1] > d; j--) {
+      hits[j] = hits[j-1];
+      hitdistances[j] = hitdistances[j-1];
+    }
+    hits[j] = shape;
+    hitdistances[j] = d;
+    numhits++;
+  }
+
+  if(lp->debug >= MS_DEBUGLEVEL_VV)
+    msDebug("msQueryByPoint(): layer %s, %d candidate(s), %d shape(s) read, %d found.\n", lp->name, numcandidates, numread, numhits);
+
+  /* the hits were ranked by distance, the results keep the layer order */
+  if(numhits > 1)
+    qsort(hits, numhits, sizeof(shapeObj), compareShapeIndexes);
+
+  for(j=0; j<numhits; j++) {
+    if(status == MS_DONE && addResult(map, lp, &(hits[j]), MS_FALSE) != MS_SUCCESS)
+      status = MS_FAILURE;
+    msFreeShape(&(hits[j]));
+  }
+
+  free(hits);
+  free(hitdistances);
+  free(candidates);
+
+  return status;
+}
+
 int msQueryByPoint(mapObj *map)
 {
-  int l;
+  int l, k;
   int start, stop=0;
 
   double d, t;
@@ -1585,7 +2025,7 @@ int msQueryByPoint(mapObj *map)
 
     /* free any previous search results, do it now in case one of the next few tests fail */
     if(lp->resultcache) {
-      if(lp->resultcache->results) free(lp->resultcache->results);
+      cleanupResultCache(lp->resultcache);
       free(lp->resultcache);
       lp->resultcache = NULL;
     }
@@ -1673,7 +2113,9 @@ int msQueryByPoint(mapObj *map)
     if (lp->minfeaturesize > 0)
       minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
 
-    while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
+    if((k = getNearestQueryCount(map, lp)) > 0) /* only the closest features are wanted */
+      status = queryByPointNearest(map, lp, t, k, classgroup, nclasses, minfeaturesize);
+    else while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
 
       /* Check if the shape size is ok to be drawn */
       if ( (shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) && (minfeaturesize > 0) ) {
@@ -1697,9 +2139,10 @@ int msQueryByPoint(mapObj *map)
       }
 
 #ifdef USE_PROJ
-      if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
+      if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection))) {
+        keepUnprojectedShape(lp, &shape);
         msProjectShape(&(lp->projection), &(map->projection), &shape);
-      else
+      } else
         lp->project = MS_FALSE;
 #endif
 
@@ -1715,10 +2158,10 @@ int msQueryByPoint(mapObj *map)
 
         if(map->query.mode == MS_QUERY_SINGLE) {
           lp->resultcache->numresults = 0;
-          addResult(lp->resultcache, &shape);
+          addResult(map, lp, &shape, lp->project);
           t = d; /* next one must be closer */
         } else {
-          addResult(lp->resultcache, &shape);
+          addResult(map, lp, &shape, lp->project);
         }
       }
 
@@ -1764,7 +2207,10 @@ int msQueryByShape(mapObj *map)
   layerObj *lp;
   char status;
   double distance, tolerance, layer_tolerance;
-  rectObj searchrect;
+  rectObj searchrect, qbounds;
+#ifdef USE_GEOS
+  int geosstatus;
+#endif
 
   int nclasses = 0;
   int *classgroup = NULL;
@@ -1811,7 +2257,7 @@ int msQueryByShape(mapObj *map)
 
     /* free any previous search results, do it now in case one of the next few tests fail */
     if(lp->resultcache) {
-      if(lp->resultcache->results) free(lp->resultcache->results);
+      cleanupResultCache(lp->resultcache);
       free(lp->resultcache);
       lp->resultcache = NULL;
     }
@@ -1867,6 +2313,7 @@ int msQueryByShape(mapObj *map)
     searchrect.maxx += tolerance;
     searchrect.miny -= tolerance;
     searchrect.maxy += tolerance;
+    qbounds = searchrect; /* in map coordinates, to reject candidates cheaply */
 
 #ifdef USE_PROJ
     if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
@@ -1920,12 +2367,33 @@ int msQueryByShape(mapObj *map)
       }
 
 #ifdef USE_PROJ
-      if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
+      if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection))) {
+        keepUnprojectedShape(lp, &shape);
         msProjectShape(&(lp->projection), &(map->projection), &shape);
-      else
+        msGEOSFreeGeometry(&shape); /* a geometry read with the shape is in the layer projection */
+      } else
         lp->project = MS_FALSE;
 #endif
 
+      /* the index search is coarse, skip the shapes whose extent can't reach the selection shape */
+      msComputeBounds(&shape);
+      if(msRectOverlap(&(shape.bounds), &qbounds) != MS_TRUE) {
+        msFreeShape(&shape);
+        continue;
+      }
+
+      status = MS_FALSE;
+#ifdef USE_GEOS
+      /*
+      ** The selection shape keeps its GEOS geometry and is prepared once, see
+      ** msGEOSPredicate(). Candidates with a geometry of their own, and GEOS
+      ** errors, get the native test.
+      */
+      if(tolerance == 0 && qshape->type != MS_SHAPE_POINT && shape.geometry == NULL &&
+          (geosstatus = msGEOSIntersects(qshape, &shape)) != -1)
+        status = (geosstatus == MS_TRUE) ? MS_TRUE : MS_FALSE;
+      else
+#endif
       switch(qshape->type) { /* may eventually support types other than polygon or line */
         case MS_SHAPE_POLYGON:
           switch(shape.type) { /* make sure shape actually intersects the shape */
@@ -2006,7 +2474,7 @@ int msQueryByShape(mapObj *map)
           msFreeShape(&shape);
           continue;
         }
-        addResult(lp->resultcache, &shape);
+        addResult(map, lp, &shape, lp->project);
       }
       msFreeShape(&shape);
 
@@ -2022,6 +2490,10 @@ int msQueryByShape(mapObj *map)
     if(lp->resultcache->numresults == 0) msLayerClose(lp); /* no need to keep the layer open */
   } /* next layer */
 
+#ifdef USE_GEOS
+  msGEOSFreeGeometry(qshape); /* the caller may still edit the selection shape */
+#endif
+
   /* was anything found? */
   for(l=start; l>=stop; l--) {
     if(GET_LAYER(map, l)->resultcache && GET_LAYER(map, l)->resultcache->numresults > 0)
@@ -2085,8 +2557,7 @@ void msQueryFree(mapObj *map, int qlayer)
     lp = (GET_LAYER(map, l));
 
     if(lp->resultcache) {
-      if(lp->resultcache->results)
-        free(lp->resultcache->results);
+      cleanupResultCache(lp->resultcache);
       free(lp->resultcache);
       lp->resultcache = NULL;
     }
@@ -47,6 +47,20 @@ extern parseResultObj yypresult; /* result of parsing, true/false */
 #include "cpl_string.h"
 #endif
 
+/*
+** From GDAL 1.6 GDALOpenShared() never hands the same dataset to two
+** threads, so once a dataset is open it can be read without holding
+** TLOCK_GDAL.  Only opening, closing and dereferencing still touch the
+** shared dataset list and need the lock.
+*/
+#if defined(USE_GDAL) && GDAL_VERSION_NUM >= 1600
+#  define RELEASE_GDAL_READ_LOCK   msReleaseLock( TLOCK_GDAL )
+#  define ACQUIRE_GDAL_CLOSE_LOCK  msAcquireLock( TLOCK_GDAL )
+#else
+#  define RELEASE_GDAL_READ_LOCK
+#  define ACQUIRE_GDAL_CLOSE_LOCK
+#endif
+
 #define MAXCOLORS 256
 #define BUFLEN 1024
 #define HDRLEN 8
@@ -311,6 +325,30 @@ int msAddColorGD(mapObj *map, gdImagePtr img, int cmt, int r, int g, int b)
 
 #endif
 
+#ifdef USE_GDAL
+/************************************************************************/
+/*                      msRasterDatasetCacheSize()                      */
+/*                                                                      */
+/*      How many tile datasets to keep open between requests, from      */
+/*      PROCESSING "DATASET_CACHE_SIZE" or else the config option       */
+/*      MS_GDAL_DATASET_CACHE_SIZE.  Reuse is off unless one is set.    */
+/************************************************************************/
+
+static int msRasterDatasetCacheSize( mapObj *map, layerObj *layer )
+
+{
+  const char *pszSize;
+
+  pszSize = msLayerGetProcessingKey( layer, "DATASET_CACHE_SIZE" );
+  if( pszSize == NULL )
+    pszSize = msGetConfigOption( map, "MS_GDAL_DATASET_CACHE_SIZE" );
+  if( pszSize == NULL )
+    return 0;
+
+  return MS_MAX(0, atoi(pszSize));
+}
+#endif
+
 /************************************************************************/
 /*                        msDrawRasterLayerLow()                        */
 /*                                                                      */
@@ -351,12 +389,15 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
   GDALDatasetH  hDS;
   double  adfGeoTransform[6];
   const char *close_connection;
+  int nDatasetCacheSize = 0;
 
   msGDALInitialize();
 
   if(layer->debug > 0 || map->debug > 1)
     msDebug( "msDrawRasterLayerLow(%s): entering.\n", layer->name );
 
+  layer->rasterbytesread = 0;
+
   if(!layer->data && !layer->tileindex) {
     if(layer->debug == MS_TRUE)
       msDebug( "msDrawRasterLayerLow(%s): layer data and tileindex NULL ... doing nothing.", layer->name );
@@ -483,6 +524,14 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
       }
     }
 #endif
+    /*
+    ** When asked to, and unless CLOSE_CONNECTION is set, the tiles of a
+    ** tile index are kept open for the next requests in a bounded cache,
+    ** see msGDALAcquireDataset().
+    */
+    if( msLayerGetProcessingKey( layer, "CLOSE_CONNECTION" ) == NULL )
+      nDatasetCacheSize = msRasterDatasetCacheSize( map, layer );
+
     status = msLayerWhichShapes(tlp, searchrect, MS_FALSE);
     if (status != MS_SUCCESS) {
       /* Can be either MS_DONE or MS_FAILURE */
@@ -547,7 +596,11 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
       return MS_FAILURE;
 
     msAcquireLock( TLOCK_GDAL );
-    hDS = GDALOpenShared( decrypted_path, GA_ReadOnly );
+    if( nDatasetCacheSize > 0 )
+      hDS = (GDALDatasetH) msGDALAcquireDataset( decrypted_path,
+            nDatasetCacheSize );
+    else
+      hDS = GDALOpenShared( decrypted_path, GA_ReadOnly );
 
     /*
     ** If GDAL doesn't recognise it, and it wasn't successfully opened
@@ -622,6 +675,8 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
           msSetError(MS_OGRERR, "%s","msDrawRasterLayer()",
                      szLongMsg);
 
+          if( nDatasetCacheSize > 0 )
+            msGDALReleaseDataset( hDS, nDatasetCacheSize );
           msReleaseLock( TLOCK_GDAL );
           final_status = MS_FAILURE;
           break;
@@ -631,6 +686,8 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
 
     msGetGDALGeoTransform( hDS, map, layer, adfGeoTransform );
 
+    RELEASE_GDAL_READ_LOCK;
+
     /*
     ** We want to resample if the source image is rotated, if
     ** the projections differ or if resampling has been explicitly
@@ -659,13 +716,24 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
       status = msDrawRasterLayerGDAL(map, layer, image, rb, hDS );
     }
 
+    ACQUIRE_GDAL_CLOSE_LOCK;
+
     if( status == -1 ) {
-      GDALClose( hDS );
+      if( nDatasetCacheSize > 0 )
+        msGDALReleaseDataset( hDS, nDatasetCacheSize );
+      else
+        GDALClose( hDS );
       msReleaseLock( TLOCK_GDAL );
       final_status = MS_FAILURE;
       break;
     }
 
+    if( nDatasetCacheSize > 0 ) {
+      msGDALReleaseDataset( hDS, nDatasetCacheSize );
+      msReleaseLock( TLOCK_GDAL );
+      continue;
+    }
+
     /*
     ** Should we keep this file open for future use?
     ** default to keeping open for single data files, and
@@ -696,6 +764,10 @@ cleanup:
     }
   }
 
+  if(layer->debug >= MS_DEBUGLEVEL_TUNING || map->debug >= MS_DEBUGLEVEL_TUNING)
+    msDebug( "msDrawRasterLayerLow(%s): %.0f bytes of raster data read.\n",
+             layer->name, layer->rasterbytesread );
+
   return final_status;
 
 #endif /* defined(USE_GDAL) */
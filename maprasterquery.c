@@ -684,7 +684,7 @@ int msRasterQueryByRect(mapObj *map, layerObj *layer, rectObj queryRect)
   /*      Clear old results cache.                                        */
   /* -------------------------------------------------------------------- */
   if(layer->resultcache) {
-    if(layer->resultcache->results) free(layer->resultcache->results);
+    cleanupResultCache(layer->resultcache);
     free(layer->resultcache);
     layer->resultcache = NULL;
   }
@@ -693,12 +693,7 @@ int msRasterQueryByRect(mapObj *map, layerObj *layer, rectObj queryRect)
   /*      Initialize the results cache.                                   */
   /* -------------------------------------------------------------------- */
   layer->resultcache = (resultCacheObj *)msSmallMalloc(sizeof(resultCacheObj));
-  layer->resultcache->results = NULL;
-  layer->resultcache->numresults = layer->resultcache->cachesize = 0;
-  layer->resultcache->bounds.minx =
-    layer->resultcache->bounds.miny =
-      layer->resultcache->bounds.maxx =
-        layer->resultcache->bounds.maxy = -1;
+  initResultCache( layer->resultcache );
 
   /* -------------------------------------------------------------------- */
   /*      Check if we should really be acting on this layer and           */
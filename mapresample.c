@@ -31,6 +31,10 @@
 #include "mapresample.h"
 #include "mapthread.h"
 
+#if defined(USE_GDAL) && GDAL_VERSION_NUM >= 1800
+#  include "cpl_multiproc.h"
+#endif
+
 
 
 #ifndef MAX
@@ -40,6 +44,8 @@
 
 #define SKIP_MASK(x,y) (mask_rb && !*(mask_rb->data.rgba.a+(y)*mask_rb->data.rgba.row_step+(x)*mask_rb->data.rgba.pixel_step))
 
+#ifndef MS_RESAMPLE_KERNEL_TEST
+
 /************************************************************************/
 /*                          InvGeoTransform()                           */
 /*                                                                      */
@@ -77,28 +83,750 @@ int InvGeoTransform( double *gt_in, double *gt_out )
   return 1;
 }
 
-#if defined(USE_PROJ) && defined(USE_GDAL)
+#endif /* ndef MS_RESAMPLE_KERNEL_TEST */
+
+#if (defined(USE_PROJ) && defined(USE_GDAL)) || defined(MS_RESAMPLE_KERNEL_TEST)
+
+/*
+** One band of destination rows to resample.  The rows of a destination
+** image are split between several jobs that may run on separate threads,
+** each with its own transformer.  Jobs only write to their own rows.
+*/
+typedef struct {
+  imageObj *psSrcImage;
+  rasterBufferObj *src_rb;
+  imageObj *psDstImage;
+  rasterBufferObj *dst_rb;
+  int *panCMap;
+  SimpleTransformer pfnTransform;
+  void *pCBData;
+  rasterBufferObj *mask_rb;
+
+  int nDstYMin;  /* first destination row */
+  int nDstYMax;  /* one past the last destination row */
+
+  int nFailedPoints;
+  int nSetPoints;
+} msResampleJob;
+
+/************************************************************************/
+/* ==================================================================== */
+/*      Row kernels for 8-bit RGBA sources.                             */
+/*                                                                      */
+/*      The common case of resampling the temporary RGBA image onto     */
+/*      an RGBA map image is done a row at a time.  The kernels only    */
+/*      compute the source value of each destination pixel of the      */
+/*      row, packed as r | g<<8 | b<<16 | a<<24, and flag the pixels    */
+/*      that got one.  Blending into the destination stays with the     */
+/*      resamplers.  SSE2 and AVX2 versions are used when the build     */
+/*      and the cpu support them.                                       */
+/*                                                                      */
+/*      testresample.c builds this section alone, with                  */
+/*      MS_RESAMPLE_KERNEL_TEST defined, to check the vector kernels    */
+/*      against the scalar ones.                                        */
+/* ==================================================================== */
+/************************************************************************/
+
+#ifdef HAVE_SSE2
+#  include <emmintrin.h>
+#endif
+#ifdef HAVE_AVX2_DISPATCH
+#  include <immintrin.h>
+#endif
+
+typedef struct {
+  const unsigned char *pixels;
+  int nXSize;
+  int nYSize;
+  int row_step;
+  int r_shift, g_shift, b_shift, a_shift;
+} msRGBASource;
+
+typedef void (*msRGBARowKernel)( const msRGBASource *psSrc, int nCount,
+                                 const double *x, const double *y,
+                                 const int *panSuccess,
+                                 unsigned int *panPixel, int *panValid );
+
+/*
+** Bilinear panValid value for a pixel that was sampled but whose weight
+** is too small to be drawn.  It still counts as a set point.
+*/
+#define MS_RGBA_FAINT 2
+
+#define RGBA_CHANNEL(pixel,shift) (((pixel) >> (shift)) & 0xff)
+#define RGBA_PACK(r,g,b,a) \
+  ((unsigned int)(r) | ((unsigned int)(g) << 8) | \
+   ((unsigned int)(b) << 16) | ((unsigned int)(a) << 24))
+
+/************************************************************************/
+/*                          msInitRGBASource()                          */
+/*                                                                      */
+/*      The kernels read whole 4 byte pixels, so they need the          */
+/*      channels interleaved in one 32 bit little endian word, with     */
+/*      an alpha channel.                                               */
+/************************************************************************/
+
+static int msInitRGBASource( msRGBASource *psSrc, rasterBufferObj *rb,
+                             int nXSize, int nYSize )
+
+{
+  rgbaArrayObj *rgba;
+  const unsigned int nOne = 1;
+
+  if( rb == NULL || rb->type != MS_BUFFER_BYTE_RGBA
+      || *((const unsigned char *) &nOne) != 1 )
+    return MS_FALSE;
+
+  rgba = &(rb->data.rgba);
+  if( rgba->pixels == NULL || rgba->a == NULL || rgba->pixel_step != 4
+      || rgba->r < rgba->pixels || rgba->r > rgba->pixels + 3
+      || rgba->g < rgba->pixels || rgba->g > rgba->pixels + 3
+      || rgba->b < rgba->pixels || rgba->b > rgba->pixels + 3
+      || rgba->a < rgba->pixels || rgba->a > rgba->pixels + 3 )
+    return MS_FALSE;
+
+  psSrc->pixels = rgba->pixels;
+  psSrc->nXSize = nXSize;
+  psSrc->nYSize = nYSize;
+  psSrc->row_step = rgba->row_step;
+  psSrc->r_shift = 8 * (int) (rgba->r - rgba->pixels);
+  psSrc->g_shift = 8 * (int) (rgba->g - rgba->pixels);
+  psSrc->b_shift = 8 * (int) (rgba->b - rgba->pixels);
+  psSrc->a_shift = 8 * (int) (rgba->a - rgba->pixels);
+
+  return MS_TRUE;
+}
+
+static unsigned int msRGBASourcePixel( const msRGBASource *psSrc, int nOffset )
+
+{
+  unsigned int nPixel;
+
+  memcpy( &nPixel, psSrc->pixels + nOffset, 4 );
+
+  return nPixel;
+}
+
+/************************************************************************/
+/*                         msNearestRowRGBA()                           */
+/************************************************************************/
+
+static void msNearestRowRGBA( const msRGBASource *psSrc, int nCount,
+                              const double *x, const double *y,
+                              const int *panSuccess,
+                              unsigned int *panPixel, int *panValid )
+
+{
+  int i;
+
+  for( i = 0; i < nCount; i++ ) {
+    int nSrcX = (int) x[i];
+    int nSrcY = (int) y[i];
+
+    /* same tests as msNearestRasterResampler(), see bug #3120 */
+    panValid[i] = panSuccess[i]
+                  && !( x[i] < 0.0 || y[i] < 0.0
+                        || nSrcX < 0 || nSrcY < 0
+                        || nSrcX >= psSrc->nXSize || nSrcY >= psSrc->nYSize );
+    if( panValid[i] )
+      panPixel[i] = msRGBASourcePixel( psSrc, nSrcX * 4 + nSrcY * psSrc->row_step );
+  }
+}
+
+/************************************************************************/
+/*                         msBilinearRowRGBA()                          */
+/*                                                                      */
+/*      Same arithmetic as msBilinearRasterResampler() with             */
+/*      msSourceSample().                                               */
+/************************************************************************/
+
+static void msBilinearRowRGBA( const msRGBASource *psSrc, int nCount,
+                               const double *x, const double *y,
+                               const int *panSuccess,
+                               unsigned int *panPixel, int *panValid )
+
+{
+  int i;
+
+  for( i = 0; i < nCount; i++ ) {
+    int nSrcX, nSrcY, nSrcX2, nSrcY2, iTap;
+    int anOffset[4];
+    double dfRatioX2, dfRatioY2, dfWeightSum = 0.0;
+    double adfWeight[4], adfSum[3] = { 0.0, 0.0, 0.0 };
+
+    panValid[i] = MS_FALSE;
+    if( !panSuccess[i] )
+      continue;
+
+    nSrcX = (int) floor(x[i] - 0.5);
+    nSrcY = (int) floor(y[i] - 0.5);
+    nSrcX2 = nSrcX+1;
+    nSrcY2 = nSrcY+1;
+    dfRatioX2 = (x[i] - 0.5) - nSrcX;
+    dfRatioY2 = (y[i] - 0.5) - nSrcY;
+
+    if( nSrcX2 < 0 || nSrcX >= psSrc->nXSize
+        || nSrcY2 < 0 || nSrcY >= psSrc->nYSize )
+      continue;
+
+    nSrcX = MAX(nSrcX,0);
+    nSrcY = MAX(nSrcY,0);
+    nSrcX2 = MIN(nSrcX2,psSrc->nXSize-1);
+    nSrcY2 = MIN(nSrcY2,psSrc->nYSize-1);
+
+    anOffset[0] = nSrcX * 4 + nSrcY * psSrc->row_step;
+    anOffset[1] = nSrcX2 * 4 + nSrcY * psSrc->row_step;
+    anOffset[2] = nSrcX * 4 + nSrcY2 * psSrc->row_step;
+    anOffset[3] = nSrcX2 * 4 + nSrcY2 * psSrc->row_step;
+    adfWeight[0] = (1.0 - dfRatioX2) * (1.0 - dfRatioY2);
+    adfWeight[1] = (dfRatioX2) * (1.0 - dfRatioY2);
+    adfWeight[2] = (1.0 - dfRatioX2) * (dfRatioY2);
+    adfWeight[3] = (dfRatioX2) * (dfRatioY2);
+
+    for( iTap = 0; iTap < 4; iTap++ ) {
+      unsigned int nPixel = msRGBASourcePixel( psSrc, anOffset[iTap] );
+      int nAlpha = RGBA_CHANNEL(nPixel, psSrc->a_shift);
+
+      if( nAlpha > 1 ) {
+        adfSum[0] += RGBA_CHANNEL(nPixel, psSrc->r_shift) * adfWeight[iTap];
+        adfSum[1] += RGBA_CHANNEL(nPixel, psSrc->g_shift) * adfWeight[iTap];
+        adfSum[2] += RGBA_CHANNEL(nPixel, psSrc->b_shift) * adfWeight[iTap];
+        dfWeightSum += adfWeight[iTap] * (nAlpha / 255.0);
+      }
+    }
+
+    if( dfWeightSum == 0.0 )
+      continue;
+
+    panPixel[i] =
+      RGBA_PACK( (unsigned char) MAX(0,MIN(255,adfSum[0] / dfWeightSum)),
+                 (unsigned char) MAX(0,MIN(255,adfSum[1] / dfWeightSum)),
+                 (unsigned char) MAX(0,MIN(255,adfSum[2] / dfWeightSum)),
+                 (unsigned char) MAX(0,MIN(255,255.5*dfWeightSum)) );
+    panValid[i] = dfWeightSum > 0.001 ? MS_TRUE : MS_RGBA_FAINT;
+  }
+}
+
+#ifdef HAVE_SSE2
+/************************************************************************/
+/*                           SSE2 kernels                               */
+/*                                                                      */
+/*      Four destination pixels at a time.  Coordinates are floored     */
+/*      in double precision, weights and sums are computed in single    */
+/*      precision, which keeps the result within one unit of the        */
+/*      scalar kernels.  SSE2 has no gather, the source pixels are      */
+/*      fetched one by one.                                             */
+/************************************************************************/
+
+/* floor() of 4 doubles to int32, also returning the fractional parts */
+static __m128i msFloor4_SSE2( const double *padf, double dfShift,
+                              __m128 *pFraction )
+
+{
+  const __m128d one = _mm_set1_pd( 1.0 );
+  __m128d a = _mm_sub_pd( _mm_loadu_pd( padf ), _mm_set1_pd( dfShift ) );
+  __m128d b = _mm_sub_pd( _mm_loadu_pd( padf + 2 ), _mm_set1_pd( dfShift ) );
+  __m128d fa = _mm_cvtepi32_pd( _mm_cvttpd_epi32( a ) );
+  __m128d fb = _mm_cvtepi32_pd( _mm_cvttpd_epi32( b ) );
+
+  /* truncation rounds negative values up */
+  fa = _mm_sub_pd( fa, _mm_and_pd( _mm_cmpgt_pd( fa, a ), one ) );
+  fb = _mm_sub_pd( fb, _mm_and_pd( _mm_cmpgt_pd( fb, b ), one ) );
+
+  if( pFraction )
+    *pFraction = _mm_movelh_ps( _mm_cvtpd_ps( _mm_sub_pd( a, fa ) ),
+                                _mm_cvtpd_ps( _mm_sub_pd( b, fb ) ) );
+
+  return _mm_unpacklo_epi64( _mm_cvttpd_epi32( fa ), _mm_cvttpd_epi32( fb ) );
+}
+
+static __m128i msSelect_SSE2( __m128i mask, __m128i a, __m128i b )
+
+{
+  return _mm_or_si128( _mm_and_si128( mask, a ), _mm_andnot_si128( mask, b ) );
+}
+
+/* clamp int32 lanes to [0,nMax] */
+static __m128i msClamp4_SSE2( __m128i v, int nMax )
+
+{
+  const __m128i max = _mm_set1_epi32( nMax );
+
+  v = msSelect_SSE2( _mm_cmplt_epi32( v, _mm_setzero_si128() ),
+                     _mm_setzero_si128(), v );
+  return msSelect_SSE2( _mm_cmpgt_epi32( v, max ), max, v );
+}
+
+static __m128 msChannel4_SSE2( __m128i pixels, int nShift )
+
+{
+  return _mm_cvtepi32_ps(
+           _mm_and_si128( _mm_srl_epi32( pixels, _mm_cvtsi32_si128( nShift ) ),
+                          _mm_set1_epi32( 0xff ) ) );
+}
+
+static __m128i msGather4_SSE2( const msRGBASource *psSrc,
+                               __m128i x, __m128i y )
+
+{
+  int anX[4], anY[4];
+  unsigned int anPixel[4];
+  int i;
+
+  _mm_storeu_si128( (__m128i *) anX, x );
+  _mm_storeu_si128( (__m128i *) anY, y );
+  for( i = 0; i < 4; i++ )
+    anPixel[i] = msRGBASourcePixel( psSrc, anX[i] * 4 + anY[i] * psSrc->row_step );
+
+  return _mm_loadu_si128( (const __m128i *) anPixel );
+}
+
+static void msNearestRowRGBA_SSE2( const msRGBASource *psSrc, int nCount,
+                                   const double *x, const double *y,
+                                   const int *panSuccess,
+                                   unsigned int *panPixel, int *panValid )
+
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128d zerod = _mm_setzero_pd();
+  int i;
+
+  for( i = 0; i + 4 <= nCount; i += 4 ) {
+    __m128i nSrcX = _mm_unpacklo_epi64( _mm_cvttpd_epi32( _mm_loadu_pd( x + i ) ),
+                                        _mm_cvttpd_epi32( _mm_loadu_pd( x + i + 2 ) ) );
+    __m128i nSrcY = _mm_unpacklo_epi64( _mm_cvttpd_epi32( _mm_loadu_pd( y + i ) ),
+                                        _mm_cvttpd_epi32( _mm_loadu_pd( y + i + 2 ) ) );
+    __m128d negx0 = _mm_cmplt_pd( _mm_loadu_pd( x + i ), zerod );
+    __m128d negx1 = _mm_cmplt_pd( _mm_loadu_pd( x + i + 2 ), zerod );
+    __m128d negy0 = _mm_cmplt_pd( _mm_loadu_pd( y + i ), zerod );
+    __m128d negy1 = _mm_cmplt_pd( _mm_loadu_pd( y + i + 2 ), zerod );
+    __m128i invalid, valid;
+
+    /* the 64 bit double masks, narrowed to 32 bit lanes */
+    invalid = _mm_castps_si128( _mm_shuffle_ps( _mm_castpd_ps( _mm_or_pd( negx0, negy0 ) ),
+                                _mm_castpd_ps( _mm_or_pd( negx1, negy1 ) ),
+                                _MM_SHUFFLE(2,0,2,0) ) );
+    invalid = _mm_or_si128( invalid, _mm_cmpeq_epi32(
+                              _mm_loadu_si128( (const __m128i *) (panSuccess + i) ), zero ) );
+    invalid = _mm_or_si128( invalid, _mm_cmplt_epi32( nSrcX, zero ) );
+    invalid = _mm_or_si128( invalid, _mm_cmplt_epi32( nSrcY, zero ) );
+    invalid = _mm_or_si128( invalid, _mm_cmpgt_epi32( nSrcX, _mm_set1_epi32( psSrc->nXSize - 1 ) ) );
+    invalid = _mm_or_si128( invalid, _mm_cmpgt_epi32( nSrcY, _mm_set1_epi32( psSrc->nYSize - 1 ) ) );
+    valid = _mm_andnot_si128( invalid, _mm_set1_epi32( 1 ) );
+    _mm_storeu_si128( (__m128i *) (panValid + i), valid );
+
+    /* keep invalid lanes inside the source */
+    nSrcX = _mm_andnot_si128( invalid, nSrcX );
+    nSrcY = _mm_andnot_si128( invalid, nSrcY );
+    _mm_storeu_si128( (__m128i *) (panPixel + i),
+                      msGather4_SSE2( psSrc, nSrcX, nSrcY ) );
+  }
+
+  if( i < nCount )
+    msNearestRowRGBA( psSrc, nCount - i, x + i, y + i, panSuccess + i,
+                      panPixel + i, panValid + i );
+}
+
+static void msBilinearRowRGBA_SSE2( const msRGBASource *psSrc, int nCount,
+                                    const double *x, const double *y,
+                                    const int *panSuccess,
+                                    unsigned int *panPixel, int *panValid )
+
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i minusone = _mm_set1_epi32( -1 );
+  const __m128 onef = _mm_set1_ps( 1.0f );
+  const __m128 zerof = _mm_setzero_ps();
+  const __m128 maxf = _mm_set1_ps( 255.0f );
+  int i;
+
+  for( i = 0; i + 4 <= nCount; i += 4 ) {
+    __m128 fRatioX2, fRatioY2, w[4], sumR, sumG, sumB, sumW, inv;
+    __m128i nSrcX, nSrcY, nSrcX2, nSrcY2, invalid, faint, pixels[4], r, g, b, a;
+    int iTap;
+
+    nSrcX = msFloor4_SSE2( x + i, 0.5, &fRatioX2 );
+    nSrcY = msFloor4_SSE2( y + i, 0.5, &fRatioY2 );
+
+    invalid = _mm_cmpeq_epi32( _mm_loadu_si128( (const __m128i *) (panSuccess + i) ), zero );
+    invalid = _mm_or_si128( invalid, _mm_cmplt_epi32( nSrcX, minusone ) );
+    invalid = _mm_or_si128( invalid, _mm_cmplt_epi32( nSrcY, minusone ) );
+    invalid = _mm_or_si128( invalid, _mm_cmpgt_epi32( nSrcX, _mm_set1_epi32( psSrc->nXSize - 1 ) ) );
+    invalid = _mm_or_si128( invalid, _mm_cmpgt_epi32( nSrcY, _mm_set1_epi32( psSrc->nYSize - 1 ) ) );
+
+    nSrcX2 = msClamp4_SSE2( _mm_sub_epi32( nSrcX, minusone ), psSrc->nXSize - 1 );
+    nSrcY2 = msClamp4_SSE2( _mm_sub_epi32( nSrcY, minusone ), psSrc->nYSize - 1 );
+    nSrcX = msClamp4_SSE2( nSrcX, psSrc->nXSize - 1 );
+    nSrcY = msClamp4_SSE2( nSrcY, psSrc->nYSize - 1 );
+
+    pixels[0] = msGather4_SSE2( psSrc, nSrcX, nSrcY );
+    pixels[1] = msGather4_SSE2( psSrc, nSrcX2, nSrcY );
+    pixels[2] = msGather4_SSE2( psSrc, nSrcX, nSrcY2 );
+    pixels[3] = msGather4_SSE2( psSrc, nSrcX2, nSrcY2 );
+
+    w[0] = _mm_mul_ps( _mm_sub_ps( onef, fRatioX2 ), _mm_sub_ps( onef, fRatioY2 ) );
+    w[1] = _mm_mul_ps( fRatioX2, _mm_sub_ps( onef, fRatioY2 ) );
+    w[2] = _mm_mul_ps( _mm_sub_ps( onef, fRatioX2 ), fRatioY2 );
+    w[3] = _mm_mul_ps( fRatioX2, fRatioY2 );
+
+    sumR = sumG = sumB = sumW = zerof;
+    for( iTap = 0; iTap < 4; iTap++ ) {
+      __m128 alpha = msChannel4_SSE2( pixels[iTap], psSrc->a_shift );
+      __m128 weight = _mm_and_ps( _mm_cmpgt_ps( alpha, onef ), w[iTap] );
+
+      sumR = _mm_add_ps( sumR, _mm_mul_ps( msChannel4_SSE2( pixels[iTap], psSrc->r_shift ), weight ) );
+      sumG = _mm_add_ps( sumG, _mm_mul_ps( msChannel4_SSE2( pixels[iTap], psSrc->g_shift ), weight ) );
+      sumB = _mm_add_ps( sumB, _mm_mul_ps( msChannel4_SSE2( pixels[iTap], psSrc->b_shift ), weight ) );
+      sumW = _mm_add_ps( sumW, _mm_mul_ps( weight, _mm_mul_ps( alpha, _mm_set1_ps( 1.0f / 255.0f ) ) ) );
+    }
+
+    invalid = _mm_or_si128( invalid, _mm_castps_si128( _mm_cmpeq_ps( sumW, zerof ) ) );
+    faint = _mm_andnot_si128( invalid, _mm_castps_si128(
+                                _mm_cmple_ps( sumW, _mm_set1_ps( 0.001f ) ) ) );
+    _mm_storeu_si128( (__m128i *) (panValid + i),
+                      _mm_add_epi32( _mm_andnot_si128( invalid, _mm_set1_epi32( 1 ) ),
+                                     _mm_and_si128( faint, _mm_set1_epi32( 1 ) ) ) );
+
+    /* invalid lanes may hold garbage, but their result is never used */
+    inv = _mm_div_ps( onef, _mm_or_ps( _mm_and_ps( _mm_castsi128_ps( invalid ), onef ),
+                                       _mm_andnot_ps( _mm_castsi128_ps( invalid ), sumW ) ) );
+    r = _mm_cvttps_epi32( _mm_min_ps( maxf, _mm_max_ps( zerof, _mm_mul_ps( sumR, inv ) ) ) );
+    g = _mm_cvttps_epi32( _mm_min_ps( maxf, _mm_max_ps( zerof, _mm_mul_ps( sumG, inv ) ) ) );
+    b = _mm_cvttps_epi32( _mm_min_ps( maxf, _mm_max_ps( zerof, _mm_mul_ps( sumB, inv ) ) ) );
+    a = _mm_cvttps_epi32( _mm_min_ps( maxf, _mm_max_ps( zerof,
+                                      _mm_mul_ps( sumW, _mm_set1_ps( 255.5f ) ) ) ) );
+
+    _mm_storeu_si128( (__m128i *) (panPixel + i),
+                      _mm_or_si128( _mm_or_si128( r, _mm_slli_epi32( g, 8 ) ),
+                                    _mm_or_si128( _mm_slli_epi32( b, 16 ),
+                                                  _mm_slli_epi32( a, 24 ) ) ) );
+  }
+
+  if( i < nCount )
+    msBilinearRowRGBA( psSrc, nCount - i, x + i, y + i, panSuccess + i,
+                       panPixel + i, panValid + i );
+}
+#endif /* HAVE_SSE2 */
+
+#ifdef HAVE_AVX2_DISPATCH
+/************************************************************************/
+/*                           AVX2 kernels                               */
+/*                                                                      */
+/*      Eight destination pixels at a time, fetching source pixels      */
+/*      with hardware gathers.  Only called after checking the cpu.     */
+/************************************************************************/
+
+#define MS_AVX2 __attribute__((target("avx2")))
+
+MS_AVX2 static __m256i msFloor8_AVX2( const double *padf, double dfShift,
+                                      __m256 *pFraction )
+
+{
+  __m256d a = _mm256_sub_pd( _mm256_loadu_pd( padf ), _mm256_set1_pd( dfShift ) );
+  __m256d b = _mm256_sub_pd( _mm256_loadu_pd( padf + 4 ), _mm256_set1_pd( dfShift ) );
+  __m256d fa = _mm256_floor_pd( a );
+  __m256d fb = _mm256_floor_pd( b );
+
+  if( pFraction )
+    *pFraction = _mm256_insertf128_ps(
+                   _mm256_castps128_ps256( _mm256_cvtpd_ps( _mm256_sub_pd( a, fa ) ) ),
+                   _mm256_cvtpd_ps( _mm256_sub_pd( b, fb ) ), 1 );
+
+  /* out of range values, and NaN, become INT_MIN which tests invalid */
+  return _mm256_inserti128_si256(
+           _mm256_castsi128_si256( _mm256_cvttpd_epi32( fa ) ),
+           _mm256_cvttpd_epi32( fb ), 1 );
+}
+
+MS_AVX2 static __m256i msGather8_AVX2( const msRGBASource *psSrc,
+                                       __m256i x, __m256i y )
+
+{
+  __m256i offset = _mm256_add_epi32( _mm256_slli_epi32( x, 2 ),
+                                     _mm256_mullo_epi32( y, _mm256_set1_epi32( psSrc->row_step ) ) );
+
+  return _mm256_i32gather_epi32( (const int *) psSrc->pixels, offset, 1 );
+}
+
+MS_AVX2 static __m256 msChannel8_AVX2( __m256i pixels, int nShift )
+
+{
+  return _mm256_cvtepi32_ps(
+           _mm256_and_si256( _mm256_srl_epi32( pixels, _mm_cvtsi32_si128( nShift ) ),
+                             _mm256_set1_epi32( 0xff ) ) );
+}
+
+MS_AVX2 static void msNearestRowRGBA_AVX2( const msRGBASource *psSrc, int nCount,
+    const double *x, const double *y,
+    const int *panSuccess,
+    unsigned int *panPixel, int *panValid )
+
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256d zerod = _mm256_setzero_pd();
+  int i;
+
+  for( i = 0; i + 8 <= nCount; i += 8 ) {
+    __m256d x0 = _mm256_loadu_pd( x + i ), x1 = _mm256_loadu_pd( x + i + 4 );
+    __m256d y0 = _mm256_loadu_pd( y + i ), y1 = _mm256_loadu_pd( y + i + 4 );
+    __m256i nSrcX = _mm256_inserti128_si256( _mm256_castsi128_si256( _mm256_cvttpd_epi32( x0 ) ),
+                    _mm256_cvttpd_epi32( x1 ), 1 );
+    __m256i nSrcY = _mm256_inserti128_si256( _mm256_castsi128_si256( _mm256_cvttpd_epi32( y0 ) ),
+                    _mm256_cvttpd_epi32( y1 ), 1 );
+    __m256d neg0 = _mm256_or_pd( _mm256_cmp_pd( x0, zerod, _CMP_LT_OQ ),
+                                 _mm256_cmp_pd( y0, zerod, _CMP_LT_OQ ) );
+    __m256d neg1 = _mm256_or_pd( _mm256_cmp_pd( x1, zerod, _CMP_LT_OQ ),
+                                 _mm256_cmp_pd( y1, zerod, _CMP_LT_OQ ) );
+    __m256i invalid;
+
+    /* the 64 bit double masks, narrowed to 32 bit lanes in order */
+    invalid = _mm256_castps_si256( _mm256_shuffle_ps( _mm256_castpd_ps( neg0 ),
+                                   _mm256_castpd_ps( neg1 ),
+                                   _MM_SHUFFLE(2,0,2,0) ) );
+    invalid = _mm256_permute4x64_epi64( invalid, _MM_SHUFFLE(3,1,2,0) );
+    invalid = _mm256_or_si256( invalid, _mm256_cmpeq_epi32(
+                                 _mm256_loadu_si256( (const __m256i *) (panSuccess + i) ), zero ) );
+    invalid = _mm256_or_si256( invalid, _mm256_cmpgt_epi32( zero, nSrcX ) );
+    invalid = _mm256_or_si256( invalid, _mm256_cmpgt_epi32( zero, nSrcY ) );
+    invalid = _mm256_or_si256( invalid, _mm256_cmpgt_epi32( nSrcX, _mm256_set1_epi32( psSrc->nXSize - 1 ) ) );
+    invalid = _mm256_or_si256( invalid, _mm256_cmpgt_epi32( nSrcY, _mm256_set1_epi32( psSrc->nYSize - 1 ) ) );
+    _mm256_storeu_si256( (__m256i *) (panValid + i),
+                         _mm256_andnot_si256( invalid, _mm256_set1_epi32( 1 ) ) );
+
+    nSrcX = _mm256_andnot_si256( invalid, nSrcX );
+    nSrcY = _mm256_andnot_si256( invalid, nSrcY );
+    _mm256_storeu_si256( (__m256i *) (panPixel + i),
+                         msGather8_AVX2( psSrc, nSrcX, nSrcY ) );
+  }
+
+  if( i < nCount )
+    msNearestRowRGBA( psSrc, nCount - i, x + i, y + i, panSuccess + i,
+                      panPixel + i, panValid + i );
+}
+
+MS_AVX2 static void msBilinearRowRGBA_AVX2( const msRGBASource *psSrc, int nCount,
+    const double *x, const double *y,
+    const int *panSuccess,
+    unsigned int *panPixel, int *panValid )
+
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i minusone = _mm256_set1_epi32( -1 );
+  const __m256i maxx = _mm256_set1_epi32( psSrc->nXSize - 1 );
+  const __m256i maxy = _mm256_set1_epi32( psSrc->nYSize - 1 );
+  const __m256 onef = _mm256_set1_ps( 1.0f );
+  const __m256 zerof = _mm256_setzero_ps();
+  const __m256 maxf = _mm256_set1_ps( 255.0f );
+  int i;
+
+  for( i = 0; i + 8 <= nCount; i += 8 ) {
+    __m256 fRatioX2, fRatioY2, w[4], sumR, sumG, sumB, sumW, inv;
+    __m256i nSrcX, nSrcY, nSrcX2, nSrcY2, invalid, faint, pixels[4], r, g, b, a;
+    int iTap;
+
+    nSrcX = msFloor8_AVX2( x + i, 0.5, &fRatioX2 );
+    nSrcY = msFloor8_AVX2( y + i, 0.5, &fRatioY2 );
+
+    invalid = _mm256_cmpeq_epi32( _mm256_loadu_si256( (const __m256i *) (panSuccess + i) ), zero );
+    invalid = _mm256_or_si256( invalid, _mm256_cmpgt_epi32( minusone, nSrcX ) );
+    invalid = _mm256_or_si256( invalid, _mm256_cmpgt_epi32( minusone, nSrcY ) );
+    invalid = _mm256_or_si256( invalid, _mm256_cmpgt_epi32( nSrcX, maxx ) );
+    invalid = _mm256_or_si256( invalid, _mm256_cmpgt_epi32( nSrcY, maxy ) );
+
+    nSrcX2 = _mm256_max_epi32( _mm256_min_epi32( _mm256_sub_epi32( nSrcX, minusone ), maxx ), zero );
+    nSrcY2 = _mm256_max_epi32( _mm256_min_epi32( _mm256_sub_epi32( nSrcY, minusone ), maxy ), zero );
+    nSrcX = _mm256_min_epi32( _mm256_max_epi32( nSrcX, zero ), maxx );
+    nSrcY = _mm256_min_epi32( _mm256_max_epi32( nSrcY, zero ), maxy );
+
+    pixels[0] = msGather8_AVX2( psSrc, nSrcX, nSrcY );
+    pixels[1] = msGather8_AVX2( psSrc, nSrcX2, nSrcY );
+    pixels[2] = msGather8_AVX2( psSrc, nSrcX, nSrcY2 );
+    pixels[3] = msGather8_AVX2( psSrc, nSrcX2, nSrcY2 );
+
+    w[0] = _mm256_mul_ps( _mm256_sub_ps( onef, fRatioX2 ), _mm256_sub_ps( onef, fRatioY2 ) );
+    w[1] = _mm256_mul_ps( fRatioX2, _mm256_sub_ps( onef, fRatioY2 ) );
+    w[2] = _mm256_mul_ps( _mm256_sub_ps( onef, fRatioX2 ), fRatioY2 );
+    w[3] = _mm256_mul_ps( fRatioX2, fRatioY2 );
+
+    sumR = sumG = sumB = sumW = zerof;
+    for( iTap = 0; iTap < 4; iTap++ ) {
+      __m256 alpha = msChannel8_AVX2( pixels[iTap], psSrc->a_shift );
+      __m256 weight = _mm256_and_ps( _mm256_cmp_ps( alpha, onef, _CMP_GT_OQ ), w[iTap] );
+
+      sumR = _mm256_add_ps( sumR, _mm256_mul_ps( msChannel8_AVX2( pixels[iTap], psSrc->r_shift ), weight ) );
+      sumG = _mm256_add_ps( sumG, _mm256_mul_ps( msChannel8_AVX2( pixels[iTap], psSrc->g_shift ), weight ) );
+      sumB = _mm256_add_ps( sumB, _mm256_mul_ps( msChannel8_AVX2( pixels[iTap], psSrc->b_shift ), weight ) );
+      sumW = _mm256_add_ps( sumW, _mm256_mul_ps( weight, _mm256_mul_ps( alpha, _mm256_set1_ps( 1.0f / 255.0f ) ) ) );
+    }
+
+    invalid = _mm256_or_si256( invalid, _mm256_castps_si256( _mm256_cmp_ps( sumW, zerof, _CMP_EQ_OQ ) ) );
+    faint = _mm256_andnot_si256( invalid, _mm256_castps_si256(
+                                   _mm256_cmp_ps( sumW, _mm256_set1_ps( 0.001f ), _CMP_LE_OQ ) ) );
+    _mm256_storeu_si256( (__m256i *) (panValid + i),
+                         _mm256_add_epi32( _mm256_andnot_si256( invalid, _mm256_set1_epi32( 1 ) ),
+                                           _mm256_and_si256( faint, _mm256_set1_epi32( 1 ) ) ) );
+
+    inv = _mm256_div_ps( onef, _mm256_blendv_ps( sumW, onef, _mm256_castsi256_ps( invalid ) ) );
+    r = _mm256_cvttps_epi32( _mm256_min_ps( maxf, _mm256_max_ps( zerof, _mm256_mul_ps( sumR, inv ) ) ) );
+    g = _mm256_cvttps_epi32( _mm256_min_ps( maxf, _mm256_max_ps( zerof, _mm256_mul_ps( sumG, inv ) ) ) );
+    b = _mm256_cvttps_epi32( _mm256_min_ps( maxf, _mm256_max_ps( zerof, _mm256_mul_ps( sumB, inv ) ) ) );
+    a = _mm256_cvttps_epi32( _mm256_min_ps( maxf, _mm256_max_ps( zerof,
+                                            _mm256_mul_ps( sumW, _mm256_set1_ps( 255.5f ) ) ) ) );
+
+    _mm256_storeu_si256( (__m256i *) (panPixel + i),
+                         _mm256_or_si256( _mm256_or_si256( r, _mm256_slli_epi32( g, 8 ) ),
+                                          _mm256_or_si256( _mm256_slli_epi32( b, 16 ),
+                                              _mm256_slli_epi32( a, 24 ) ) ) );
+  }
+
+  if( i < nCount )
+    msBilinearRowRGBA( psSrc, nCount - i, x + i, y + i, panSuccess + i,
+                       panPixel + i, panValid + i );
+}
+#endif /* HAVE_AVX2_DISPATCH */
+
+/************************************************************************/
+/*                   msNearestRowKernel(), msBilinearRowKernel()        */
+/*                                                                      */
+/*      Pick the fastest kernel the cpu supports.                       */
+/************************************************************************/
+
+static msRGBARowKernel msNearestRowKernel( void )
+
+{
+#ifdef HAVE_AVX2_DISPATCH
+  if( __builtin_cpu_supports( "avx2" ) )
+    return msNearestRowRGBA_AVX2;
+#endif
+#ifdef HAVE_SSE2
+  return msNearestRowRGBA_SSE2;
+#else
+  return msNearestRowRGBA;
+#endif
+}
+
+static msRGBARowKernel msBilinearRowKernel( void )
+
+{
+#ifdef HAVE_AVX2_DISPATCH
+  if( __builtin_cpu_supports( "avx2" ) )
+    return msBilinearRowRGBA_AVX2;
+#endif
+#ifdef HAVE_SSE2
+  return msBilinearRowRGBA_SSE2;
+#else
+  return msBilinearRowRGBA;
+#endif
+}
+
+/************************************************************************/
+/*                            msSourceSample()                          */
+/************************************************************************/
+
+static void msSourceSample( imageObj *psSrcImage, rasterBufferObj *rb,
+                            int iSrcX, int iSrcY, double *padfPixelSum,
+                            double dfWeight, double *pdfWeightSum )
+
+{
+  if( MS_RENDERER_PLUGIN(psSrcImage->format) ) {
+    rgbaArrayObj *rgba;
+    int rb_off;
+    assert(rb);
+#ifdef USE_GD
+    if(rb->type == MS_BUFFER_GD) {
+      assert(!gdImageTrueColor(rb->data.gd_img) );
+      padfPixelSum[0] += (dfWeight * rb->data.gd_img->pixels[iSrcY][iSrcX]);
+      *pdfWeightSum += dfWeight;
+      return;
+    }
+#endif
+    assert(rb->type == MS_BUFFER_BYTE_RGBA);
+    rgba = &(rb->data.rgba);
+    rb_off = iSrcX * rgba->pixel_step + iSrcY * rgba->row_step;
+
+    if( rgba->a == NULL || rgba->a[rb_off] > 1 ) {
+      padfPixelSum[0] += rgba->r[rb_off] * dfWeight;
+      padfPixelSum[1] += rgba->g[rb_off] * dfWeight;
+      padfPixelSum[2] += rgba->b[rb_off] * dfWeight;
+
+      if( rgba->a == NULL )
+        *pdfWeightSum += dfWeight;
+      else
+        *pdfWeightSum += dfWeight * (rgba->a[rb_off] / 255.0);
+    }
+  } else if( MS_RENDERER_RAWDATA(psSrcImage->format) ) {
+    int band;
+    int src_off;
+
+    src_off = iSrcX + iSrcY * psSrcImage->width;
+
+    if( !MS_GET_BIT(psSrcImage->img_mask,src_off) )
+      return;
+
+    for( band = 0; band < psSrcImage->format->bands; band++ ) {
+      if( psSrcImage->format->imagemode == MS_IMAGEMODE_INT16 ) {
+        int nValue;
+
+        nValue = psSrcImage->img.raw_16bit[src_off];
+
+        padfPixelSum[band] += dfWeight * nValue;
+      } else if( psSrcImage->format->imagemode
+                 == MS_IMAGEMODE_FLOAT32) {
+        float fValue;
+
+        fValue = psSrcImage->img.raw_float[src_off];
+
+        padfPixelSum[band] += fValue * dfWeight;
+      } else if(psSrcImage->format->imagemode == MS_IMAGEMODE_BYTE) {
+        int nValue;
+
+        nValue = psSrcImage->img.raw_byte[src_off];
+
+        padfPixelSum[band] += nValue * dfWeight;
+      } else {
+        assert( 0 );
+        return;
+      }
+
+      src_off += psSrcImage->width * psSrcImage->height;
+    }
+    *pdfWeightSum += dfWeight;
+  }
+}
+
+#endif /* kernels */
+
+#if defined(USE_PROJ) && defined(USE_GDAL) && !defined(MS_RESAMPLE_KERNEL_TEST)
 
 /************************************************************************/
 /*                      msNearestRasterResample()                       */
 /************************************************************************/
 
-static int
-msNearestRasterResampler( imageObj *psSrcImage, rasterBufferObj *src_rb,
-                          imageObj *psDstImage, rasterBufferObj *dst_rb,
-                          int *panCMap,
-                          SimpleTransformer pfnTransform, void *pCBData,
-                          int debug, rasterBufferObj *mask_rb )
+static int msNearestRasterResampler( void *pJob )
 
 {
+  msResampleJob *psJob = (msResampleJob *) pJob;
+  imageObj    *psSrcImage = psJob->psSrcImage;
+  imageObj    *psDstImage = psJob->psDstImage;
+  rasterBufferObj *src_rb = psJob->src_rb;
+  rasterBufferObj *dst_rb = psJob->dst_rb;
+  rasterBufferObj *mask_rb = psJob->mask_rb;
+#ifdef USE_GD
+  int         *panCMap = psJob->panCMap;
+#endif
+  SimpleTransformer pfnTransform = psJob->pfnTransform;
+  void        *pCBData = psJob->pCBData;
   double  *x, *y;
   int   nDstX, nDstY;
   int         *panSuccess;
   int   nDstXSize = psDstImage->width;
-  int   nDstYSize = psDstImage->height;
   int   nSrcXSize = psSrcImage->width;
   int   nSrcYSize = psSrcImage->height;
-  int   nFailedPoints = 0, nSetPoints = 0;
+  int   nFailedPoints = 0, nSetPoints = 0, status = MS_SUCCESS;
+  msRGBASource sRGBASrc;
+  msRGBARowKernel pfnRowKernel = NULL;
+  unsigned int *panPixel = NULL;
+  int         *panValid = NULL;
 #ifndef USE_GD
   assert(!MS_RENDERER_PLUGIN(psSrcImage->format) || src_rb->type != MS_BUFFER_GD);
 #endif
@@ -108,13 +836,66 @@ msNearestRasterResampler( imageObj *psSrcImage, rasterBufferObj *src_rb,
   y = (double *) msSmallMalloc( sizeof(double) * nDstXSize );
   panSuccess = (int *) msSmallMalloc( sizeof(int) * nDstXSize );
 
-  for( nDstY = 0; nDstY < nDstYSize; nDstY++ ) {
+  if( MS_RENDERER_PLUGIN(psSrcImage->format)
+      && dst_rb && dst_rb->type == MS_BUFFER_BYTE_RGBA
+      && msInitRGBASource( &sRGBASrc, src_rb, nSrcXSize, nSrcYSize ) ) {
+    pfnRowKernel = msNearestRowKernel();
+    panPixel = (unsigned int *) msSmallMalloc( sizeof(unsigned int) * nDstXSize );
+    panValid = (int *) msSmallMalloc( sizeof(int) * nDstXSize );
+  }
+
+  for( nDstY = psJob->nDstYMin; nDstY < psJob->nDstYMax; nDstY++ ) {
     for( nDstX = 0; nDstX < nDstXSize; nDstX++ ) {
       x[nDstX] = nDstX + 0.5;
       y[nDstX] = nDstY + 0.5;
     }
 
-    pfnTransform( pCBData, nDstXSize, x, y, panSuccess );
+    /* points it can't project are flagged, failing means a PROJ error */
+    if( !pfnTransform( pCBData, nDstXSize, x, y, panSuccess ) ) {
+      status = MS_FAILURE;
+      break;
+    }
+
+    /* -------------------------------------------------------------------- */
+    /*      RGBA onto RGBA: fetch the whole row of source pixels at once.   */
+    /* -------------------------------------------------------------------- */
+    if( pfnRowKernel ) {
+      rgbaArrayObj *dst = &dst_rb->data.rgba;
+
+      pfnRowKernel( &sRGBASrc, nDstXSize, x, y, panSuccess,
+                    panPixel, panValid );
+
+      for( nDstX = 0; nDstX < nDstXSize; nDstX++ ) {
+        int dst_rb_off, nAlpha;
+
+        if(SKIP_MASK(nDstX,nDstY))
+          continue;
+
+        if( !panSuccess[nDstX] ) {
+          nFailedPoints++;
+          continue;
+        }
+
+        if( !panValid[nDstX] )
+          continue;
+
+        nAlpha = RGBA_CHANNEL(panPixel[nDstX], sRGBASrc.a_shift);
+        if( nAlpha == 0 )
+          continue;
+
+        nSetPoints++;
+        dst_rb_off = nDstX * dst->pixel_step + nDstY * dst->row_step;
+        msAlphaBlendPM( RGBA_CHANNEL(panPixel[nDstX], sRGBASrc.r_shift),
+                        RGBA_CHANNEL(panPixel[nDstX], sRGBASrc.g_shift),
+                        RGBA_CHANNEL(panPixel[nDstX], sRGBASrc.b_shift),
+                        nAlpha,
+                        dst->r + dst_rb_off,
+                        dst->g + dst_rb_off,
+                        dst->b + dst_rb_off,
+                        dst->a ? dst->a + dst_rb_off : NULL );
+      }
+      continue;
+    }
 
     for( nDstX = 0; nDstX < nDstXSize; nDstX++ ) {
       int   nSrcX, nSrcY;
@@ -230,124 +1011,49 @@ msNearestRasterResampler( imageObj *psSrcImage, rasterBufferObj *src_rb,
     }
   }
 
+  free( panPixel );
+  free( panValid );
   free( panSuccess );
   free( x );
   free( y );
-  msFree(mask_rb);
 
-  /* -------------------------------------------------------------------- */
-  /*      Some debugging output.                                          */
-  /* -------------------------------------------------------------------- */
-  if( nFailedPoints > 0 && debug ) {
-    char  szMsg[256];
+  psJob->nFailedPoints = nFailedPoints;
+  psJob->nSetPoints = nSetPoints;
 
-    sprintf( szMsg,
-             "msNearestRasterResampler: "
-             "%d failed to transform, %d actually set.\n",
-             nFailedPoints, nSetPoints );
-    msDebug( szMsg );
-  }
-
-  return 0;
+  return status;
 }
 
 /************************************************************************/
-/*                            msSourceSample()                          */
+/*                      msBilinearRasterResample()                      */
 /************************************************************************/
 
-static void msSourceSample( imageObj *psSrcImage, rasterBufferObj *rb,
-                            int iSrcX, int iSrcY, double *padfPixelSum,
-                            double dfWeight, double *pdfWeightSum )
+static int msBilinearRasterResampler( void *pJob )
 
 {
-  if( MS_RENDERER_PLUGIN(psSrcImage->format) ) {
-    rgbaArrayObj *rgba;
-    int rb_off;
-    assert(rb);
+  msResampleJob *psJob = (msResampleJob *) pJob;
+  imageObj    *psSrcImage = psJob->psSrcImage;
+  imageObj    *psDstImage = psJob->psDstImage;
+  rasterBufferObj *src_rb = psJob->src_rb;
+  rasterBufferObj *dst_rb = psJob->dst_rb;
+  rasterBufferObj *mask_rb = psJob->mask_rb;
 #ifdef USE_GD
-    if(rb->type == MS_BUFFER_GD) {
-      assert(!gdImageTrueColor(rb->data.gd_img) );
-      padfPixelSum[0] += (dfWeight * rb->data.gd_img->pixels[iSrcY][iSrcX]);
-      *pdfWeightSum += dfWeight;
-      return;
-    }
+  int         *panCMap = psJob->panCMap;
 #endif
-    assert(rb->type == MS_BUFFER_BYTE_RGBA);
-    rgba = &(rb->data.rgba);
-    rb_off = iSrcX * rgba->pixel_step + iSrcY * rgba->row_step;
-
-    if( rgba->a == NULL || rgba->a[rb_off] > 1 ) {
-      padfPixelSum[0] += rgba->r[rb_off] * dfWeight;
-      padfPixelSum[1] += rgba->g[rb_off] * dfWeight;
-      padfPixelSum[2] += rgba->b[rb_off] * dfWeight;
-
-      if( rgba->a == NULL )
-        *pdfWeightSum += dfWeight;
-      else
-        *pdfWeightSum += dfWeight * (rgba->a[rb_off] / 255.0);
-    }
-  } else if( MS_RENDERER_RAWDATA(psSrcImage->format) ) {
-    int band;
-    int src_off;
-
-    src_off = iSrcX + iSrcY * psSrcImage->width;
-
-    if( !MS_GET_BIT(psSrcImage->img_mask,src_off) )
-      return;
-
-    for( band = 0; band < psSrcImage->format->bands; band++ ) {
-      if( psSrcImage->format->imagemode == MS_IMAGEMODE_INT16 ) {
-        int nValue;
-
-        nValue = psSrcImage->img.raw_16bit[src_off];
-
-        padfPixelSum[band] += dfWeight * nValue;
-      } else if( psSrcImage->format->imagemode
-                 == MS_IMAGEMODE_FLOAT32) {
-        float fValue;
-
-        fValue = psSrcImage->img.raw_float[src_off];
-
-        padfPixelSum[band] += fValue * dfWeight;
-      } else if(psSrcImage->format->imagemode == MS_IMAGEMODE_BYTE) {
-        int nValue;
-
-        nValue = psSrcImage->img.raw_byte[src_off];
-
-        padfPixelSum[band] += nValue * dfWeight;
-      } else {
-        assert( 0 );
-        return;
-      }
-
-      src_off += psSrcImage->width * psSrcImage->height;
-    }
-    *pdfWeightSum += dfWeight;
-  }
-}
-
-/************************************************************************/
-/*                      msBilinearRasterResample()                      */
-/************************************************************************/
-
-static int
-msBilinearRasterResampler( imageObj *psSrcImage, rasterBufferObj *src_rb,
-                           imageObj *psDstImage, rasterBufferObj *dst_rb,
-                           int *panCMap,
-                           SimpleTransformer pfnTransform, void *pCBData,
-                           int debug, rasterBufferObj *mask_rb )
-
-{
+  SimpleTransformer pfnTransform = psJob->pfnTransform;
+  void        *pCBData = psJob->pCBData;
   double  *x, *y;
   int   nDstX, nDstY, i;
   int         *panSuccess;
   int   nDstXSize = psDstImage->width;
-  int   nDstYSize = psDstImage->height;
   int   nSrcXSize = psSrcImage->width;
   int   nSrcYSize = psSrcImage->height;
-  int   nFailedPoints = 0, nSetPoints = 0;
+  int   nFailedPoints = 0, nSetPoints = 0, status = MS_SUCCESS;
   double     *padfPixelSum;
   int         bandCount = MAX(4,psSrcImage->format->bands);
+  msRGBASource sRGBASrc;
+  msRGBARowKernel pfnRowKernel = NULL;
+  unsigned int *panPixel = NULL;
+  int         *panValid = NULL;
 
   padfPixelSum = (double *) msSmallMalloc(sizeof(double) * bandCount);
 
@@ -357,13 +1063,65 @@ msBilinearRasterResampler( imageObj *psSrcImage, rasterBufferObj *src_rb,
   y = (double *) msSmallMalloc( sizeof(double) * nDstXSize );
   panSuccess = (int *) msSmallMalloc( sizeof(int) * nDstXSize );
 
-  for( nDstY = 0; nDstY < nDstYSize; nDstY++ ) {
+  if( MS_RENDERER_PLUGIN(psSrcImage->format)
+      && dst_rb && dst_rb->type == MS_BUFFER_BYTE_RGBA
+      && msInitRGBASource( &sRGBASrc, src_rb, nSrcXSize, nSrcYSize ) ) {
+    pfnRowKernel = msBilinearRowKernel();
+    panPixel = (unsigned int *) msSmallMalloc( sizeof(unsigned int) * nDstXSize );
+    panValid = (int *) msSmallMalloc( sizeof(int) * nDstXSize );
+  }
+
+  for( nDstY = psJob->nDstYMin; nDstY < psJob->nDstYMax; nDstY++ ) {
     for( nDstX = 0; nDstX < nDstXSize; nDstX++ ) {
       x[nDstX] = nDstX + 0.5;
       y[nDstX] = nDstY + 0.5;
     }
 
-    pfnTransform( pCBData, nDstXSize, x, y, panSuccess );
+    /* points it can't project are flagged, failing means a PROJ error */
+    if( !pfnTransform( pCBData, nDstXSize, x, y, panSuccess ) ) {
+      status = MS_FAILURE;
+      break;
+    }
+
+    /* -------------------------------------------------------------------- */
+    /*      RGBA onto RGBA: sample the whole row at once.  The kernel       */
+    /*      output is packed with red in the low byte.                      */
+    /* -------------------------------------------------------------------- */
+    if( pfnRowKernel ) {
+      rgbaArrayObj *dst = &dst_rb->data.rgba;
+
+      pfnRowKernel( &sRGBASrc, nDstXSize, x, y, panSuccess,
+                    panPixel, panValid );
+
+      for( nDstX = 0; nDstX < nDstXSize; nDstX++ ) {
+        int dst_rb_off;
+
+        if(SKIP_MASK(nDstX,nDstY)) continue;
+
+        if( !panSuccess[nDstX] ) {
+          nFailedPoints++;
+          continue;
+        }
+
+        if( !panValid[nDstX] )
+          continue;
+
+        nSetPoints++;
+        if( panValid[nDstX] == MS_RGBA_FAINT )
+          continue;
+
+        dst_rb_off = nDstX * dst->pixel_step + nDstY * dst->row_step;
+        msAlphaBlendPM( RGBA_CHANNEL(panPixel[nDstX], 0),
+                        RGBA_CHANNEL(panPixel[nDstX], 8),
+                        RGBA_CHANNEL(panPixel[nDstX], 16),
+                        RGBA_CHANNEL(panPixel[nDstX], 24),
+                        dst->r + dst_rb_off,
+                        dst->g + dst_rb_off,
+                        dst->b + dst_rb_off,
+                        dst->a ? dst->a + dst_rb_off : NULL );
+      }
+      continue;
+    }
 
     for( nDstX = 0; nDstX < nDstXSize; nDstX++ ) {
       int   nSrcX, nSrcY, nSrcX2, nSrcY2;
@@ -492,26 +1250,16 @@ msBilinearRasterResampler( imageObj *psSrcImage, rasterBufferObj *src_rb,
   }
 
   free( padfPixelSum );
+  free( panPixel );
+  free( panValid );
   free( panSuccess );
   free( x );
   free( y );
-  msFree(mask_rb);
-
-  /* -------------------------------------------------------------------- */
-  /*      Some debugging output.                                          */
-  /* -------------------------------------------------------------------- */
-  if( nFailedPoints > 0 && debug )
-  {
-    char  szMsg[256];
 
-    sprintf( szMsg,
-             "msBilinearRasterResampler: "
-             "%d failed to transform, %d actually set.\n",
-             nFailedPoints, nSetPoints );
-    msDebug( szMsg );
-  }
+  psJob->nFailedPoints = nFailedPoints;
+  psJob->nSetPoints = nSetPoints;
 
-  return 0;
+  return status;
 }
 
 /************************************************************************/
@@ -571,20 +1319,25 @@ msAverageSample( imageObj *psSrcImage, rasterBufferObj *src_rb,
 /*                      msAverageRasterResample()                       */
 /************************************************************************/
 
-static int
-msAverageRasterResampler( imageObj *psSrcImage, rasterBufferObj *src_rb,
-                          imageObj *psDstImage, rasterBufferObj *dst_rb,
-                          int *panCMap,
-                          SimpleTransformer pfnTransform, void *pCBData,
-                          int debug, rasterBufferObj *mask_rb )
+static int msAverageRasterResampler( void *pJob )
 
 {
+  msResampleJob *psJob = (msResampleJob *) pJob;
+  imageObj    *psSrcImage = psJob->psSrcImage;
+  imageObj    *psDstImage = psJob->psDstImage;
+  rasterBufferObj *src_rb = psJob->src_rb;
+  rasterBufferObj *dst_rb = psJob->dst_rb;
+  rasterBufferObj *mask_rb = psJob->mask_rb;
+#ifdef USE_GD
+  int         *panCMap = psJob->panCMap;
+#endif
+  SimpleTransformer pfnTransform = psJob->pfnTransform;
+  void        *pCBData = psJob->pCBData;
   double  *x1, *y1, *x2, *y2;
   int   nDstX, nDstY;
   int         *panSuccess1, *panSuccess2;
   int   nDstXSize = psDstImage->width;
-  int   nDstYSize = psDstImage->height;
-  int   nFailedPoints = 0, nSetPoints = 0;
+  int   nFailedPoints = 0, nSetPoints = 0, status = MS_SUCCESS;
   double     *padfPixelSum;
 
   int         bandCount = MAX(4,psSrcImage->format->bands);
@@ -600,7 +1353,7 @@ msAverageRasterResampler( imageObj *psSrcImage, rasterBufferObj *src_rb,
   panSuccess1 = (int *) msSmallMalloc( sizeof(int) * (nDstXSize+1) );
   panSuccess2 = (int *) msSmallMalloc( sizeof(int) * (nDstXSize+1) );
 
-  for( nDstY = 0; nDstY < nDstYSize; nDstY++ ) {
+  for( nDstY = psJob->nDstYMin; nDstY < psJob->nDstYMax; nDstY++ ) {
     for( nDstX = 0; nDstX <= nDstXSize; nDstX++ ) {
       x1[nDstX] = nDstX;
       y1[nDstX] = nDstY;
@@ -608,8 +1361,11 @@ msAverageRasterResampler( imageObj *psSrcImage, rasterBufferObj *src_rb,
       y2[nDstX] = nDstY+1;
     }
 
-    pfnTransform( pCBData, nDstXSize+1, x1, y1, panSuccess1 );
-    pfnTransform( pCBData, nDstXSize+1, x2, y2, panSuccess2 );
+    if( !pfnTransform( pCBData, nDstXSize+1, x1, y1, panSuccess1 )
+        || !pfnTransform( pCBData, nDstXSize+1, x2, y2, panSuccess2 ) ) {
+      status = MS_FAILURE;
+      break;
+    }
 
     for( nDstX = 0; nDstX < nDstXSize; nDstX++ ) {
       double  dfXMin, dfYMin, dfXMax, dfYMax;
@@ -716,23 +1472,11 @@ msAverageRasterResampler( imageObj *psSrcImage, rasterBufferObj *src_rb,
   free( panSuccess2 );
   free( x2 );
   free( y2 );
-  msFree(mask_rb);
 
-  /* -------------------------------------------------------------------- */
-  /*      Some debugging output.                                          */
-  /* -------------------------------------------------------------------- */
-  if( nFailedPoints > 0 && debug )
-  {
-    char  szMsg[256];
+  psJob->nFailedPoints = nFailedPoints;
+  psJob->nSetPoints = nSetPoints;
 
-    sprintf( szMsg,
-             "msAverageRasterResampler: "
-             "%d failed to transform, %d actually set.\n",
-             nFailedPoints, nSetPoints );
-    msDebug( szMsg );
-  }
-
-  return 0;
+  return status;
 }
 
 /************************************************************************/
@@ -753,6 +1497,10 @@ typedef struct {
   double adfDstGeoTransform[6];
 
   int  bUseProj;
+  int  bOwnsProj;  /* psSrcProj/psDstProj are private to this transformer */
+#if PJ_VERSION >= 480
+  projCtx psCtx;
+#endif
 } msProjTransformInfo;
 
 /************************************************************************/
@@ -769,6 +1517,10 @@ void *msInitProjTransformer( projectionObj *psSrc,
 
   psPTInfo = (msProjTransformInfo *) msSmallCalloc(1,sizeof(msProjTransformInfo));
 
+  /* The calling thread's own objects, this transformer is used from it. */
+  msProjectionBindThread( psSrc );
+  msProjectionBindThread( psDst );
+
   /* -------------------------------------------------------------------- */
   /*      We won't even use PROJ.4 if either coordinate system is         */
   /*      NULL.                                                           */
@@ -813,9 +1565,72 @@ void *msInitProjTransformer( projectionObj *psSrc,
 void msFreeProjTransformer( void * pCBData )
 
 {
+#if PJ_VERSION >= 480
+  msProjTransformInfo *psPTInfo = (msProjTransformInfo*) pCBData;
+
+  if( psPTInfo && psPTInfo->bOwnsProj ) {
+    pj_free( psPTInfo->psSrcProj );
+    pj_free( psPTInfo->psDstProj );
+    pj_ctx_free( psPTInfo->psCtx );
+  }
+#endif
   free( pCBData );
 }
 
+/************************************************************************/
+/*                       msCloneProjTransformer()                       */
+/*                                                                      */
+/*      Copy a transformer so that the copy can be used from another    */
+/*      thread at the same time as the original.  With PROJ 4.8 the     */
+/*      copy gets its own context and projPJ objects, initialized       */
+/*      from the expanded definitions of the original ones, and         */
+/*      transforms without locking.  Returns NULL if that fails: the    */
+/*      original's objects belong to the calling thread's context.      */
+/*      Older PROJ versions share the objects, transforming under       */
+/*      TLOCK_PROJ.                                                     */
+/************************************************************************/
+
+static void *msCloneProjTransformer( void *pCBData )
+
+{
+  msProjTransformInfo *psPTInfo = (msProjTransformInfo*) pCBData;
+  msProjTransformInfo *psClone;
+
+  psClone = (msProjTransformInfo *) msSmallMalloc(sizeof(msProjTransformInfo));
+  memcpy( psClone, psPTInfo, sizeof(msProjTransformInfo) );
+  psClone->bOwnsProj = MS_FALSE;
+
+#if PJ_VERSION >= 480
+  if( psPTInfo->bUseProj ) {
+    char *pszSrcDef = pj_get_def( psPTInfo->psSrcProj, 0 );
+    char *pszDstDef = pj_get_def( psPTInfo->psDstProj, 0 );
+
+    psClone->psCtx = pj_ctx_alloc();
+    psClone->psSrcProj = pszSrcDef ? pj_init_plus_ctx( psClone->psCtx, pszSrcDef ) : NULL;
+    psClone->psDstProj = pszDstDef ? pj_init_plus_ctx( psClone->psCtx, pszDstDef ) : NULL;
+
+    if( pszSrcDef )
+      pj_dalloc( pszSrcDef );
+    if( pszDstDef )
+      pj_dalloc( pszDstDef );
+
+    if( psClone->psSrcProj && psClone->psDstProj )
+      psClone->bOwnsProj = MS_TRUE;
+    else {
+      if( psClone->psSrcProj )
+        pj_free( psClone->psSrcProj );
+      if( psClone->psDstProj )
+        pj_free( psClone->psDstProj );
+      pj_ctx_free( psClone->psCtx );
+      free( psClone );
+      return NULL;
+    }
+  }
+#endif
+
+  return psClone;
+}
+
 /************************************************************************/
 /*                          msProjTransformer                           */
 /************************************************************************/
@@ -862,12 +1677,18 @@ int msProjTransformer( void *pCBData, int nPoints,
 
     z = (double *) msSmallCalloc(sizeof(double),nPoints);
 
+#if PJ_VERSION < 480
     msAcquireLock( TLOCK_PROJ );
+#endif
     tr_result = pj_transform( psPTInfo->psDstProj, psPTInfo->psSrcProj,
                               nPoints, 1, x, y,  z);
+#if PJ_VERSION < 480
     msReleaseLock( TLOCK_PROJ );
+#endif
 
     if( tr_result != 0 ) {
+      msSetError( MS_PROJERR, "proj says: %s", "msProjTransformer()",
+                  pj_strerrno(tr_result) );
       free( z );
       for( i = 0; i < nPoints; i++ )
         panSuccess[i] = 0;
@@ -1045,6 +1866,143 @@ static int msApproxTransformer( void *pCBData, int nPoints,
   return 1;
 }
 
+/************************************************************************/
+/*                       msResampleThreadCount()                        */
+/*                                                                      */
+/*      How many threads to resample a layer with.  The RESAMPLE_THREADS */
+/*      processing option wins over the MS_RESAMPLE_THREADS config      */
+/*      option or environment variable, and the default is a single     */
+/*      thread.  ALL_CPUS uses one thread per processor.                */
+/************************************************************************/
+
+#define MS_RESAMPLE_MAX_THREADS 64
+#define MS_RESAMPLE_MIN_JOB_ROWS 64 /* fewer rows aren't worth a thread */
+
+static int msResampleThreadCount( mapObj *map, layerObj *layer )
+
+{
+  const char *pszThreads;
+  int nThreads;
+
+  pszThreads = CSLFetchNameValue( layer->processing, "RESAMPLE_THREADS" );
+  if( pszThreads == NULL )
+    pszThreads = msGetConfigOption( map, "MS_RESAMPLE_THREADS" );
+  if( pszThreads == NULL )
+    pszThreads = getenv( "MS_RESAMPLE_THREADS" );
+  if( pszThreads == NULL )
+    return 1;
+
+#if GDAL_VERSION_NUM >= 1800
+  if( EQUAL(pszThreads,"ALL_CPUS") )
+    nThreads = CPLGetNumCPUs();
+  else
+#endif
+    nThreads = atoi( pszThreads );
+
+  return MAX(1, MIN(nThreads, MS_RESAMPLE_MAX_THREADS));
+}
+
+/************************************************************************/
+/*                           msResampleRows()                           */
+/*                                                                      */
+/*      Run a resampler over all rows of the destination image, split   */
+/*      into blocks of at least MS_RESAMPLE_MIN_JOB_ROWS rows handled   */
+/*      by up to nThreads threads.  Each block gets its own             */
+/*      approximate transformer on top of its own copy of the PROJ      */
+/*      transformer.  Fails if any block does.                          */
+/************************************************************************/
+
+static int msResampleRows( int (*pfnResampler)( void * ),
+                            const char *pszResampler,
+                            msResampleJob *psTemplate, void *pTCBData,
+                            int nThreads, int debug )
+
+{
+  int nRows = psTemplate->psDstImage->height;
+  int nBlockRows, nJobs, i, status;
+  int nFailedPoints = 0, nSetPoints = 0;
+  msResampleJob *pasJobs;
+  void **papJobs;
+
+  if( nRows <= 0 )
+    return MS_SUCCESS;
+
+  /*
+  ** Blocks are a multiple of MS_ARRAY_BIT rows so that no two jobs ever
+  ** write to the same word of the raw data img_mask bit array.
+  */
+  nBlockRows = MAX( (nRows + nThreads - 1) / nThreads, MS_RESAMPLE_MIN_JOB_ROWS );
+  nBlockRows = ((nBlockRows + MS_ARRAY_BIT - 1) / MS_ARRAY_BIT) * MS_ARRAY_BIT;
+  nJobs = (nRows + nBlockRows - 1) / nBlockRows;
+
+  pasJobs = (msResampleJob *) msSmallMalloc( sizeof(msResampleJob) * nJobs );
+  papJobs = (void **) msSmallMalloc( sizeof(void *) * nJobs );
+
+  /* The copies of the transformer first, without them it all runs in one job. */
+  for( i = 1; i < nJobs; i++ ) {
+    if( (papJobs[i] = msCloneProjTransformer( pTCBData )) == NULL ) {
+      if( debug )
+        msDebug( "%s: the projections could not be copied for other threads.\n",
+                 pszResampler );
+      while( --i > 0 )
+        msFreeProjTransformer( papJobs[i] );
+      nJobs = 1;
+      nBlockRows = nRows;
+      break;
+    }
+  }
+
+  for( i = 0; i < nJobs; i++ ) {
+    void *pJobTCBData = (i == 0) ? pTCBData : papJobs[i];
+
+    pasJobs[i] = *psTemplate;
+    pasJobs[i].nDstYMin = i * nBlockRows;
+    pasJobs[i].nDstYMax = MIN(nRows, (i + 1) * nBlockRows);
+    pasJobs[i].nFailedPoints = 0;
+    pasJobs[i].nSetPoints = 0;
+
+    /* -------------------------------------------------------------------- */
+    /*      It is cheaper to use linear approximations as long as our       */
+    /*      error is modest (less than 0.333 pixels).                       */
+    /* -------------------------------------------------------------------- */
+    pasJobs[i].pfnTransform = msApproxTransformer;
+    pasJobs[i].pCBData =
+      msInitApproxTransformer( msProjTransformer, pJobTCBData, 0.333 );
+
+    papJobs[i] = pasJobs + i;
+  }
+
+  if( debug && nJobs > 1 )
+    msDebug( "%s: resampling %d rows with %d threads.\n",
+             pszResampler, nRows, nJobs );
+
+  status = msRunThreads( nJobs, pfnResampler, papJobs );
+
+  for( i = 0; i < nJobs; i++ ) {
+    msApproxTransformInfo *psATInfo = (msApproxTransformInfo *) pasJobs[i].pCBData;
+
+    nFailedPoints += pasJobs[i].nFailedPoints;
+    nSetPoints += pasJobs[i].nSetPoints;
+
+    if( i > 0 )
+      msFreeProjTransformer( psATInfo->pBaseCBData );
+    msFreeApproxTransformer( psATInfo );
+  }
+
+  free( papJobs );
+  free( pasJobs );
+
+  /* -------------------------------------------------------------------- */
+  /*      Some debugging output.                                          */
+  /* -------------------------------------------------------------------- */
+  if( nFailedPoints > 0 && debug ) {
+    msDebug( "%s: %d failed to transform, %d actually set.\n",
+             pszResampler, nFailedPoints, nSetPoints );
+  }
+
+  return status;
+}
+
 /************************************************************************/
 /*                       msTransformMapToSource()                       */
 /*                                                                      */
@@ -1135,10 +2093,17 @@ static int msTransformMapToSource( int nDstXSize, int nDstYSize,
       }
     }
 
+    msProjectionBindThread(psDstProj);
+    msProjectionBindThread(psSrcProj);
+
+#if PJ_VERSION < 480
     msAcquireLock( TLOCK_PROJ );
+#endif
     tr_result = pj_transform( psDstProj->proj, psSrcProj->proj,
                               nSamples, 1, x, y, z );
+#if PJ_VERSION < 480
     msReleaseLock( TLOCK_PROJ );
+#endif
 
     if( tr_result != 0 )
       return MS_FALSE;
@@ -1223,7 +2188,7 @@ static int msTransformMapToSource( int nDstXSize, int nDstYSize,
 
 #endif /* def USE_PROJ */
 
-#ifdef USE_GDAL
+#if defined(USE_GDAL) && !defined(MS_RESAMPLE_KERNEL_TEST)
 /************************************************************************/
 /*                        msResampleGDALToMap()                         */
 /************************************************************************/
@@ -1250,7 +2215,8 @@ int msResampleGDALToMap( mapObj *map, layerObj *layer, imageObj *image,
   mapObj  sDummyMap;
   imageObj   *srcImage;
   void  *pTCBData;
-  void  *pACBData;
+  msResampleJob sJob;
+  int         nThreads;
   int         anCMap[256];
   char       **papszAlteredProcessing = NULL;
   int         nLoadImgXSize, nLoadImgYSize;
@@ -1570,30 +2536,27 @@ int msResampleGDALToMap( mapObj *map, layerObj *layer, imageObj *image,
     return MS_PROJERR;
   }
 
-  /* -------------------------------------------------------------------- */
-  /*      It is cheaper to use linear approximations as long as our       */
-  /*      error is modest (less than 0.333 pixels).                       */
-  /* -------------------------------------------------------------------- */
-  pACBData = msInitApproxTransformer( msProjTransformer, pTCBData, 0.333 );
-
   /* -------------------------------------------------------------------- */
   /*      Perform the resampling.                                         */
   /* -------------------------------------------------------------------- */
+  sJob.psSrcImage = srcImage;
+  sJob.src_rb = psrc_rb;
+  sJob.psDstImage = image;
+  sJob.dst_rb = rb;
+  sJob.panCMap = anCMap;
+  sJob.mask_rb = mask_rb;
+
+  nThreads = msResampleThreadCount( map, layer );
+
   if( EQUAL(resampleMode,"AVERAGE") )
-    result =
-      msAverageRasterResampler( srcImage, psrc_rb, image, rb,
-                                anCMap, msApproxTransformer, pACBData,
-                                layer->debug, mask_rb );
+    result = msResampleRows( msAverageRasterResampler, "msAverageRasterResampler",
+                             &sJob, pTCBData, nThreads, layer->debug );
   else if( EQUAL(resampleMode,"BILINEAR") )
-    result =
-      msBilinearRasterResampler( srcImage, psrc_rb, image, rb,
-                                 anCMap, msApproxTransformer, pACBData,
-                                 layer->debug, mask_rb );
+    result = msResampleRows( msBilinearRasterResampler, "msBilinearRasterResampler",
+                             &sJob, pTCBData, nThreads, layer->debug );
   else
-    result =
-      msNearestRasterResampler( srcImage, psrc_rb, image, rb,
-                                anCMap, msApproxTransformer, pACBData,
-                                layer->debug, mask_rb );
+    result = msResampleRows( msNearestRasterResampler, "msNearestRasterResampler",
+                             &sJob, pTCBData, nThreads, layer->debug );
 
   /* -------------------------------------------------------------------- */
   /*      cleanup                                                         */
@@ -1603,9 +2566,9 @@ int msResampleGDALToMap( mapObj *map, layerObj *layer, imageObj *image,
   msFreeImage( srcImage );
 
   msFreeProjTransformer( pTCBData );
-  msFreeApproxTransformer( pACBData );
+  msFree( mask_rb );
 
-  return result;
+  return result == MS_SUCCESS ? 0 : -1;
 #endif
 }
 
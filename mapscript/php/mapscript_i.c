@@ -406,10 +406,14 @@ int mapObj_selectOutputFormat(mapObj *self,
 
 int mapObj_applySLD(mapObj *self, char *sld)
 {
+  /* mapscript may have changed the map since it was loaded, don't cache */
+  self->modified = MS_TRUE;
   return msSLDApplySLD(self, sld, -1, NULL, NULL);
 }
 int mapObj_applySLDURL(mapObj *self, char *sld)
 {
+  /* mapscript may have changed the map since it was loaded, don't cache */
+  self->modified = MS_TRUE;
   return msSLDApplySLDURL(self, sld, -1, NULL, NULL);
 }
 
@@ -427,6 +431,8 @@ int mapObj_loadOWSParameters(mapObj *self, cgiRequestObj *request,
 
 int mapObj_OWSDispatch(mapObj *self, cgiRequestObj *req )
 {
+  /* mapscript may have changed the map since it was loaded, don't cache */
+  self->modified = MS_TRUE;
   return msOWSDispatch( self, req, MS_TRUE);
 }
 
@@ -826,10 +832,14 @@ char *layerObj_executeWFSGetFeature(layerObj *self)
 
 int layerObj_applySLD(layerObj *self, char *sld, char *stylelayer)
 {
+  /* mapscript may have changed the map since it was loaded, don't cache */
+  self->map->modified = MS_TRUE;
   return msSLDApplySLD(self->map, sld, self->index, stylelayer, NULL);
 }
 int layerObj_applySLDURL(layerObj *self, char *sld, char *stylelayer)
 {
+  /* mapscript may have changed the map since it was loaded, don't cache */
+  self->map->modified = MS_TRUE;
   return msSLDApplySLDURL(self->map, sld, self->index, stylelayer, NULL);
 }
 
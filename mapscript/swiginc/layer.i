@@ -571,11 +571,15 @@
 
     int applySLD(char *sld, char *stylelayer) 
     {
+      /* mapscript may have changed the map since it was loaded, don't cache */
+      self->map->modified = MS_TRUE;
       return msSLDApplySLD(self->map, sld, self->index, stylelayer, NULL);
     }
 
     int applySLDURL(char *sld, char *stylelayer) 
     {
+      /* mapscript may have changed the map since it was loaded, don't cache */
+      self->map->modified = MS_TRUE;
       return msSLDApplySLDURL(self->map, sld, self->index, stylelayer, NULL);
     }
 
@@ -450,10 +450,14 @@
   /* SLD */
   
     int applySLD(char *sld) {
+      /* mapscript may have changed the map since it was loaded, don't cache */
+      self->modified = MS_TRUE;
       return msSLDApplySLD(self, sld, -1, NULL, NULL);
     }
 
     int applySLDURL(char *sld) {
+      /* mapscript may have changed the map since it was loaded, don't cache */
+      self->modified = MS_TRUE;
       return msSLDApplySLDURL(self, sld, -1, NULL, NULL);
     }
     
@@ -500,6 +504,8 @@
 
     int OWSDispatch( cgiRequestObj *req )
     {
+        /* mapscript may have changed the map since it was loaded, don't cache */
+        self->modified = MS_TRUE;
 	return msOWSDispatch( self, req, MS_TRUE );
     }
     
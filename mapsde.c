@@ -1122,6 +1122,10 @@ int msSDELayerOpen(layerObj *layer)
   if (!poolinfo) {
     char *conn_decrypted;
 
+    /* CONNECTION_MAX reached, the error is already set */
+    if (!msConnPoolCanOpen(layer))
+      return(MS_FAILURE);
+
     if (layer->debug)
       msDebug("msSDELayerOpen(): "
               "Layer %s opened from scratch.\n", layer->name);
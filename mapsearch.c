@@ -309,6 +309,46 @@ int msIntersectPolygons(shapeObj *p1, shapeObj *p2)
   return(MS_FALSE);
 }
 
+/*
+** Same test as the rect queries: a shape whose bounds are inside the rect
+** intersects it without looking at the vertices.
+*/
+int msIntersectShapeRect(shapeObj *shape, rectObj *rect)
+{
+  pointObj points[5];
+  lineObj ring;
+  shapeObj rectshape;
+
+  if(msRectContained(&shape->bounds, rect) == MS_TRUE)
+    return(MS_TRUE);
+  if(msRectOverlap(&shape->bounds, rect) != MS_TRUE)
+    return(MS_FALSE);
+
+  points[0].x = points[3].x = points[4].x = rect->minx;
+  points[1].x = points[2].x = rect->maxx;
+  points[0].y = points[1].y = points[4].y = rect->miny;
+  points[2].y = points[3].y = rect->maxy;
+  ring.numpoints = 5;
+  ring.point = points;
+
+  msInitShape(&rectshape);
+  rectshape.type = MS_SHAPE_POLYGON;
+  rectshape.numlines = 1;
+  rectshape.line = &ring;
+  rectshape.bounds = *rect;
+
+  switch(shape->type) {
+    case MS_SHAPE_POINT:
+      return msIntersectMultipointPolygon(shape, &rectshape);
+    case MS_SHAPE_LINE:
+      return msIntersectPolylinePolygon(shape, &rectshape);
+    case MS_SHAPE_POLYGON:
+      return msIntersectPolygons(shape, &rectshape);
+    default:
+      return(MS_FALSE);
+  }
+}
+
 
 /*
 ** Distance computations
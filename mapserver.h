@@ -298,6 +298,11 @@ extern "C" {
 
   /* boolean options for the expression object. */
 #define MS_EXP_INSENSITIVE 1
+#define MS_EXP_NATIVE      2 /* datasource syntax (ie. SQL) built by MapServer itself */
+
+  /* SQL dialects for msExpressionToSQL() */
+#define MS_SQL_DIALECT_POSTGRESQL 1
+#define MS_SQL_DIALECT_OGR        2
 
   /* General macro definitions */
 #define MS_MIN(a,b) (((a)<(b))?(a):(b))
@@ -1224,6 +1229,13 @@ extern "C" {
 #ifndef SWIG
     resultObj *results;
     int cachesize;
+
+    /* copies of the result shapes kept by the query (PROCESSING QUERY_SHAPE_CACHE) */
+    shapeObj **shapes; /* same size as results, NULL entries were not kept */
+    char **shapeitems; /* the layer items the values of the copies refer to */
+    int numshapeitems;
+    size_t shapememory, shapememorymax;
+    shapeObj *unprojected; /* copy of the current candidate taken before it was projected */
 #endif /* not SWIG */
 
 #ifdef SWIG
@@ -1632,6 +1644,7 @@ extern "C" {
 
 #ifndef SWIG
     imageObj *maskimage;
+    double rasterbytesread; /* raster data read by the last draw, for the request logs */
 #endif
     char *mask;
 
@@ -1694,6 +1707,12 @@ extern "C" {
 
     char *shapepath; /* where are the shape files located */
     char *mappath; /* path of the mapfile, all path are relative to this path */
+#ifndef SWIG
+    char *mapfile; /* the mapfile itself, NULL if the map was not loaded from a file */
+    char **includes; /* the files the mapfile INCLUDEs */
+    int numincludes;
+    int modified; /* changed since it was loaded (URL updates, substitutions, SLD, mapscript) */
+#endif /* SWIG */
 
 #ifndef SWIG
     paletteObj palette; /* holds a map palette */
@@ -1787,6 +1806,7 @@ extern "C" {
     char* (*LayerEscapePropertyName)(layerObj *layer, const char* pszString);
     void (*LayerEnablePaging)(layerObj *layer, int value);
     int (*LayerGetPaging)(layerObj *layer);
+    int (*LayerGetShapeCount)(layerObj *layer, rectObj rect);
   };
 #endif /*SWIG*/
 
@@ -1842,6 +1862,7 @@ extern "C" {
   MS_DLL_EXPORT void initWeb(webObj *web);
   MS_DLL_EXPORT void freeWeb(webObj *web);
   MS_DLL_EXPORT void initResultCache(resultCacheObj *resultcache);
+  MS_DLL_EXPORT void cleanupResultCache(resultCacheObj *resultcache);
 
   MS_DLL_EXPORT featureListNodeObjPtr insertFeatureList(featureListNodeObjPtr *list, shapeObj *shape);
   MS_DLL_EXPORT void freeFeatureList(featureListNodeObjPtr list);
@@ -1905,6 +1926,7 @@ extern "C" {
   MS_DLL_EXPORT int msGetLayerIndex(mapObj *map, char *name);
   MS_DLL_EXPORT int msGetSymbolIndex(symbolSetObj *set, char *name, int try_addimage_if_notfound);
   MS_DLL_EXPORT mapObj  *msLoadMap(char *filename, char *new_mappath);
+  MS_DLL_EXPORT char *msGetMapFilesKey(mapObj *map);
   MS_DLL_EXPORT int msTransformXmlMapfile(const char *stylesheet, const char *xmlMapfile, FILE *tmpfile);
   MS_DLL_EXPORT int msSaveMap(mapObj *map, char *filename);
   MS_DLL_EXPORT void msFreeCharArray(char **array, int num_items);
@@ -1946,6 +1968,8 @@ extern "C" {
   MS_DLL_EXPORT void msOGRCleanup(void);
   MS_DLL_EXPORT void msGDALCleanup(void);
   MS_DLL_EXPORT void msGDALInitialize(void);
+  MS_DLL_EXPORT void *msGDALAcquireDataset(const char *pszPath, int nMaxDatasets);
+  MS_DLL_EXPORT void msGDALReleaseDataset(void *hDS, int nMaxDatasets);
 
   MS_DLL_EXPORT imageObj *msDrawScalebar(mapObj *map); /* in mapscale.c */
   MS_DLL_EXPORT int msCalculateScale(rectObj extent, int units, int width, int height, double resolution, double *scaledenom);
@@ -1979,6 +2003,7 @@ extern "C" {
   MS_DLL_EXPORT int msPointInPolygon(pointObj *p, lineObj *c);
   MS_DLL_EXPORT int msIntersectMultipointPolygon(shapeObj *multipoint, shapeObj *polygon);
   MS_DLL_EXPORT int msIntersectPointPolygon(pointObj *p, shapeObj *polygon);
+  MS_DLL_EXPORT int msIntersectShapeRect(shapeObj *shape, rectObj *rect);
   MS_DLL_EXPORT int msIntersectPolylinePolygon(shapeObj *line, shapeObj *poly);
   MS_DLL_EXPORT int msIntersectPolygons(shapeObj *p1, shapeObj *p2);
   MS_DLL_EXPORT int msIntersectPolylines(shapeObj *line1, shapeObj *line2);
@@ -1993,6 +2018,9 @@ extern "C" {
   MS_DLL_EXPORT int msQueryByAttributes(mapObj *map);
   MS_DLL_EXPORT int msQueryByPoint(mapObj *map);
   MS_DLL_EXPORT int msQueryByRect(mapObj *map);
+  typedef int (*msQueryShapeFunc)( void *cbData, layerObj *layer, shapeObj *shape );
+  MS_DLL_EXPORT int msQueryByRectStream(mapObj *map, msQueryShapeFunc pfnShape, void *cbData);
+  MS_DLL_EXPORT int msQueryByRectCount(mapObj *map, int *pnCount);
   MS_DLL_EXPORT int msQueryByFeatures(mapObj *map);
   MS_DLL_EXPORT int msQueryByShape(mapObj *map);
   MS_DLL_EXPORT int msQueryByFilter(mapObj *map);
@@ -2000,6 +2028,7 @@ extern "C" {
   MS_DLL_EXPORT int msGetQueryResultBounds(mapObj *map, rectObj *bounds);
   MS_DLL_EXPORT int msIsLayerQueryable(layerObj *lp);
   MS_DLL_EXPORT void msQueryFree(mapObj *map, int qlayer); /* todo: rename */
+  MS_DLL_EXPORT int msResultCacheGetShape(layerObj *layer, shapeObj *shape, resultObj *record);
   MS_DLL_EXPORT int msRasterQueryByShape(mapObj *map, layerObj *layer, shapeObj *selectshape);
   MS_DLL_EXPORT int msRasterQueryByRect(mapObj *map, layerObj *layer, rectObj queryRect);
   MS_DLL_EXPORT int msRasterQueryByPoint(mapObj *map, layerObj *layer, int mode, pointObj p, double buffer, int maxresults );
@@ -2026,6 +2055,7 @@ extern "C" {
   MS_DLL_EXPORT int msCountChars(char *str, char ch);
   MS_DLL_EXPORT char *msLongToString(long value);
   MS_DLL_EXPORT char *msDoubleToString(double value, int force_f);
+  MS_DLL_EXPORT int msFormatDoubleFixed(char *buffer, size_t bufferSize, double value, int precision);
   MS_DLL_EXPORT char *msIntToString(int value);
   MS_DLL_EXPORT void msStringToUpper(char *string);
   MS_DLL_EXPORT void msStringToLower(char *string);
@@ -2222,6 +2252,8 @@ extern "C" {
 
   MS_DLL_EXPORT int msLayerSupportsCommonFilters(layerObj *layer);
   MS_DLL_EXPORT int msTokenizeExpression(expressionObj *expression, char **list, int *listsize);
+  MS_DLL_EXPORT char *msExpressionToSQL(expressionObj *expression, int dialect,
+      char **numericitems, int numnumericitems);
 
   MS_DLL_EXPORT int msLayerSetTimeFilter(layerObj *lp, const char *timestring,
                                          const char *timefield);
@@ -2241,11 +2273,14 @@ extern "C" {
 
   /* maplayer.c */
   MS_DLL_EXPORT int msLayerGetNumFeatures(layerObj *layer);
+  MS_DLL_EXPORT int msLayerGetShapeCount(layerObj *layer, rectObj rect);
+  MS_DLL_EXPORT int msLayerDefaultGetShapeCount(layerObj *layer, rectObj rect);
 
   MS_DLL_EXPORT int msLayerSupportsPaging(layerObj *layer);
 
   MS_DLL_EXPORT void msLayerEnablePaging(layerObj *layer, int value);
   MS_DLL_EXPORT int msLayerGetPaging(layerObj *layer);
+  MS_DLL_EXPORT int msLayerCanPageCandidates(layerObj *layer);
 
   MS_DLL_EXPORT int msLayerGetMaxFeaturesToDraw(layerObj *layer, outputFormatObj *format);
 
@@ -2270,6 +2305,7 @@ extern "C" {
 
   MS_DLL_EXPORT int msINLINELayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msSHPLayerInitializeVirtualTable(layerObj *layer);
+  MS_DLL_EXPORT int msSHPLayerNextBounds(layerObj *layer, long *shapeindex, rectObj *bounds);
   MS_DLL_EXPORT int msTiledSHPLayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msSDELayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msOGRLayerInitializeVirtualTable(layerObj *layer);
@@ -2280,6 +2316,7 @@ extern "C" {
   MS_DLL_EXPORT int msRASTERLayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msUVRASTERLayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msContourLayerInitializeVirtualTable(layerObj *layer);  
+  MS_DLL_EXPORT void msContourCacheCleanup(void);
   MS_DLL_EXPORT int msPluginLayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msUnionLayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT void msPluginFreeVirtualTableFactory(void);
@@ -2383,6 +2420,7 @@ extern "C" {
   MS_DLL_EXPORT int msJoinPrepare(joinObj *join, shapeObj *shape);
   MS_DLL_EXPORT int msJoinNext(joinObj *join);
   MS_DLL_EXPORT int msJoinClose(joinObj *join);
+  MS_DLL_EXPORT void msJoinCleanup(void);
 
   /*in mapraster.c */
   MS_DLL_EXPORT int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image, rasterBufferObj *rb );
@@ -2581,11 +2619,16 @@ extern "C" {
   /*      mappool.c: connection pooling API.                              */
   /* ==================================================================== */
   MS_DLL_EXPORT void *msConnPoolRequest( layerObj *layer );
+  MS_DLL_EXPORT int msConnPoolCanOpen( layerObj *layer );
   MS_DLL_EXPORT void msConnPoolRelease( layerObj *layer, void * );
   MS_DLL_EXPORT void msConnPoolRegister( layerObj *layer,
                                          void *conn_handle,
                                          void (*close)( void * ) );
+  MS_DLL_EXPORT void msConnPoolSetPing( layerObj *layer,
+                                        void *conn_handle,
+                                        int (*ping)( void * ) );
   MS_DLL_EXPORT void msConnPoolCloseUnreferenced( void );
+  MS_DLL_EXPORT void msConnPoolDumpStats( void );
   MS_DLL_EXPORT void msConnPoolFinalCleanup( void );
 
   /* ==================================================================== */
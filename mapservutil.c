@@ -267,6 +267,7 @@ mapObj *msCGILoadMap(mapservObj *mapserv)
               msLoadMapContextURL(map, mapserv->request->ParamValues[i], MS_FALSE);
           } else
             msLoadMapContext(map, mapserv->request->ParamValues[i], MS_FALSE);
+          map->modified = MS_TRUE;
         }
       }
     }
@@ -1723,7 +1723,12 @@ void msShapefileClose(shapefileObj *shpfile)
 }
 
 /* status array lives in the shpfile, can return MS_SUCCESS/MS_FAILURE/MS_DONE */
-int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect, int debug)
+/*
+** Set the status bits of the shapes overlapping rect.  The .qix is used if
+** there is one, otherwise with bMemoryIndex a process wide in-memory tree
+** is built once and reused, else all the shape bounds are scanned.
+*/
+static int msShapefileWhichShapesEx(shapefileObj *shpfile, rectObj rect, int debug, int bMemoryIndex)
 {
   int i;
   rectObj shaperect;
@@ -1766,6 +1771,11 @@ int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect, int debug)
     free(filename);
     free(sourcename);
 
+    if(!shpfile->status && bMemoryIndex) { /* no index on disk, use the cached one */
+      shpfile->status = msSearchCachedTree(shpfile, rect, debug);
+      if(!shpfile->status) return(MS_FAILURE);
+    }
+
     if(shpfile->status) { /* index  */
       msFilterTreeSearch(shpfile, shpfile->status, rect);
     } else { /* no index  */
@@ -1787,6 +1797,17 @@ int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect, int debug)
   return(MS_SUCCESS); /* success */
 }
 
+int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect, int debug)
+{
+  return msShapefileWhichShapesEx(shpfile, rect, debug, MS_FALSE);
+}
+
+/* Same as msShapefileWhichShapes() for a tile index, see msSearchCachedTree() */
+int msTileIndexWhichShapes(shapefileObj *shpfile, rectObj rect, int debug)
+{
+  return msShapefileWhichShapesEx(shpfile, rect, debug, MS_TRUE);
+}
+
 /* Return the absolute path to the given layer's tileindex file's directory */
 void msTileIndexAbsoluteDir(char *tiFileAbsDir, layerObj *layer)
 {
@@ -1868,6 +1889,8 @@ int msTiledSHPOpenFile(layerObj *layer)
   
   tSHP->shpfile->isopen = MS_FALSE; /* in case of error: do not try to close the shpfile */
   tSHP->tileshpfile = NULL; /* may need this if not using a tile layer, look for malloc later */
+  tSHP->paging = MS_TRUE;
+  tSHP->pagingskip = 0;
   layer->layerinfo = tSHP;
 
   tSHP->tilelayerindex = msGetLayerIndex(layer->map, layer->tileindex);
@@ -1941,6 +1964,51 @@ int msTiledSHPOpenFile(layerObj *layer)
 }
 
 
+/*
+** Paging: does shape i fall in the extent last passed to msShapefileWhichShapes(),
+** the test queryByRect() would make? The vertices are only read for shapes
+** whose bounds cross the edge of the extent, the attributes never are.
+*/
+static int msSHPPagingMatch(shapefileObj *shpfile, int i)
+{
+  rectObj bounds;
+  shapeObj shape;
+  int match;
+
+  if(msSHPReadBounds(shpfile->hSHP, i, &bounds) != MS_SUCCESS)
+    return MS_FALSE; /* NULL shape */
+
+  if(msRectContained(&bounds, &(shpfile->statusbounds)) == MS_TRUE)
+    return MS_TRUE;
+
+  msInitShape(&shape);
+  msSHPReadShape(shpfile->hSHP, i, &shape);
+  match = (shape.type != MS_SHAPE_NULL && msIntersectShapeRect(&shape, &(shpfile->statusbounds)) == MS_TRUE);
+  msFreeShape(&shape);
+
+  return match;
+}
+
+int msSHPLayerGetPaging(layerObj *layer)
+{
+  shapefileObj *shpfile = layer->layerinfo;
+
+  if(shpfile && !shpfile->paging)
+    return MS_FALSE;
+
+  return msLayerCanPageCandidates(layer);
+}
+
+int msTiledSHPLayerGetPaging(layerObj *layer)
+{
+  msTiledSHPLayerInfo *tSHP = layer->layerinfo;
+
+  if(tSHP && !tSHP->paging)
+    return MS_FALSE;
+
+  return msLayerCanPageCandidates(layer);
+}
+
 int msTiledSHPWhichShapes(layerObj *layer, rectObj rect, int isQuery)
 {
   int i, status;
@@ -1960,6 +2028,11 @@ int msTiledSHPWhichShapes(layerObj *layer, rectObj rect, int isQuery)
 
   msShapefileClose(tSHP->shpfile); /* close previously opened files */
 
+  /* the first STARTINDEX-1 matches are dropped by msTiledSHPNextShape() as the tiles go by */
+  tSHP->pagingskip = 0;
+  if(isQuery && layer->startindex > 1 && msTiledSHPLayerGetPaging(layer))
+    tSHP->pagingskip = layer->startindex - 1;
+
   if(tSHP->tilelayerindex != -1) {  /* does the tileindex reference another layer */
     layerObj *tlp;
     shapeObj tshape;
@@ -2009,7 +2082,7 @@ int msTiledSHPWhichShapes(layerObj *layer, rectObj rect, int isQuery)
   } else { /* or reference a shapefile directly */
     int try_open;
 
-    status = msShapefileWhichShapes(tSHP->tileshpfile, rect, layer->debug);
+    status = msTileIndexWhichShapes(tSHP->tileshpfile, rect, layer->debug);
     if(status != MS_SUCCESS) return(status); /* could be MS_DONE or MS_FAILURE */
 
     msTileIndexAbsoluteDir(tiFileAbsDir, layer);
@@ -2173,6 +2246,12 @@ int msTiledSHPNextShape(layerObj *layer, shapeObj *shape)
 
     tSHP->shpfile->lastshape = i;
 
+    if(tSHP->pagingskip > 0) { /* skipped without reading the attributes */
+      if(msSHPPagingMatch(tSHP->shpfile, i))
+        tSHP->pagingskip--;
+      continue;
+    }
+
     msSHPReadShape(tSHP->shpfile->hSHP, i, shape);
     if(shape->type == MS_SHAPE_NULL) {
       msFreeShape(shape);
@@ -2419,6 +2498,14 @@ int msTiledSHPLayerSupportsCommonFilters(layerObj *layer)
   return MS_TRUE;
 }
 
+void msTiledSHPLayerEnablePaging(layerObj *layer, int value)
+{
+  if(!msTiledSHPLayerIsOpen(layer) && msTiledSHPOpenFile(layer) != MS_SUCCESS)
+    return;
+
+  ((msTiledSHPLayerInfo *) layer->layerinfo)->paging = value;
+}
+
 int msTiledSHPLayerInitializeVirtualTable(layerObj *layer)
 {
   assert(layer != NULL);
@@ -2444,6 +2531,8 @@ int msTiledSHPLayerInitializeVirtualTable(layerObj *layer)
   /* layer->vtable->LayerCreateItems, use default */
   /* layer->vtable->LayerGetNumFeatures, use default */
   /* layer->vtable->LayerGetAutoProjection, use defaut*/
+  layer->vtable->LayerEnablePaging = msTiledSHPLayerEnablePaging;
+  layer->vtable->LayerGetPaging = msTiledSHPLayerGetPaging;
 
   return MS_SUCCESS;
 }
@@ -2501,6 +2590,8 @@ int msSHPLayerOpen(layerObj *layer)
     }
   }
 
+  shpfile->paging = MS_TRUE;
+
   return MS_SUCCESS;
 }
 
@@ -2524,11 +2615,27 @@ int msSHPLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
     return MS_FAILURE;
   }
 
-  status = msShapefileWhichShapes(shpfile, rect, layer->debug);
+  if(layer->type == MS_LAYER_TILEINDEX)
+    status = msTileIndexWhichShapes(shpfile, rect, layer->debug);
+  else
+    status = msShapefileWhichShapes(shpfile, rect, layer->debug);
   if(status != MS_SUCCESS) {
     return status;
   }
 
+  /* paging: clear the first STARTINDEX-1 matches from the status bitarray */
+  if(isQuery && layer->startindex > 1 && msSHPLayerGetPaging(layer)) {
+    int i = -1, skip = layer->startindex - 1;
+
+    while(skip > 0 && (i = msGetNextBit(shpfile->status, i + 1, shpfile->numshapes)) != -1) {
+      if(msSHPPagingMatch(shpfile, i))
+        skip--;
+      msSetBit(shpfile->status, i, 0);
+    }
+    if(skip > 0)
+      return MS_DONE; /* the page starts past the last match */
+  }
+
   return MS_SUCCESS;
 }
 
@@ -2571,6 +2678,110 @@ int msSHPLayerNextShape(layerObj *layer, shapeObj *shape)
   return MS_SUCCESS;
 }
 
+/*
+** Like msSHPLayerNextShape() but only hands out the index and the bounds of the
+** next shape selected by msSHPLayerWhichShapes(), as stored in the .shp record
+** header.  Neither the geometry nor the attributes are decoded and the layer
+** FILTER is not applied.  NULL shapes are skipped.
+*/
+int msSHPLayerNextBounds(layerObj *layer, long *shapeindex, rectObj *bounds)
+{
+  int i;
+  shapefileObj *shpfile;
+
+  shpfile = layer->layerinfo;
+
+  if(!shpfile) {
+    msSetError(MS_SHPERR, "Shapefile layer has not been opened.", "msSHPLayerNextBounds()");
+    return MS_FAILURE;
+  }
+
+  do {
+    i = msGetNextBit(shpfile->status, shpfile->lastshape + 1, shpfile->numshapes);
+    shpfile->lastshape = i;
+    if(i == -1) return(MS_DONE); /* nothing else to read */
+  } while(msSHPReadBounds(shpfile->hSHP, i, bounds) != MS_SUCCESS);
+
+  *shapeindex = i;
+
+  return MS_SUCCESS;
+}
+
+/*
+** Registered vtable->LayerGetShapeCount. The bounds in the .shp record
+** headers settle most shapes, the vertices are only read for shapes crossing
+** the edge of rect or when the FILTER refers to the geometry.
+*/
+int msSHPLayerGetShapeCount(layerObj *layer, rectObj rect)
+{
+  int i, status, count = 0, filtershape = MS_FALSE, filteritems = MS_FALSE;
+  shapefileObj *shpfile;
+  tokenListNodeObjPtr node;
+  rectObj bounds;
+  shapeObj shape;
+
+  status = msSHPLayerWhichShapes(layer, rect, MS_TRUE);
+  if(status == MS_DONE)
+    return 0;
+  else if(status != MS_SUCCESS)
+    return -1;
+
+  shpfile = layer->layerinfo;
+
+  for(node = layer->filter.tokens; node; node = node->next) {
+    if(node->token == MS_TOKEN_BINDING_SHAPE)
+      filtershape = MS_TRUE;
+    else if(node->token == MS_TOKEN_BINDING_DOUBLE || node->token == MS_TOKEN_BINDING_INTEGER ||
+            node->token == MS_TOKEN_BINDING_STRING || node->token == MS_TOKEN_BINDING_TIME)
+      filteritems = MS_TRUE;
+  }
+  if(layer->filter.string && layer->filter.type != MS_EXPRESSION)
+    filteritems = MS_TRUE;
+
+  /* the FILTER is always applied, msLayerWhichItems() must have set it up */
+  if((layer->filter.string && layer->filter.type == MS_EXPRESSION && !layer->filter.tokens) ||
+      (filteritems && !(layer->numitems > 0 && layer->iteminfo))) {
+    msSetError(MS_SHPERR, "FILTER of layer %s has not been set up by msLayerWhichItems().", "msSHPLayerGetShapeCount()", layer->name);
+    return -1;
+  }
+
+  i = -1;
+  while((i = msGetNextBit(shpfile->status, i + 1, shpfile->numshapes)) != -1) {
+    if(msSHPReadBounds(shpfile->hSHP, i, &bounds) != MS_SUCCESS)
+      continue; /* NULL shape */
+
+    msInitShape(&shape);
+    if(filtershape || msRectContained(&bounds, &rect) != MS_TRUE) {
+      msSHPReadShape(shpfile->hSHP, i, &shape);
+      if(shape.type == MS_SHAPE_NULL || msIntersectShapeRect(&shape, &rect) != MS_TRUE) {
+        msFreeShape(&shape);
+        continue;
+      }
+    } else {
+      shape.bounds = bounds;
+      shape.index = i;
+    }
+
+    if(layer->filter.string) {
+      if(filteritems) {
+        shape.numvalues = layer->numitems;
+        shape.values = msDBFGetValueList(shpfile->hDBF, i, layer->iteminfo, layer->numitems);
+        if(!shape.values)
+          shape.numvalues = 0;
+      }
+      if(msEvalExpression(layer, &shape, &(layer->filter), layer->filteritemindex) != MS_TRUE) {
+        msFreeShape(&shape);
+        continue;
+      }
+    }
+
+    msFreeShape(&shape);
+    count++;
+  }
+
+  return count;
+}
+
 int msSHPLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
 {
   shapefileObj *shpfile;
@@ -2654,6 +2865,14 @@ int msSHPLayerSupportsCommonFilters(layerObj *layer)
   return MS_TRUE;
 }
 
+void msSHPLayerEnablePaging(layerObj *layer, int value)
+{
+  if(!msSHPLayerIsOpen(layer) && msSHPLayerOpen(layer) != MS_SUCCESS)
+    return;
+
+  ((shapefileObj *) layer->layerinfo)->paging = value;
+}
+
 int msSHPLayerInitializeVirtualTable(layerObj *layer)
 {
   assert(layer != NULL);
@@ -2676,6 +2895,9 @@ int msSHPLayerInitializeVirtualTable(layerObj *layer)
   /* layer->vtable->LayerApplyFilterToLayer, use default */
   /* layer->vtable->LayerCreateItems, use default */
   /* layer->vtable->LayerGetNumFeatures, use default */
+  layer->vtable->LayerGetShapeCount = msSHPLayerGetShapeCount;
+  layer->vtable->LayerEnablePaging = msSHPLayerEnablePaging;
+  layer->vtable->LayerGetPaging = msSHPLayerGetPaging;
 
   return MS_SUCCESS;
 }
@@ -168,6 +168,9 @@ extern "C" {
     rectObj statusbounds; /* holds extent associated with the status vector */
 
     int isopen;
+#ifndef SWIG
+    int paging; /* layer STARTINDEX applied by the driver */
+#endif
 #ifdef SWIG
     %mutable;
 #endif
@@ -179,6 +182,8 @@ extern "C" {
     shapefileObj *shpfile;
     shapefileObj *tileshpfile;
     int tilelayerindex;
+    int paging; /* layer STARTINDEX applied by the driver */
+    int pagingskip; /* features still to skip across the tiles */
   } msTiledSHPLayerInfo;
 
   /* shapefileObj function prototypes  */
@@ -186,6 +191,7 @@ extern "C" {
   MS_DLL_EXPORT int msShapefileCreate(shapefileObj *shpfile, char *filename, int type);
   MS_DLL_EXPORT void msShapefileClose(shapefileObj *shpfile);
   MS_DLL_EXPORT int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect, int debug);
+  MS_DLL_EXPORT int msTileIndexWhichShapes(shapefileObj *shpfile, rectObj rect, int debug);
 
   /* SHP/SHX function prototypes */
   MS_DLL_EXPORT SHPHandle msSHPOpen( const char * pszShapeFile, const char * pszAccess );
@@ -381,6 +381,83 @@ char *msDoubleToString(double value, int force_f)
   return(buffer);
 }
 
+/*
+** Format a double into buffer exactly like snprintf() with "%.*f" would.
+** The usual case (moderate magnitude, not close to a rounding tie) is done
+** with integer arithmetic which is several times faster than the printf
+** machinery, the rest is handed over to snprintf(). Returns the length of
+** the formatted value, like snprintf().
+*/
+int msFormatDoubleFixed(char *buffer, size_t bufferSize, double value, int precision)
+{
+  static const double scales[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+  char digits[32];
+  double absval, scaled, intpart, frac, high;
+  unsigned long low, h;
+  int negative, len = 0, k;
+  size_t outlen;
+  char *out;
+
+  if(precision < 0 || precision > 9)
+    return snprintf(buffer, bufferSize, "%.*f", precision, value);
+
+  absval = fabs(value);
+  if(!(absval < 1e15 / scales[precision])) /* too large, also NaN and infinity */
+    return snprintf(buffer, bufferSize, "%.*f", precision, value);
+
+  scaled = absval * scales[precision];
+  intpart = floor(scaled);
+  frac = scaled - intpart;
+
+  /* the product is only exact to half an ulp, leave anything that close to a tie to printf */
+  if(fabs(frac - 0.5) <= scaled * 2.3e-16)
+    return snprintf(buffer, bufferSize, "%.*f", precision, value);
+
+  if(frac > 0.5)
+    intpart += 1;
+
+  /* collect the digits in reverse, in two halves that fit an unsigned long */
+  high = floor(intpart / 1e9);
+  low = (unsigned long) (intpart - high * 1e9);
+  if(high > 0) {
+    for(k = 0; k < 9; k++) {
+      digits[len++] = '0' + (char) (low % 10);
+      low /= 10;
+    }
+    h = (unsigned long) high;
+    while(h > 0) {
+      digits[len++] = '0' + (char) (h % 10);
+      h /= 10;
+    }
+  } else {
+    do {
+      digits[len++] = '0' + (char) (low % 10);
+      low /= 10;
+    } while(low > 0);
+  }
+  while(len <= precision)
+    digits[len++] = '0';
+
+  negative = (value < 0.0 || (value == 0.0 && 1.0 / value < 0.0)); /* printf keeps the sign of -0.0 */
+  outlen = negative + (len - precision) + (precision > 0 ? precision + 1 : 0);
+  if(outlen >= bufferSize)
+    return snprintf(buffer, bufferSize, "%.*f", precision, value);
+
+  out = buffer;
+  if(negative)
+    *out++ = '-';
+  for(k = len - 1; k >= precision; k--)
+    *out++ = digits[k];
+  if(precision > 0) {
+    *out++ = '.';
+    for(k = precision - 1; k >= 0; k--)
+      *out++ = digits[k];
+  }
+  *out = '\0';
+
+  return (int) outlen;
+}
+
 char *msIntToString(int value)
 {
   size_t bufferSize = 256;
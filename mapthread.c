@@ -59,6 +59,34 @@ possible to implement for other thread libraries if needed.
         Releases the indicated mutex.  If the lock id is invalid, or if the
         mutex is not currently held by this thread then results are undefined.
 
+  int msWaitLock(int, int timeout_ms):
+        Atomically releases the indicated mutex (which must be held by this
+        thread), waits until another thread calls msSignalLock() on the same
+        lock id or timeout_ms milliseconds have elapsed, and reacquires the
+        mutex.  Returns 1 if woken up, 0 on timeout.  Spurious wakeups are
+        possible so callers should recheck their condition in a loop.
+
+  void msSignalLock(int):
+        Wakes up all threads currently blocked in msWaitLock() on the
+        indicated lock id.  Should be called while holding the mutex.
+
+  int msRunThreads(int nJobs, int (*pfnJob)(void *), void **papArgs):
+        Calls pfnJob(papArgs[i]) for each of the nJobs arguments in
+        parallel, and returns once all of them are done.  The calling
+        thread runs the first job itself, and the jobs no other thread has
+        picked up yet.  Other jobs run on a pool of worker threads that are
+        kept around for the next call (posix), or on their own thread
+        (win32).  Without thread support the jobs simply run one after the
+        other, up to the first one that fails.  Returns MS_FAILURE, with
+        the error of the lowest numbered failed job set in the calling
+        thread, if any job failed.  Jobs must not touch the mapObj or use
+        locks held by the caller.
+
+  void msThreadCleanup(void):
+        Stops the worker threads of msRunThreads() once they are done with
+        their current job (posix), called from msCleanup().  A later
+        msRunThreads() call starts new ones.
+
 It is incredibly important to ensure that any mutex that is acquired is
 released as soon as possible.  Any flow of control that could result in a
 mutex not being release is going to be a disaster.
@@ -144,10 +172,75 @@ static int thread_debug = 0;
 
 static char *lock_names[] = {
   NULL, "PARSER", "GDAL", "ERROROBJ", "PROJ", "TTF", "POOL", "SDE",
-  "ORACLE", "OWS", "LAYER_VTABLE", "IOCONTEXT", "TMPFILE", "DEBUGOBJ", NULL
+  "ORACLE", "OWS", "LAYER_VTABLE", "IOCONTEXT", "TMPFILE", "DEBUGOBJ",
+  "OGR", "TIME", "FRIBIDI", "JOIN", "SHPTREE", "CONTOUR", "OWSCAPS", "SLD", NULL
 };
 #endif
 
+/************************************************************************/
+/*                             msThreadJob                              */
+/*                                                                      */
+/*      One job of msRunThreads().  Errors live in per thread error     */
+/*      lists, so the error of a job run by another thread is copied    */
+/*      here for the caller to raise again.                             */
+/************************************************************************/
+
+#if defined(USE_THREAD)
+typedef struct msThreadJob {
+  int (*pfnJob)(void *);
+  void *pArg;
+  int status;
+  int bInCaller;        /* ran in the thread that called msRunThreads() */
+  int code;
+  char routine[ROUTINELENGTH];
+  char message[MESSAGELENGTH];
+  int *pnPending;       /* jobs of the same msRunThreads() call not done */
+  struct msThreadJob *psNext;
+} msThreadJob;
+
+static void msThreadRunJob( msThreadJob *psJob, int bInCaller )
+
+{
+  psJob->bInCaller = bInCaller;
+  psJob->status = psJob->pfnJob( psJob->pArg );
+
+  if( psJob->status != MS_SUCCESS ) {
+    errorObj *ms_error = msGetErrorObj();
+
+    psJob->code = ms_error->code;
+    strlcpy( psJob->routine, ms_error->routine, sizeof(psJob->routine) );
+    strlcpy( psJob->message, ms_error->message, sizeof(psJob->message) );
+  }
+
+  if( !bInCaller )
+    msResetErrorList(); /* also drops this thread's error context */
+}
+
+static int msThreadJobsStatus( msThreadJob *pasJobs, int nJobs )
+
+{
+  int i;
+
+  for( i = 0; i < nJobs; i++ ) {
+    errorObj *ms_error;
+
+    if( pasJobs[i].status == MS_SUCCESS )
+      continue;
+
+    /* raise it again, unless it is already the last error of the caller */
+    ms_error = msGetErrorObj();
+    if( !pasJobs[i].bInCaller || ms_error->code != pasJobs[i].code
+        || strcmp( ms_error->routine, pasJobs[i].routine ) != 0
+        || strcmp( ms_error->message, pasJobs[i].message ) != 0 )
+      msSetError( pasJobs[i].code, "%s", pasJobs[i].routine,
+                  pasJobs[i].message );
+    return MS_FAILURE;
+  }
+
+  return MS_SUCCESS;
+}
+#endif /* defined(USE_THREAD) */
+
 /************************************************************************/
 /* ==================================================================== */
 /*                               PTHREADS                               */
@@ -157,9 +250,11 @@ static char *lock_names[] = {
 #if defined(USE_THREAD) && !defined(_WIN32)
 
 #include "pthread.h"
+#include <sys/time.h>
 
 static int mutexes_initialized = 0;
 static pthread_mutex_t mutex_locks[TLOCK_MAX];
+static pthread_cond_t cond_locks[TLOCK_MAX];
 
 /************************************************************************/
 /*                            msThreadInit()                            */
@@ -175,8 +270,10 @@ void msThreadInit()
 
   pthread_mutex_lock( &core_lock );
 
-  for( ; mutexes_initialized < TLOCK_STATIC_MAX; mutexes_initialized++ )
+  for( ; mutexes_initialized < TLOCK_STATIC_MAX; mutexes_initialized++ ) {
     pthread_mutex_init( mutex_locks + mutexes_initialized, NULL );
+    pthread_cond_init( cond_locks + mutexes_initialized, NULL );
+  }
 
   pthread_mutex_unlock( &core_lock );
 }
@@ -227,6 +324,192 @@ void msReleaseLock( int nLockId )
   pthread_mutex_unlock( mutex_locks + nLockId );
 }
 
+/************************************************************************/
+/*                             msWaitLock()                             */
+/************************************************************************/
+
+int msWaitLock( int nLockId, int timeout_ms )
+
+{
+  struct timeval now;
+  struct timespec deadline;
+
+  assert( mutexes_initialized > 0 );
+  assert( nLockId >= 0 && nLockId < mutexes_initialized );
+
+  if( thread_debug )
+    fprintf( stderr, "msWaitLock(%d/%s,%d) (posix)\n",
+             nLockId, lock_names[nLockId], timeout_ms );
+
+  gettimeofday( &now, NULL );
+  deadline.tv_sec = now.tv_sec + timeout_ms / 1000;
+  deadline.tv_nsec = now.tv_usec * 1000 + (long) (timeout_ms % 1000) * 1000000;
+  if( deadline.tv_nsec >= 1000000000 ) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  return pthread_cond_timedwait( cond_locks + nLockId, mutex_locks + nLockId,
+                                 &deadline ) == 0;
+}
+
+/************************************************************************/
+/*                            msSignalLock()                            */
+/************************************************************************/
+
+void msSignalLock( int nLockId )
+
+{
+  assert( mutexes_initialized > 0 );
+  assert( nLockId >= 0 && nLockId < mutexes_initialized );
+
+  pthread_cond_broadcast( cond_locks + nLockId );
+}
+
+/************************************************************************/
+/*                            msRunThreads()                            */
+/*                                                                      */
+/*      Jobs are queued for a pool of detached worker threads, started  */
+/*      on demand and then kept waiting for more work.  The caller      */
+/*      takes back the jobs of its own call that are still queued, so   */
+/*      nested calls or a pool that can't grow never stall.             */
+/************************************************************************/
+
+#define MS_THREAD_POOL_MAX 64
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static msThreadJob *pool_queue = NULL;
+static int pool_threads = 0, pool_idle = 0, pool_queued = 0;
+static int pool_shutdown = 0;
+
+static void *msThreadPoolWorker( void *pUnused )
+
+{
+  msThreadJob *psJob;
+
+  pthread_mutex_lock( &pool_mutex );
+  pool_idle--; /* see msRunThreads() */
+  for( ;; ) {
+    while( pool_queue == NULL && !pool_shutdown ) {
+      pool_idle++;
+      pthread_cond_wait( &pool_work, &pool_mutex );
+      pool_idle--;
+    }
+    if( pool_queue == NULL )
+      break;
+    psJob = pool_queue;
+    pool_queue = psJob->psNext;
+    pool_queued--;
+    pthread_mutex_unlock( &pool_mutex );
+
+    msThreadRunJob( psJob, MS_FALSE );
+
+    pthread_mutex_lock( &pool_mutex );
+    (*psJob->pnPending)--;
+    pthread_cond_broadcast( &pool_done );
+  }
+
+  pool_threads--;
+  pthread_cond_broadcast( &pool_done );
+  pthread_mutex_unlock( &pool_mutex );
+
+  return NULL;
+}
+
+/************************************************************************/
+/*                          msThreadCleanup()                           */
+/************************************************************************/
+
+void msThreadCleanup()
+
+{
+  pthread_mutex_lock( &pool_mutex );
+  if( thread_debug && pool_threads > 0 )
+    fprintf( stderr, "msThreadCleanup(): stopping %d workers (posix)\n",
+             pool_threads );
+  pool_shutdown = 1;
+  pthread_cond_broadcast( &pool_work );
+  while( pool_threads > 0 )
+    pthread_cond_wait( &pool_done, &pool_mutex );
+  pool_shutdown = 0;
+  pthread_mutex_unlock( &pool_mutex );
+}
+
+int msRunThreads( int nJobs, int (*pfnJob)(void *), void **papArgs )
+
+{
+  msThreadJob *pasJobs, *psJob, **ppsLink;
+  pthread_attr_t hAttr;
+  pthread_t hThread;
+  int i, nPending = nJobs - 1, status;
+
+  if( nJobs < 1 )
+    return MS_SUCCESS;
+
+  pasJobs = (msThreadJob *) msSmallCalloc( nJobs, sizeof(msThreadJob) );
+
+  if( thread_debug )
+    fprintf( stderr, "msRunThreads(%d) (posix)\n", nJobs );
+
+  for( i = 0; i < nJobs; i++ ) {
+    pasJobs[i].pfnJob = pfnJob;
+    pasJobs[i].pArg = papArgs[i];
+    pasJobs[i].pnPending = &nPending;
+  }
+
+  pthread_mutex_lock( &pool_mutex );
+
+  for( i = nJobs - 1; i > 0; i-- ) { /* job 1 first in the queue */
+    pasJobs[i].psNext = pool_queue;
+    pool_queue = pasJobs + i;
+    pool_queued++;
+  }
+
+  pthread_attr_init( &hAttr );
+  pthread_attr_setdetachstate( &hAttr, PTHREAD_CREATE_DETACHED );
+  while( pool_threads < MS_THREAD_POOL_MAX && pool_idle < pool_queued ) {
+    if( pthread_create( &hThread, &hAttr, msThreadPoolWorker, NULL ) != 0 )
+      break;
+    pool_threads++;
+    pool_idle++; /* counted as idle until it reaches pool_work itself */
+  }
+  pthread_attr_destroy( &hAttr );
+  if( nJobs > 1 )
+    pthread_cond_broadcast( &pool_work );
+
+  pthread_mutex_unlock( &pool_mutex );
+
+  msThreadRunJob( pasJobs, MS_TRUE );
+
+  pthread_mutex_lock( &pool_mutex );
+  while( nPending > 0 ) {
+    for( ppsLink = &pool_queue; *ppsLink != NULL; ppsLink = &((*ppsLink)->psNext) ) {
+      if( (*ppsLink)->pnPending == &nPending )
+        break;
+    }
+
+    if( (psJob = *ppsLink) == NULL ) {
+      pthread_cond_wait( &pool_done, &pool_mutex );
+      continue;
+    }
+
+    *ppsLink = psJob->psNext;
+    pool_queued--;
+    pthread_mutex_unlock( &pool_mutex );
+    msThreadRunJob( psJob, MS_TRUE );
+    pthread_mutex_lock( &pool_mutex );
+    nPending--;
+  }
+  pthread_mutex_unlock( &pool_mutex );
+
+  status = msThreadJobsStatus( pasJobs, nJobs );
+  free( pasJobs );
+
+  return status;
+}
+
 #endif /* defined(USE_THREAD) && !defined(_WIN32) */
 
 /************************************************************************/
@@ -315,4 +598,135 @@ void msReleaseLock( int nLockId )
   ReleaseMutex( mutex_locks[nLockId] );
 }
 
+/************************************************************************/
+/*                             msWaitLock()                             */
+/*                                                                      */
+/*      Win32 mutexes can't be paired with condition variables, so      */
+/*      we just give up the lock for a short while and let the          */
+/*      caller recheck its condition.                                   */
+/************************************************************************/
+
+int msWaitLock( int nLockId, int timeout_ms )
+
+{
+  assert( mutexes_initialized > 0 );
+  assert( nLockId >= 0 && nLockId < mutexes_initialized );
+
+  if( thread_debug )
+    fprintf( stderr, "msWaitLock(%d/%s,%d) (win32)\n",
+             nLockId, lock_names[nLockId], timeout_ms );
+
+  ReleaseMutex( mutex_locks[nLockId] );
+  Sleep( timeout_ms < 10 ? timeout_ms : 10 );
+  WaitForSingleObject( mutex_locks[nLockId], INFINITE );
+
+  return 1;
+}
+
+/************************************************************************/
+/*                            msSignalLock()                            */
+/************************************************************************/
+
+void msSignalLock( int nLockId )
+
+{
+  /* nothing to do, waiters poll */
+}
+
+/************************************************************************/
+/*                            msRunThreads()                            */
+/************************************************************************/
+
+static DWORD WINAPI msThreadJobStart( LPVOID pJob )
+
+{
+  msThreadRunJob( (msThreadJob *) pJob, MS_FALSE );
+
+  return 0;
+}
+
+int msRunThreads( int nJobs, int (*pfnJob)(void *), void **papArgs )
+
+{
+  HANDLE *pahThreads;
+  msThreadJob *pasJobs;
+  int i, status;
+
+  if( nJobs < 1 )
+    return MS_SUCCESS;
+
+  pahThreads = (HANDLE *) msSmallCalloc( nJobs, sizeof(HANDLE) );
+  pasJobs = (msThreadJob *) msSmallCalloc( nJobs, sizeof(msThreadJob) );
+
+  if( thread_debug )
+    fprintf( stderr, "msRunThreads(%d) (win32)\n", nJobs );
+
+  for( i = 0; i < nJobs; i++ ) {
+    pasJobs[i].pfnJob = pfnJob;
+    pasJobs[i].pArg = papArgs[i];
+    if( i > 0 )
+      pahThreads[i] = CreateThread( NULL, 0, msThreadJobStart, pasJobs + i,
+                                    0, NULL );
+  }
+
+  msThreadRunJob( pasJobs, MS_TRUE );
+
+  for( i = 1; i < nJobs; i++ ) {
+    if( pahThreads[i] != NULL ) {
+      WaitForSingleObject( pahThreads[i], INFINITE );
+      CloseHandle( pahThreads[i] );
+    } else
+      msThreadRunJob( pasJobs + i, MS_TRUE );
+  }
+
+  status = msThreadJobsStatus( pasJobs, nJobs );
+  free( pasJobs );
+  free( pahThreads );
+
+  return status;
+}
+
+/************************************************************************/
+/*                          msThreadCleanup()                           */
+/*                                                                      */
+/*      Nothing to do, jobs don't outlive their msRunThreads() call.    */
+/************************************************************************/
+
+void msThreadCleanup()
+
+{
+}
+
 #endif /* defined(USE_THREAD) && defined(_WIN32) */
+
+/************************************************************************/
+/* ==================================================================== */
+/*                          NO THREAD SUPPORT                           */
+/* ==================================================================== */
+/************************************************************************/
+
+#if !defined(USE_THREAD)
+
+/************************************************************************/
+/*                            msRunThreads()                            */
+/************************************************************************/
+
+int msRunThreads( int nJobs, int (*pfnJob)(void *), void **papArgs )
+
+{
+  int i;
+
+  for( i = 0; i < nJobs; i++ ) {
+    if( pfnJob( papArgs[i] ) != MS_SUCCESS )
+      return MS_FAILURE;
+  }
+
+  return MS_SUCCESS;
+}
+
+void msThreadCleanup()
+
+{
+}
+
+#endif /* !defined(USE_THREAD) */
@@ -39,13 +39,20 @@ extern "C" {
   int msGetThreadId(void);
   void msAcquireLock(int);
   void msReleaseLock(int);
+  int msWaitLock(int, int);
+  void msSignalLock(int);
 #else
 #define msThreadInit()
 #define msGetThreadId() (0)
 #define msAcquireLock(x)
 #define msReleaseLock(x)
+#define msWaitLock(x,t) (0)
+#define msSignalLock(x)
 #endif
 
+  int msRunThreads(int, int (*)(void *), void **);
+  void msThreadCleanup(void);
+
   /*
   ** lock ids - note there is a corresponding lock_names[] array in
   ** mapthread.c that needs to be extended when new ids are added.
@@ -67,8 +74,13 @@ extern "C" {
 #define TLOCK_OGR       14
 #define TLOCK_TIME      15
 #define TLOCK_FRIBIDI   16
+#define TLOCK_JOIN      17
+#define TLOCK_SHPTREE   18
+#define TLOCK_CONTOUR   19
+#define TLOCK_OWSCAPS   20
+#define TLOCK_SLD       21
 
-#define TLOCK_STATIC_MAX 20
+#define TLOCK_STATIC_MAX 22
 #define TLOCK_MAX       100
 
 #ifdef __cplusplus
@@ -30,6 +30,10 @@
 
 #include "mapserver.h"
 #include "maptree.h"
+#include "mapthread.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
 
 
 
@@ -776,3 +780,167 @@ void msFilterTreeSearch(shapefileObj *shp, ms_bitarray status, rectObj search_re
   }
 
 }
+
+/*
+** Process wide cache of in-memory trees for shapefiles that come without
+** a .qix, used for tile indexes so that a request only visits the tiles
+** it overlaps instead of reading the bounds of every tile.  Trees are
+** keyed by path and modification time of the .shp, and are read-only once
+** built; a stale tree is freed once the last search using it is done.
+** Protected by TLOCK_SHPTREE.
+*/
+typedef struct treeCacheObj {
+  char *path;
+  time_t mtime;
+  treeObj *tree;
+
+  int refcount;
+  int stale;
+
+  struct treeCacheObj *next;
+} treeCacheObj;
+
+static treeCacheObj *treeCache = NULL;
+
+static void msTreeCacheFree(treeCacheObj *entry)
+{
+  msDestroyTree(entry->tree);
+  msFree(entry->path);
+  free(entry);
+}
+
+static treeCacheObj *msTreeCacheAcquire(const char *path, time_t mtime, int numshapes)
+{
+  treeCacheObj **link, *entry = NULL;
+
+  msAcquireLock(TLOCK_SHPTREE);
+  link = &treeCache;
+  while(*link != NULL) {
+    treeCacheObj *candidate = *link;
+    if(!candidate->stale && strcmp(candidate->path, path) == 0) {
+      if(candidate->mtime == mtime && candidate->tree->numshapes == numshapes) {
+        candidate->refcount++;
+        entry = candidate;
+        break;
+      }
+
+      /* file changed, drop the entry now or once the last search is done */
+      candidate->stale = MS_TRUE;
+      if(candidate->refcount == 0) {
+        *link = candidate->next;
+        msTreeCacheFree(candidate);
+        continue;
+      }
+    }
+    link = &(candidate->next);
+  }
+  msReleaseLock(TLOCK_SHPTREE);
+
+  return entry;
+}
+
+static treeCacheObj *msTreeCacheAdd(const char *path, time_t mtime, treeObj *tree)
+{
+  treeCacheObj *entry;
+
+  msAcquireLock(TLOCK_SHPTREE);
+  for(entry=treeCache; entry!=NULL; entry=entry->next) {
+    if(!entry->stale && entry->mtime == mtime && entry->tree->numshapes == tree->numshapes
+        && strcmp(entry->path, path) == 0)
+      break;
+  }
+  if(entry) { /* another thread beat us to it */
+    msDestroyTree(tree);
+  } else {
+    entry = (treeCacheObj *) msSmallMalloc(sizeof(treeCacheObj));
+    entry->path = msStrdup(path);
+    entry->mtime = mtime;
+    entry->tree = tree;
+    entry->refcount = 0;
+    entry->stale = MS_FALSE;
+    entry->next = treeCache;
+    treeCache = entry;
+  }
+  entry->refcount++;
+  msReleaseLock(TLOCK_SHPTREE);
+
+  return entry;
+}
+
+static void msTreeCacheRelease(treeCacheObj *entry)
+{
+  treeCacheObj **link;
+
+  msAcquireLock(TLOCK_SHPTREE);
+  entry->refcount--;
+  if(entry->stale && entry->refcount == 0) {
+    for(link=&treeCache; *link!=NULL; link=&((*link)->next)) {
+      if(*link == entry) {
+        *link = entry->next;
+        break;
+      }
+    }
+    msTreeCacheFree(entry);
+  }
+  msReleaseLock(TLOCK_SHPTREE);
+}
+
+/*
+** Search the cached in-memory tree of an open shapefile, building it the
+** first time.  Like msSearchDiskTree() the result still needs to be passed
+** through msFilterTreeSearch().
+*/
+ms_bitarray msSearchCachedTree(shapefileObj *shapefile, rectObj aoi, int debug)
+{
+  struct stat stat_buf;
+  time_t mtime = 0;
+  treeCacheObj *entry;
+  ms_bitarray status;
+
+  if(fstat(fileno(shapefile->hSHP->fpSHP), &stat_buf) == 0)
+    mtime = stat_buf.st_mtime;
+
+  entry = msTreeCacheAcquire(shapefile->source, mtime, shapefile->numshapes);
+  if(!entry) {
+    treeObj *tree;
+
+    if(debug)
+      msDebug("msSearchCachedTree(): building in-memory index of %d shapes for %s\n",
+              shapefile->numshapes, shapefile->source);
+
+    tree = msCreateTree(shapefile, 0);
+    if(!tree) {
+      msSetError(MS_MEMERR, NULL, "msSearchCachedTree()");
+      return(NULL);
+    }
+    msTreeTrim(tree);
+    entry = msTreeCacheAdd(shapefile->source, mtime, tree);
+  }
+
+  status = msSearchTree(entry->tree, aoi);
+  msTreeCacheRelease(entry);
+
+  return(status);
+}
+
+/*
+** Free all unreferenced cached trees, called from msCleanup().
+*/
+void msTreeCacheCleanup()
+{
+  treeCacheObj **link;
+
+  msAcquireLock(TLOCK_SHPTREE);
+  link = &treeCache;
+  while(*link != NULL) {
+    treeCacheObj *entry = *link;
+    if(entry->refcount == 0) {
+      *link = entry->next;
+      msTreeCacheFree(entry);
+    } else {
+      entry->stale = MS_TRUE;
+      link = &(entry->next);
+    }
+  }
+  msReleaseLock(TLOCK_SHPTREE);
+}
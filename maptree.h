@@ -86,6 +86,8 @@ extern "C" {
 
   MS_DLL_EXPORT ms_bitarray msSearchTree(treeObj *tree, rectObj aoi);
   MS_DLL_EXPORT ms_bitarray msSearchDiskTree(char *filename, rectObj aoi, int debug);
+  MS_DLL_EXPORT ms_bitarray msSearchCachedTree(shapefileObj *shapefile, rectObj aoi, int debug);
+  MS_DLL_EXPORT void msTreeCacheCleanup(void);
 
   MS_DLL_EXPORT treeObj *msReadTree(char *filename, int debug);
   MS_DLL_EXPORT int msWriteTree(treeObj *tree, char *filename, int LSB_order);
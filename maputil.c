@@ -37,6 +37,7 @@
 #include "maptime.h"
 #include "mapthread.h"
 #include "mapcopy.h"
+#include "mapogcsld.h"
 
 #if defined(_WIN32) && !defined(__CYGWIN__)
 # include <windows.h>
@@ -1902,8 +1903,14 @@ int msSetup()
 #endif
 void msCleanup(int signal)
 {
+  msThreadCleanup();
   msForceTmpFileBase( NULL );
   msConnPoolFinalCleanup();
+  msJoinCleanup();
+  msTreeCacheCleanup();
+  msContourCacheCleanup();
+  msOWSCapabilitiesCacheCleanup();
+  msSLDCacheCleanup();
   /* Lexer string parsing variable */
   if (msyystring_buffer != NULL) {
     msFree(msyystring_buffer);
@@ -1918,6 +1925,7 @@ void msCleanup(int signal)
   msGDALCleanup();
 #endif
 #ifdef USE_PROJ
+  msProjectionCacheCleanup();
 #  if PJ_VERSION >= 480
   pj_clear_initcache();
 #  endif
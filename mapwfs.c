@@ -1346,6 +1346,7 @@ typedef struct {
   const char *typename;
   char       *script_url, *script_url_encoded;
   const char *output_schema_format;
+  int         streaming; /* features are written while the query runs */
 } WFSGMLInfo;
 
 static int msWFSGetFeature_GMLPreamble( mapObj *map,
@@ -1502,6 +1503,19 @@ static int msWFSGetFeature_GMLPreamble( mapObj *map,
                   encoded_typename, gmlinfo->output_schema_format);
   }
 
+  /*
+  ** When streaming the extent is not known before the features go out,
+  ** but the collection still needs its boundedBy first.
+  */
+  if (gmlinfo->streaming) {
+    msIO_printf("   <gml:boundedBy>\n");
+    if(outputformat == OWS_GML3)
+      msIO_printf("      <gml:Null>unknown</gml:Null>\n");
+    else
+      msIO_printf("      <gml:null>unknown</gml:null>\n");
+    msIO_printf("   </gml:boundedBy>\n");
+  }
+
   msFree(encoded);
   msFree(encoded_schema);
   msFree(encoded_typename);
@@ -1527,7 +1541,8 @@ static int msWFSGetFeature_GMLPostfix( mapObj *map,
                                        int iNumberOfFeatures )
 
 {
-  if (((iNumberOfFeatures==0) || (maxfeatures == 0)) && iResultTypeHits == 0) {
+  if (((iNumberOfFeatures==0) || (maxfeatures == 0)) && iResultTypeHits == 0
+      && !gmlinfo->streaming) {
     msIO_printf("   <gml:boundedBy>\n");
     if(outputformat == OWS_GML3)
       msIO_printf("      <gml:Null>missing</gml:Null>\n");
@@ -1553,6 +1568,92 @@ static int msWFSGetFeature_GMLPostfix( mapObj *map,
   return MS_SUCCESS;
 }
 
+/*
+** msWFSGetFeature_GMLHeader()
+**
+** Send the HTTP headers and the GML collection preamble.
+*/
+
+static int msWFSGetFeature_GMLHeader( mapObj *map,
+                                      cgiRequestObj *req,
+                                      WFSGMLInfo *gmlinfo,
+                                      wfsParamsObj *paramsObj,
+                                      int outputformat,
+                                      const char *output_mime_type,
+                                      int iResultTypeHits,
+                                      int iNumberOfFeatures )
+
+{
+  const char *value;
+
+  value = msOWSLookupMetadata(&(map->web.metadata), "FO", "encoding");
+  if (value)
+    msIO_setHeader("Content-Type","%s; charset=%s", output_mime_type,value);
+  else
+    msIO_setHeader("Content-Type",output_mime_type);
+  msIO_sendHeaders();
+
+  return msWFSGetFeature_GMLPreamble( map, req, gmlinfo, paramsObj,
+                                      outputformat,
+                                      iResultTypeHits,
+                                      iNumberOfFeatures );
+}
+
+/*
+** msWFSGetFeature_Query()
+**
+** Run the rect query set up in map->query. When streaming, the matching
+** features are written out as they are read instead of being stored in
+** the layer result caches. For resultType=hits they are only counted.
+*/
+
+static int msWFSGetFeature_Query( mapObj *map,
+                                  WFSGMLInfo *gmlinfo,
+                                  int outputformat,
+                                  int bStreaming,
+                                  int iResultTypeHits,
+                                  int *piNumberOfFeatures )
+
+{
+  if (bStreaming)
+    return msGMLWriteWFSQueryStream(map, stdout,
+                                    (char *) gmlinfo->user_namespace_prefix,
+                                    outputformat, piNumberOfFeatures);
+
+  if (iResultTypeHits)
+    return msQueryByRectCount(map, piNumberOfFeatures);
+
+  return msQueryByRect(map);
+}
+
+/*
+** msWFSGetFeature_StreamError()
+**
+** Once streamed output has started an exception document can't be sent
+** anymore, so report the error in a comment and close the collection.
+*/
+
+static int msWFSGetFeature_StreamError( mapObj *map,
+                                        cgiRequestObj *req,
+                                        WFSGMLInfo *gmlinfo,
+                                        wfsParamsObj *paramsObj,
+                                        int outputformat,
+                                        int maxfeatures,
+                                        int iNumberOfFeatures )
+
+{
+  char *errstr = msGetErrorString("; ");
+
+  msIO_printf("<!-- ERROR: %s -->\n", errstr ? errstr : "GetFeature failed");
+  msFree(errstr);
+
+  msWFSGetFeature_GMLPostfix( map, req, gmlinfo, paramsObj,
+                              outputformat,
+                              maxfeatures, 0, iNumberOfFeatures );
+
+  return MS_FAILURE;
+}
+
 /*
 ** msWFSGetFeature()
 */
@@ -1585,6 +1686,7 @@ int msWFSGetFeature(mapObj *map, wfsParamsObj *paramsObj, cgiRequestObj *req, ow
   int iFIDLayers = 0;
   int iNumberOfFeatures = 0;
   int iResultTypeHits = 0;
+  int bStreaming = MS_FALSE;
 
   char **papszPropertyName = NULL;
   int nPropertyNames = 0;
@@ -2269,6 +2371,26 @@ this request. Check wfs/ows_enable_request settings.", "msWFSGetFeature()",
   if (msWFSGetFeatureApplySRS(map, paramsObj->pszSrs, paramsObj->pszVersion) == MS_FAILURE)
     return msWFSException(map, "typename", "InvalidParameterValue", paramsObj->pszVersion);
   
+  /*
+  ** Plain BBOX queries to GML can be streamed: the features are written
+  ** while the layers are read instead of being read once by the query and
+  ** once more by the GML writer. The collection preamble goes out first.
+  */
+  value = msOWSLookupMetadata(&(map->web.metadata), "FO", "getfeature_streaming");
+  if (value && strcasecmp(value, "true") == 0 &&
+      psFormat == NULL && iResultTypeHits == 0 && maxfeatures != 0 &&
+      !bFilterSet && !bFeatureIdSet) {
+    bStreaming = MS_TRUE;
+    gmlinfo.streaming = MS_TRUE;
+
+    status = msWFSGetFeature_GMLHeader( map, req, &gmlinfo, paramsObj,
+                                        outputformat, output_mime_type,
+                                        iResultTypeHits, iNumberOfFeatures );
+    if(status != MS_SUCCESS) {
+      return MS_FAILURE;
+    }
+  }
+
   /*
   ** Perform Query (only BBOX for now)
   */
@@ -2331,12 +2453,14 @@ this request. Check wfs/ows_enable_request settings.", "msWFSGetFeature()",
           }
           map->query.rect = bbox;
           map->query.layer = j;
-          if(msQueryByRect(map) != MS_SUCCESS) {
+          if(msWFSGetFeature_Query(map, &gmlinfo, outputformat, bStreaming, iResultTypeHits && psFormat == NULL, &iNumberOfFeatures) != MS_SUCCESS) {
             errorObj   *ms_error;
             ms_error = msGetErrorObj();
 
             if(ms_error->code != MS_NOTFOUND) {
               msSetError(MS_WFSERR, "ms_error->code not found", "msWFSGetFeature()");
+              if (bStreaming)
+                return msWFSGetFeature_StreamError(map, req, &gmlinfo, paramsObj, outputformat, maxfeatures, iNumberOfFeatures);
               return msWFSException(map, "mapserv", "NoApplicableCode", paramsObj->pszVersion);
             }
           }
@@ -2368,13 +2492,24 @@ this request. Check wfs/ows_enable_request settings.", "msWFSGetFeature()",
       map->query.mode = MS_QUERY_MULTIPLE;
       map->query.rect = bbox;
 
-      if(msQueryByRect(map) != MS_SUCCESS) {
-        errorObj   *ms_error;
-        ms_error = msGetErrorObj();
+      /* when streaming go through the layers in drawing order, like msGMLWriteWFSQuery() */
+      for(j=0; j<(bStreaming ? map->numlayers : 1); j++) {
+        if (bStreaming) {
+          if (map->query.maxfeatures == 0)
+            break;
+          map->query.layer = map->layerorder[j];
+        }
 
-        if(ms_error->code != MS_NOTFOUND) {
-          msSetError(MS_WFSERR, "ms_error->code not found", "msWFSGetFeature()");
-          return msWFSException(map, "mapserv", "NoApplicableCode", paramsObj->pszVersion);
+        if(msWFSGetFeature_Query(map, &gmlinfo, outputformat, bStreaming, iResultTypeHits && psFormat == NULL, &iNumberOfFeatures) != MS_SUCCESS) {
+          errorObj   *ms_error;
+          ms_error = msGetErrorObj();
+
+          if(ms_error->code != MS_NOTFOUND) {
+            msSetError(MS_WFSERR, "ms_error->code not found", "msWFSGetFeature()");
+            if (bStreaming)
+              return msWFSGetFeature_StreamError(map, req, &gmlinfo, paramsObj, outputformat, maxfeatures, iNumberOfFeatures);
+            return msWFSException(map, "mapserv", "NoApplicableCode", paramsObj->pszVersion);
+          }
         }
       }
     }
@@ -2393,18 +2528,10 @@ this request. Check wfs/ows_enable_request settings.", "msWFSGetFeature()",
 
   status = MS_SUCCESS;
 
-  if( psFormat == NULL ) {
-    value = msOWSLookupMetadata(&(map->web.metadata), "FO", "encoding");
-    if (value)
-      msIO_setHeader("Content-Type","%s; charset=%s", output_mime_type,value);
-    else
-      msIO_setHeader("Content-Type",output_mime_type);
-    msIO_sendHeaders();
-
-    status = msWFSGetFeature_GMLPreamble( map, req, &gmlinfo, paramsObj,
-                                 outputformat,
-                                 iResultTypeHits,
-                                 iNumberOfFeatures );
+  if( psFormat == NULL && !bStreaming ) {
+    status = msWFSGetFeature_GMLHeader( map, req, &gmlinfo, paramsObj,
+                                        outputformat, output_mime_type,
+                                        iResultTypeHits, iNumberOfFeatures );
     if(status != MS_SUCCESS) {
       return MS_FAILURE;
     }
@@ -2413,7 +2540,7 @@ this request. Check wfs/ows_enable_request settings.", "msWFSGetFeature()",
   /* handle case of maxfeatures = 0 */
   /*internally use a start index that start with 0 as the first index*/
   if( psFormat == NULL ) {
-    if(maxfeatures != 0 && iResultTypeHits == 0)
+    if(maxfeatures != 0 && iResultTypeHits == 0 && !bStreaming)
       status = msGMLWriteWFSQuery(map, stdout,
                                   (char *) gmlinfo.user_namespace_prefix,
                                   outputformat);
@@ -0,0 +1,208 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Commandline benchmark of reprojection throughput per thread count
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2005 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** Each worker thread loads its own pair of projections, the way every
+** request of a threaded server does, then reprojects the same line over
+** and over.  Run for 1 to N threads, the points per second should grow
+** with the thread count unless something serializes the workers.
+*/
+
+#include "mapserver.h"
+#include "maptime.h"
+
+#ifdef USE_THREAD
+#include <pthread.h>
+#endif
+
+typedef struct {
+  const char *src;
+  const char *dst;
+  int numpoints;
+  int iterations;
+  int status;
+} projBenchArgs;
+
+static void *projBenchWorker(void *p)
+{
+  projBenchArgs *args = (projBenchArgs *) p;
+  projectionObj in, out;
+  shapeObj shape;
+  lineObj line;
+  int i;
+
+  args->status = MS_FAILURE;
+
+  msInitProjection(&in);
+  msInitProjection(&out);
+  if(msLoadProjectionString(&in, args->src) != 0 ||
+      msLoadProjectionString(&out, args->dst) != 0) {
+    msWriteError(stderr); /* errors are kept per thread */
+    msFreeProjection(&in);
+    msFreeProjection(&out);
+    return NULL;
+  }
+
+  /* a line across the middle of western Europe, in degrees */
+  line.numpoints = args->numpoints;
+  line.point = (pointObj *) msSmallMalloc(sizeof(pointObj) * line.numpoints);
+  for(i = 0; i < line.numpoints; i++) {
+    line.point[i].x = -5.0 + 20.0 * i / line.numpoints;
+    line.point[i].y = 40.0 + 10.0 * i / line.numpoints;
+#ifdef USE_POINT_Z_M
+    line.point[i].z = 0;
+    line.point[i].m = 0;
+#endif
+  }
+
+  msInitShape(&shape);
+  shape.type = MS_SHAPE_LINE;
+
+  for(i = 0; i < args->iterations; i++) {
+    msAddLine(&shape, &line);
+    if(msProjectShape(&in, &out, &shape) != MS_SUCCESS)
+      break;
+    msFreeShape(&shape);
+  }
+
+  if(i == args->iterations)
+    args->status = MS_SUCCESS;
+  else
+    msWriteError(stderr);
+
+  msFreeShape(&shape);
+  free(line.point);
+  msFreeProjection(&in);
+  msFreeProjection(&out);
+
+  return NULL;
+}
+
+static int projBenchRun(int numthreads, projBenchArgs *settings)
+{
+  projBenchArgs *args;
+  struct mstimeval starttime, endtime;
+  double elapsed, total;
+  int i, status = MS_SUCCESS;
+#ifdef USE_THREAD
+  pthread_t *threads;
+#endif
+
+  args = (projBenchArgs *) msSmallMalloc(sizeof(projBenchArgs) * numthreads);
+  for(i = 0; i < numthreads; i++)
+    args[i] = *settings;
+
+  msGettimeofday(&starttime, NULL);
+
+#ifdef USE_THREAD
+  threads = (pthread_t *) msSmallMalloc(sizeof(pthread_t) * numthreads);
+  for(i = 0; i < numthreads; i++)
+    pthread_create(&threads[i], NULL, projBenchWorker, &args[i]);
+  for(i = 0; i < numthreads; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+#else
+  for(i = 0; i < numthreads; i++)
+    projBenchWorker(&args[i]);
+#endif
+
+  msGettimeofday(&endtime, NULL);
+
+  for(i = 0; i < numthreads; i++) {
+    if(args[i].status != MS_SUCCESS)
+      status = MS_FAILURE;
+  }
+  free(args);
+
+  if(status != MS_SUCCESS)
+    return MS_FAILURE;
+
+  elapsed = (endtime.tv_sec + endtime.tv_usec / 1.0e6) -
+            (starttime.tv_sec + starttime.tv_usec / 1.0e6);
+  total = (double) numthreads * settings->iterations * settings->numpoints;
+
+  printf("%3d thread(s): %10.3f s %14.0f points/s\n",
+         numthreads, elapsed, elapsed > 0 ? total / elapsed : 0.0);
+
+  return MS_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+  projBenchArgs args;
+  int i, numthreads = 4;
+
+  if(argc > 1 && strcmp(argv[1], "-v") == 0) {
+    printf("%s\n", msGetVersion());
+    exit(0);
+  }
+
+  args.numpoints = 1000;
+  args.iterations = 1000;
+
+  for(i = 1; i < argc - 2; i++) {
+    if(strcmp(argv[i], "-t") == 0 && i < argc - 3)
+      numthreads = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-n") == 0 && i < argc - 3)
+      args.numpoints = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-i") == 0 && i < argc - 3)
+      args.iterations = atoi(argv[++i]);
+    else
+      break;
+  }
+
+  /* ---- check the number of arguments, return syntax if not correct ---- */
+  if(i != argc - 2 || numthreads < 1 || args.numpoints < 2 || args.iterations < 1) {
+    fprintf(stdout, "Syntax: projbench [-t threads] [-n points] [-i iterations] src_proj dst_proj\n");
+    fprintf(stdout, "  eg. projbench -t 8 EPSG:4326 EPSG:3857\n");
+    exit(0);
+  }
+
+  args.src = argv[argc - 2];
+  args.dst = argv[argc - 1];
+
+#ifndef USE_THREAD
+  if(numthreads > 1)
+    fprintf(stdout, "Not built with thread support, workers run one after the other.\n");
+#endif
+
+  if(msSetup() != MS_SUCCESS) {
+    msWriteError(stderr);
+    exit(1);
+  }
+
+  /* powers of two, finishing with the requested count */
+  for(i = 1; projBenchRun(i, &args) == MS_SUCCESS && i < numthreads; ) {
+    i = (i * 2 < numthreads) ? i * 2 : numthreads;
+  }
+
+  msCleanup(0);
+
+  exit(0);
+}
@@ -0,0 +1,137 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Commandline tester checking msFormatDoubleFixed() against
+ *           snprintf() with "%.*f".
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2005 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include <float.h>
+
+#include "mapserver.h"
+
+#define TEST_RANDOM_VALUES 200000
+
+static int nChecks = 0;
+static int nFailures = 0;
+
+/************************************************************************/
+/*                            checkValue()                              */
+/*                                                                      */
+/*      Compare the output and the return value for one value and       */
+/*      precision, with a roomy buffer and with a buffer too short.     */
+/************************************************************************/
+
+static void checkValue( double value, int precision )
+
+{
+  static const size_t anSizes[] = { 64, 512, 1, 4 };
+  char szExpected[512], szResult[512];
+  int i, nExpected, nResult;
+
+  for( i = 0; i < (int) (sizeof(anSizes) / sizeof(anSizes[0])); i++ ) {
+    memset( szExpected, 'x', sizeof(szExpected) );
+    memset( szResult, 'x', sizeof(szResult) );
+
+    nExpected = snprintf( szExpected, anSizes[i], "%.*f", precision, value );
+    nResult = msFormatDoubleFixed( szResult, anSizes[i], value, precision );
+    nChecks++;
+
+    if( nResult != nExpected
+        || memcmp( szResult, szExpected, MS_MIN(anSizes[i], sizeof(szExpected)) ) != 0 ) {
+      szExpected[sizeof(szExpected)-1] = '\0';
+      szResult[sizeof(szResult)-1] = '\0';
+      printf( "%.17g with precision %d into %d bytes: got \"%s\" (%d), "
+              "expected \"%s\" (%d)\n", value, precision, (int) anSizes[i],
+              szResult, nResult, szExpected, nExpected );
+      nFailures++;
+    }
+  }
+}
+
+static void checkAllPrecisions( double value )
+
+{
+  int precision;
+
+  for( precision = -1; precision <= 12; precision++ ) {
+    checkValue( value, precision );
+    checkValue( -value, precision );
+  }
+}
+
+/************************************************************************/
+/*                           randomValue()                              */
+/*                                                                      */
+/*      Random magnitudes between 1e-12 and 1e18, and values sitting    */
+/*      on or right next to a decimal rounding tie.                     */
+/************************************************************************/
+
+static double randomValue( void )
+
+{
+  double value = rand() / (double) RAND_MAX;
+
+  switch( rand() % 4 ) {
+    case 0: /* a tie at some precision, like 2.5 or 0.125 */
+      return (rand() % 100000 + 0.5) / pow( 10.0, rand() % 8 );
+    case 1: /* next to a tie */
+      value = (rand() % 100000 + 0.5) / pow( 10.0, rand() % 8 );
+      return rand() % 2 ? nextafter( value, HUGE_VAL ) : nextafter( value, 0.0 );
+    default:
+      return value * pow( 10.0, rand() % 31 - 12 );
+  }
+}
+
+int main( int argc, char *argv[] )
+
+{
+  static const double adfEdgeValues[] = {
+    0.0, 0.5, 1.5, 2.5, 0.05, 0.15, 0.25, 0.35, 0.125, 0.375, 1.0005,
+    0.0000005, 0.9999999999, 9.5, 99.5, 999999999.5, 4294967295.5,
+    1e9, 1e9 - 0.5, 1e10 + 0.5, 123456789.123456789, 1e14, 1e15, 1e16,
+    1e17, 1e21, 1e22, 1e100, 1e300, DBL_MAX, DBL_MIN, 5e-324, 1e-5, 1e-9,
+    1e-10, 0.1, 0.2, 0.3, 0.7, 2.675, 1.005, 1.0 / 3.0, 2.0 / 3.0,
+    180.0, -180.0, 90.0, 6378137.0, 20037508.342789244
+  };
+  int i;
+
+  srand( argc > 1 ? atoi(argv[1]) : 1 );
+
+  for( i = 0; i < (int) (sizeof(adfEdgeValues) / sizeof(adfEdgeValues[0])); i++ )
+    checkAllPrecisions( adfEdgeValues[i] );
+
+  /* negative zero keeps its sign, NaN and infinities go through printf */
+  checkAllPrecisions( -0.0 );
+  checkAllPrecisions( HUGE_VAL );
+  checkAllPrecisions( NAN );
+
+  for( i = 0; i < TEST_RANDOM_VALUES; i++ )
+    checkValue( rand() % 2 ? randomValue() : -randomValue(), rand() % 11 );
+
+  printf( "%d checks, %d failures\n", nChecks, nFailures );
+
+  return nFailures ? 1 : 0;
+}
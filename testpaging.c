@@ -0,0 +1,192 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Commandline tester checking that rect queries honour the layer
+ *           STARTINDEX the same way on shapefile and OGR polygon layers,
+ *           whether or not the layer is already open.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2005 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include "mapserver.h"
+#include "mapshape.h"
+
+#define TEST_POLYGONS 10
+#define TEST_STARTINDEX 4
+
+static int nChecks = 0;
+static int nFailures = 0;
+
+/************************************************************************/
+/*                          writePolygons()                             */
+/*                                                                      */
+/*      Write TEST_POLYGONS unit squares side by side along the x axis  */
+/*      to pszBase.shp, with their number in the ID attribute.          */
+/************************************************************************/
+
+static int writePolygons( char *pszBase )
+
+{
+  shapefileObj sShapefile;
+  DBFHandle hDBF;
+  shapeObj sShape;
+  lineObj sLine;
+  pointObj asPoints[5];
+  char szPath[MS_MAXPATHLEN];
+  int i;
+
+  snprintf( szPath, sizeof(szPath), "%s.shp", pszBase );
+  if( msShapefileCreate( &sShapefile, szPath, SHP_POLYGON ) != 0 )
+    return MS_FAILURE;
+  snprintf( szPath, sizeof(szPath), "%s.dbf", pszBase );
+  if( (hDBF = msDBFCreate( szPath )) == NULL ) {
+    msShapefileClose( &sShapefile );
+    return MS_FAILURE;
+  }
+  msDBFAddField( hDBF, "ID", FTInteger, 8, 0 );
+
+  for( i = 0; i < TEST_POLYGONS; i++ ) {
+    asPoints[0].x = asPoints[3].x = asPoints[4].x = i;
+    asPoints[1].x = asPoints[2].x = i + 0.8;
+    asPoints[0].y = asPoints[1].y = asPoints[4].y = 0;
+    asPoints[2].y = asPoints[3].y = 1;
+    sLine.numpoints = 5;
+    sLine.point = asPoints;
+
+    msInitShape( &sShape );
+    sShape.type = MS_SHAPE_POLYGON;
+    msAddLine( &sShape, &sLine );
+    msSHPWriteShape( sShapefile.hSHP, &sShape );
+    msDBFWriteIntegerAttribute( hDBF, i, 0, i );
+    msFreeShape( &sShape );
+  }
+
+  msShapefileClose( &sShapefile );
+  msDBFClose( hDBF );
+
+  return MS_SUCCESS;
+}
+
+/************************************************************************/
+/*                           checkPaging()                              */
+/*                                                                      */
+/*      Query all the polygons of a layer from STARTINDEX on, with the  */
+/*      layer closed or opened beforehand, and check that the results   */
+/*      are the polygons from STARTINDEX-1 on.                          */
+/************************************************************************/
+
+static void checkPaging( mapObj *map, int iLayer, int bOpen )
+
+{
+  layerObj *lp = GET_LAYER(map, iLayer);
+  int i, nExpected = TEST_POLYGONS - (TEST_STARTINDEX - 1);
+
+  msInitQuery( &(map->query) );
+  map->query.type = MS_QUERY_BY_RECT;
+  map->query.mode = MS_QUERY_MULTIPLE;
+  map->query.layer = iLayer;
+  map->query.rect.minx = -1;
+  map->query.rect.miny = -1;
+  map->query.rect.maxx = TEST_POLYGONS + 1;
+  map->query.rect.maxy = 2;
+  lp->startindex = TEST_STARTINDEX;
+
+  if( bOpen && msLayerOpen( lp ) != MS_SUCCESS ) {
+    msWriteError( stdout );
+    nFailures++;
+    return;
+  }
+
+  nChecks++;
+  if( msQueryByRect( map ) != MS_SUCCESS ) {
+    printf( "%s (%s): query failed\n", lp->name, bOpen ? "open" : "closed" );
+    msWriteError( stdout );
+    nFailures++;
+  } else if( lp->resultcache->numresults != nExpected ) {
+    printf( "%s (%s): %d results, expected %d\n", lp->name,
+            bOpen ? "open" : "closed", lp->resultcache->numresults, nExpected );
+    nFailures++;
+  } else {
+    for( i = 0; i < nExpected; i++ ) {
+      if( lp->resultcache->results[i].shapeindex != TEST_STARTINDEX - 1 + i ) {
+        printf( "%s (%s): result %d is polygon %ld, expected %d\n", lp->name,
+                bOpen ? "open" : "closed", i,
+                lp->resultcache->results[i].shapeindex, TEST_STARTINDEX - 1 + i );
+        nFailures++;
+        break;
+      }
+    }
+  }
+
+  msLayerClose( lp );
+  msResetErrorList();
+}
+
+int main( int argc, char *argv[] )
+
+{
+  char szCWD[MS_MAXPATHLEN], szBase[MS_MAXPATHLEN], *pszMap = NULL;
+  mapObj *map;
+  int iLayer;
+
+  if( getcwd( szCWD, sizeof(szCWD) ) == NULL )
+    return 1;
+  snprintf( szBase, sizeof(szBase), "%s/testpaging", szCWD );
+
+  if( writePolygons( szBase ) != MS_SUCCESS ) {
+    printf( "Unable to write %s.shp\n", szBase );
+    return 1;
+  }
+
+  pszMap = msStringConcatenate( pszMap, "MAP EXTENT -1 -1 11 2 SIZE 120 30 "
+                                "LAYER NAME 'shapefile' TYPE POLYGON STATUS ON TEMPLATE 'x' DATA '" );
+  pszMap = msStringConcatenate( pszMap, szBase );
+  pszMap = msStringConcatenate( pszMap, "' END " );
+#ifdef USE_OGR
+  pszMap = msStringConcatenate( pszMap, "LAYER NAME 'ogr' TYPE POLYGON STATUS ON TEMPLATE 'x' "
+                                "CONNECTIONTYPE OGR CONNECTION '" );
+  pszMap = msStringConcatenate( pszMap, szBase );
+  pszMap = msStringConcatenate( pszMap, ".shp' END " );
+#endif
+  pszMap = msStringConcatenate( pszMap, "END" );
+
+  map = msLoadMapFromString( pszMap, NULL );
+  msFree( pszMap );
+  if( map == NULL ) {
+    msWriteError( stdout );
+    return 1;
+  }
+
+  for( iLayer = 0; iLayer < map->numlayers; iLayer++ ) {
+    checkPaging( map, iLayer, MS_FALSE );
+    checkPaging( map, iLayer, MS_TRUE );
+  }
+
+  printf( "%d layer(s), %d checks, %d failures\n", map->numlayers, nChecks, nFailures );
+
+  msFreeMap( map );
+  msCleanup(0);
+
+  return nFailures ? 1 : 0;
+}
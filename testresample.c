@@ -0,0 +1,310 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Commandline tester comparing the vector RGBA resampling row
+ *           kernels with the scalar ones on random input.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2005 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** Only the row kernel section of mapresample.c is compiled here.
+*/
+#define MS_RESAMPLE_KERNEL_TEST
+#include "mapresample.c"
+
+#define TEST_ROUNDS   2000
+#define TEST_MAX_ROW  67
+
+static int nFailures = 0;
+
+static int randInt( int nMax )
+
+{
+  return (int) (rand() % nMax);
+}
+
+/************************************************************************/
+/*                            randAlpha()                               */
+/*                                                                      */
+/*      Favour the alpha values the kernels treat specially.            */
+/************************************************************************/
+
+static unsigned char randAlpha( void )
+
+{
+  switch( randInt(6) ) {
+    case 0:
+      return 0;
+    case 1:
+      return 1;
+    case 2:
+      return 2;
+    case 3:
+      return 255;
+    default:
+      return (unsigned char) randInt(256);
+  }
+}
+
+/************************************************************************/
+/*                            randCoord()                               */
+/*                                                                      */
+/*      Mostly inside the source, sometimes on pixel edges and          */
+/*      centers, sometimes well outside.                                */
+/************************************************************************/
+
+static double randCoord( int nSize )
+
+{
+  switch( randInt(8) ) {
+    case 0:
+      return randInt(nSize + 1);
+    case 1:
+      return randInt(nSize) + 0.5;
+    case 2:
+      return -3.0 + 6.0 * rand() / (double) RAND_MAX
+             + (randInt(2) ? nSize : 0);
+    default:
+      return -1.0 + (nSize + 2.0) * rand() / (double) RAND_MAX;
+  }
+}
+
+/************************************************************************/
+/*                           compareRows()                              */
+/************************************************************************/
+
+static void compareRows( const char *pszName, int nCount,
+                         const unsigned int *panRefPixel,
+                         const int *panRefValid,
+                         const unsigned int *panPixel,
+                         const int *panValid, int nTolerance )
+
+{
+  int i, nShift;
+
+  for( i = 0; i < nCount; i++ ) {
+    if( panValid[i] != panRefValid[i] ) {
+      fprintf( stderr, "%s: pixel %d of %d: valid %d, expected %d\n",
+               pszName, i, nCount, panValid[i], panRefValid[i] );
+      nFailures++;
+      continue;
+    }
+
+    if( !panRefValid[i] )
+      continue;
+
+    for( nShift = 0; nShift < 32; nShift += 8 ) {
+      int nDiff = (int) RGBA_CHANNEL(panPixel[i], nShift)
+                  - (int) RGBA_CHANNEL(panRefPixel[i], nShift);
+
+      if( nDiff < -nTolerance || nDiff > nTolerance ) {
+        fprintf( stderr, "%s: pixel %d of %d: 0x%08x, expected 0x%08x\n",
+                 pszName, i, nCount, panPixel[i], panRefPixel[i] );
+        nFailures++;
+        break;
+      }
+    }
+  }
+}
+
+/************************************************************************/
+/*                         sourceSampleRow()                            */
+/*                                                                      */
+/*      msBilinearRasterResampler() as it was before the row kernels,   */
+/*      every pixel summed by msSourceSample(), giving the color and    */
+/*      alpha it blends into the destination.                           */
+/************************************************************************/
+
+static void sourceSampleRow( imageObj *psSrcImage, rasterBufferObj *rb,
+                             int nCount, const double *x, const double *y,
+                             const int *panSuccess,
+                             unsigned int *panPixel, int *panValid )
+
+{
+  int nXSize = (int) rb->width, nYSize = (int) rb->height;
+  int i;
+
+  for( i = 0; i < nCount; i++ ) {
+    int nSrcX, nSrcY, nSrcX2, nSrcY2;
+    double dfRatioX2, dfRatioY2, dfWeightSum = 0.0;
+    double adfPixelSum[4] = { 0.0, 0.0, 0.0, 0.0 };
+
+    panValid[i] = MS_FALSE;
+    if( !panSuccess[i] )
+      continue;
+
+    nSrcX = (int) floor(x[i] - 0.5);
+    nSrcY = (int) floor(y[i] - 0.5);
+    nSrcX2 = nSrcX+1;
+    nSrcY2 = nSrcY+1;
+    dfRatioX2 = (x[i] - 0.5) - nSrcX;
+    dfRatioY2 = (y[i] - 0.5) - nSrcY;
+
+    if( nSrcX2 < 0 || nSrcX >= nXSize
+        || nSrcY2 < 0 || nSrcY >= nYSize )
+      continue;
+
+    nSrcX = MAX(nSrcX,0);
+    nSrcY = MAX(nSrcY,0);
+    nSrcX2 = MIN(nSrcX2,nXSize-1);
+    nSrcY2 = MIN(nSrcY2,nYSize-1);
+
+    msSourceSample( psSrcImage, rb, nSrcX, nSrcY, adfPixelSum,
+                    (1.0 - dfRatioX2) * (1.0 - dfRatioY2), &dfWeightSum );
+    msSourceSample( psSrcImage, rb, nSrcX2, nSrcY, adfPixelSum,
+                    (dfRatioX2) * (1.0 - dfRatioY2), &dfWeightSum );
+    msSourceSample( psSrcImage, rb, nSrcX, nSrcY2, adfPixelSum,
+                    (1.0 - dfRatioX2) * (dfRatioY2), &dfWeightSum );
+    msSourceSample( psSrcImage, rb, nSrcX2, nSrcY2, adfPixelSum,
+                    (dfRatioX2) * (dfRatioY2), &dfWeightSum );
+
+    if( dfWeightSum == 0.0 )
+      continue;
+
+    panPixel[i] =
+      RGBA_PACK( (unsigned char) MAX(0,MIN(255,adfPixelSum[0] / dfWeightSum)),
+                 (unsigned char) MAX(0,MIN(255,adfPixelSum[1] / dfWeightSum)),
+                 (unsigned char) MAX(0,MIN(255,adfPixelSum[2] / dfWeightSum)),
+                 (unsigned char) MAX(0,MIN(255,255.5*dfWeightSum)) );
+    panValid[i] = dfWeightSum > 0.001 ? MS_TRUE : MS_RGBA_FAINT;
+  }
+}
+
+/************************************************************************/
+/*                           testKernels()                              */
+/*                                                                      */
+/*      The vector kernels against the scalar ones, and the bilinear    */
+/*      ones against the original msSourceSample() resampler too.       */
+/************************************************************************/
+
+static void testKernels( const char *pszName, msRGBARowKernel pfnNearest,
+                         msRGBARowKernel pfnBilinear )
+
+{
+  static const int anOrders[3][4] = {
+    { 0, 1, 2, 3 },   /* r, g, b, a */
+    { 2, 1, 0, 3 },   /* b, g, r, a */
+    { 1, 2, 3, 0 }    /* a, r, g, b */
+  };
+  outputFormatObj sFormat;
+  imageObj sImage;
+  int iRound;
+
+  memset( &sFormat, 0, sizeof(sFormat) );
+  sFormat.renderer = MS_RENDER_WITH_AGG;
+  memset( &sImage, 0, sizeof(sImage) );
+  sImage.format = &sFormat;
+
+  for( iRound = 0; iRound < TEST_ROUNDS; iRound++ ) {
+    rasterBufferObj rb;
+    msRGBASource sSrc;
+    const int *panOrder = anOrders[randInt(3)];
+    int nXSize = 1 + randInt(40), nYSize = 1 + randInt(40);
+    int nCount = 1 + randInt(TEST_MAX_ROW);
+    double x[TEST_MAX_ROW], y[TEST_MAX_ROW];
+    int panSuccess[TEST_MAX_ROW];
+    unsigned int anRefPixel[TEST_MAX_ROW], anPixel[TEST_MAX_ROW];
+    int anRefValid[TEST_MAX_ROW], anValid[TEST_MAX_ROW];
+    int i;
+
+    memset( &rb, 0, sizeof(rb) );
+    rb.type = MS_BUFFER_BYTE_RGBA;
+    rb.width = nXSize;
+    rb.height = nYSize;
+    rb.data.rgba.pixel_step = 4;
+    rb.data.rgba.row_step = 4 * nXSize + 4 * randInt(3);
+    rb.data.rgba.pixels = (unsigned char *)
+                          msSmallMalloc( rb.data.rgba.row_step * nYSize );
+    rb.data.rgba.r = rb.data.rgba.pixels + panOrder[0];
+    rb.data.rgba.g = rb.data.rgba.pixels + panOrder[1];
+    rb.data.rgba.b = rb.data.rgba.pixels + panOrder[2];
+    rb.data.rgba.a = rb.data.rgba.pixels + panOrder[3];
+
+    for( i = 0; i < rb.data.rgba.row_step * nYSize; i++ )
+      rb.data.rgba.pixels[i] = (unsigned char) randInt(256);
+    for( i = 0; i < nXSize * nYSize; i++ )
+      rb.data.rgba.a[(i / nXSize) * rb.data.rgba.row_step
+                     + (i % nXSize) * 4] = randAlpha();
+
+    if( !msInitRGBASource( &sSrc, &rb, nXSize, nYSize ) ) {
+      fprintf( stderr, "msInitRGBASource() refused the test source\n" );
+      exit( 2 );
+    }
+
+    for( i = 0; i < nCount; i++ ) {
+      x[i] = randCoord( nXSize );
+      y[i] = randCoord( nYSize );
+      panSuccess[i] = randInt(10) != 0;
+    }
+
+    msNearestRowRGBA( &sSrc, nCount, x, y, panSuccess,
+                      anRefPixel, anRefValid );
+    pfnNearest( &sSrc, nCount, x, y, panSuccess, anPixel, anValid );
+    compareRows( pszName, nCount, anRefPixel, anRefValid,
+                 anPixel, anValid, 0 );
+
+    msBilinearRowRGBA( &sSrc, nCount, x, y, panSuccess,
+                       anRefPixel, anRefValid );
+    pfnBilinear( &sSrc, nCount, x, y, panSuccess, anPixel, anValid );
+    compareRows( pszName, nCount, anRefPixel, anRefValid,
+                 anPixel, anValid, 1 );
+
+    sourceSampleRow( &sImage, &rb, nCount, x, y, panSuccess,
+                     anRefPixel, anRefValid );
+    compareRows( pszName, nCount, anRefPixel, anRefValid,
+                 anPixel, anValid, 1 );
+
+    msFree( rb.data.rgba.pixels );
+  }
+
+  printf( "%s: %d rounds checked\n", pszName, TEST_ROUNDS );
+}
+
+int main( int argc, char *argv[] )
+
+{
+  srand( argc > 1 ? atoi(argv[1]) : 1 );
+
+  /* the scalar kernels only get checked against msSourceSample() */
+  testKernels( "C", msNearestRowRGBA, msBilinearRowRGBA );
+#ifdef HAVE_SSE2
+  testKernels( "SSE2", msNearestRowRGBA_SSE2, msBilinearRowRGBA_SSE2 );
+#endif
+#ifdef HAVE_AVX2_DISPATCH
+  if( __builtin_cpu_supports( "avx2" ) )
+    testKernels( "AVX2", msNearestRowRGBA_AVX2, msBilinearRowRGBA_AVX2 );
+#endif
+
+  if( msNearestRowKernel() == msNearestRowRGBA
+      && msBilinearRowKernel() == msBilinearRowRGBA )
+    printf( "no vector kernels in this build\n" );
+
+  if( nFailures ) {
+    printf( "%d mismatches\n", nFailures );
+    return 1;
+  }
+
+  return 0;
+}